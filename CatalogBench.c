@@ -0,0 +1,891 @@
+/*
+ * CatalogBench.c - A load generator that measures the server's capacity, built on the client library in CatalogClient.c.
+ *
+ * Each connection is driven by its own thread with a client of its own, sending a mix of SUBMIT, GET by author, GET by title, specific
+ * GET and REMOVE requests for keys drawn uniformly or from a Zipfian distribution:
+ *     gcc -O2 -pthread -o CatalogBench CatalogBench.c CatalogClient.c -lm
+ *     ./CatalogBench [options] <hostname> <port>
+ *     ./CatalogBench [options] -u <socket path>
+ *
+ * Options:
+ *     -c <connections>     The number of connections, each driven by its own thread (default 8)
+ *     -d <seconds>         How long to measure for (default 10)
+ *     -k <keys>            The number of distinct Books, submitted before measuring starts (default 10000). Every ten share an author
+ *     -z <exponent>        Draw keys from a Zipfian distribution with the given exponent, i.e. 0.99, rather than uniformly
+ *     -r <requests/s>      Run open-loop at the given total arrival rate, rather than closed-loop
+ *     -m <mix>             The weight of each request, i.e. 'submit:5,author:40,title:20,specific:30,remove:5' (the default)
+ *     -u <socket path>     Connect to the server's Unix domain socket instead of a host and port
+ *
+ * Closed-loop, each connection sends its next request as soon as the last is answered, so the latencies are service times. Open-loop,
+ * each connection sends requests on a fixed schedule, and a request's latency runs from when it was due rather than when it was sent,
+ * so a server stall is charged to every request it held up instead of being hidden by the requests never sent during it.
+ */
+#define _XOPEN_SOURCE 600
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "CatalogClient.h"
+
+//The kinds of request in the mix
+#define OP_SUBMIT 0
+#define OP_AUTHOR 1
+#define OP_TITLE 2
+#define OP_SPECIFIC 3
+#define OP_REMOVE 4
+#define OP_COUNT 5
+
+//The number of Books that share each author
+#define BOOKS_PER_AUTHOR 10
+
+//The buckets of a latency histogram: exact below 128 nanoseconds, then 64 buckets for every doubling, which keeps every latency within
+//1.6% up to hours
+#define HISTOGRAM_EXACT 128
+#define HISTOGRAM_SUB_BUCKETS 64
+#define HISTOGRAM_SIZE (HISTOGRAM_EXACT + 40 * HISTOGRAM_SUB_BUCKETS)
+
+//The number of Books each connection remembers having submitted, for its REMOVE requests to take back out
+#define SUBMITTED_RING_SIZE 4096
+
+//How long to wait for the server to accept a connection, in milliseconds
+#define CONNECT_TIMEOUT_MS 5000
+
+//The counts of latencies in each histogram bucket
+typedef struct latencyHistogram {
+    long long counts[HISTOGRAM_SIZE];
+    long long total;
+    long long maxNs;
+} LatencyHistogram;
+
+//A Book a connection submitted, which a later REMOVE can take back out
+typedef struct submittedBook {
+    int key;
+    char location[100];
+} SubmittedBook;
+
+//A thread driving one connection, and what it measured
+typedef struct benchWorker {
+    int number;
+    CatalogClient* client;
+    pthread_t thread;
+
+    //The thread's own random number generator state
+    unsigned short random[3];
+
+    //The Books it submitted and hasn't removed yet, oldest first, and the number it has submitted in all
+    SubmittedBook submitted[SUBMITTED_RING_SIZE];
+    int submittedStart;
+    int submittedCount;
+    long long submitSequence;
+
+    //The requests of each kind sent, and those that failed
+    long long sentCounts[OP_COUNT];
+    long long errorCounts[OP_COUNT];
+
+    //The latency of each kind of request from when it was due, and from when it was sent
+    LatencyHistogram responseTimes[OP_COUNT];
+    LatencyHistogram serviceTimes[OP_COUNT];
+
+    //The furthest an open-loop connection fell behind its schedule, in nanoseconds
+    long long maxLagNs;
+} BenchWorker;
+
+//The server to connect to
+char* hostName = NULL;
+int portNum = 0;
+char* socketPath = NULL;
+
+//The settings shared by every connection
+int connectionCount = 8;
+int durationSeconds = 10;
+int keyCount = 10000;
+double zipfExponent = 0.0;
+double arrivalRate = 0.0;
+int opWeights[OP_COUNT] = { 5, 40, 20, 30, 5 };
+
+//The cumulative probability of each key, for drawing keys from a Zipfian distribution, or NULL to draw them uniformly
+double* keyDistribution = NULL;
+
+//The names of the kinds of request, as given in the mix
+const char* opNames[OP_COUNT] = { "submit", "author", "title", "specific", "remove" };
+
+//When measuring starts and ends, on the monotonic clock
+long long startNs;
+long long endNs;
+
+
+
+/* Name: buildKeyDistribution
+ * Description: This function builds the cumulative probabilities of a Zipfian distribution over the keys, where the key of rank i is
+ *              drawn with probability proportional to 1 / (i + 1)^exponent.
+ *
+ * Return: None
+*/
+void buildKeyDistribution();
+
+
+
+/* Name: chooseKey
+ * Description: This function draws a key from the configured distribution.
+ *
+ * Parameter: worker            The thread drawing the key, whose random number generator is used
+ * Return: The key
+*/
+int chooseKey(BenchWorker* worker);
+
+
+
+/* Name: chooseOp
+ * Description: This function draws the kind of the next request from the configured mix.
+ *
+ * Parameter: worker            The thread drawing the request, whose random number generator is used
+ * Return: The kind of request, i.e. OP_SUBMIT
+*/
+int chooseOp(BenchWorker* worker);
+
+
+
+/* Name: connectClient
+ * Description: This function connects a client with a single connection to the server.
+ *
+ * Return: The client, or NULL with errno set if the server couldn't be reached
+*/
+CatalogClient* connectClient();
+
+
+
+/* Name: histogramIndex
+ * Description: This function finds the histogram bucket a latency is counted in.
+ *
+ * Parameter: latencyNs         The latency, in nanoseconds
+ * Return: The bucket's index
+*/
+int histogramIndex(long long latencyNs);
+
+
+
+/* Name: histogramPercentile
+ * Description: This function finds the latency a given fraction of a histogram's latencies are no larger than.
+ *
+ * Parameter: histogram         The histogram
+ * Parameter: fraction          The fraction, i.e. 0.99
+ * Return: The latency, in nanoseconds, as the upper end of the bucket it falls in
+*/
+long long histogramPercentile(LatencyHistogram* histogram, double fraction);
+
+
+
+/* Name: launchPreloader
+ * Description: This function runs a thread that submits its share of the keys' Books before measuring starts.
+ *
+ * Parameter: arg               The thread's BenchWorker
+ * Return: NULL
+*/
+void* launchPreloader(void* arg);
+
+
+
+/* Name: launchWorker
+ * Description: This function runs a thread that drives its connection with the configured mix until measuring ends, closed-loop or on
+ *              its share of the open-loop schedule.
+ *
+ * Parameter: arg               The thread's BenchWorker
+ * Return: NULL
+*/
+void* launchWorker(void* arg);
+
+
+
+/* Name: monotonicNs
+ * Description: This function reads the monotonic clock.
+ *
+ * Return: The time, in nanoseconds
+*/
+long long monotonicNs();
+
+
+
+/* Name: parseMix
+ * Description: This function reads the weight of each kind of request from a mix such as 'submit:5,author:40'. Kinds not named get 0.
+ *
+ * Parameter: mix               The mix
+ * Return: 0, or -1 if the mix names an unknown kind or has no positive weight
+*/
+int parseMix(char mix[]);
+
+
+
+/* Name: printHistograms
+ * Description: This function prints the count, throughput and latency percentiles of each kind of request, and of every request.
+ *
+ * Parameter: title             The heading printed above the table
+ * Parameter: histograms        The histograms of each kind of request, merged from every thread
+ * Parameter: errorCounts       The number of each kind of request that failed
+ * Parameter: seconds           How long measuring lasted
+ * Return: None
+*/
+void printHistograms(const char title[], LatencyHistogram histograms[], long long errorCounts[], double seconds);
+
+
+
+/* Name: recordLatency
+ * Description: This function counts a latency in a histogram.
+ *
+ * Parameter: histogram         The histogram
+ * Parameter: latencyNs         The latency, in nanoseconds
+ * Return: None
+*/
+void recordLatency(LatencyHistogram* histogram, long long latencyNs);
+
+
+
+/* Name: sendOp
+ * Description: This function sends a single request of the given kind for a key and waits for its response.
+ *
+ * Parameter: worker            The thread sending the request
+ * Parameter: op                The kind of request
+ * Parameter: key               The key the request is for
+ * Return: true if the server answered it as expected, false if it failed
+*/
+bool sendOp(BenchWorker* worker, int op, int key);
+
+
+
+//Main loop
+int main(int argc, char **argv) {
+
+    //The threads driving the connections
+    BenchWorker* workers;
+
+    //The histograms and error counts merged from every thread
+    LatencyHistogram* responseTimes;
+    LatencyHistogram* serviceTimes;
+    long long errorCounts[OP_COUNT] = { 0 };
+    long long maxLagNs = 0;
+
+    //When preloading started, and how long measuring lasted
+    long long preloadStartNs;
+    double seconds;
+
+    //The command line option read
+    int option;
+
+    //Read the command line options
+    while ((option = getopt(argc, argv, "c:d:k:z:r:m:u:")) != -1) {
+
+        //-c: The number of connections, each driven by its own thread
+        if (option == 'c') {
+            connectionCount = atoi(optarg);
+        }
+
+        //-d: How long to measure for, in seconds
+        else if (option == 'd') {
+            durationSeconds = atoi(optarg);
+        }
+
+        //-k: The number of distinct Books
+        else if (option == 'k') {
+            keyCount = atoi(optarg);
+        }
+
+        //-z: Draw keys from a Zipfian distribution with the given exponent
+        else if (option == 'z') {
+            zipfExponent = atof(optarg);
+        }
+
+        //-r: Run open-loop at the given total arrival rate
+        else if (option == 'r') {
+            arrivalRate = atof(optarg);
+        }
+
+        //-m: The weight of each kind of request
+        else if (option == 'm' && parseMix(optarg) == 0) {
+            continue;
+        }
+
+        //-u: Connect to the server's Unix domain socket at the given path, instead of a host and port
+        else if (option == 'u') {
+            socketPath = optarg;
+        }
+
+        else {
+            fprintf(stderr, "usage: %s [-c connections] [-d seconds] [-k keys] [-z exponent] [-r requests/s] [-m mix] <hostname> <port>\n"
+                            "       %s [-c connections] [-d seconds] [-k keys] [-z exponent] [-r requests/s] [-m mix] -u <socket path>\n", argv[0], argv[0]);
+            exit(1);
+        }
+    }
+
+    //Verify the user provided a server to connect to, unless it's a Unix domain socket
+    if (socketPath == NULL && argc - optind == 2) {
+        hostName = argv[optind];
+        portNum = atoi(argv[optind + 1]);
+    }
+    else if (socketPath == NULL || argc - optind != 0) {
+        fprintf(stderr, "usage: %s [-c connections] [-d seconds] [-k keys] [-z exponent] [-r requests/s] [-m mix] <hostname> <port>\n"
+                        "       %s [-c connections] [-d seconds] [-k keys] [-z exponent] [-r requests/s] [-m mix] -u <socket path>\n", argv[0], argv[0]);
+        exit(1);
+    }
+
+    //Verify the settings make sense
+    if (connectionCount <= 0 || durationSeconds <= 0 || keyCount <= 0 || zipfExponent < 0 || arrivalRate < 0 || portNum < 0) {
+        fprintf(stderr, "usage: The connections, seconds and keys must be positive, and the exponent, rate and port non-negative.\n");
+        exit(1);
+    }
+
+    if (zipfExponent > 0) {
+        buildKeyDistribution();
+    }
+
+    workers = calloc(connectionCount, sizeof(BenchWorker));
+
+    if (workers == NULL) {
+        fprintf(stderr, "ERROR: There isn't enough memory for %d connections.\n", connectionCount);
+        exit(1);
+    }
+
+    //Connect every thread's client before anything is measured
+    for (int i = 0; i < connectionCount; i++) {
+
+        workers[i].number = i;
+        workers[i].client = connectClient();
+        workers[i].random[0] = 0x330e;
+        workers[i].random[1] = (unsigned short) i;
+        workers[i].random[2] = (unsigned short) (i >> 16) ^ 0x5eed;
+
+        if (workers[i].client == NULL) {
+            perror("ERROR: ");
+            exit(1);
+        }
+    }
+
+    //Submit every key's Book, split between the threads
+    preloadStartNs = monotonicNs();
+
+    for (int i = 0; i < connectionCount; i++) {
+        pthread_create(&workers[i].thread, NULL, launchPreloader, &workers[i]);
+    }
+    for (int i = 0; i < connectionCount; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    printf("Submitted %d Books in %.2fs.\n", keyCount, (monotonicNs() - preloadStartNs) / 1e9);
+
+    if (arrivalRate > 0) {
+        printf("Running open-loop at %.0f requests/s over %d connections for %ds, with %s keys.\n", arrivalRate, connectionCount, durationSeconds,
+               zipfExponent > 0 ? "Zipfian" : "uniform");
+    }
+    else {
+        printf("Running closed-loop over %d connections for %ds, with %s keys.\n", connectionCount, durationSeconds, zipfExponent > 0 ? "Zipfian" : "uniform");
+    }
+
+    fflush(stdout);
+
+    //Measure every connection over the same interval
+    startNs = monotonicNs();
+    endNs = startNs + (long long) durationSeconds * 1000000000LL;
+
+    for (int i = 0; i < connectionCount; i++) {
+        pthread_create(&workers[i].thread, NULL, launchWorker, &workers[i]);
+    }
+    for (int i = 0; i < connectionCount; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    seconds = (monotonicNs() - startNs) / 1e9;
+
+    //Merge every thread's histograms
+    responseTimes = calloc(OP_COUNT, sizeof(LatencyHistogram));
+    serviceTimes = calloc(OP_COUNT, sizeof(LatencyHistogram));
+
+    for (int i = 0; i < connectionCount; i++) {
+
+        for (int op = 0; op < OP_COUNT; op++) {
+
+            for (int bucket = 0; bucket < HISTOGRAM_SIZE; bucket++) {
+                responseTimes[op].counts[bucket] += workers[i].responseTimes[op].counts[bucket];
+                serviceTimes[op].counts[bucket] += workers[i].serviceTimes[op].counts[bucket];
+            }
+
+            responseTimes[op].total += workers[i].responseTimes[op].total;
+            serviceTimes[op].total += workers[i].serviceTimes[op].total;
+
+            if (workers[i].responseTimes[op].maxNs > responseTimes[op].maxNs) {
+                responseTimes[op].maxNs = workers[i].responseTimes[op].maxNs;
+            }
+            if (workers[i].serviceTimes[op].maxNs > serviceTimes[op].maxNs) {
+                serviceTimes[op].maxNs = workers[i].serviceTimes[op].maxNs;
+            }
+
+            errorCounts[op] += workers[i].errorCounts[op];
+        }
+
+        if (workers[i].maxLagNs > maxLagNs) {
+            maxLagNs = workers[i].maxLagNs;
+        }
+
+        catalogClientDestroy(workers[i].client);
+    }
+
+    //Open-loop, the latencies that count are from when each request was due
+    if (arrivalRate > 0) {
+        printHistograms("response time, from when each request was due (corrected for coordinated omission)", responseTimes, errorCounts, seconds);
+        printf("\n");
+        printHistograms("service time, from when each request was sent", serviceTimes, errorCounts, seconds);
+        printf("\nThe connections fell up to %.3fms behind the schedule.\n", maxLagNs / 1e6);
+    }
+    else {
+        printHistograms("service time", serviceTimes, errorCounts, seconds);
+    }
+
+    free(responseTimes);
+    free(serviceTimes);
+    free(workers);
+    free(keyDistribution);
+
+    return 0;
+}
+
+
+
+//FUNCTION buildKeyDistribution
+void buildKeyDistribution() {
+
+    //The running total of the keys' weights
+    double total = 0;
+
+    keyDistribution = malloc(sizeof(double) * keyCount);
+
+    if (keyDistribution == NULL) {
+        fprintf(stderr, "ERROR: There isn't enough memory for the distribution of %d keys.\n", keyCount);
+        exit(1);
+    }
+
+    for (int i = 0; i < keyCount; i++) {
+        total += 1.0 / pow(i + 1, zipfExponent);
+        keyDistribution[i] = total;
+    }
+
+    //Scale the running totals to probabilities
+    for (int i = 0; i < keyCount; i++) {
+        keyDistribution[i] /= total;
+    }
+}
+
+
+
+//FUNCTION chooseKey
+int chooseKey(BenchWorker* worker) {
+
+    //The probability drawn, and the range of keys it may fall in
+    double draw = erand48(worker->random);
+    int low = 0;
+    int high = keyCount - 1;
+
+    if (keyDistribution == NULL) {
+        return (int) (draw * keyCount);
+    }
+
+    //Find the first key whose cumulative probability reaches the draw
+    while (low < high) {
+
+        int middle = (low + high) / 2;
+
+        if (keyDistribution[middle] < draw) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+
+
+//FUNCTION chooseOp
+int chooseOp(BenchWorker* worker) {
+
+    //The total weight of the mix, and the weight drawn from it
+    int totalWeight = 0;
+    int draw;
+
+    for (int op = 0; op < OP_COUNT; op++) {
+        totalWeight += opWeights[op];
+    }
+
+    draw = (int) (erand48(worker->random) * totalWeight);
+
+    for (int op = 0; op < OP_COUNT; op++) {
+
+        if (draw < opWeights[op]) {
+            return op;
+        }
+
+        draw -= opWeights[op];
+    }
+
+    return OP_COUNT - 1;
+}
+
+
+
+//FUNCTION connectClient
+CatalogClient* connectClient() {
+
+    if (socketPath != NULL) {
+        return catalogClientCreateUnix(socketPath, 1, CONNECT_TIMEOUT_MS);
+    }
+
+    return catalogClientCreate(hostName, portNum, 1, CONNECT_TIMEOUT_MS);
+}
+
+
+
+//FUNCTION histogramIndex
+int histogramIndex(long long latencyNs) {
+
+    //The number of bits the latency is shifted right by to fit its doubling's sub-buckets
+    int shift;
+
+    if (latencyNs < HISTOGRAM_EXACT) {
+        return latencyNs > 0 ? (int) latencyNs : 0;
+    }
+
+    shift = 63 - __builtin_clzll((unsigned long long) latencyNs) - 6;
+
+    if (shift > 40) {
+        return HISTOGRAM_SIZE - 1;
+    }
+
+    return HISTOGRAM_EXACT + (shift - 1) * HISTOGRAM_SUB_BUCKETS + (int) ((latencyNs >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+
+
+//FUNCTION histogramPercentile
+long long histogramPercentile(LatencyHistogram* histogram, double fraction) {
+
+    //The number of latencies that must be no larger than the answer, and the number counted so far
+    long long needed = (long long) ceil(histogram->total * fraction);
+    long long counted = 0;
+
+    if (histogram->total == 0) {
+        return 0;
+    }
+
+    for (int bucket = 0; bucket < HISTOGRAM_SIZE; bucket++) {
+
+        counted += histogram->counts[bucket];
+
+        if (counted >= needed && counted > 0) {
+
+            //The upper end of the bucket, which is never more than the largest latency counted
+            long long upperNs;
+            int shift;
+
+            if (bucket < HISTOGRAM_EXACT) {
+                upperNs = bucket;
+            }
+            else {
+                shift = (bucket - HISTOGRAM_EXACT) / HISTOGRAM_SUB_BUCKETS + 1;
+                upperNs = (((long long) ((bucket - HISTOGRAM_EXACT) % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS) + 1) << shift) - 1;
+            }
+
+            return upperNs < histogram->maxNs ? upperNs : histogram->maxNs;
+        }
+    }
+
+    return histogram->maxNs;
+}
+
+
+
+//FUNCTION launchPreloader
+void* launchPreloader(void* arg) {
+
+    BenchWorker* worker = arg;
+
+    //The key's Book
+    char title[100];
+    char author[100];
+    char location[100];
+
+    //Submit every key this thread's share. A Book left from an earlier run is reported as a duplicate, which is just as good
+    for (int key = worker->number; key < keyCount; key += connectionCount) {
+
+        int status;
+
+        sprintf(title, "Bench Title %d", key);
+        sprintf(author, "Bench Author %d", key / BOOKS_PER_AUTHOR);
+        sprintf(location, "Shelf %d", key);
+
+        status = catalogSubmit(worker->client, title, author, location, NULL);
+
+        if (status != 201 && status != 401) {
+            fprintf(stderr, "ERROR: The Books couldn't be submitted: %s\n", status < 0 ? catalogErrorText(status) : "the server refused one.");
+            exit(1);
+        }
+    }
+
+    return NULL;
+}
+
+
+
+//FUNCTION launchWorker
+void* launchWorker(void* arg) {
+
+    BenchWorker* worker = arg;
+
+    //The time between this connection's requests open-loop, and when its first is due. The connections' schedules are staggered evenly
+    double intervalNs = arrivalRate > 0 ? 1e9 * connectionCount / arrivalRate : 0;
+    double dueNs = startNs + intervalNs * worker->number / connectionCount;
+
+    while (1) {
+
+        //The kind of request, its key, and when it was sent and answered
+        int op = chooseOp(worker);
+        int key = chooseKey(worker);
+        long long sentNs;
+        long long answeredNs;
+        bool succeeded;
+
+        //Open-loop, wait until the request is due, or send it straight away if the connection is behind
+        if (arrivalRate > 0) {
+
+            if (dueNs >= endNs) {
+                break;
+            }
+
+            if (dueNs > monotonicNs()) {
+
+                struct timespec due;
+
+                due.tv_sec = (time_t) (dueNs / 1e9);
+                due.tv_nsec = (long) (dueNs - due.tv_sec * 1e9);
+
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) != 0) {
+                }
+            }
+        }
+        else if (monotonicNs() >= endNs) {
+            break;
+        }
+
+        sentNs = monotonicNs();
+        succeeded = sendOp(worker, op, key);
+        answeredNs = monotonicNs();
+
+        worker->sentCounts[op]++;
+        if (succeeded == false) {
+            worker->errorCounts[op]++;
+        }
+
+        recordLatency(&worker->serviceTimes[op], answeredNs - sentNs);
+
+        //Charge the request for any time it spent waiting behind the requests before it, as well as its own
+        if (arrivalRate > 0) {
+
+            recordLatency(&worker->responseTimes[op], answeredNs - (long long) dueNs);
+
+            if (sentNs - (long long) dueNs > worker->maxLagNs) {
+                worker->maxLagNs = sentNs - (long long) dueNs;
+            }
+
+            dueNs += intervalNs;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+//FUNCTION monotonicNs
+long long monotonicNs() {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+
+//FUNCTION parseMix
+int parseMix(char mix[]) {
+
+    //The mix split at its commas
+    char* savePointer;
+    char* entry;
+    int totalWeight = 0;
+
+    memset(opWeights, 0, sizeof(opWeights));
+
+    for (entry = strtok_r(mix, ",", &savePointer); entry != NULL; entry = strtok_r(NULL, ",", &savePointer)) {
+
+        //The kind named and its weight
+        char* colon = strchr(entry, ':');
+        int op;
+
+        if (colon == NULL) {
+            return -1;
+        }
+
+        *colon = '\0';
+
+        for (op = 0; op < OP_COUNT && strcmp(entry, opNames[op]) != 0; op++) {
+        }
+
+        if (op == OP_COUNT || atoi(colon + 1) < 0) {
+            return -1;
+        }
+
+        opWeights[op] = atoi(colon + 1);
+        totalWeight += opWeights[op];
+    }
+
+    return totalWeight > 0 ? 0 : -1;
+}
+
+
+
+//FUNCTION printHistograms
+void printHistograms(const char title[], LatencyHistogram histograms[], long long errorCounts[], double seconds) {
+
+    //Every request, merged from each kind
+    LatencyHistogram* all = calloc(1, sizeof(LatencyHistogram));
+    long long allErrors = 0;
+
+    printf("%s\n", title);
+    printf("%-10s %12s %10s %12s %10s %10s %10s %10s\n", "request", "count", "errors", "per second", "p50 (us)", "p99 (us)", "p99.9 (us)", "max (us)");
+
+    for (int op = 0; op <= OP_COUNT; op++) {
+
+        //The row's histogram and error count
+        LatencyHistogram* histogram = op < OP_COUNT ? &histograms[op] : all;
+        long long errors = op < OP_COUNT ? errorCounts[op] : allErrors;
+
+        //Add the kind's latencies to the total, and leave out kinds not in the mix
+        if (op < OP_COUNT) {
+
+            for (int bucket = 0; bucket < HISTOGRAM_SIZE; bucket++) {
+                all->counts[bucket] += histogram->counts[bucket];
+            }
+
+            all->total += histogram->total;
+            allErrors += errors;
+
+            if (histogram->maxNs > all->maxNs) {
+                all->maxNs = histogram->maxNs;
+            }
+
+            if (histogram->total == 0) {
+                continue;
+            }
+        }
+
+        printf("%-10s %12lld %10lld %12.0f %10.1f %10.1f %10.1f %10.1f\n", op < OP_COUNT ? opNames[op] : "all", histogram->total, errors,
+               histogram->total / seconds, histogramPercentile(histogram, 0.50) / 1e3, histogramPercentile(histogram, 0.99) / 1e3,
+               histogramPercentile(histogram, 0.999) / 1e3, histogram->maxNs / 1e3);
+    }
+
+    free(all);
+}
+
+
+
+//FUNCTION recordLatency
+void recordLatency(LatencyHistogram* histogram, long long latencyNs) {
+
+    histogram->counts[histogramIndex(latencyNs)]++;
+    histogram->total++;
+
+    if (latencyNs > histogram->maxNs) {
+        histogram->maxNs = latencyNs;
+    }
+}
+
+
+
+//FUNCTION sendOp
+bool sendOp(BenchWorker* worker, int op, int key) {
+
+    //The key's Book
+    char title[100];
+    char author[100];
+    char location[100];
+    int status;
+
+    sprintf(title, "Bench Title %d", key);
+    sprintf(author, "Bench Author %d", key / BOOKS_PER_AUTHOR);
+
+    switch (op) {
+
+        //Submit another copy of the key's Book at a location of its own, remembering it for a later REMOVE
+        case OP_SUBMIT:
+
+            sprintf(location, "Bench %d-%lld", worker->number, worker->submitSequence++);
+            status = catalogSubmit(worker->client, title, author, location, NULL);
+
+            if (status == 201) {
+
+                SubmittedBook* book;
+
+                //Forget the oldest Book when the ring is full, leaving it in the Catalog
+                if (worker->submittedCount == SUBMITTED_RING_SIZE) {
+                    worker->submittedStart = (worker->submittedStart + 1) % SUBMITTED_RING_SIZE;
+                    worker->submittedCount--;
+                }
+
+                book = &worker->submitted[(worker->submittedStart + worker->submittedCount) % SUBMITTED_RING_SIZE];
+                book->key = key;
+                strcpy(book->location, location);
+                worker->submittedCount++;
+            }
+
+            return status == 201;
+
+        case OP_AUTHOR:
+            status = catalogGetByAuthor(worker->client, author, NULL);
+            return status == 202 || status == 402;
+
+        case OP_TITLE:
+            status = catalogGetByTitle(worker->client, title, NULL);
+            return status == 202 || status == 402;
+
+        case OP_SPECIFIC:
+            status = catalogGet(worker->client, title, author, NULL);
+            return status == 202 || status == 402;
+
+        //Remove the oldest Book this connection submitted, so the Catalog stays the same size, or a Book that was never submitted if none
+        //is left, which costs the server the same search
+        default:
+
+            if (worker->submittedCount > 0) {
+
+                SubmittedBook* book = &worker->submitted[worker->submittedStart];
+
+                sprintf(title, "Bench Title %d", book->key);
+                sprintf(author, "Bench Author %d", book->key / BOOKS_PER_AUTHOR);
+                strcpy(location, book->location);
+
+                worker->submittedStart = (worker->submittedStart + 1) % SUBMITTED_RING_SIZE;
+                worker->submittedCount--;
+            }
+            else {
+                sprintf(location, "Bench %d-none", worker->number);
+            }
+
+            status = catalogRemove(worker->client, title, author, location, NULL);
+            return status == 203 || status == 402;
+    }
+}
@@ -0,0 +1,2893 @@
+/*
+ * CatalogClient.c - A client library for the Book Catalog server, with a pool of persistent connections shared between threads.
+ *
+ * See CatalogClient.h for the functions it provides. Link it into a program with:
+ *     gcc -O2 -pthread -o Client Client.c CatalogClient.c
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "CatalogClient.h"
+
+//The most bytes a response framing line can have, i.e. 'ID:12,LENGTH:85'
+#define MAX_FRAME_HEADER 100
+
+//The size a connection's read buffer starts at
+#define CONNECTION_BUFFER_SIZE 4096
+
+//The most requests a pipelined connection has in flight at once, unless told otherwise
+#define DEFAULT_MAX_IN_FLIGHT 1024
+
+//A persistent connection to a server, with the bytes read from it that haven't been used yet
+typedef struct catalogConnection {
+    int sockfd;
+
+    char* buffer;
+    int bufferStart;
+    int bufferEnd;
+    int bufferCapacity;
+
+    struct catalogConnection* nextConnection;
+} CatalogConnection;
+
+//The connections a client keeps open to one server
+typedef struct catalogPool {
+
+    //The server's address
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+
+    //The connections not in use, and the number open in all
+    CatalogConnection* idleConnections;
+    int openCount;
+
+    //The most connections open at once, and how long to wait for one to be established
+    int poolSize;
+    int timeoutMs;
+
+    //Guards the connections, and signals a thread waiting for one when it's returned
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+} CatalogPool;
+
+//A GET result kept by a client's cache
+typedef struct cacheEntry {
+
+    //The catalog and request the result answers, i.e. 'METHOD:GET,AUTHOR:Clayton\n', and the hash of both
+    char catalog[100];
+    char* request;
+    unsigned int hash;
+
+    //The title and author the request names, or blank, which invalidations are matched against
+    char title[100];
+    char author[100];
+
+    CatalogResult result;
+
+    //The next entry in the same hash bucket, and the entries used just before and after this one
+    struct cacheEntry* nextEntry;
+    struct cacheEntry* older;
+    struct cacheEntry* newer;
+} CacheEntry;
+
+//A client's cache of GET results. Every result is fetched on a connection of the cache's own, which the server pushes an invalidation
+//on whenever a change makes a result it sent stale, so the cache is never more stale than the network delay
+typedef struct catalogCache {
+
+    //The connection results are fetched and invalidations arrive on, or NULL until the next result is fetched
+    CatalogConnection* connection;
+
+    //The entries hashed by catalog and request, and in order of use, most recent first
+    CacheEntry** buckets;
+    int bucketCount;
+    CacheEntry* newest;
+    CacheEntry* oldest;
+    int entryCount;
+    int maxEntries;
+
+    //The catalog, title and author of the result being fetched, and whether an invalidation for it arrived before it did
+    char pendingCatalog[100];
+    char pendingTitle[100];
+    char pendingAuthor[100];
+    bool pendingInvalidated;
+
+    //Guards everything above, so only one thread uses the connection at a time
+    pthread_mutex_t lock;
+} CatalogCache;
+
+//A client, with the server changes go to and the replica reads go to, if any
+struct catalogClient {
+    CatalogPool* primary;
+    CatalogPool* replica;
+
+    //The cache of GET results, if the client keeps one
+    CatalogCache* cache;
+
+    //The catalog requests are made against
+    char catalog[100];
+
+    //The session token: the log sequence number of the last change this client made, which a replica must have applied before it answers
+    unsigned long long sessionLsn;
+
+    //The request ID of the next request
+    unsigned int nextRequestId;
+
+    //Guards the catalog name, session token and request IDs
+    pthread_mutex_t lock;
+};
+
+//A pipelined request waiting for its response
+typedef struct pendingRequest {
+    unsigned int requestId;
+
+    //The title and author the request names, for a response that only gives locations
+    char title[100];
+    char author[100];
+
+    CatalogCallback callback;
+    void* context;
+
+    //The next request in the same hash bucket
+    struct pendingRequest* nextPending;
+} PendingRequest;
+
+//A connection that pipelines requests, with the reader thread completing them
+struct catalogAsync {
+    CatalogClient* client;
+    CatalogConnection* connection;
+    pthread_t reader;
+
+    //Requests queued but not yet written, and the spare buffer the writing thread swaps in so others can keep queueing while it writes
+    char* queued;
+    int queuedLength;
+    int queuedCapacity;
+    char* writing;
+    int writingCapacity;
+    bool flushing;
+
+    //The requests in flight, hashed by request ID, and the most allowed at once
+    PendingRequest** pending;
+    int pendingBuckets;
+    int inFlight;
+    int maxInFlight;
+
+    //The error every request fails with once the connection has failed or is closing, or 0
+    int failure;
+
+    //Guards everything above but the connection, which only the reader thread reads, and signals when a request completes
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+//The outcome of a pipelined request, moved here by its callback
+struct catalogFuture {
+    bool complete;
+    int status;
+    CatalogResult result;
+
+    pthread_mutex_t lock;
+    pthread_cond_t completed;
+};
+
+//A response being parsed a line at a time
+typedef struct responseParser {
+
+    //The title, author and GETMANY key the next LOCATION line belongs to
+    char title[100];
+    char author[100];
+    int key;
+
+    //Whether the status line has been read
+    bool started;
+
+    //The function each Book is passed to as it's parsed, or NULL to keep the Books in the result, and whether it has asked for no more
+    CatalogBookCallback callback;
+    void* context;
+    bool stopped;
+} ResponseParser;
+
+
+
+/* Name: acquireConnection
+ * Description: This function borrows a connection from a pool. An idle connection is reused, otherwise a new one is opened if the pool
+ *              is below its size, otherwise the thread waits for another to return one.
+ *
+ * Parameter: pool              The pool to borrow from
+ * Parameter: reused            Set to whether the connection had already been used
+ * Return: The connection, or NULL with errno set if a new one couldn't be opened
+*/
+static CatalogConnection* acquireConnection(CatalogPool* pool, bool* reused);
+
+
+
+/* Name: applyInvalidation
+ * Description: This function drops every cached result an invalidation pushed by the server makes stale: every result for the catalog
+ *              that names the changed Book's title or author, or every result at all for a flush. It must be called with the cache's
+ *              lock held.
+ *
+ * Parameter: cache             The cache
+ * Parameter: response          The invalidation, i.e. '212:INVALIDATE\nCATALOG:\nTITLE:Networking\nAUTHOR:Clayton\n'
+ * Return: None
+*/
+static void applyInvalidation(CatalogCache* cache, const char response[]);
+
+
+
+/* Name: appendBook
+ * Description: This function adds a Book to a result, growing its Books as needed.
+ *
+ * Parameter: result            The result
+ * Parameter: title             The title of the Book
+ * Parameter: author            The author of the Book
+ * Parameter: location          The location of the Book
+ * Parameter: key               The GETMANY key the Book was found for, or 0
+ * Return: 0, or CATALOG_ERROR_MEMORY
+*/
+static int appendBook(CatalogResult* result, const char title[], const char author[], const char location[], int key);
+
+
+
+/* Name: clearCache
+ * Description: This function drops every cached result, and closes the cache's connection if asked to, since the server forgets what a
+ *              closed connection caches. It must be called with the cache's lock held.
+ *
+ * Parameter: cache             The cache
+ * Parameter: disconnect        Whether to close the cache's connection too
+ * Return: None
+*/
+static void clearCache(CatalogCache* cache, bool disconnect);
+
+
+
+/* Name: closeIdleConnections
+ * Description: This function closes every idle connection of a pool, once one has turned out to be closed by the server, since the
+ *              server closed the others with it.
+ *
+ * Parameter: pool              The pool
+ * Return: None
+*/
+static void closeIdleConnections(CatalogPool* pool);
+
+
+
+/* Name: completeFuture
+ * Description: This function is the callback of a request made with a future. It moves the request's result into the future and wakes
+ *              the thread waiting for it.
+ *
+ * Parameter: status            The status of the request
+ * Parameter: result            The result of the request
+ * Parameter: context           The future
+ * Return: None
+*/
+static void completeFuture(int status, CatalogResult* result, void* context);
+
+
+
+/* Name: copyResult
+ * Description: This function copies a result, with its own copy of the Books and response body.
+ *
+ * Parameter: copy              The copy to fill
+ * Parameter: result            The result to copy
+ * Return: 0, or CATALOG_ERROR_MEMORY
+*/
+static int copyResult(CatalogResult* copy, const CatalogResult* result);
+
+
+
+/* Name: createClient
+ * Description: This function creates a client for the server at the given address, opening its first connection.
+ *
+ * Parameter: address           The server's address
+ * Parameter: addressLength     The length of the server's address
+ * Parameter: poolSize          The most connections the client keeps open to the server at once
+ * Parameter: timeoutMs         How long to wait for a connection to be established, in milliseconds, or 0 to wait indefinitely
+ * Return: The client, or NULL with errno set if the server couldn't be reached
+*/
+static CatalogClient* createClient(struct sockaddr_storage* address, socklen_t addressLength, int poolSize, int timeoutMs);
+
+
+
+/* Name: createPool
+ * Description: This function creates a pool of connections to the server at the given address, and opens its first connection so an
+ *              unreachable server is reported straight away.
+ *
+ * Parameter: address           The server's address
+ * Parameter: addressLength     The length of the server's address
+ * Parameter: poolSize          The most connections open at once
+ * Parameter: timeoutMs         How long to wait for a connection to be established, in milliseconds, or 0 to wait indefinitely
+ * Return: The pool, or NULL with errno set if the server couldn't be reached
+*/
+static CatalogPool* createPool(struct sockaddr_storage* address, socklen_t addressLength, int poolSize, int timeoutMs);
+
+
+
+/* Name: destroyPool
+ * Description: This function closes every connection of a pool and frees it.
+ *
+ * Parameter: pool              The pool to destroy
+ * Return: None
+*/
+static void destroyPool(CatalogPool* pool);
+
+
+
+/* Name: dropCacheEntry
+ * Description: This function takes an entry out of a cache and frees it. It must be called with the cache's lock held.
+ *
+ * Parameter: cache             The cache
+ * Parameter: entry             The entry
+ * Return: None
+*/
+static void dropCacheEntry(CatalogCache* cache, CacheEntry* entry);
+
+
+
+/* Name: exchangeFrame
+ * Description: This function sends a request on a connection and reads the response framed with its request ID, skipping any others.
+ *
+ * Parameter: connection        The connection
+ * Parameter: request           The request message, with its request ID
+ * Parameter: requestId         The request ID
+ * Parameter: response          Set to the response body, which the caller must free
+ * Parameter: answered          Set to whether any of a response arrived, so a failure can't be mistaken for a connection the server closed
+ * Return: 0, or a negative CATALOG_ERROR code
+*/
+static int exchangeFrame(CatalogConnection* connection, const char request[], unsigned int requestId, char** response, bool* answered);
+
+
+
+/* Name: failAsync
+ * Description: This function marks a pipelined connection as failed, wakes its reader thread, and completes every request in flight on it
+ *              with the given error. It's called by the reader thread, with the connection's lock held.
+ *
+ * Parameter: async             The pipelined connection
+ * Parameter: status            The error the requests failed with
+ * Return: None
+*/
+static void failAsync(CatalogAsync* async, int status);
+
+
+
+/* Name: fetchCached
+ * Description: This function answers a GET from the client's cache, after applying every invalidation that has arrived. Otherwise it
+ *              sends the GET on the cache's connection, asking the server to track it, and keeps the result unless an invalidation for
+ *              it arrived first.
+ *
+ * Parameter: client            The client
+ * Parameter: request           The GET request message, without its header fields
+ * Parameter: title             The title of the Books if the response doesn't name it, or NULL
+ * Parameter: author            The author of the Books if the response doesn't name it, or NULL
+ * Parameter: result            The result to fill
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+static int fetchCached(CatalogClient* client, const char request[], const char title[], const char author[], CatalogResult* result);
+
+
+
+/* Name: fillBuffer
+ * Description: This function reads more of the server's responses into a connection's buffer, moving the unused bytes to its front and
+ *              growing it first if it's full.
+ *
+ * Parameter: connection        The connection
+ * Return: The number of bytes read, 0 if the server closed the connection, or -1 on an error
+*/
+static int fillBuffer(CatalogConnection* connection);
+
+
+
+/* Name: formatRequest
+ * Description: This function puts a request ID, the session token, the catalog name and the tracking flag in front of a request message.
+ *
+ * Parameter: client            The client
+ * Parameter: request           The request message, without its request ID
+ * Parameter: tracked           Whether to ask the server to push an invalidation when the result goes stale
+ * Parameter: requestId         Set to the request ID taken
+ * Return: The request to send, which the caller must free, or NULL if there isn't enough memory
+*/
+static char* formatRequest(CatalogClient* client, const char request[], bool tracked, unsigned int* requestId);
+
+
+
+/* Name: hashCacheKey
+ * Description: This function computes the FNV-1a hash of the catalog and request a cached result answers.
+ *
+ * Parameter: catalog           The name of the catalog
+ * Parameter: request           The request message
+ * Return: The hash
+*/
+static unsigned int hashCacheKey(const char catalog[], const char request[]);
+
+
+
+/* Name: isValidField
+ * Description: This function checks a field value can be sent in a request: it isn't blank or longer than a Book's fields, and has no
+ *              comma or newline to end the field early.
+ *
+ * Parameter: value             The field value
+ * Return: Whether the value can be sent
+*/
+static bool isValidField(const char value[]);
+
+
+
+/* Name: noteSessionLsn
+ * Description: This function makes the log sequence number of a change the client's session token, if it's later than the current one.
+ *
+ * Parameter: client            The client
+ * Parameter: lsn               The log sequence number from a response, or 0
+ * Return: None
+*/
+static void noteSessionLsn(CatalogClient* client, unsigned long long lsn);
+
+
+
+/* Name: openConnection
+ * Description: This function opens a connection to a pool's server. The connect is non-blocking, so it gives up after the pool's timeout.
+ *
+ * Parameter: pool              The pool
+ * Return: The connection, or NULL with errno set
+*/
+static CatalogConnection* openConnection(CatalogPool* pool);
+
+
+
+/* Name: parseLine
+ * Description: This function parses a single line of a response: its status line, a TITLE, AUTHOR or KEY line naming the Books that
+ *              follow, a LOCATION line completing a Book, or its MESSAGE, LSN or COUNT line.
+ *
+ * Parameter: parser            The response being parsed
+ * Parameter: line              The line, without its newline
+ * Parameter: result            The result to fill
+ * Return: 0, or a negative CATALOG_ERROR code
+*/
+static int parseLine(ResponseParser* parser, char line[], CatalogResult* result);
+
+
+
+/* Name: parseResponse
+ * Description: This function fills a result from a response body: its status code, message, log sequence number and count, and a Book
+ *              for every LOCATION line, named by the TITLE, AUTHOR and KEY lines before it.
+ *
+ * Parameter: response          The response body
+ * Parameter: title             The title of the Books if the response doesn't name it, or NULL
+ * Parameter: author            The author of the Books if the response doesn't name it, or NULL
+ * Parameter: result            The result to fill
+ * Return: The status code, or a negative CATALOG_ERROR code
+*/
+static int parseResponse(const char response[], const char title[], const char author[], CatalogResult* result);
+
+
+
+/* Name: performRequest
+ * Description: This function sends a request on a pooled connection, with the client's request ID, session token and catalog name, and
+ *              reads its response into a result. A read redirected by a replica is sent again to the primary, and a request on a pooled
+ *              connection the server has since closed is sent again on a new one.
+ *
+ * Parameter: client            The client
+ * Parameter: request           The request message, without its request ID
+ * Parameter: change            Whether the request changes the Catalog
+ * Parameter: title             The title of the Books if the response doesn't name it, or NULL
+ * Parameter: author            The author of the Books if the response doesn't name it, or NULL
+ * Parameter: callback          The function to pass each Book to as it arrives, or NULL to keep them in the result
+ * Parameter: context           Passed to the callback
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+static int performRequest(CatalogClient* client, const char request[], bool change, const char title[], const char author[], CatalogBookCallback callback, void* context, CatalogResult* result);
+
+
+
+/* Name: readAsyncResponses
+ * Description: This function is the reader thread of a pipelined connection. It reads each response as it arrives, in whatever order the
+ *              server completes them, and completes the request with the same request ID.
+ *
+ * Parameter: arg               The pipelined connection
+ * Return: NULL
+*/
+static void* readAsyncResponses(void* arg);
+
+
+
+/* Name: readInvalidations
+ * Description: This function applies every invalidation that has arrived on the cache's connection, without waiting for any more. It
+ *              must be called with the cache's lock held.
+ *
+ * Parameter: cache             The cache
+ * Return: 0, or a negative CATALOG_ERROR code if the connection failed
+*/
+static int readInvalidations(CatalogCache* cache);
+
+
+
+/* Name: readFrame
+ * Description: This function reads the next response from a connection, whatever request it answers.
+ *
+ * Parameter: connection        The connection
+ * Parameter: responseId        Set to the request ID the response answers
+ * Parameter: response          Set to the response body, which the caller must free
+ * Parameter: answered          Set to true once any of a response has arrived
+ * Return: 0, or a negative CATALOG_ERROR code
+*/
+static int readFrame(CatalogConnection* connection, unsigned int* responseId, char** response, bool* answered);
+
+
+
+/* Name: releaseConnection
+ * Description: This function returns a borrowed connection to its pool, or closes it if it can't be used again.
+ *
+ * Parameter: pool              The pool the connection was borrowed from
+ * Parameter: connection        The connection
+ * Parameter: reusable          Whether the connection is ready for another request
+ * Return: None
+*/
+static void releaseConnection(CatalogPool* pool, CatalogConnection* connection, bool reusable);
+
+
+
+/* Name: requestField
+ * Description: This function finds the value of the first field with the given name in a request message.
+ *
+ * Parameter: request           The request message
+ * Parameter: name              The field's name with its colon, i.e. 'TITLE:'
+ * Parameter: value             Set to the field's value, or the empty string if the request has no such field
+ * Return: None
+*/
+static void requestField(const char request[], const char name[], char value[100]);
+
+
+
+/* Name: responseField
+ * Description: This function finds the value of a line of a response, i.e. the 'Clayton' of 'AUTHOR:Clayton'.
+ *
+ * Parameter: response          The response body
+ * Parameter: name              The line's name, with its colon
+ * Parameter: value             Set to the value, or blank if the response has no such line
+ * Return: None
+*/
+static void responseField(const char response[], const char name[], char value[100]);
+
+
+
+/* Name: resolveHost
+ * Description: This function looks up the address of a server by its hostname.
+ *
+ * Parameter: hostName          The hostname of the server
+ * Parameter: portNum           The port number of the server
+ * Parameter: address           Set to the server's address
+ * Parameter: addressLength     Set to the length of the server's address
+ * Return: 0, or -1 with errno set if the hostname doesn't exist
+*/
+static int resolveHost(const char hostName[], int portNum, struct sockaddr_storage* address, socklen_t* addressLength);
+
+
+
+/* Name: sendFully
+ * Description: This function sends a whole message on a socket, without a signal if the server has closed the connection.
+ *
+ * Parameter: sockfd            The socket
+ * Parameter: message           The message
+ * Parameter: messageLength     The length of the message
+ * Return: 0, or -1 if the message couldn't be sent
+*/
+static int sendFully(int sockfd, const char message[], int messageLength);
+
+
+
+/* Name: storeCacheEntry
+ * Description: This function keeps a copy of a result in a cache, dropping the least recently used entry if the cache is full. It must
+ *              be called with the cache's lock held.
+ *
+ * Parameter: cache             The cache
+ * Parameter: catalog           The catalog the request was for
+ * Parameter: request           The request message the result answers
+ * Parameter: hash              The hash of the catalog and request
+ * Parameter: result            The result
+ * Return: None
+*/
+static void storeCacheEntry(CatalogCache* cache, const char catalog[], const char request[], unsigned int hash, const CatalogResult* result);
+
+
+
+/* Name: startParser
+ * Description: This function prepares to parse a response a line at a time.
+ *
+ * Parameter: parser            The parser
+ * Parameter: title             The title of the Books if the response doesn't name it, or NULL
+ * Parameter: author            The author of the Books if the response doesn't name it, or NULL
+ * Parameter: callback          The function to pass each Book to as it's parsed, or NULL to keep them in the result
+ * Parameter: context           Passed to the callback
+ * Return: None
+*/
+static void startParser(ResponseParser* parser, const char title[], const char author[], CatalogBookCallback callback, void* context);
+
+
+
+/* Name: streamFrame
+ * Description: This function sends a request on a connection and parses the response framed with its request ID as it arrives, a line
+ *              at a time, so however large the response is, only the line being read is held. Responses to other requests are skipped.
+ *
+ * Parameter: connection        The connection
+ * Parameter: request           The request message, with its request ID
+ * Parameter: requestId         The request ID
+ * Parameter: parser            The parser, which passes each Book on as it's parsed
+ * Parameter: result            The result to fill
+ * Parameter: answered          Set to whether any of a response arrived, so a failure can't be mistaken for a connection the server closed
+ * Return: 0, or a negative CATALOG_ERROR code
+*/
+static int streamFrame(CatalogConnection* connection, const char request[], unsigned int requestId, ResponseParser* parser, CatalogResult* result, bool* answered);
+
+
+
+//FUNCTION catalogAsyncCreate
+CatalogAsync* catalogAsyncCreate(CatalogClient* client, int maxInFlight) {
+
+    //The pipelined connection created
+    CatalogAsync* async = calloc(1, sizeof(CatalogAsync));
+
+    if (async == NULL) {
+        return NULL;
+    }
+
+    async->client = client;
+    async->maxInFlight = maxInFlight > 0 ? maxInFlight : DEFAULT_MAX_IN_FLIGHT;
+
+    //Size the table of requests in flight to the power of two at or above the most allowed
+    async->pendingBuckets = 1;
+    while (async->pendingBuckets < async->maxInFlight) {
+        async->pendingBuckets *= 2;
+    }
+
+    async->pending = calloc(async->pendingBuckets, sizeof(PendingRequest*));
+    async->queued = malloc(CONNECTION_BUFFER_SIZE);
+    async->writing = malloc(CONNECTION_BUFFER_SIZE);
+    async->queuedCapacity = CONNECTION_BUFFER_SIZE;
+    async->writingCapacity = CONNECTION_BUFFER_SIZE;
+
+    if (async->pending == NULL || async->queued == NULL || async->writing == NULL) {
+        free(async->pending);
+        free(async->queued);
+        free(async->writing);
+        free(async);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    //Open a connection of its own, outside the client's pool, since its responses can't be read one request at a time
+    async->connection = openConnection(client->primary);
+
+    if (async->connection == NULL) {
+
+        int connectError = errno;
+
+        free(async->pending);
+        free(async->queued);
+        free(async->writing);
+        free(async);
+        errno = connectError;
+
+        return NULL;
+    }
+
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->changed, NULL);
+
+    pthread_create(&async->reader, NULL, readAsyncResponses, async);
+
+    return async;
+}
+
+
+
+//FUNCTION catalogAsyncDestroy
+void catalogAsyncDestroy(CatalogAsync* async) {
+
+    if (async == NULL) {
+        return;
+    }
+
+    catalogAsyncDrain(async);
+
+    //Refuse any more requests, and close the connection under the reader thread so it finishes
+    pthread_mutex_lock(&async->lock);
+    if (async->failure == 0) {
+        async->failure = CATALOG_ERROR_IO;
+    }
+    shutdown(async->connection->sockfd, SHUT_RDWR);
+    pthread_mutex_unlock(&async->lock);
+
+    pthread_join(async->reader, NULL);
+
+    close(async->connection->sockfd);
+    free(async->connection->buffer);
+    free(async->connection);
+
+    pthread_mutex_destroy(&async->lock);
+    pthread_cond_destroy(&async->changed);
+
+    free(async->pending);
+    free(async->queued);
+    free(async->writing);
+    free(async);
+}
+
+
+
+//FUNCTION catalogAsyncDrain
+void catalogAsyncDrain(CatalogAsync* async) {
+
+    pthread_mutex_lock(&async->lock);
+
+    while (async->inFlight > 0) {
+        pthread_cond_wait(&async->changed, &async->lock);
+    }
+
+    pthread_mutex_unlock(&async->lock);
+}
+
+
+
+//FUNCTION catalogAsyncRequest
+int catalogAsyncRequest(CatalogAsync* async, const char request[], CatalogCallback callback, void* context) {
+
+    //The request with its header fields, and its request ID
+    char* message;
+    int messageLength;
+    unsigned int requestId;
+
+    //The request's entry in the table of requests in flight
+    PendingRequest* pending;
+    int bucket;
+
+    //The request must be a single line, ending with its newline
+    if (request == NULL || callback == NULL || strchr(request, '\n') == NULL || strchr(request, '\n')[1] != '\0') {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    message = formatRequest(async->client, request, false, &requestId);
+    pending = malloc(sizeof(PendingRequest));
+
+    if (message == NULL || pending == NULL) {
+        free(message);
+        free(pending);
+        return CATALOG_ERROR_MEMORY;
+    }
+
+    messageLength = strlen(message);
+
+    pending->requestId = requestId;
+    requestField(request, "TITLE:", pending->title);
+    requestField(request, "AUTHOR:", pending->author);
+    pending->callback = callback;
+    pending->context = context;
+
+    pthread_mutex_lock(&async->lock);
+
+    //Wait for room among the requests in flight, unless this is a callback on the reader thread, which is what makes room
+    while (async->failure == 0 && async->inFlight >= async->maxInFlight && pthread_equal(pthread_self(), async->reader) == 0) {
+        pthread_cond_wait(&async->changed, &async->lock);
+    }
+
+    //Grow the queue if the request doesn't fit
+    if (async->failure == 0 && async->queuedLength + messageLength > async->queuedCapacity) {
+
+        int capacity = (async->queuedLength + messageLength) * 2;
+        char* queued = realloc(async->queued, capacity);
+
+        if (queued == NULL) {
+            pthread_mutex_unlock(&async->lock);
+            free(message);
+            free(pending);
+            return CATALOG_ERROR_MEMORY;
+        }
+
+        async->queued = queued;
+        async->queuedCapacity = capacity;
+    }
+
+    //Once the connection has failed, no more requests are sent on it
+    if (async->failure != 0) {
+
+        int failure = async->failure;
+
+        pthread_mutex_unlock(&async->lock);
+        free(message);
+        free(pending);
+
+        return failure;
+    }
+
+    //Track the request before it's written, so the reader thread finds it however soon its response arrives
+    bucket = requestId & (async->pendingBuckets - 1);
+    pending->nextPending = async->pending[bucket];
+    async->pending[bucket] = pending;
+    async->inFlight++;
+
+    memcpy(async->queued + async->queuedLength, message, messageLength);
+    async->queuedLength += messageLength;
+    free(message);
+
+    //If another thread is writing, it sends this request along with any others queued meanwhile
+    if (async->flushing == true) {
+        pthread_mutex_unlock(&async->lock);
+        return requestId;
+    }
+
+    //Otherwise write everything queued, swapping in the spare buffer so other threads can keep queueing during each write
+    async->flushing = true;
+
+    while (async->queuedLength > 0 && async->failure == 0) {
+
+        char* writing = async->queued;
+        int writingLength = async->queuedLength;
+        int writingCapacity = async->queuedCapacity;
+
+        async->queued = async->writing;
+        async->queuedCapacity = async->writingCapacity;
+        async->queuedLength = 0;
+        async->writing = writing;
+        async->writingCapacity = writingCapacity;
+
+        pthread_mutex_unlock(&async->lock);
+
+        //If the write fails, close the connection so the reader thread fails every request in flight
+        if (sendFully(async->connection->sockfd, writing, writingLength) < 0) {
+            shutdown(async->connection->sockfd, SHUT_RDWR);
+        }
+
+        pthread_mutex_lock(&async->lock);
+    }
+
+    async->flushing = false;
+    pthread_mutex_unlock(&async->lock);
+
+    return requestId;
+}
+
+
+
+//FUNCTION catalogAsyncRequestFuture
+CatalogFuture* catalogAsyncRequestFuture(CatalogAsync* async, const char request[]) {
+
+    //The future created
+    CatalogFuture* future = calloc(1, sizeof(CatalogFuture));
+    int requestId;
+
+    if (future == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&future->lock, NULL);
+    pthread_cond_init(&future->completed, NULL);
+
+    requestId = catalogAsyncRequest(async, request, completeFuture, future);
+
+    //If the request couldn't be sent, the future is already complete with the error
+    if (requestId < 0) {
+        future->complete = true;
+        future->status = requestId;
+        future->result.status = requestId;
+    }
+
+    return future;
+}
+
+
+
+//FUNCTION catalogClientCreate
+CatalogClient* catalogClientCreate(const char hostName[], int portNum, int poolSize, int timeoutMs) {
+
+    //The server's address
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+
+    if (hostName == NULL || portNum < 0 || portNum > 65535) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (resolveHost(hostName, portNum, &address, &addressLength) < 0) {
+        return NULL;
+    }
+
+    return createClient(&address, addressLength, poolSize, timeoutMs);
+}
+
+
+
+//FUNCTION catalogClientCreateUnix
+CatalogClient* catalogClientCreateUnix(const char socketPath[], int poolSize, int timeoutMs) {
+
+    //The server's address
+    struct sockaddr_storage address;
+    struct sockaddr_un* unixAddress = (struct sockaddr_un*) &address;
+
+    //If the socket path is missing or too long, it can't be connected to
+    if (socketPath == NULL || strlen(socketPath) >= sizeof(unixAddress->sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    //Build the socket's address from its path
+    memset(&address, 0, sizeof(address));
+    unixAddress->sun_family = AF_UNIX;
+    strcpy(unixAddress->sun_path, socketPath);
+
+    return createClient(&address, sizeof(struct sockaddr_un), poolSize, timeoutMs);
+}
+
+
+
+//FUNCTION catalogClientDestroy
+void catalogClientDestroy(CatalogClient* client) {
+
+    if (client == NULL) {
+        return;
+    }
+
+    destroyPool(client->primary);
+
+    if (client->replica != NULL) {
+        destroyPool(client->replica);
+    }
+
+    if (client->cache != NULL) {
+        clearCache(client->cache, true);
+        pthread_mutex_destroy(&client->cache->lock);
+        free(client->cache->buckets);
+        free(client->cache);
+    }
+
+    pthread_mutex_destroy(&client->lock);
+    free(client);
+}
+
+
+
+//FUNCTION catalogClientEnableCache
+int catalogClientEnableCache(CatalogClient* client, int maxEntries) {
+
+    //The cache created
+    CatalogCache* cache;
+
+    if (client == NULL || client->cache != NULL || maxEntries <= 0) {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    cache = calloc(1, sizeof(CatalogCache));
+
+    if (cache == NULL) {
+        return CATALOG_ERROR_MEMORY;
+    }
+
+    //Give the table a power of two buckets, at least one per entry
+    cache->bucketCount = 16;
+    while (cache->bucketCount < maxEntries) {
+        cache->bucketCount *= 2;
+    }
+
+    cache->buckets = calloc(cache->bucketCount, sizeof(CacheEntry*));
+
+    if (cache->buckets == NULL) {
+        free(cache);
+        return CATALOG_ERROR_MEMORY;
+    }
+
+    cache->maxEntries = maxEntries;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    client->cache = cache;
+
+    return 0;
+}
+
+
+
+//FUNCTION catalogClientSetCatalog
+int catalogClientSetCatalog(CatalogClient* client, const char catalogName[]) {
+
+    //The empty name is the default catalog, otherwise it must fit in a request field
+    if (catalogName == NULL || (catalogName[0] != '\0' && isValidField(catalogName) == false)) {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&client->lock);
+    strcpy(client->catalog, catalogName);
+    pthread_mutex_unlock(&client->lock);
+
+    return 0;
+}
+
+
+
+//FUNCTION catalogClientSetReplica
+int catalogClientSetReplica(CatalogClient* client, const char hostName[], int portNum) {
+
+    //The replica's address and its connections
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+    CatalogPool* replica;
+
+    if (hostName == NULL || portNum < 0 || portNum > 65535) {
+        errno = EINVAL;
+        return CATALOG_ERROR_CONNECT;
+    }
+
+    if (resolveHost(hostName, portNum, &address, &addressLength) < 0) {
+        return CATALOG_ERROR_CONNECT;
+    }
+
+    replica = createPool(&address, addressLength, client->primary->poolSize, client->primary->timeoutMs);
+
+    if (replica == NULL) {
+        return CATALOG_ERROR_CONNECT;
+    }
+
+    //Replace any replica reads were going to before
+    if (client->replica != NULL) {
+        destroyPool(client->replica);
+    }
+
+    client->replica = replica;
+
+    //Cached results are fetched from the server reads go to, so start again with the new one
+    if (client->cache != NULL) {
+        pthread_mutex_lock(&client->cache->lock);
+        clearCache(client->cache, true);
+        pthread_mutex_unlock(&client->cache->lock);
+    }
+
+    return 0;
+}
+
+
+
+//FUNCTION catalogErrorText
+const char* catalogErrorText(int status) {
+
+    switch (status) {
+        case CATALOG_ERROR_ARGUMENT:
+            return "A field was blank, too long, or had a comma or newline in it.";
+        case CATALOG_ERROR_CONNECT:
+            return "The server couldn't be connected to.";
+        case CATALOG_ERROR_IO:
+            return "The connection to the server failed before the response arrived.";
+        case CATALOG_ERROR_PROTOCOL:
+            return "The server's response was not framed properly.";
+        case CATALOG_ERROR_MEMORY:
+            return "There isn't enough memory for the response.";
+        default:
+            return "The server answered the request.";
+    }
+}
+
+
+
+//FUNCTION catalogFreeResult
+void catalogFreeResult(CatalogResult* result) {
+
+    if (result == NULL) {
+        return;
+    }
+
+    free(result->books);
+    free(result->response);
+
+    result->books = NULL;
+    result->bookCount = 0;
+    result->response = NULL;
+}
+
+
+
+//FUNCTION catalogFutureDone
+bool catalogFutureDone(CatalogFuture* future) {
+
+    bool complete;
+
+    pthread_mutex_lock(&future->lock);
+    complete = future->complete;
+    pthread_mutex_unlock(&future->lock);
+
+    return complete;
+}
+
+
+
+//FUNCTION catalogFutureWait
+int catalogFutureWait(CatalogFuture* future, CatalogResult* result) {
+
+    //The status of the request
+    int status;
+
+    pthread_mutex_lock(&future->lock);
+
+    while (future->complete == false) {
+        pthread_cond_wait(&future->completed, &future->lock);
+    }
+
+    pthread_mutex_unlock(&future->lock);
+
+    //Hand the result to the caller, or free it if they don't want it
+    status = future->status;
+
+    if (result != NULL) {
+        *result = future->result;
+    }
+    else {
+        catalogFreeResult(&future->result);
+    }
+
+    pthread_mutex_destroy(&future->lock);
+    pthread_cond_destroy(&future->completed);
+    free(future);
+
+    return status;
+}
+
+
+
+//FUNCTION catalogGet
+int catalogGet(CatalogClient* client, const char title[], const char author[], CatalogResult* result) {
+
+    //The Book GET request
+    char request[300];
+
+    if (isValidField(title) == false || isValidField(author) == false) {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    sprintf(request, "METHOD:GET,TITLE:%s,AUTHOR:%s\n", title, author);
+
+    //The response only has the Book's locations, so the Books found are named after the request
+    return performRequest(client, request, false, title, author, NULL, NULL, result);
+}
+
+
+
+//FUNCTION catalogGetByAuthor
+int catalogGetByAuthor(CatalogClient* client, const char author[], CatalogResult* result) {
+
+    //The Book GET request
+    char request[200];
+
+    if (isValidField(author) == false) {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    sprintf(request, "METHOD:GET,AUTHOR:%s\n", author);
+
+    return performRequest(client, request, false, NULL, author, NULL, NULL, result);
+}
+
+
+
+//FUNCTION catalogGetByAuthorStream
+int catalogGetByAuthorStream(CatalogClient* client, const char author[], CatalogBookCallback callback, void* context, CatalogResult* result) {
+
+    //The Book GET request
+    char request[200];
+
+    if (isValidField(author) == false || callback == NULL) {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    sprintf(request, "METHOD:GET,AUTHOR:%s\n", author);
+
+    return performRequest(client, request, false, NULL, author, callback, context, result);
+}
+
+
+
+//FUNCTION catalogGetByTitle
+int catalogGetByTitle(CatalogClient* client, const char title[], CatalogResult* result) {
+
+    //The Book GET request
+    char request[200];
+
+    if (isValidField(title) == false) {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    sprintf(request, "METHOD:GET,TITLE:%s\n", title);
+
+    return performRequest(client, request, false, title, NULL, NULL, NULL, result);
+}
+
+
+
+//FUNCTION catalogGetByTitleStream
+int catalogGetByTitleStream(CatalogClient* client, const char title[], CatalogBookCallback callback, void* context, CatalogResult* result) {
+
+    //The Book GET request
+    char request[200];
+
+    if (isValidField(title) == false || callback == NULL) {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    sprintf(request, "METHOD:GET,TITLE:%s\n", title);
+
+    return performRequest(client, request, false, title, NULL, callback, context, result);
+}
+
+
+
+//FUNCTION catalogGetMany
+int catalogGetMany(CatalogClient* client, const char* titles[], const char* authors[], int keyCount, CatalogResult* result) {
+
+    //The Book GETMANY request, sized for every key at its maximum length
+    char* request;
+    int requestLength;
+    int status;
+
+    if (keyCount <= 0) {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    for (int i = 0; i < keyCount; i++) {
+        if (isValidField(titles[i]) == false || isValidField(authors[i]) == false) {
+            return CATALOG_ERROR_ARGUMENT;
+        }
+    }
+
+    request = malloc(sizeof(char) * (50 + (size_t) keyCount * 220));
+
+    if (request == NULL) {
+        return CATALOG_ERROR_MEMORY;
+    }
+
+    //Form the request with a TITLE and AUTHOR field per key
+    requestLength = sprintf(request, "METHOD:GETMANY");
+    for (int i = 0; i < keyCount; i++) {
+        requestLength += sprintf(request + requestLength, ",TITLE:%s,AUTHOR:%s", titles[i], authors[i]);
+    }
+    strcpy(request + requestLength, "\n");
+
+    status = performRequest(client, request, false, NULL, NULL, NULL, NULL, result);
+    free(request);
+
+    return status;
+}
+
+
+
+//FUNCTION catalogMove
+int catalogMove(CatalogClient* client, const char title[], const char author[], const char location[], const char newLocation[], CatalogResult* result) {
+
+    //The Book MOVE request
+    char request[500];
+
+    if (isValidField(title) == false || isValidField(author) == false || isValidField(location) == false || isValidField(newLocation) == false) {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    sprintf(request, "METHOD:MOVE,TITLE:%s,AUTHOR:%s,LOCATION:%s,NEWLOCATION:%s\n", title, author, location, newLocation);
+
+    return performRequest(client, request, true, NULL, NULL, NULL, NULL, result);
+}
+
+
+
+//FUNCTION catalogRemove
+int catalogRemove(CatalogClient* client, const char title[], const char author[], const char location[], CatalogResult* result) {
+
+    //The Book REMOVE request
+    char request[400];
+
+    if (isValidField(title) == false || isValidField(author) == false || isValidField(location) == false) {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    sprintf(request, "METHOD:REMOVE,TITLE:%s,AUTHOR:%s,LOCATION:%s\n", title, author, location);
+
+    return performRequest(client, request, true, NULL, NULL, NULL, NULL, result);
+}
+
+
+
+//FUNCTION catalogRequest
+int catalogRequest(CatalogClient* client, const char request[], bool change, CatalogResult* result) {
+
+    //The title and author the request names, for a response that only gives locations
+    char title[100];
+    char author[100];
+
+    //The request must be a single line, ending with its newline
+    if (request == NULL || strchr(request, '\n') == NULL || strchr(request, '\n')[1] != '\0') {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    requestField(request, "TITLE:", title);
+    requestField(request, "AUTHOR:", author);
+
+    return performRequest(client, request, change, title, author, NULL, NULL, result);
+}
+
+
+
+//FUNCTION catalogRequestStream
+int catalogRequestStream(CatalogClient* client, const char request[], bool change, CatalogBookCallback callback, void* context, CatalogResult* result) {
+
+    //The title and author the request names, for a response that only gives locations
+    char title[100];
+    char author[100];
+
+    //The request must be a single line, ending with its newline
+    if (request == NULL || callback == NULL || strchr(request, '\n') == NULL || strchr(request, '\n')[1] != '\0') {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    requestField(request, "TITLE:", title);
+    requestField(request, "AUTHOR:", author);
+
+    return performRequest(client, request, change, title, author, callback, context, result);
+}
+
+
+
+//FUNCTION catalogSubmit
+int catalogSubmit(CatalogClient* client, const char title[], const char author[], const char location[], CatalogResult* result) {
+
+    //The Book SUBMIT request
+    char request[400];
+
+    if (isValidField(title) == false || isValidField(author) == false || isValidField(location) == false) {
+        return CATALOG_ERROR_ARGUMENT;
+    }
+
+    sprintf(request, "METHOD:SUBMIT,TITLE:%s,AUTHOR:%s,LOCATION:%s\n", title, author, location);
+
+    return performRequest(client, request, true, NULL, NULL, NULL, NULL, result);
+}
+
+
+
+//FUNCTION acquireConnection
+static CatalogConnection* acquireConnection(CatalogPool* pool, bool* reused) {
+
+    //The connection borrowed
+    CatalogConnection* connection = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+
+    //Wait until a connection is idle, or there's room to open another
+    while (pool->idleConnections == NULL && pool->openCount >= pool->poolSize) {
+        pthread_cond_wait(&pool->available, &pool->lock);
+    }
+
+    //Reuse the most recently returned connection
+    if (pool->idleConnections != NULL) {
+        connection = pool->idleConnections;
+        pool->idleConnections = connection->nextConnection;
+        pthread_mutex_unlock(&pool->lock);
+
+        *reused = true;
+        return connection;
+    }
+
+    //Otherwise claim room for a new one, and open it without holding up the other threads
+    pool->openCount++;
+    pthread_mutex_unlock(&pool->lock);
+
+    *reused = false;
+    connection = openConnection(pool);
+
+    //If it couldn't be opened, give its room back
+    if (connection == NULL) {
+
+        int connectError = errno;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->openCount--;
+        pthread_cond_signal(&pool->available);
+        pthread_mutex_unlock(&pool->lock);
+
+        errno = connectError;
+    }
+
+    return connection;
+}
+
+
+
+//FUNCTION applyInvalidation
+static void applyInvalidation(CatalogCache* cache, const char response[]) {
+
+    //The catalog, title and author of the changed Book
+    char catalog[100];
+    char title[100];
+    char author[100];
+
+    //A flush drops everything, including the result being fetched
+    if (strncmp(response, "213:", 4) == 0) {
+        clearCache(cache, false);
+        return;
+    }
+
+    if (strncmp(response, "212:", 4) != 0) {
+        return;
+    }
+
+    responseField(response, "CATALOG:", catalog);
+    responseField(response, "TITLE:", title);
+    responseField(response, "AUTHOR:", author);
+
+    //Drop every result for the catalog naming the title or the author
+    for (CacheEntry* entry = cache->newest; entry != NULL; ) {
+
+        CacheEntry* older = entry->older;
+
+        if (strcmp(entry->catalog, catalog) == 0 && ((entry->title[0] != '\0' && strcmp(entry->title, title) == 0)
+                                                     || (entry->author[0] != '\0' && strcmp(entry->author, author) == 0))) {
+            dropCacheEntry(cache, entry);
+        }
+
+        entry = older;
+    }
+
+    //The result being fetched may have been read before the change, so it isn't kept either
+    if (strcmp(cache->pendingCatalog, catalog) == 0 && ((cache->pendingTitle[0] != '\0' && strcmp(cache->pendingTitle, title) == 0)
+                                                        || (cache->pendingAuthor[0] != '\0' && strcmp(cache->pendingAuthor, author) == 0))) {
+        cache->pendingInvalidated = true;
+    }
+}
+
+
+
+//FUNCTION appendBook
+static int appendBook(CatalogResult* result, const char title[], const char author[], const char location[], int key) {
+
+    //The Book added
+    CatalogBook* book;
+
+    //Double the room for Books whenever it's full, i.e. when the count reaches a power of two
+    if (result->bookCount == 0 || (result->bookCount >= 16 && (result->bookCount & (result->bookCount - 1)) == 0)) {
+
+        int capacity = result->bookCount < 16 ? 16 : result->bookCount * 2;
+        CatalogBook* books = realloc(result->books, sizeof(CatalogBook) * capacity);
+
+        if (books == NULL) {
+            return CATALOG_ERROR_MEMORY;
+        }
+
+        result->books = books;
+    }
+
+    book = &result->books[result->bookCount++];
+
+    snprintf(book->title, sizeof(book->title), "%s", title);
+    snprintf(book->author, sizeof(book->author), "%s", author);
+    snprintf(book->location, sizeof(book->location), "%s", location);
+    book->key = key;
+
+    return 0;
+}
+
+
+
+//FUNCTION clearCache
+static void clearCache(CatalogCache* cache, bool disconnect) {
+
+    while (cache->newest != NULL) {
+        dropCacheEntry(cache, cache->newest);
+    }
+
+    //Nor can the result being fetched be trusted
+    cache->pendingInvalidated = true;
+
+    if (disconnect == true && cache->connection != NULL) {
+        close(cache->connection->sockfd);
+        free(cache->connection->buffer);
+        free(cache->connection);
+        cache->connection = NULL;
+    }
+}
+
+
+
+//FUNCTION closeIdleConnections
+static void closeIdleConnections(CatalogPool* pool) {
+
+    //The idle connections, taken from the pool
+    CatalogConnection* idleConnections;
+
+    pthread_mutex_lock(&pool->lock);
+    idleConnections = pool->idleConnections;
+    pool->idleConnections = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    //Close each one, giving its room back to the pool
+    while (idleConnections != NULL) {
+
+        CatalogConnection* connection = idleConnections;
+        idleConnections = connection->nextConnection;
+
+        releaseConnection(pool, connection, false);
+    }
+}
+
+
+
+//FUNCTION completeFuture
+static void completeFuture(int status, CatalogResult* result, void* context) {
+
+    CatalogFuture* future = context;
+
+    pthread_mutex_lock(&future->lock);
+
+    //Take the result's Books and response, so they outlive the callback
+    future->status = status;
+    future->result = *result;
+    result->books = NULL;
+    result->bookCount = 0;
+    result->response = NULL;
+
+    future->complete = true;
+    pthread_cond_signal(&future->completed);
+    pthread_mutex_unlock(&future->lock);
+}
+
+
+
+//FUNCTION copyResult
+static int copyResult(CatalogResult* copy, const CatalogResult* result) {
+
+    *copy = *result;
+    copy->books = NULL;
+    copy->response = NULL;
+
+    if (result->bookCount > 0) {
+
+        copy->books = malloc(sizeof(CatalogBook) * result->bookCount);
+
+        if (copy->books == NULL) {
+            return CATALOG_ERROR_MEMORY;
+        }
+
+        memcpy(copy->books, result->books, sizeof(CatalogBook) * result->bookCount);
+    }
+
+    if (result->response != NULL && (copy->response = strdup(result->response)) == NULL) {
+        catalogFreeResult(copy);
+        return CATALOG_ERROR_MEMORY;
+    }
+
+    return 0;
+}
+
+
+
+//FUNCTION createClient
+static CatalogClient* createClient(struct sockaddr_storage* address, socklen_t addressLength, int poolSize, int timeoutMs) {
+
+    //The client created
+    CatalogClient* client = calloc(1, sizeof(CatalogClient));
+
+    if (client == NULL) {
+        return NULL;
+    }
+
+    client->primary = createPool(address, addressLength, poolSize, timeoutMs);
+
+    if (client->primary == NULL) {
+
+        int connectError = errno;
+
+        free(client);
+        errno = connectError;
+
+        return NULL;
+    }
+
+    client->nextRequestId = 1;
+    pthread_mutex_init(&client->lock, NULL);
+
+    return client;
+}
+
+
+
+//FUNCTION createPool
+static CatalogPool* createPool(struct sockaddr_storage* address, socklen_t addressLength, int poolSize, int timeoutMs) {
+
+    //The pool created
+    CatalogPool* pool = calloc(1, sizeof(CatalogPool));
+
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    memcpy(&pool->address, address, addressLength);
+    pool->addressLength = addressLength;
+    pool->poolSize = poolSize > 0 ? poolSize : 1;
+    pool->timeoutMs = timeoutMs;
+
+    //Open the first connection straight away, so an unreachable server is reported now
+    pool->idleConnections = openConnection(pool);
+
+    if (pool->idleConnections == NULL) {
+
+        int connectError = errno;
+
+        free(pool);
+        errno = connectError;
+
+        return NULL;
+    }
+
+    pool->openCount = 1;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->available, NULL);
+
+    return pool;
+}
+
+
+
+//FUNCTION destroyPool
+static void destroyPool(CatalogPool* pool) {
+
+    //Close every idle connection
+    while (pool->idleConnections != NULL) {
+
+        CatalogConnection* connection = pool->idleConnections;
+        pool->idleConnections = connection->nextConnection;
+
+        close(connection->sockfd);
+        free(connection->buffer);
+        free(connection);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->available);
+    free(pool);
+}
+
+
+
+//FUNCTION dropCacheEntry
+static void dropCacheEntry(CatalogCache* cache, CacheEntry* entry) {
+
+    //Unlink the entry from its bucket
+    for (CacheEntry** it = &cache->buckets[entry->hash & (cache->bucketCount - 1)]; *it != NULL; it = &(*it)->nextEntry) {
+        if (*it == entry) {
+            *it = entry->nextEntry;
+            break;
+        }
+    }
+
+    //And from the order of use
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    }
+    else {
+        cache->newest = entry->older;
+    }
+
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    }
+    else {
+        cache->oldest = entry->newer;
+    }
+
+    cache->entryCount--;
+
+    catalogFreeResult(&entry->result);
+    free(entry->request);
+    free(entry);
+}
+
+
+
+//FUNCTION exchangeFrame
+static int exchangeFrame(CatalogConnection* connection, const char request[], unsigned int requestId, char** response, bool* answered) {
+
+    //The request ID of each response read
+    unsigned int responseId;
+    int status;
+
+    *answered = false;
+
+    if (sendFully(connection->sockfd, request, strlen(request)) < 0) {
+        return CATALOG_ERROR_IO;
+    }
+
+    //Skip any responses to other requests until the one for this request arrives
+    while ((status = readFrame(connection, &responseId, response, answered)) == 0) {
+
+        if (responseId == requestId) {
+            return 0;
+        }
+
+        free(*response);
+    }
+
+    return status;
+}
+
+
+
+//FUNCTION failAsync
+static void failAsync(CatalogAsync* async, int status) {
+
+    //The requests in flight, taken from the table
+    PendingRequest* failed = NULL;
+    int failedCount = 0;
+
+    //Refuse any more requests, and take every request in flight
+    if (async->failure == 0) {
+        async->failure = status;
+    }
+
+    for (int i = 0; i < async->pendingBuckets; i++) {
+        while (async->pending[i] != NULL) {
+
+            PendingRequest* pending = async->pending[i];
+            async->pending[i] = pending->nextPending;
+
+            pending->nextPending = failed;
+            failed = pending;
+            failedCount++;
+        }
+    }
+
+    //Wake any thread waiting for room, since it won't get any
+    pthread_cond_broadcast(&async->changed);
+    pthread_mutex_unlock(&async->lock);
+
+    //Complete each request with the error, without holding the lock during the callbacks
+    while (failed != NULL) {
+
+        PendingRequest* pending = failed;
+        CatalogResult result;
+
+        failed = pending->nextPending;
+
+        memset(&result, 0, sizeof(CatalogResult));
+        result.status = status;
+        pending->callback(status, &result, pending->context);
+        catalogFreeResult(&result);
+
+        free(pending);
+    }
+
+    pthread_mutex_lock(&async->lock);
+    async->inFlight -= failedCount;
+    pthread_cond_broadcast(&async->changed);
+}
+
+
+
+//FUNCTION fetchCached
+static int fetchCached(CatalogClient* client, const char request[], const char title[], const char author[], CatalogResult* result) {
+
+    CatalogCache* cache = client->cache;
+
+    //The catalog the request is for, the hash it's cached under, and its cached result
+    char catalog[100];
+    unsigned int hash;
+    CacheEntry* entry;
+
+    //The request with its header fields, and the response to it
+    char* message;
+    unsigned int requestId;
+    unsigned int responseId;
+    char* response = NULL;
+    int status = CATALOG_ERROR_IO;
+
+    pthread_mutex_lock(&client->lock);
+    strcpy(catalog, client->catalog);
+    pthread_mutex_unlock(&client->lock);
+
+    hash = hashCacheKey(catalog, request);
+
+    pthread_mutex_lock(&cache->lock);
+
+    //Apply the invalidations that have arrived before trusting anything cached. A failed connection takes its cache with it
+    if (readInvalidations(cache) < 0) {
+        clearCache(cache, true);
+    }
+
+    for (entry = cache->buckets[hash & (cache->bucketCount - 1)]; entry != NULL; entry = entry->nextEntry) {
+        if (entry->hash == hash && strcmp(entry->request, request) == 0 && strcmp(entry->catalog, catalog) == 0) {
+            break;
+        }
+    }
+
+    //Answer from the cache, making the entry the most recently used
+    if (entry != NULL) {
+
+        if (entry != cache->newest) {
+
+            entry->newer->older = entry->older;
+
+            if (entry->older != NULL) {
+                entry->older->newer = entry->newer;
+            }
+            else {
+                cache->oldest = entry->newer;
+            }
+
+            entry->newer = NULL;
+            entry->older = cache->newest;
+            cache->newest->newer = entry;
+            cache->newest = entry;
+        }
+
+        status = copyResult(result, &entry->result);
+        pthread_mutex_unlock(&cache->lock);
+
+        if (status < 0) {
+            result->status = status;
+            return status;
+        }
+
+        result->cached = true;
+
+        return result->status;
+    }
+
+    message = formatRequest(client, request, true, &requestId);
+
+    if (message == NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        result->status = CATALOG_ERROR_MEMORY;
+        return CATALOG_ERROR_MEMORY;
+    }
+
+    //Note what the result names, so an invalidation arriving before it keeps it out of the cache
+    snprintf(cache->pendingCatalog, sizeof(cache->pendingCatalog), "%s", catalog);
+    requestField(request, "TITLE:", cache->pendingTitle);
+    requestField(request, "AUTHOR:", cache->pendingAuthor);
+
+    //Send the request on the cache's connection, and once more on a new one if the server had closed it while it was idle
+    for (int attempt = 0; attempt < 2; attempt++) {
+
+        bool reused = cache->connection != NULL;
+        bool answered = false;
+
+        if (cache->connection == NULL) {
+            cache->connection = openConnection(client->replica != NULL ? client->replica : client->primary);
+        }
+
+        if (cache->connection == NULL) {
+            status = CATALOG_ERROR_CONNECT;
+            break;
+        }
+
+        cache->pendingInvalidated = false;
+
+        //Apply any invalidations that arrive ahead of the response
+        if (sendFully(cache->connection->sockfd, message, strlen(message)) < 0) {
+            status = CATALOG_ERROR_IO;
+        }
+        else {
+            while ((status = readFrame(cache->connection, &responseId, &response, &answered)) == 0 && responseId != requestId) {
+
+                if (responseId == 0) {
+                    applyInvalidation(cache, response);
+                }
+
+                free(response);
+                response = NULL;
+            }
+        }
+
+        if (status == 0) {
+            break;
+        }
+
+        //The server forgets what a failed connection cached, so the client does too
+        clearCache(cache, true);
+
+        if (reused == false || answered == true) {
+            break;
+        }
+    }
+
+    free(message);
+
+    if (status == 0) {
+        result->response = response;
+        status = parseResponse(response, title, author, result);
+    }
+
+    //Keep the result unless it's already stale or it wasn't an answer the server tracks, i.e. a replica's redirect
+    if ((status == 202 || status == 402) && cache->pendingInvalidated == false) {
+        storeCacheEntry(cache, catalog, request, hash, result);
+    }
+
+    cache->pendingCatalog[0] = '\0';
+
+    pthread_mutex_unlock(&cache->lock);
+
+    if (status < 0) {
+        catalogFreeResult(result);
+        result->status = status;
+    }
+
+    return status;
+}
+
+
+
+//FUNCTION fillBuffer
+static int fillBuffer(CatalogConnection* connection) {
+
+    //The number of bytes read
+    int readLength;
+
+    //Move the unused bytes to the front of the buffer
+    if (connection->bufferStart > 0) {
+        memmove(connection->buffer, connection->buffer + connection->bufferStart, connection->bufferEnd - connection->bufferStart);
+        connection->bufferEnd -= connection->bufferStart;
+        connection->bufferStart = 0;
+    }
+
+    //If the buffer is still full, double it
+    if (connection->bufferEnd == connection->bufferCapacity) {
+
+        char* buffer = realloc(connection->buffer, connection->bufferCapacity * 2);
+
+        if (buffer == NULL) {
+            return -1;
+        }
+
+        connection->buffer = buffer;
+        connection->bufferCapacity *= 2;
+    }
+
+    do {
+        readLength = read(connection->sockfd, connection->buffer + connection->bufferEnd, connection->bufferCapacity - connection->bufferEnd);
+    } while (readLength < 0 && errno == EINTR);
+
+    if (readLength > 0) {
+        connection->bufferEnd += readLength;
+    }
+
+    return readLength;
+}
+
+
+
+//FUNCTION formatRequest
+static char* formatRequest(CatalogClient* client, const char request[], bool tracked, unsigned int* requestId) {
+
+    //The request with its header fields, i.e. 'ID:12,SESSION:40,CATALOG:fiction,TRACK:ON,METHOD:GET,...'
+    char* message = malloc(sizeof(char) * (strlen(request) + 200));
+    int headerLength;
+
+    if (message == NULL) {
+        return NULL;
+    }
+
+    //Take a request ID, and carry the session token once the client has changed anything
+    pthread_mutex_lock(&client->lock);
+
+    //Request ID 0 is kept for the invalidations the server pushes, and IDs stay within an int so catalogAsyncRequest can return them
+    if (client->nextRequestId == 0 || client->nextRequestId > INT_MAX) {
+        client->nextRequestId = 1;
+    }
+
+    *requestId = client->nextRequestId++;
+    headerLength = sprintf(message, "ID:%u,", *requestId);
+
+    if (client->sessionLsn > 0) {
+        headerLength += sprintf(message + headerLength, "SESSION:%llu,", client->sessionLsn);
+    }
+
+    if (client->catalog[0] != '\0') {
+        headerLength += sprintf(message + headerLength, "CATALOG:%s,", client->catalog);
+    }
+
+    if (tracked == true) {
+        headerLength += sprintf(message + headerLength, "TRACK:ON,");
+    }
+
+    pthread_mutex_unlock(&client->lock);
+
+    strcpy(message + headerLength, request);
+
+    return message;
+}
+
+
+
+//FUNCTION hashCacheKey
+static unsigned int hashCacheKey(const char catalog[], const char request[]) {
+
+    unsigned int hash = 2166136261u;
+
+    for (const char* it = catalog; *it != '\0'; it++) {
+        hash = (hash ^ (unsigned char) *it) * 16777619u;
+    }
+
+    //Separate the catalog from the request, so no two pairs hash the same text
+    hash = (hash ^ '\n') * 16777619u;
+
+    for (const char* it = request; *it != '\0'; it++) {
+        hash = (hash ^ (unsigned char) *it) * 16777619u;
+    }
+
+    return hash;
+}
+
+
+
+//FUNCTION isValidField
+static bool isValidField(const char value[]) {
+
+    if (value == NULL || value[0] == '\0' || strlen(value) > 99) {
+        return false;
+    }
+
+    return strpbrk(value, ",\n") == NULL;
+}
+
+
+
+//FUNCTION noteSessionLsn
+static void noteSessionLsn(CatalogClient* client, unsigned long long lsn) {
+
+    pthread_mutex_lock(&client->lock);
+
+    if (lsn > client->sessionLsn) {
+        client->sessionLsn = lsn;
+    }
+
+    pthread_mutex_unlock(&client->lock);
+}
+
+
+
+//FUNCTION openConnection
+static CatalogConnection* openConnection(CatalogPool* pool) {
+
+    //The connection opened, and its socket's flags before the connect
+    CatalogConnection* connection;
+    int sockfd;
+    int flags;
+
+    //The error the connect finished with
+    int connectError = 0;
+    socklen_t errorLength = sizeof(connectError);
+
+    sockfd = socket(pool->address.ss_family, SOCK_STREAM, 0);
+
+    if (sockfd < 0) {
+        return NULL;
+    }
+
+    //Start the connect without waiting for it
+    flags = fcntl(sockfd, F_GETFL, 0);
+    fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+
+    if (connect(sockfd, (struct sockaddr*) &pool->address, pool->addressLength) < 0) {
+
+        struct pollfd pollSocket;
+        int ready;
+
+        if (errno != EINPROGRESS) {
+            connectError = errno;
+            close(sockfd);
+            errno = connectError;
+            return NULL;
+        }
+
+        //Wait for the connect to finish, for no longer than the timeout
+        pollSocket.fd = sockfd;
+        pollSocket.events = POLLOUT;
+
+        do {
+            ready = poll(&pollSocket, 1, pool->timeoutMs > 0 ? pool->timeoutMs : -1);
+        } while (ready < 0 && errno == EINTR);
+
+        if (ready == 0) {
+            connectError = ETIMEDOUT;
+        }
+        else if (ready < 0) {
+            connectError = errno;
+        }
+        else if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &connectError, &errorLength) < 0) {
+            connectError = errno;
+        }
+
+        if (connectError != 0) {
+            close(sockfd);
+            errno = connectError;
+            return NULL;
+        }
+    }
+
+    //Requests on the connection block as usual once it's established
+    fcntl(sockfd, F_SETFL, flags);
+
+    connection = calloc(1, sizeof(CatalogConnection));
+
+    if (connection == NULL || (connection->buffer = malloc(CONNECTION_BUFFER_SIZE)) == NULL) {
+        free(connection);
+        close(sockfd);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    connection->sockfd = sockfd;
+    connection->bufferCapacity = CONNECTION_BUFFER_SIZE;
+
+    return connection;
+}
+
+
+
+//FUNCTION parseLine
+static int parseLine(ResponseParser* parser, char line[], CatalogResult* result) {
+
+    //Every response starts with its status code, i.e. '202:RETRIEVED', and the status line's text is the message unless a MESSAGE line follows
+    if (parser->started == false) {
+
+        if (strlen(line) < 4 || sscanf(line, "%3d", &result->status) != 1 || line[3] != ':') {
+            return CATALOG_ERROR_PROTOCOL;
+        }
+
+        snprintf(result->message, sizeof(result->message), "%s", line + 4 + (line[4] == ' '));
+        parser->started = true;
+    }
+    else if (strncmp(line, "KEY:", 4) == 0) {
+        parser->key = atoi(line + 4);
+    }
+    else if (strncmp(line, "TITLE:", 6) == 0) {
+        snprintf(parser->title, sizeof(parser->title), "%s", line + 6);
+    }
+    else if (strncmp(line, "AUTHOR:", 7) == 0) {
+        snprintf(parser->author, sizeof(parser->author), "%s", line + 7);
+    }
+    else if (strncmp(line, "LOCATION:", 9) == 0) {
+
+        //Keep the Book in the result
+        if (parser->callback == NULL) {
+            return appendBook(result, parser->title, parser->author, line + 9, parser->key);
+        }
+
+        //Or pass it on and forget it, unless the caller has asked for no more
+        if (parser->stopped == false) {
+
+            CatalogBook book;
+
+            snprintf(book.title, sizeof(book.title), "%s", parser->title);
+            snprintf(book.author, sizeof(book.author), "%s", parser->author);
+            snprintf(book.location, sizeof(book.location), "%s", line + 9);
+            book.key = parser->key;
+
+            result->bookCount++;
+            parser->stopped = parser->callback(&book, parser->context) == false;
+        }
+    }
+    else if (strncmp(line, "MESSAGE:", 8) == 0) {
+        snprintf(result->message, sizeof(result->message), "%s", line + 8 + (line[8] == ' '));
+    }
+    else if (strncmp(line, "LSN:", 4) == 0) {
+        result->lsn = strtoull(line + 4, NULL, 10);
+    }
+    else if (strncmp(line, "COUNT:", 6) == 0) {
+        result->count = atoi(line + 6);
+    }
+
+    return 0;
+}
+
+
+
+//FUNCTION parseResponse
+static int parseResponse(const char response[], const char title[], const char author[], CatalogResult* result) {
+
+    //A copy of the response to split into lines, so the caller keeps the whole body
+    char* lines = strdup(response);
+
+    //The current line and the one after it
+    char* line = lines;
+    char* nextLine;
+
+    //The parser keeping the Books in the result
+    ResponseParser parser;
+    int status = 0;
+
+    if (lines == NULL) {
+        return CATALOG_ERROR_MEMORY;
+    }
+
+    startParser(&parser, title, author, NULL, NULL);
+
+    //Walk the response a line at a time, ending each line in place
+    while (status == 0 && line != NULL && *line != '\0') {
+
+        nextLine = strchr(line, '\n');
+
+        if (nextLine != NULL) {
+            *nextLine = '\0';
+            nextLine++;
+        }
+
+        status = parseLine(&parser, line, result);
+        line = nextLine;
+    }
+
+    free(lines);
+
+    if (status == 0 && parser.started == false) {
+        status = CATALOG_ERROR_PROTOCOL;
+    }
+
+    return status < 0 ? status : result->status;
+}
+
+
+
+//FUNCTION performRequest
+static int performRequest(CatalogClient* client, const char request[], bool change, const char title[], const char author[], CatalogBookCallback callback, void* context, CatalogResult* result) {
+
+    //The result filled when the caller doesn't want one
+    CatalogResult ownResult;
+
+    //The request with its request ID, session token and catalog name
+    char* message;
+    unsigned int requestId;
+
+    //The pool the request is sent to, and the response body
+    CatalogPool* pool = change == false && client->replica != NULL ? client->replica : client->primary;
+    char* response = NULL;
+    int status = CATALOG_ERROR_IO;
+
+    if (result == NULL) {
+        result = &ownResult;
+    }
+
+    memset(result, 0, sizeof(CatalogResult));
+
+    //A GET the client caches is answered from the cache, or fetched on the connection the server pushes invalidations on
+    if (client->cache != NULL && change == false && callback == NULL && strncmp(request, "METHOD:GET,", 11) == 0) {
+
+        status = fetchCached(client, request, title, author, result);
+
+        if (status != 307) {
+
+            if (result == &ownResult) {
+                catalogFreeResult(result);
+            }
+
+            return status;
+        }
+
+        //The replica is behind this client's writes, so the primary answers instead, and the result isn't cached
+        catalogFreeResult(result);
+        memset(result, 0, sizeof(CatalogResult));
+        result->redirected = true;
+        pool = client->primary;
+    }
+
+    message = formatRequest(client, request, false, &requestId);
+
+    if (message == NULL) {
+        result->status = CATALOG_ERROR_MEMORY;
+        return CATALOG_ERROR_MEMORY;
+    }
+
+    //Send the request, and once more if a replica redirects it to the primary
+    while (1) {
+
+        //Try a pooled connection, and once more on a new one if the server had closed it while it was idle
+        for (int attempt = 0; attempt < 2; attempt++) {
+
+            CatalogConnection* connection;
+            bool reused;
+            bool answered;
+
+            connection = acquireConnection(pool, &reused);
+
+            if (connection == NULL) {
+                status = CATALOG_ERROR_CONNECT;
+                break;
+            }
+
+            //Read the whole response, or pass its Books to the caller as they arrive
+            if (callback == NULL) {
+                status = exchangeFrame(connection, message, requestId, &response, &answered);
+            }
+            else {
+
+                ResponseParser parser;
+
+                startParser(&parser, title, author, callback, context);
+                status = streamFrame(connection, message, requestId, &parser, result, &answered);
+            }
+
+            releaseConnection(pool, connection, status == 0);
+
+            if (status == 0 || reused == false || answered == true) {
+                break;
+            }
+
+            //The server has closed the connection since it was last used, so the other idle ones are closed too
+            closeIdleConnections(pool);
+        }
+
+        if (status < 0) {
+            break;
+        }
+
+        //Keep the whole response body for the caller, as well as the Books parsed from it
+        if (callback == NULL) {
+            result->response = response;
+            status = parseResponse(response, title, author, result);
+        }
+        else {
+            status = result->status;
+        }
+
+        //If a replica is behind this client's writes, read from the primary instead
+        if (status == 307 && pool == client->replica) {
+            catalogFreeResult(result);
+            memset(result, 0, sizeof(CatalogResult));
+            result->redirected = true;
+            pool = client->primary;
+            continue;
+        }
+
+        break;
+    }
+
+    free(message);
+
+    if (status < 0) {
+        catalogFreeResult(result);
+        result->status = status;
+        return status;
+    }
+
+    noteSessionLsn(client, result->lsn);
+
+    //The cache may be reading from a replica that hasn't applied this client's change yet, so the client reads its own changes from the
+    //server, with its session token, rather than from results cached before them
+    if (change == true && client->cache != NULL) {
+        pthread_mutex_lock(&client->cache->lock);
+        clearCache(client->cache, false);
+        pthread_mutex_unlock(&client->cache->lock);
+    }
+
+    if (result == &ownResult) {
+        catalogFreeResult(result);
+    }
+
+    return status;
+}
+
+
+
+//FUNCTION readAsyncResponses
+static void* readAsyncResponses(void* arg) {
+
+    CatalogAsync* async = arg;
+
+    //Complete each request as its response arrives, until the connection fails or is closed
+    while (1) {
+
+        //The request ID and body of the response, and the result parsed from it
+        unsigned int responseId;
+        char* response;
+        bool answered;
+        CatalogResult result;
+        int status;
+
+        //The request the response answers
+        PendingRequest** link;
+        PendingRequest* pending;
+
+        status = readFrame(async->connection, &responseId, &response, &answered);
+
+        //If the connection failed, fail every request in flight with it
+        if (status < 0) {
+            pthread_mutex_lock(&async->lock);
+            failAsync(async, status);
+            pthread_mutex_unlock(&async->lock);
+            return NULL;
+        }
+
+        //Find the request and take it out of the table
+        pthread_mutex_lock(&async->lock);
+
+        link = &async->pending[responseId & (async->pendingBuckets - 1)];
+        while (*link != NULL && (*link)->requestId != responseId) {
+            link = &(*link)->nextPending;
+        }
+
+        pending = *link;
+        if (pending != NULL) {
+            *link = pending->nextPending;
+        }
+
+        pthread_mutex_unlock(&async->lock);
+
+        //A response to a request that isn't in flight is discarded
+        if (pending == NULL) {
+            free(response);
+            continue;
+        }
+
+        memset(&result, 0, sizeof(CatalogResult));
+        result.response = response;
+        status = parseResponse(response, pending->title, pending->author, &result);
+
+        if (status < 0) {
+            result.status = status;
+        }
+
+        noteSessionLsn(async->client, result.lsn);
+
+        pending->callback(status, &result, pending->context);
+        catalogFreeResult(&result);
+        free(pending);
+
+        //Only count the request complete once its callback has returned, so draining waits for every callback
+        pthread_mutex_lock(&async->lock);
+        async->inFlight--;
+        pthread_cond_broadcast(&async->changed);
+        pthread_mutex_unlock(&async->lock);
+    }
+
+    return NULL;
+}
+
+
+
+//FUNCTION readInvalidations
+static int readInvalidations(CatalogCache* cache) {
+
+    //The request ID and body of each frame read
+    unsigned int responseId;
+    char* response;
+    bool answered;
+    int status;
+
+    if (cache->connection == NULL) {
+        return 0;
+    }
+
+    //Read whatever has arrived, without waiting
+    while (1) {
+
+        struct pollfd pollSocket = { cache->connection->sockfd, POLLIN, 0 };
+        int ready = poll(&pollSocket, 1, 0);
+
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (ready <= 0) {
+            break;
+        }
+
+        if (fillBuffer(cache->connection) <= 0) {
+            return CATALOG_ERROR_IO;
+        }
+    }
+
+    //Apply every invalidation read, waiting only for the rest of one that has partly arrived
+    while (cache->connection->bufferStart < cache->connection->bufferEnd) {
+
+        if ((status = readFrame(cache->connection, &responseId, &response, &answered)) < 0) {
+            return status;
+        }
+
+        if (responseId == 0) {
+            applyInvalidation(cache, response);
+        }
+
+        free(response);
+    }
+
+    return 0;
+}
+
+
+
+//FUNCTION readFrame
+static int readFrame(CatalogConnection* connection, unsigned int* responseId, char** response, bool* answered) {
+
+    //The end of the framing line, and the response length it gives
+    char* headerEnd;
+    char frameHeader[MAX_FRAME_HEADER];
+    int responseLength;
+
+    //Read until the buffer holds the whole framing line
+    while ((headerEnd = memchr(connection->buffer + connection->bufferStart, '\n', connection->bufferEnd - connection->bufferStart)) == NULL) {
+
+        if (connection->bufferEnd - connection->bufferStart >= MAX_FRAME_HEADER) {
+            return CATALOG_ERROR_PROTOCOL;
+        }
+
+        if (fillBuffer(connection) <= 0) {
+            return CATALOG_ERROR_IO;
+        }
+
+        *answered = true;
+    }
+
+    *answered = true;
+
+    //Parse the framing line, i.e. 'ID:12,LENGTH:85'
+    memcpy(frameHeader, connection->buffer + connection->bufferStart, headerEnd - (connection->buffer + connection->bufferStart));
+    frameHeader[headerEnd - (connection->buffer + connection->bufferStart)] = '\0';
+
+    if (sscanf(frameHeader, "ID:%u,LENGTH:%d", responseId, &responseLength) != 2 || responseLength < 0) {
+        return CATALOG_ERROR_PROTOCOL;
+    }
+
+    connection->bufferStart = headerEnd + 1 - connection->buffer;
+
+    //Read until the buffer holds the whole body
+    while (connection->bufferEnd - connection->bufferStart < responseLength) {
+
+        //Make room for the rest of the body before reading it
+        if (connection->bufferCapacity - connection->bufferStart < responseLength) {
+
+            int needed = responseLength + CONNECTION_BUFFER_SIZE;
+            char* buffer;
+
+            memmove(connection->buffer, connection->buffer + connection->bufferStart, connection->bufferEnd - connection->bufferStart);
+            connection->bufferEnd -= connection->bufferStart;
+            connection->bufferStart = 0;
+
+            if (connection->bufferCapacity < needed) {
+
+                buffer = realloc(connection->buffer, needed);
+
+                if (buffer == NULL) {
+                    return CATALOG_ERROR_MEMORY;
+                }
+
+                connection->buffer = buffer;
+                connection->bufferCapacity = needed;
+            }
+        }
+
+        if (fillBuffer(connection) <= 0) {
+            return CATALOG_ERROR_IO;
+        }
+    }
+
+    //Copy the body out, so the buffer can be reused for the next response
+    *response = malloc(sizeof(char) * (responseLength + 1));
+
+    if (*response == NULL) {
+        return CATALOG_ERROR_MEMORY;
+    }
+
+    memcpy(*response, connection->buffer + connection->bufferStart, responseLength);
+    (*response)[responseLength] = '\0';
+    connection->bufferStart += responseLength;
+
+    return 0;
+}
+
+
+
+//FUNCTION releaseConnection
+static void releaseConnection(CatalogPool* pool, CatalogConnection* connection, bool reusable) {
+
+    //A connection that failed part way through a response can't be read from again
+    if (reusable == false) {
+        close(connection->sockfd);
+        free(connection->buffer);
+        free(connection);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (reusable == true) {
+        connection->nextConnection = pool->idleConnections;
+        pool->idleConnections = connection;
+    }
+    else {
+        pool->openCount--;
+    }
+
+    pthread_cond_signal(&pool->available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+
+//FUNCTION requestField
+static void requestField(const char request[], const char name[], char value[100]) {
+
+    //The field, which starts the request or follows a comma
+    const char* field = request;
+    int valueLength;
+
+    while (field != NULL && strncmp(field, name, strlen(name)) != 0) {
+        field = strchr(field, ',');
+        field = field != NULL ? field + 1 : NULL;
+    }
+
+    if (field == NULL) {
+        value[0] = '\0';
+        return;
+    }
+
+    //The value runs to the next comma or the end of the request
+    field += strlen(name);
+    valueLength = strcspn(field, ",\n");
+
+    snprintf(value, 100, "%.*s", valueLength, field);
+}
+
+
+
+//FUNCTION responseField
+static void responseField(const char response[], const char name[], char value[100]) {
+
+    //The line, which starts the response or follows a newline
+    const char* line = response;
+    int valueLength;
+
+    while (line != NULL && strncmp(line, name, strlen(name)) != 0) {
+        line = strchr(line, '\n');
+        line = line != NULL ? line + 1 : NULL;
+    }
+
+    if (line == NULL) {
+        value[0] = '\0';
+        return;
+    }
+
+    line += strlen(name);
+    valueLength = strcspn(line, "\n");
+
+    snprintf(value, 100, "%.*s", valueLength, line);
+}
+
+
+
+//FUNCTION resolveHost
+static int resolveHost(const char hostName[], int portNum, struct sockaddr_storage* address, socklen_t* addressLength) {
+
+    //The lookup's hints and its results
+    struct addrinfo hints;
+    struct addrinfo* results;
+    char portText[10];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    sprintf(portText, "%d", portNum);
+
+    if (getaddrinfo(hostName, portText, &hints, &results) != 0 || results == NULL) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    //Use the first address found
+    memcpy(address, results->ai_addr, results->ai_addrlen);
+    *addressLength = results->ai_addrlen;
+
+    freeaddrinfo(results);
+
+    return 0;
+}
+
+
+
+//FUNCTION sendFully
+static int sendFully(int sockfd, const char message[], int messageLength) {
+
+    //The number of bytes sent so far
+    int totalSent = 0;
+
+    //Keep writing until the whole message is sent, without a signal if the server has closed the connection
+    while (totalSent < messageLength) {
+
+        int sentBytes = send(sockfd, message + totalSent, messageLength - totalSent, MSG_NOSIGNAL);
+
+        if (sentBytes < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (sentBytes <= 0) {
+            return -1;
+        }
+
+        totalSent += sentBytes;
+    }
+
+    return 0;
+}
+
+
+
+//FUNCTION storeCacheEntry
+static void storeCacheEntry(CatalogCache* cache, const char catalog[], const char request[], unsigned int hash, const CatalogResult* result) {
+
+    //The entry stored
+    CacheEntry* entry = calloc(1, sizeof(CacheEntry));
+
+    if (entry == NULL || (entry->request = strdup(request)) == NULL || copyResult(&entry->result, result) < 0) {
+
+        if (entry != NULL) {
+            free(entry->request);
+        }
+
+        free(entry);
+        return;
+    }
+
+    //Make room by dropping the least recently used entry
+    if (cache->entryCount >= cache->maxEntries) {
+        dropCacheEntry(cache, cache->oldest);
+    }
+
+    snprintf(entry->catalog, sizeof(entry->catalog), "%s", catalog);
+    snprintf(entry->title, sizeof(entry->title), "%s", cache->pendingTitle);
+    snprintf(entry->author, sizeof(entry->author), "%s", cache->pendingAuthor);
+    entry->hash = hash;
+    entry->result.cached = false;
+
+    entry->nextEntry = cache->buckets[hash & (cache->bucketCount - 1)];
+    cache->buckets[hash & (cache->bucketCount - 1)] = entry;
+
+    entry->older = cache->newest;
+    if (cache->newest != NULL) {
+        cache->newest->newer = entry;
+    }
+    else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+    cache->entryCount++;
+}
+
+
+
+//FUNCTION startParser
+static void startParser(ResponseParser* parser, const char title[], const char author[], CatalogBookCallback callback, void* context) {
+
+    memset(parser, 0, sizeof(ResponseParser));
+
+    snprintf(parser->title, sizeof(parser->title), "%s", title != NULL ? title : "");
+    snprintf(parser->author, sizeof(parser->author), "%s", author != NULL ? author : "");
+    parser->callback = callback;
+    parser->context = context;
+}
+
+
+
+//FUNCTION streamFrame
+static int streamFrame(CatalogConnection* connection, const char request[], unsigned int requestId, ResponseParser* parser, CatalogResult* result, bool* answered) {
+
+    *answered = false;
+
+    if (sendFully(connection->sockfd, request, strlen(request)) < 0) {
+        return CATALOG_ERROR_IO;
+    }
+
+    //Skip any responses to other requests until the one for this request arrives
+    while (1) {
+
+        //The end of the framing line, the request ID and length it gives, and how much of the body is still to be read
+        char* headerEnd;
+        char frameHeader[MAX_FRAME_HEADER];
+        unsigned int responseId;
+        int remaining;
+
+        //Read until the buffer holds the whole framing line
+        while ((headerEnd = memchr(connection->buffer + connection->bufferStart, '\n', connection->bufferEnd - connection->bufferStart)) == NULL) {
+
+            if (connection->bufferEnd - connection->bufferStart >= MAX_FRAME_HEADER) {
+                return CATALOG_ERROR_PROTOCOL;
+            }
+
+            if (fillBuffer(connection) <= 0) {
+                return CATALOG_ERROR_IO;
+            }
+
+            *answered = true;
+        }
+
+        *answered = true;
+
+        memcpy(frameHeader, connection->buffer + connection->bufferStart, headerEnd - (connection->buffer + connection->bufferStart));
+        frameHeader[headerEnd - (connection->buffer + connection->bufferStart)] = '\0';
+
+        if (sscanf(frameHeader, "ID:%u,LENGTH:%d", &responseId, &remaining) != 2 || remaining < 0) {
+            return CATALOG_ERROR_PROTOCOL;
+        }
+
+        connection->bufferStart = headerEnd + 1 - connection->buffer;
+
+        //Parse the body a line at a time as it arrives, so only the line being read is ever held, and skip the body of any other response
+        while (remaining > 0) {
+
+            //The bytes of the body in the buffer, and the end of the next line among them
+            int available = connection->bufferEnd - connection->bufferStart;
+            char* lineStart = connection->buffer + connection->bufferStart;
+            char* lineEnd;
+
+            if (available > remaining) {
+                available = remaining;
+            }
+
+            if (responseId != requestId && available > 0) {
+                connection->bufferStart += available;
+                remaining -= available;
+                continue;
+            }
+
+            lineEnd = memchr(lineStart, '\n', available);
+
+            //Parse a whole line, ending it in place
+            if (lineEnd != NULL) {
+
+                int status;
+
+                *lineEnd = '\0';
+                status = parseLine(parser, lineStart, result);
+
+                connection->bufferStart += lineEnd + 1 - lineStart;
+                remaining -= lineEnd + 1 - lineStart;
+
+                if (status < 0) {
+                    return status;
+                }
+
+                continue;
+            }
+
+            //The last line of a body without a newline is parsed from a copy
+            if (available == remaining && available > 0) {
+
+                char* lastLine = strndup(lineStart, available);
+                int status;
+
+                if (lastLine == NULL) {
+                    return CATALOG_ERROR_MEMORY;
+                }
+
+                status = parseLine(parser, lastLine, result);
+                free(lastLine);
+
+                connection->bufferStart += available;
+                remaining = 0;
+
+                if (status < 0) {
+                    return status;
+                }
+
+                break;
+            }
+
+            //Otherwise read more of the body
+            if (fillBuffer(connection) <= 0) {
+                return CATALOG_ERROR_IO;
+            }
+        }
+
+        if (responseId == requestId) {
+            return parser->started == true ? 0 : CATALOG_ERROR_PROTOCOL;
+        }
+    }
+}
@@ -0,0 +1,418 @@
+/*
+ * CatalogClient.h - A client library for the Book Catalog server.
+ *
+ * A CatalogClient is an opaque handle to one server (and optionally a replica to read from). It keeps a pool of persistent connections
+ * that any number of threads can share: each request borrows an idle connection, or opens a new one while the pool is below its size,
+ * and returns it when the response has been read. Requests return the server's status code (201, 202, 402, ...) or a negative
+ * CATALOG_ERROR code, and fill a CatalogResult with the Books the response names.
+ *
+ * A CatalogAsync pipelines requests over a connection of its own without waiting for each response. Its reader thread matches every
+ * response to its request by request ID, since the server completes them in any order, and calls the request's callback or completes
+ * its future, so a single thread can keep thousands of requests in flight.
+ *
+ * A client can also keep a cache of GET results, which the server keeps coherent: the GETs are fetched on a connection of the cache's own,
+ * and the server pushes an invalidation on it whenever a change makes one of the results it sent stale.
+ *
+ * Link the library into a program with:
+ *     gcc -O2 -pthread -o Client Client.c CatalogClient.c
+ */
+#ifndef CATALOG_CLIENT_H
+#define CATALOG_CLIENT_H
+
+#include <stdbool.h>
+
+//The errors a request can fail with before the server answers it
+#define CATALOG_ERROR_ARGUMENT -1
+#define CATALOG_ERROR_CONNECT -2
+#define CATALOG_ERROR_IO -3
+#define CATALOG_ERROR_PROTOCOL -4
+#define CATALOG_ERROR_MEMORY -5
+
+//A connection to the Book Catalog server, shared between threads
+typedef struct catalogClient CatalogClient;
+
+//A Book named in a server response
+typedef struct catalogBook {
+    char title[100];
+    char author[100];
+    char location[100];
+
+    //The 1-based GETMANY key the Book was found for, or 0
+    int key;
+} CatalogBook;
+
+//The outcome of a request
+typedef struct catalogResult {
+
+    //The server's status code, or a negative CATALOG_ERROR code
+    int status;
+
+    //The Books named in the response
+    CatalogBook* books;
+    int bookCount;
+
+    //The COUNT line of a response, i.e. the number of Books a REMOVE by author removed
+    int count;
+
+    //The log sequence number of a change, or 0
+    unsigned long long lsn;
+
+    //The response's MESSAGE line, or the text of its status line
+    char message[200];
+
+    //Whether a replica redirected the request to the primary
+    bool redirected;
+
+    //Whether the result was answered from the client's cache
+    bool cached;
+
+    //The whole response body
+    char* response;
+} CatalogResult;
+
+//The function a pipelined request calls with its outcome, on the reader thread. The result is freed once it returns, unless the callback
+//takes its Books and response by setting them to NULL
+typedef void (*CatalogCallback)(int status, CatalogResult* result, void* context);
+
+//The function a streamed request passes each Book to as its response arrives. Returning false passes on no more of the response's Books
+typedef bool (*CatalogBookCallback)(const CatalogBook* book, void* context);
+
+//A connection that pipelines requests without waiting for each response
+typedef struct catalogAsync CatalogAsync;
+
+//The outcome of a pipelined request, to wait for later
+typedef struct catalogFuture CatalogFuture;
+
+
+
+/* Name: catalogAsyncCreate
+ * Description: This function opens a connection to a client's server for pipelined requests, with a reader thread to complete them.
+ *              Requests carry the client's request IDs, session token and catalog name, and always go to the server the client was
+ *              created for, not its replica.
+ *
+ * Parameter: client            The client
+ * Parameter: maxInFlight       The most requests sent and not yet answered at once, or 0 for 1024
+ * Return: The pipelined connection, or NULL with errno set if the server couldn't be reached
+*/
+CatalogAsync* catalogAsyncCreate(CatalogClient* client, int maxInFlight);
+
+
+
+/* Name: catalogAsyncDestroy
+ * Description: This function waits for every request in flight to complete, then closes a pipelined connection and frees it.
+ *
+ * Parameter: async             The pipelined connection
+ * Return: None
+*/
+void catalogAsyncDestroy(CatalogAsync* async);
+
+
+
+/* Name: catalogAsyncDrain
+ * Description: This function waits until every request sent on a pipelined connection has completed. It can't be called from a callback.
+ *
+ * Parameter: async             The pipelined connection
+ * Return: None
+*/
+void catalogAsyncDrain(CatalogAsync* async);
+
+
+
+/* Name: catalogAsyncRequest
+ * Description: This function queues a request message, without its request ID, i.e. 'METHOD:GET,AUTHOR:Orwell\n', and returns without
+ *              waiting for its response. If the connection already has its most requests in flight, it waits for one to complete first,
+ *              unless it's called from a callback.
+ *
+ * Parameter: async             The pipelined connection
+ * Parameter: request           The request message
+ * Parameter: callback          The function to call with the request's outcome
+ * Parameter: context           Passed to the callback
+ * Return: The request ID, which is always positive, or a negative CATALOG_ERROR code if the request couldn't be sent, in which case the
+ *         callback isn't called
+*/
+int catalogAsyncRequest(CatalogAsync* async, const char request[], CatalogCallback callback, void* context);
+
+
+
+/* Name: catalogAsyncRequestFuture
+ * Description: This function queues a request message like catalogAsyncRequest, and returns a future to wait for its outcome with.
+ *
+ * Parameter: async             The pipelined connection
+ * Parameter: request           The request message
+ * Return: The future, which catalogFutureWait frees, or NULL if there isn't enough memory
+*/
+CatalogFuture* catalogAsyncRequestFuture(CatalogAsync* async, const char request[]);
+
+
+
+/* Name: catalogClientCreate
+ * Description: This function creates a client for the server at the given hostname and port. The first connection is opened straight
+ *              away, so an unreachable server is reported here rather than on the first request.
+ *
+ * Parameter: hostName          The hostname of the server
+ * Parameter: portNum           The port number of the server
+ * Parameter: poolSize          The most connections the client keeps open to the server at once
+ * Parameter: timeoutMs         How long to wait for a connection to be established, in milliseconds, or 0 to wait indefinitely
+ * Return: The client, or NULL with errno set if the server couldn't be reached
+*/
+CatalogClient* catalogClientCreate(const char hostName[], int portNum, int poolSize, int timeoutMs);
+
+
+
+/* Name: catalogClientCreateUnix
+ * Description: This function creates a client for the server listening on the given Unix domain socket on this host.
+ *
+ * Parameter: socketPath        The path of the server's socket
+ * Parameter: poolSize          The most connections the client keeps open to the server at once
+ * Parameter: timeoutMs         How long to wait for a connection to be established, in milliseconds, or 0 to wait indefinitely
+ * Return: The client, or NULL with errno set if the server couldn't be reached
+*/
+CatalogClient* catalogClientCreateUnix(const char socketPath[], int poolSize, int timeoutMs);
+
+
+
+/* Name: catalogClientDestroy
+ * Description: This function closes every connection of a client and frees it. No requests may be in progress.
+ *
+ * Parameter: client            The client to destroy
+ * Return: None
+*/
+void catalogClientDestroy(CatalogClient* client);
+
+
+
+/* Name: catalogClientEnableCache
+ * Description: This function has a client keep the results of GET requests for a title, an author, or both, and answer repeats of them
+ *              locally. The server tracks every result the cache fetches and pushes an invalidation when a change to the catalog makes it
+ *              stale, which the cache applies before every lookup, so a cached result is never more stale than the network delay.
+ *              The client's own changes drop the whole cache, so it always reads them. Streamed and pipelined GETs aren't cached.
+ *              It must be called before the client is shared between threads.
+ *
+ * Parameter: client            The client
+ * Parameter: maxEntries        The most results kept. The least recently used is dropped to make room for another
+ * Return: 0, or a negative CATALOG_ERROR code
+*/
+int catalogClientEnableCache(CatalogClient* client, int maxEntries);
+
+
+
+/* Name: catalogClientSetCatalog
+ * Description: This function names the catalog the client's later requests are made against. The empty name is the server's default
+ *              catalog.
+ *
+ * Parameter: client            The client
+ * Parameter: catalogName       The name of the catalog
+ * Return: 0, or CATALOG_ERROR_ARGUMENT if the name can't be sent in a request
+*/
+int catalogClientSetCatalog(CatalogClient* client, const char catalogName[]);
+
+
+
+/* Name: catalogClientSetReplica
+ * Description: This function sends the client's reads to a replica from now on. Changes still go to the server the client was created
+ *              for, and a read the replica redirects because it hasn't caught up with the client's changes is sent again there.
+ *
+ * Parameter: client            The client
+ * Parameter: hostName          The hostname of the replica
+ * Parameter: portNum           The port number of the replica
+ * Return: 0, or CATALOG_ERROR_CONNECT with errno set if the replica couldn't be reached
+*/
+int catalogClientSetReplica(CatalogClient* client, const char hostName[], int portNum);
+
+
+
+/* Name: catalogErrorText
+ * Description: This function describes a negative CATALOG_ERROR code.
+ *
+ * Parameter: status            The status returned by a request
+ * Return: A description of the error
+*/
+const char* catalogErrorText(int status);
+
+
+
+/* Name: catalogFreeResult
+ * Description: This function frees the Books and response held by a result, so it can be reused.
+ *
+ * Parameter: result            The result to free
+ * Return: None
+*/
+void catalogFreeResult(CatalogResult* result);
+
+
+
+/* Name: catalogFutureDone
+ * Description: This function checks whether a pipelined request has completed, without waiting for it.
+ *
+ * Parameter: future            The future
+ * Return: Whether catalogFutureWait would return straight away
+*/
+bool catalogFutureDone(CatalogFuture* future);
+
+
+
+/* Name: catalogFutureWait
+ * Description: This function waits for a pipelined request to complete, moves its result to the caller and frees the future.
+ *
+ * Parameter: future            The future
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogFutureWait(CatalogFuture* future, CatalogResult* result);
+
+
+
+/* Name: catalogGet
+ * Description: This function gets the locations of the Book with the given title and author.
+ *
+ * Parameter: client            The client
+ * Parameter: title             The title of the Book
+ * Parameter: author            The author of the Book
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogGet(CatalogClient* client, const char title[], const char author[], CatalogResult* result);
+
+
+
+/* Name: catalogGetByAuthor
+ * Description: This function gets every Book by the given author.
+ *
+ * Parameter: client            The client
+ * Parameter: author            The author of the Books
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogGetByAuthor(CatalogClient* client, const char author[], CatalogResult* result);
+
+
+
+/* Name: catalogGetByAuthorStream
+ * Description: This function gets every Book by the given author, passing each one to a callback as the response arrives instead of
+ *              keeping them, so the memory used doesn't grow with the number of Books. The result's Books and response are left empty,
+ *              but its count of Books is filled.
+ *
+ * Parameter: client            The client
+ * Parameter: author            The author of the Books
+ * Parameter: callback          The function to pass each Book to
+ * Parameter: context           Passed to the callback
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogGetByAuthorStream(CatalogClient* client, const char author[], CatalogBookCallback callback, void* context, CatalogResult* result);
+
+
+
+/* Name: catalogGetByTitle
+ * Description: This function gets every Book with the given title.
+ *
+ * Parameter: client            The client
+ * Parameter: title             The title of the Books
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogGetByTitle(CatalogClient* client, const char title[], CatalogResult* result);
+
+
+
+/* Name: catalogGetByTitleStream
+ * Description: This function gets every Book with the given title, passing each one to a callback as the response arrives.
+ *
+ * Parameter: client            The client
+ * Parameter: title             The title of the Books
+ * Parameter: callback          The function to pass each Book to
+ * Parameter: context           Passed to the callback
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogGetByTitleStream(CatalogClient* client, const char title[], CatalogBookCallback callback, void* context, CatalogResult* result);
+
+
+
+/* Name: catalogGetMany
+ * Description: This function gets the locations of several Books in a single request. Each Book found carries the 1-based number of the
+ *              (title, author) key it was found for.
+ *
+ * Parameter: client            The client
+ * Parameter: titles            The titles of the Books
+ * Parameter: authors           The authors of the Books
+ * Parameter: keyCount          The number of (title, author) keys
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogGetMany(CatalogClient* client, const char* titles[], const char* authors[], int keyCount, CatalogResult* result);
+
+
+
+/* Name: catalogMove
+ * Description: This function moves a Book to a new location.
+ *
+ * Parameter: client            The client
+ * Parameter: title             The title of the Book
+ * Parameter: author            The author of the Book
+ * Parameter: location          The current location of the Book
+ * Parameter: newLocation       The location to move the Book to
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogMove(CatalogClient* client, const char title[], const char author[], const char location[], const char newLocation[], CatalogResult* result);
+
+
+
+/* Name: catalogRemove
+ * Description: This function removes a Book.
+ *
+ * Parameter: client            The client
+ * Parameter: title             The title of the Book
+ * Parameter: author            The author of the Book
+ * Parameter: location          The location of the Book
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogRemove(CatalogClient* client, const char title[], const char author[], const char location[], CatalogResult* result);
+
+
+
+/* Name: catalogRequest
+ * Description: This function sends any request message, without its request ID, i.e. 'METHOD:GET,AUTHOR:Orwell\n', and reads its
+ *              response. The client adds the request ID, session token and catalog name.
+ *
+ * Parameter: client            The client
+ * Parameter: request           The request message
+ * Parameter: change            Whether the request changes the Catalog, and so can't be sent to a replica
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogRequest(CatalogClient* client, const char request[], bool change, CatalogResult* result);
+
+
+
+/* Name: catalogRequestStream
+ * Description: This function sends any request message like catalogRequest, passing each Book in its response to a callback as the
+ *              response arrives.
+ *
+ * Parameter: client            The client
+ * Parameter: request           The request message
+ * Parameter: change            Whether the request changes the Catalog, and so can't be sent to a replica
+ * Parameter: callback          The function to pass each Book to
+ * Parameter: context           Passed to the callback
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogRequestStream(CatalogClient* client, const char request[], bool change, CatalogBookCallback callback, void* context, CatalogResult* result);
+
+
+
+/* Name: catalogSubmit
+ * Description: This function submits a new Book.
+ *
+ * Parameter: client            The client
+ * Parameter: title             The title of the Book
+ * Parameter: author            The author of the Book
+ * Parameter: location          The location of the Book
+ * Parameter: result            The result to fill, or NULL
+ * Return: The server's status code, or a negative CATALOG_ERROR code
+*/
+int catalogSubmit(CatalogClient* client, const char title[], const char author[], const char location[], CatalogResult* result);
+
+#endif
@@ -0,0 +1,450 @@
+/*
+ * CatalogMicrobench.c - Measures the cost of each Catalog operation at catalog sizes from 1,000 to 10,000,000 Books, without the network.
+ *
+ * The benchmark calls the server's own submitBook, removeBook and GET functions directly, with their responses written to /dev/null:
+ *     gcc -O2 -pthread -DSERVER_NO_MAIN -o CatalogMicrobench CatalogMicrobench.c Server.c
+ *     ./CatalogMicrobench [largest catalog] [books visited per operation]
+ *
+ * Every size is measured in a child process of its own, starting from a freshly built Catalog. Each operation is repeated until it has
+ * visited about the given number of Books (100,000,000 by default), but at least 10 and at most 100,000 times. The table it prints is
+ * the same from run to run, so results can be kept and compared after every change to the Catalog. The 10,000,000 Book catalog takes
+ * about 3.5GB.
+ */
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+//The number of Books that share each author
+#define BOOKS_PER_AUTHOR 10
+
+//The fewest and most times each operation is repeated at a catalog size
+#define MIN_ITERATIONS 10
+#define MAX_ITERATIONS 100000
+
+//A Book in the Catalog, as defined by Server.c
+typedef struct book {
+    char title[100];
+    char author[100];
+    char location[100];
+
+    struct book* previous;
+    struct book* next;
+} Book;
+
+//The key of a Book an operation is given
+typedef struct benchKey {
+    char title[100];
+    char author[100];
+    char location[100];
+} BenchKey;
+
+//The Catalog functions from Server.c
+void getBooksByAuthor(Book* head, char author[100], int childfd);
+void getBooksWithTitle(Book* head, char title[100], int childfd);
+void getSpecificBook(Book* head, char title[100], char author[100], int childfd);
+void removeBook(Book** head, char title[100], char author[100], char location[100], int childfd);
+void submitBook(Book** head, char title[100], char author[100], char location[100], int childfd);
+
+//The C library's own allocator, which the counting allocator below passes every allocation on to
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_malloc(size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+
+//The number of allocations made so far, by the Catalog functions or anything else
+long long allocationCount = 0;
+
+//The sink every response is written to, so only the Catalog is measured
+int sinkfd;
+
+//The number of Books each operation should visit at every catalog size
+long long visitBudget = 100000000;
+
+
+
+/* Name: buildCatalog
+ * Description: This function builds a Catalog of the given size directly, in the same order and layout submitBook leaves it in, since
+ *              submitting every Book would take time proportional to the square of the size.
+ *
+ * Parameter: head              The head pointer of the Catalog to build
+ * Parameter: bookCount         The number of Books
+ * Return: None
+*/
+void buildCatalog(Book** head, long long bookCount);
+
+
+
+/* Name: calloc
+ * Description: This function counts an allocation, then makes it with the C library's allocator.
+ *
+ * Parameter: count             The number of elements
+ * Parameter: size              The size of each element
+ * Return: The allocated memory, zeroed
+*/
+void* calloc(size_t count, size_t size);
+
+
+
+/* Name: fillKey
+ * Description: This function fills in the title, author and location of a Book in the benchmark's Catalog.
+ *
+ * Parameter: key               The key to fill in
+ * Parameter: number            The Book's number
+ * Return: None
+*/
+void fillKey(BenchKey* key, long long number);
+
+
+
+/* Name: malloc
+ * Description: This function counts an allocation, then makes it with the C library's allocator.
+ *
+ * Parameter: size              The number of bytes
+ * Return: The allocated memory
+*/
+void* malloc(size_t size);
+
+
+
+/* Name: measureSize
+ * Description: This function builds a Catalog of the given size and measures every operation on it, in a child process, so every size
+ *              starts from an empty heap.
+ *
+ * Parameter: bookCount         The number of Books in the Catalog
+ * Return: None
+*/
+void measureSize(long long bookCount);
+
+
+
+/* Name: nanosSince
+ * Description: This function measures the time elapsed since the given moment on the monotonic clock.
+ *
+ * Parameter: start             The moment to measure from
+ * Return: The elapsed time, in nanoseconds
+*/
+double nanosSince(struct timespec* start);
+
+
+
+/* Name: printOperation
+ * Description: This function prints the time and allocations per operation of one operation at one catalog size.
+ *
+ * Parameter: bookCount         The number of Books in the Catalog
+ * Parameter: name              The operation's name
+ * Parameter: iterations        The number of times the operation ran
+ * Parameter: elapsedNs         How long they took, in nanoseconds
+ * Parameter: allocations       The number of allocations they made
+ * Parameter: bytesPerBook      The heap memory taken by each Book in the Catalog
+ * Return: None
+*/
+void printOperation(long long bookCount, char name[], int iterations, double elapsedNs, long long allocations, double bytesPerBook);
+
+
+
+/* Name: realloc
+ * Description: This function counts an allocation, then makes it with the C library's allocator.
+ *
+ * Parameter: pointer           The memory to resize, or NULL
+ * Parameter: size              The new number of bytes
+ * Return: The resized memory
+*/
+void* realloc(void* pointer, size_t size);
+
+
+
+//Main loop
+int main(int argc, char **argv) {
+
+    //The largest catalog size measured
+    long long largestCount = 10000000;
+
+    //Verify the user gave no more than the optional settings
+    if (argc > 3) {
+        fprintf(stderr, "usage: %s [largest catalog] [books visited per operation]\n", argv[0]);
+        exit(1);
+    }
+
+    //Grab the optional settings
+    if (argc >= 2) {
+        largestCount = atoll(argv[1]);
+    }
+    if (argc == 3) {
+        visitBudget = atoll(argv[2]);
+    }
+
+    if (largestCount < 1000 || visitBudget <= 0) {
+        fprintf(stderr, "usage: [largest catalog] must be at least 1000, and [books visited per operation] positive.\n");
+        exit(1);
+    }
+
+    //Responses are written to a sink so only the Catalog is measured
+    sinkfd = open("/dev/null", O_WRONLY);
+
+    if (sinkfd < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    printf("%-12s %-10s %10s %14s %12s %14s\n", "books", "operation", "iterations", "ns/op", "allocs/op", "bytes/book");
+
+    //Measure every power of ten up to the largest size
+    for (long long bookCount = 1000; bookCount <= largestCount; bookCount *= 10) {
+        measureSize(bookCount);
+    }
+
+    close(sinkfd);
+
+    return 0;
+}
+
+
+
+//FUNCTION buildCatalog
+void buildCatalog(Book** head, long long bookCount) {
+
+    //The last Book linked in
+    Book* tail = NULL;
+
+    //The key of the Book being linked in
+    BenchKey key;
+
+    for (long long i = 0; i < bookCount; i++) {
+
+        Book* book = malloc(sizeof(Book));
+
+        if (book == NULL) {
+            fprintf(stderr, "ERROR: There isn't enough memory for a Catalog of %lld Books.\n", bookCount);
+            exit(1);
+        }
+
+        fillKey(&key, i);
+        strcpy(book->title, key.title);
+        strcpy(book->author, key.author);
+        strcpy(book->location, key.location);
+
+        //Append the Book to the end of the list, as submitBook does
+        book->previous = tail;
+        book->next = NULL;
+
+        if (tail == NULL) {
+            *head = book;
+        }
+        else {
+            tail->next = book;
+        }
+
+        tail = book;
+    }
+}
+
+
+
+//FUNCTION calloc
+void* calloc(size_t count, size_t size) {
+
+    allocationCount++;
+
+    return __libc_calloc(count, size);
+}
+
+
+
+//FUNCTION fillKey
+void fillKey(BenchKey* key, long long number) {
+
+    sprintf(key->title, "Micro Title %lld", number);
+    sprintf(key->author, "Micro Author %lld", number / BOOKS_PER_AUTHOR);
+    sprintf(key->location, "Shelf %lld", number);
+}
+
+
+
+//FUNCTION malloc
+void* malloc(size_t size) {
+
+    allocationCount++;
+
+    return __libc_malloc(size);
+}
+
+
+
+//FUNCTION measureSize
+void measureSize(long long bookCount) {
+
+    //The child process measuring the size
+    pid_t child;
+
+    //Run the size in a child process and wait for it to finish, without the child repeating anything still buffered for stdout
+    fflush(stdout);
+    child = fork();
+
+    if (child < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    if (child > 0) {
+        waitpid(child, NULL, 0);
+        return;
+    }
+
+    //The Catalog
+    Book* head = NULL;
+
+    //The number of times each operation runs, and the keys they're given, chosen before anything is measured
+    int iterations = visitBudget / bookCount;
+    BenchKey* lookups;
+    BenchKey* submissions;
+    unsigned short random[3] = { 0x330e, 0x1234, 0xabcd };
+
+    //The heap memory in use before and after the Catalog is built
+    size_t heapBefore;
+    double bytesPerBook;
+
+    //When an operation's iterations started, and the allocations made before them
+    struct timespec start;
+    long long allocationsBefore;
+
+    //The number of Books submitted before they're removed again, and the time and allocations taken by each
+    int batchSize = bookCount / 100;
+    double submitNs;
+    double removeNs;
+    long long submitAllocations;
+    long long removeAllocations;
+
+    if (iterations < MIN_ITERATIONS) {
+        iterations = MIN_ITERATIONS;
+    }
+    if (iterations > MAX_ITERATIONS) {
+        iterations = MAX_ITERATIONS;
+    }
+
+    lookups = malloc(sizeof(BenchKey) * iterations);
+    submissions = malloc(sizeof(BenchKey) * iterations);
+
+    if (lookups == NULL || submissions == NULL) {
+        fprintf(stderr, "ERROR: There isn't enough memory for %d keys.\n", iterations);
+        exit(1);
+    }
+
+    //Look up Books spread over the whole Catalog, and submit Books that aren't in it yet
+    for (int i = 0; i < iterations; i++) {
+        fillKey(&lookups[i], (long long) (erand48(random) * bookCount));
+        fillKey(&submissions[i], bookCount + i);
+    }
+
+    //Build the Catalog, measuring the heap memory it takes
+    heapBefore = mallinfo2().uordblks;
+    buildCatalog(&head, bookCount);
+    bytesPerBook = (double) (mallinfo2().uordblks - heapBefore) / bookCount;
+
+    //Find every Book of a title
+    allocationsBefore = allocationCount;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        getBooksWithTitle(head, lookups[i].title, sinkfd);
+    }
+
+    printOperation(bookCount, "title", iterations, nanosSince(&start), allocationCount - allocationsBefore, bytesPerBook);
+
+    //Find every Book of an author
+    allocationsBefore = allocationCount;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        getBooksByAuthor(head, lookups[i].author, sinkfd);
+    }
+
+    printOperation(bookCount, "author", iterations, nanosSince(&start), allocationCount - allocationsBefore, bytesPerBook);
+
+    //Find a specific Book
+    allocationsBefore = allocationCount;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        getSpecificBook(head, lookups[i].title, lookups[i].author, sinkfd);
+    }
+
+    printOperation(bookCount, "specific", iterations, nanosSince(&start), allocationCount - allocationsBefore, bytesPerBook);
+
+    //Submit new Books, which are checked against every Book for duplicates and appended to the end, then remove them again. They're
+    //submitted and removed a batch of no more than 1% of the Catalog at a time, so its size stays where it's being measured
+    submitNs = 0;
+    removeNs = 0;
+    submitAllocations = 0;
+    removeAllocations = 0;
+
+    for (int batchStart = 0; batchStart < iterations; batchStart += batchSize) {
+
+        //The end of the batch
+        int batchEnd = batchStart + batchSize < iterations ? batchStart + batchSize : iterations;
+
+        allocationsBefore = allocationCount;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (int i = batchStart; i < batchEnd; i++) {
+            submitBook(&head, submissions[i].title, submissions[i].author, submissions[i].location, sinkfd);
+        }
+
+        submitNs += nanosSince(&start);
+        submitAllocations += allocationCount - allocationsBefore;
+
+        allocationsBefore = allocationCount;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (int i = batchStart; i < batchEnd; i++) {
+            removeBook(&head, submissions[i].title, submissions[i].author, submissions[i].location, sinkfd);
+        }
+
+        removeNs += nanosSince(&start);
+        removeAllocations += allocationCount - allocationsBefore;
+    }
+
+    printOperation(bookCount, "submit", iterations, submitNs, submitAllocations, bytesPerBook);
+    printOperation(bookCount, "remove", iterations, removeNs, removeAllocations, bytesPerBook);
+
+    exit(0);
+}
+
+
+
+//FUNCTION nanosSince
+double nanosSince(struct timespec* start) {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+
+
+//FUNCTION printOperation
+void printOperation(long long bookCount, char name[], int iterations, double elapsedNs, long long allocations, double bytesPerBook) {
+
+    printf("%-12lld %-10s %10d %14.0f %12.2f %14.1f\n", bookCount, name, iterations, elapsedNs / iterations, (double) allocations / iterations,
+           bytesPerBook);
+    fflush(stdout);
+}
+
+
+
+//FUNCTION realloc
+void* realloc(void* pointer, size_t size) {
+
+    allocationCount++;
+
+    return __libc_realloc(pointer, size);
+}
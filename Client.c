@@ -1,13 +1,59 @@
+/*
+ * Client.c - An interactive front end to the Book Catalog server, built on the client library in CatalogClient.c.
+ *
+ *     gcc -O2 -pthread -o Client Client.c CatalogClient.c
+ *     ./Client <hostname> <port> [-r <replica hostname> <replica port>] [-c <cache entries>] [-b <batch file>]
+ *
+ * With -c, the menu keeps up to the given number of GET results and answers repeats of them locally. The server pushes an invalidation
+ * whenever a change makes a cached result stale, so the results shown are as current as a GET sent to the server.
+ *
+ * With -b, the client runs the requests in the batch file ('-' for stdin) instead of showing the menu. Each line is either a request
+ * message, i.e. 'METHOD:GET,AUTHOR:Orwell' or 'CATALOG:fiction,METHOD:REMOVE,AUTHOR:Orwell,LOCATION:Attic', or a 'title,author,location'
+ * line of CSV to SUBMIT. Blank lines and lines starting with '#' are skipped. The requests are pipelined to the server, and a tab separated
+ * line is printed for each response as it arrives, followed by a summary:
+ *     RESULT   <line>  <status>  <lsn>  <milliseconds>  <message>
+ *     BOOK     <line>  <title>  <author>  <location>
+ *     SUMMARY  requests=<n>  succeeded=<n>  failed=<n>  seconds=<s>  per_second=<n>  p50_ms=<ms>  p99_ms=<ms>  max_ms=<ms>
+ *     STATUS   <status>  <count>
+ * The exit status is 0 if every request succeeded, and 2 otherwise.
+ */
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netdb.h>
+#include <time.h>
+
+#include "CatalogClient.h"
+
+//The maximum number of (title, author) keys sent in a single GETMANY request
+#define MAX_GETMANY_KEYS 100
+
+//How long to wait for the server to accept a connection, in milliseconds
+#define CONNECT_TIMEOUT_MS 5000
+
+//The most batch requests in flight at once
+#define BATCH_IN_FLIGHT 1024
+
+//The status codes a batch summary counts
+#define MAX_STATUS 600
+
+//The counts and latencies of a batch's completed requests, written only by the callbacks until the batch is drained
+typedef struct batchStats {
+    int statusCounts[MAX_STATUS];
+    int errorCount;
+
+    double* latencies;
+    int latencyCount;
+    int latencyCapacity;
+} BatchStats;
+
+//A batch request in flight
+typedef struct batchRequest {
+    int line;
+    double startSeconds;
+    BatchStats* stats;
+} BatchRequest;
 
 
 
@@ -16,141 +62,197 @@
  *              SUBMIT, GET, or REMOVE Book(s) to/from the Book Catalog.
  * 
  * Parameter: menuChoice            The user's menu choice used to determine what request they selected
- * Parameter: sockfd                The socket connection to the server
+ * Parameter: client                The client connected to the server
+ * Parameter: cached                Whether the client caches GET results, which are then fetched whole rather than streamed
  * Return: None
  */ 
-void collectBookInformation(int menuChoice, int sockfd);
+void collectBookInformation(int menuChoice, CatalogClient* client, bool cached);
 
 
 
-/* Name: getBooksByAuthor
- * Description: This function will attempt to get the Books from the server's Book Catalog for the given author.
- * 
- * Parameter: bookAuthor        The author of the book
- * Parameter: sockfd            The socket connection to the server
+/* Name: completeBatchRequest
+ * Description: This function is called with the response to a batch request. It prints the response's RESULT line, and a BOOK line for
+ *              each Book it retrieved, and counts it in the batch's summary.
+ *
+ * Parameter: status            The status of the request
+ * Parameter: result            The result of the request
+ * Parameter: context           The batch request
  * Return: None
-*/ 
-void getBooksByAuthor(char bookAuthor[], int sockfd);
+*/
+void completeBatchRequest(int status, CatalogResult* result, void* context);
 
 
 
-/* Name: getBooksWithTitle
- * Description: This function will attempt to get the Books from the server's Book Catalog with the given title.
- * 
- * Parameter: bookTitle         The title of the book
- * Parameter: sockfd            The socket connection to the server
- */ 
-void getBooksWithTitle(char bookTitle[], int sockfd);
+/* Name: compareLatencies
+ * Description: This function orders two request latencies for qsort.
+ *
+ * Parameter: first             The first latency
+ * Parameter: second            The second latency
+ * Return: Less than, equal to or greater than 0 as the first latency is shorter than, equal to or longer than the second
+*/
+int compareLatencies(const void* first, const void* second);
 
 
 
-/* Name: getSpecificBook
- * Description: This function will attempt to get the Book from the server's Book Catalog with the passed information.
+/* Name: monotonicSeconds
+ * Description: This function reads a clock that only moves forwards.
  *
- * Parameter: bookTitle         The title of the book
- * Parameter: bookAuthor        The author of the book
- * Parameter: sockfd            The socket connection to the server
- * Return: None
-*/  
-void getSpecificBook(char bookTitle[], char bookAuthor[], int sockfd);
+ * Return: The clock, in seconds
+*/
+double monotonicSeconds(void);
 
 
 
-/* Name: removeBook
- * Description: This function will attempt to remove the Book from the server's Book Catalog with the passed information.
- * 
- * Parameter: bookTitle         The title of the Book
- * Parameter: bookAuthor        The author of the Book
- * Parameter: bookLocation      The location of the Book
- * Parameter: sockfd            The socket connection to the server
- * Return: None
-*/  
-void removeBook(char bookTitle[], char bookAuthor[], char bookLocation[], int sockfd);
+/* Name: runBatch
+ * Description: This function pipelines every request in a batch file to the server, printing a line for each response and a summary once
+ *              they have all completed.
+ *
+ * Parameter: client            The client connected to the server
+ * Parameter: batchPath         The path of the batch file, or '-' for stdin
+ * Return: 0 if every request succeeded, 2 if any failed
+*/
+int runBatch(CatalogClient* client, char batchPath[]);
 
 
 
-/* Name: submitBook
- * Description: This function will attempt to submit a Book to the server's Book Catalog with the passed information.
- * 
- * Parameter: bookTitle         The title of the Book
- * Parameter: bookAuthor        The author of the Book
- * Parameter: bookLocation      The location of the Book
- * Parameter: sockfd            The socket connection to the server 
+/* Name: showBook
+ * Description: This function displays a Book from a streamed response as soon as it arrives, in the server's format.
+ *
+ * Parameter: book              The Book
+ * Parameter: context           The number of Books displayed so far
+ * Return: true, to keep displaying the response's Books
+*/
+bool showBook(const CatalogBook* book, void* context);
+
+
+
+/* Name: showResult
+ * Description: This function displays the server's response to a request, or why the request failed, and frees the result. A streamed
+ *              response has already displayed its Books, so only its status is shown if it had none.
+ *
+ * Parameter: status            The status the request returned
+ * Parameter: result            The result of the request
  * Return: None
-*/ 
-void submitBook(char bookTitle[], char bookAuthor[], char bookLocation[], int sockfd);
+*/
+void showResult(int status, CatalogResult* result);
 
 
 
 //Main loop
 int main(int argc, char **argv) {
 
-    int sockfd;
+    //The client connected to the server
+    CatalogClient* client;
     int portNum;
-    struct sockaddr_in serveraddr;
-    struct hostent *server;
-    char hostName[20];
+
+    //The replica to read from and the batch file to run, if the user gave them
+    char* replicaHost = NULL;
+    char* replicaPort = NULL;
+    char* batchPath = NULL;
+
+    //The most GET results to cache, or 0 to send every GET to the server
+    int cacheEntries = 0;
 
     //The user's menu choice
     char menuChoice = '0';
 
-    //Verify the user specified a host and port number
-    if (argc != 3) {
-       fprintf(stderr,"usage: %s <hostname> <port>\n", argv[0]);
-       exit(1);
+    //The status the program exits with
+    int exitStatus;
+
+    //Grab the optional replica, cache size and batch file after the server's address
+    for (int i = 3; i < argc; i++) {
+
+        if (strcmp(argv[i], "-r") == 0 && i + 2 < argc) {
+            replicaHost = argv[i + 1];
+            replicaPort = argv[i + 2];
+            i += 2;
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            cacheEntries = atoi(argv[i + 1]);
+            i++;
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            batchPath = argv[i + 1];
+            i++;
+        }
+        else {
+            argc = 0;
+        }
     }
 
-    //Grab the hostname and port number provided by the user
-    strcpy(hostName, argv[1]);
-    portNum = atoi(argv[2]);
+    //Verify the user specified a host and port number, or a local socket path
+    if (argc < 3) {
+       fprintf(stderr,"usage: %s <hostname> <port> [-r <replica hostname> <replica port>] [-c <cache entries>] [-b <batch file>]\n       %s -u <socket path> [-r <replica hostname> <replica port>] [-c <cache entries>] [-b <batch file>]\n", argv[0], argv[0]);
+       exit(1);
+    }
 
-    //If the user gave a negative port number, exit
-    if (portNum < 0) {
-        fprintf(stderr, "usage: %s <port> must be non-negative.", argv[2]);
-        exit(1);
+    //If the user gave a socket path, connect over the server's Unix domain socket on this host
+    if (strcmp(argv[1], "-u") == 0) {
+        client = catalogClientCreateUnix(argv[2], 1, CONNECT_TIMEOUT_MS);
     }
 
-    //Create the socket
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    //Otherwise, connect over TCP
+    else {
+
+        //Grab the port number provided by the user
+        portNum = atoi(argv[2]);
+
+        //If the user gave a negative port number, exit
+        if (portNum < 0) {
+            fprintf(stderr, "usage: %s <port> must be non-negative.", argv[2]);
+            exit(1);
+        }
+
+        client = catalogClientCreate(argv[1], portNum, 1, CONNECT_TIMEOUT_MS);
+    }
 
-    //If the socket couldn't be created, inform the user
-    if (sockfd < 0) {
+    //If the server couldn't be reached, inform the user
+    if (client == NULL) {
         perror("ERROR: ");
         exit(1);
     }
 
-    //Get the server's DNS entry
-    server = gethostbyname(hostName);
+    //If the user gave a replica, send reads to it instead
+    if (replicaHost != NULL) {
 
-    //If the hostname provided was invalid, inform the user
-    if (server == NULL) {
-        fprintf(stderr,"usage: Hostname provides doesn't exist. %s\n", hostName);
-        exit(1);
-    }
+        //Grab the replica's port number
+        portNum = atoi(replicaPort);
 
-    //Build the internet address
-    bzero((char *) &serveraddr, sizeof(serveraddr));
-    serveraddr.sin_family = AF_INET;
-    bcopy((char*)server->h_addr_list[0], (char*)&serveraddr.sin_addr.s_addr, server->h_length);
+        if (portNum < 0) {
+            fprintf(stderr, "usage: %s <replica port> must be non-negative.", replicaPort);
+            exit(1);
+        }
 
-    //Convert the port number to network byte order
-    serveraddr.sin_port = htons(portNum);
+        if (catalogClientSetReplica(client, replicaHost, portNum) < 0) {
+            perror("ERROR: ");
+            exit(1);
+        }
+    }
 
-    //Create a connection with the server
-    if (connect(sockfd, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) < 0) {
-        perror("ERROR: ");
+    //If the user asked for a cache, keep GET results once the replica, if any, is known
+    if (cacheEntries > 0 && catalogClientEnableCache(client, cacheEntries) < 0) {
+        fprintf(stderr, "ERROR: The cache couldn't be created.\n");
         exit(1);
     }
 
+    //If the user gave a batch file, run it instead of showing the menu
+    if (batchPath != NULL) {
+        exitStatus = runBatch(client, batchPath);
+        catalogClientDestroy(client);
+        return exitStatus;
+    }
+
     //Continue to run the program until the user decides to quit
-    while (menuChoice != '6') {
+    while (menuChoice != '8') {
         printf("Please select one of the below menu options.\n");
         printf("1: SUBMIT a Book to the Book Catalog.\n");
         printf("2: GET locations of a specific Book from the Book Catalog.\n");
         printf("3: GET all Books by an author from the Book Catalog.\n");
         printf("4: GET all Books with a given title from the Book Catalog.\n");
         printf("5: REMOVE a Book from the Book Catalog.\n");
-        printf("6: EXIT the program.\n\n");
+        printf("6: GET several Books at once from the Book Catalog.\n");
+        printf("7: MOVE a Book to a new location in the Book Catalog.\n");
+        printf("8: EXIT the program.\n\n");
 
         //Prompt for the user's menu selection
         printf(">: ");
@@ -161,31 +263,41 @@ int main(int argc, char **argv) {
 
         //MENU CHOICE 1: SUBMIT a Book
         if (menuChoice == '1') {
-            collectBookInformation(1, sockfd);
+            collectBookInformation(1, client, cacheEntries > 0);
         }
 
         //MENU CHOICE 2: GET a Book
         else if (menuChoice == '2') {
-            collectBookInformation(2, sockfd);
+            collectBookInformation(2, client, cacheEntries > 0);
         }
 
         //MENU CHOICE 3: GET all Books by the given author
         else if (menuChoice == '3') {
-            collectBookInformation(3, sockfd);
+            collectBookInformation(3, client, cacheEntries > 0);
         }
 
         //MENU CHOICE 4: GET all Books with the given title
         else if (menuChoice == '4') {
-            collectBookInformation(4, sockfd);
+            collectBookInformation(4, client, cacheEntries > 0);
         }
 
         //MENU CHOICE 5: REMOVE a Book from the Book Catalog
         else if (menuChoice == '5') {
-            collectBookInformation(5, sockfd);
+            collectBookInformation(5, client, cacheEntries > 0);
         }
 
-        //MENU CHOICE 6: EXIT
+        //MENU CHOICE 6: GET several Books at once
         else if (menuChoice == '6') {
+            collectBookInformation(6, client, cacheEntries > 0);
+        }
+
+        //MENU CHOICE 7: MOVE a Book
+        else if (menuChoice == '7') {
+            collectBookInformation(7, client, cacheEntries > 0);
+        }
+
+        //MENU CHOICE 8: EXIT
+        else if (menuChoice == '8') {
             printf("Goodbye!\n");
         }
 
@@ -195,8 +307,8 @@ int main(int argc, char **argv) {
         }
     }
 
-    //Close the client socket connection
-    close(sockfd);
+    //Close the client's connections
+    catalogClientDestroy(client);
 
     return 0;
 }
@@ -204,11 +316,15 @@ int main(int argc, char **argv) {
 
 
 //FUNCTION collectBookInformation
-void collectBookInformation(int menuChoice, int sockfd) {
+void collectBookInformation(int menuChoice, CatalogClient* client, bool cached) {
 
     //The Input Buffer for collecting data
     char inputBuffer[1000];
 
+    //The status and result of the request sent
+    CatalogResult result;
+    int status;
+
     //The Book's fields collected from the user
     char bookTitle[100];
     char bookAuthor[100];
@@ -219,6 +335,9 @@ void collectBookInformation(int menuChoice, int sockfd) {
     int authorLength;
     int locationLength;
 
+    //The number of Books a streamed response has displayed
+    int bookCount;
+
     //OPTION ONE: SUBMIT A BOOK
     if (menuChoice == 1) {
 
@@ -276,8 +395,9 @@ void collectBookInformation(int menuChoice, int sockfd) {
             bookAuthor[authorLength] = '\0';
             bookLocation[locationLength] = '\0';
 
-            //Call the submitBook function with the inputs
-            submitBook(bookTitle, bookAuthor, bookLocation, sockfd);
+            //Submit the Book and display the server's response
+            status = catalogSubmit(client, bookTitle, bookAuthor, bookLocation, &result);
+            showResult(status, &result);
         }
     }
 
@@ -324,8 +444,9 @@ void collectBookInformation(int menuChoice, int sockfd) {
             bookTitle[titleLength] = '\0';
             bookAuthor[authorLength] = '\0';
 
-            //Call the getSpecificBook function
-            getSpecificBook(bookTitle, bookAuthor, sockfd);
+            //Get the Book and display the server's response
+            status = catalogGet(client, bookTitle, bookAuthor, &result);
+            showResult(status, &result);
         }
     }
 
@@ -360,8 +481,18 @@ void collectBookInformation(int menuChoice, int sockfd) {
             //Remove trailing newlines from the input
             bookAuthor[authorLength] = '\0';
 
-            //Call the getBooksByAuthor Function
-            getBooksByAuthor(bookAuthor, sockfd);
+            //Get the author's Books, displaying each one as it arrives so a prolific author's Books are never all held at once, unless the result is cached whole
+            if (cached == true) {
+                status = catalogGetByAuthor(client, bookAuthor, &result);
+            }
+            else {
+                bookCount = 0;
+                printf("Server response:\n");
+
+                status = catalogGetByAuthorStream(client, bookAuthor, showBook, &bookCount, &result);
+            }
+
+            showResult(status, &result);
         }
     }
 
@@ -396,8 +527,18 @@ void collectBookInformation(int menuChoice, int sockfd) {
             //Remove trailing newlines from the input
             bookTitle[titleLength] = '\0';
 
-            //Call the getBooksWithTitle Function
-            getBooksWithTitle(bookTitle, sockfd);
+            //Get the Books with the title, displaying each one as it arrives, unless the result is cached whole
+            if (cached == true) {
+                status = catalogGetByTitle(client, bookTitle, &result);
+            }
+            else {
+                bookCount = 0;
+                printf("Server response:\n");
+
+                status = catalogGetByTitleStream(client, bookTitle, showBook, &bookCount, &result);
+            }
+
+            showResult(status, &result);
         }
     }
 
@@ -443,320 +584,436 @@ void collectBookInformation(int menuChoice, int sockfd) {
             bookAuthor[authorLength] = '\0';
             bookLocation[locationLength] = '\0';
 
-            //Call the removeBook function with the inputs
-            removeBook(bookTitle, bookAuthor, bookLocation, sockfd);
+            //Remove the Book and display the server's response
+            status = catalogRemove(client, bookTitle, bookAuthor, bookLocation, &result);
+            showResult(status, &result);
         }
     }
 
-    //INVALID MENU OPTIONS ARE IGNORED
-    else {
-        fprintf(stderr, "usage: Invalid menu option. Options are 1-5 for contacting the server and 6 to exit. Please try again.\n");
-    }
-}
+    //OPTION SIX: GET SEVERAL BOOKS AT ONCE
+    else if (menuChoice == 6) {
 
+        //The titles and authors of every Book to retrieve
+        char bookTitles[MAX_GETMANY_KEYS][100];
+        char bookAuthors[MAX_GETMANY_KEYS][100];
 
-//FUNCTION getBooksByAuthor
-void getBooksByAuthor(char bookAuthor[], int sockfd) {
+        //The number of Books entered so far
+        int keyCount = 0;
 
-    //The Book get request to send to the server
-    char getRequest[250];
+        //Collect titles and authors until the user enters a blank title
+        while (keyCount < MAX_GETMANY_KEYS) {
 
-    //The response from the server
-    char *serverResponse;
+            //Prompt the user for the Book's title and get its length
+            printf("Please enter the title of Book %d to retrieve, or a blank line to send the request. Max 100 Characters.\n", keyCount + 1);
+            fgets(inputBuffer, 1000, stdin);
+            titleLength = strlen(inputBuffer) - 1;
 
-    //The length of the SUBMIT request sent to the server
-    int requestLength = 0;
+            printf("\n");
 
-    //The length of the response received from the server
-    int responseLength = 0;
+            //A blank title ends the list
+            if (titleLength <= 0) {
+                break;
+            }
 
-    //Form the Book REMOVE request
-    strcpy(getRequest, "METHOD:GET,");
-    strcat(getRequest, "AUTHOR:");
-    strcat(getRequest, bookAuthor);
-    strcat(getRequest, "\n");
+            //Keep the title without its newline, cut to fit, since the input buffer is reused for the author
+            snprintf(bookTitles[keyCount], sizeof(bookTitles[keyCount]), "%.*s", titleLength, inputBuffer);
 
-    //Send the GET request to the server
-    requestLength = write(sockfd, getRequest, strlen(getRequest));
-    
-    //If the request wasn't sent to the server, inform the user
-    if (requestLength <= 0) {
-        fprintf(stderr, "ERROR: Client request was not sent to server.\n");
-        perror("ERROR: ");
-        exit(1);
-    }
+            //Prompt the user for the Book's author and get its length
+            printf("Please enter the author of Book %d to retrieve. Max 100 Characters.\n", keyCount + 1);
+            fgets(inputBuffer, 1000, stdin);
+            authorLength = strlen(inputBuffer) - 1;
 
-    //Malloc room for the server's response
-    serverResponse = malloc(sizeof(char)*1000);
+            printf("\n");
 
-    //Get the server's response message
-    responseLength = read(sockfd, serverResponse, 1000);
-    
-    //If the response message couldn't be read, inform the user
-    if (responseLength <= 0) {
-        fprintf(stderr, "ERROR: Server response was not received.\n");
-        perror("ERROR: ");
-        exit(1);
-    }
+            //Verify that the entered fields aren't blank or too long
+            if (authorLength <= 0 || titleLength > 99 || authorLength > 99) {
+                fprintf(stderr, "usage: The Book information entered was blank or too long. Max 100 Characters. Please try again.\n\n");
+                continue;
+            }
 
+            //Keep the author without its newline
+            snprintf(bookAuthors[keyCount], sizeof(bookAuthors[keyCount]), "%.*s", authorLength, inputBuffer);
 
-    //Otherwise, display the response message
-    else {
-        
-        //Remove trailing newlines from the input
-        serverResponse[responseLength] = '\0';
-        printf("Server response:\n%s\n", serverResponse);
+            keyCount++;
+        }
+
+        //Verify that at least one Book was entered
+        if (keyCount == 0) {
+            fprintf(stderr, "usage: At least one Book must be entered. Please try again.\n\n");
+        }
+
+        //Else get every Book in a single request and display the server's response
+        else {
+
+            //The keys as the library takes them
+            const char* titles[MAX_GETMANY_KEYS];
+            const char* authors[MAX_GETMANY_KEYS];
+
+            for (int i = 0; i < keyCount; i++) {
+                titles[i] = bookTitles[i];
+                authors[i] = bookAuthors[i];
+            }
+
+            status = catalogGetMany(client, titles, authors, keyCount, &result);
+            showResult(status, &result);
+        }
     }
 
-    free(serverResponse);
-}
+    //OPTION SEVEN: MOVE A BOOK
+    else if (menuChoice == 7) {
 
+        //The Book's new location collected from the user
+        char newLocation[100];
+        int newLocationLength;
 
+        //Prompt the user for the Book's title, author, current location and new location. Each is kept without its newline and cut to fit,
+        //and refused below if it was too long
+        printf("Please enter the title of the Book to move. Max 100 characters.\n");
+        fgets(inputBuffer, 1000, stdin);
+        titleLength = strlen(inputBuffer) - 1;
+        snprintf(bookTitle, sizeof(bookTitle), "%.*s", titleLength, inputBuffer);
 
-//FUNCTION getBooksWithTitle
-void getBooksWithTitle(char bookTitle[], int sockfd) {
+        printf("\n");
 
-   //The Book GET request to send to the server
-    char getRequest[250];
+        printf("Please enter the author of the Book to move. Max 100 characters.\n");
+        fgets(inputBuffer, 1000, stdin);
+        authorLength = strlen(inputBuffer) - 1;
+        snprintf(bookAuthor, sizeof(bookAuthor), "%.*s", authorLength, inputBuffer);
 
-    //The response from the server
-    char *serverResponse;
+        printf("\n");
 
-    //The length of the SUBMIT request sent to the server
-    int requestLength = 0;
+        printf("Please enter the current location of the Book to move. Max 100 characters.\n");
+        fgets(inputBuffer, 1000, stdin);
+        locationLength = strlen(inputBuffer) - 1;
+        snprintf(bookLocation, sizeof(bookLocation), "%.*s", locationLength, inputBuffer);
 
-    //The length of the response received from the server
-    int responseLength = 0;
+        printf("\n");
 
-    //Form the Book GET request
-    strcpy(getRequest, "METHOD:GET,");
-    strcat(getRequest, "TITLE:");
-    strcat(getRequest, bookTitle);
-    strcat(getRequest, "\n");
+        printf("Please enter the new location of the Book. Max 100 characters.\n");
+        fgets(inputBuffer, 1000, stdin);
+        newLocationLength = strlen(inputBuffer) - 1;
+        snprintf(newLocation, sizeof(newLocation), "%.*s", newLocationLength, inputBuffer);
 
-    //Malloc room for the server's response
-    serverResponse = malloc(sizeof(char)*1000);
+        printf("\n");
 
-    //Send the GET request to the server
-    requestLength = write(sockfd, getRequest, strlen(getRequest));
-    
-    //If the request wasn't sent to the server, inform the user
-    if (requestLength <= 0) {
-        fprintf(stderr, "ERROR: Client request was not sent to server.\n");
-        perror("ERROR: ");
-        exit(1);
+        //If any entered fields were blank, inform the user
+        if (titleLength == 0 || authorLength == 0 || locationLength == 0 || newLocationLength == 0) {
+            fprintf(stderr, "usage: One of the entered Book information entries was blank. Please try again.\n\n");
+        }
+
+        //If any entered fields were too long, inform the user
+        else if (titleLength > 99 || authorLength > 99 || locationLength > 99 || newLocationLength > 99) {
+            printf("usage: One of the entered Book information entries was too long. Max 100 Characters. Please try again.\n\n");
+        }
+
+        //Else
+        else {
+
+            //Move the Book and display the server's response
+            status = catalogMove(client, bookTitle, bookAuthor, bookLocation, newLocation, &result);
+            showResult(status, &result);
+        }
     }
 
-    //Get the server's response message
-    responseLength = read(sockfd, serverResponse, 1000);
-    
-    //If the response message couldn't be read, inform the user
-    if (responseLength <= 0) {
-        fprintf(stderr, "ERROR: Server response was not received.\n");
-        perror("ERROR: ");
-        exit(1);
+    //INVALID MENU OPTIONS ARE IGNORED
+    else {
+        fprintf(stderr, "usage: Invalid menu option. Options are 1-7 for contacting the server and 8 to exit. Please try again.\n");
+    }
+}
+
+
+//FUNCTION completeBatchRequest
+void completeBatchRequest(int status, CatalogResult* result, void* context) {
+
+    BatchRequest* request = context;
+    BatchStats* stats = request->stats;
+
+    //The time the request took, from being queued to its response
+    double latency = (monotonicSeconds() - request->startSeconds) * 1000.0;
+
+    //Print the result and any Books retrieved together, so they aren't split by another line
+    flockfile(stdout);
+
+    printf("RESULT\t%d\t%d\t%llu\t%.3f\t%s\n", request->line, status, result->lsn, latency, status < 0 ? catalogErrorText(status) : result->message);
+
+    if (status == 202) {
+        for (int i = 0; i < result->bookCount; i++) {
+            printf("BOOK\t%d\t%s\t%s\t%s\n", request->line, result->books[i].title, result->books[i].author, result->books[i].location);
+        }
     }
 
-    //Otherwise, display the response message
+    funlockfile(stdout);
+
+    //Count the request in the summary
+    if (status > 0 && status < MAX_STATUS) {
+        stats->statusCounts[status]++;
+    }
     else {
+        stats->errorCount++;
+    }
 
-        //Remove trailing newlines from the input
-        serverResponse[responseLength] = '\0';
-        printf("Server response:\n%s\n", serverResponse);
+    if (stats->latencyCount == stats->latencyCapacity) {
+
+        int capacity = stats->latencyCapacity > 0 ? stats->latencyCapacity * 2 : 1024;
+        double* latencies = realloc(stats->latencies, sizeof(double) * capacity);
+
+        if (latencies != NULL) {
+            stats->latencies = latencies;
+            stats->latencyCapacity = capacity;
+        }
     }
 
-    //Free the server response
-    free(serverResponse);
+    if (stats->latencyCount < stats->latencyCapacity) {
+        stats->latencies[stats->latencyCount++] = latency;
+    }
+
+    free(request);
+}
+
+
+
+//FUNCTION compareLatencies
+int compareLatencies(const void* first, const void* second) {
+
+    double difference = *(const double*) first - *(const double*) second;
+
+    return (difference > 0) - (difference < 0);
+}
+
+
+
+//FUNCTION monotonicSeconds
+double monotonicSeconds(void) {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
 }
 
 
 
-//FUNCTION getSpecificBook
-void getSpecificBook(char bookTitle[], char bookAuthor[], int sockfd) {
+//FUNCTION runBatch
+int runBatch(CatalogClient* client, char batchPath[]) {
 
-    //The Book GGT request to send to the server
-    char getRequest[250];
+    //The batch file, and the line read from it
+    FILE* batchFile = strcmp(batchPath, "-") == 0 ? stdin : fopen(batchPath, "r");
+    char* line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLength;
+    int lineNumber = 0;
 
-    //The response from the server
-    char *serverResponse;
+    //The request sent for each line, with room for the CSV fields of a SUBMIT at their maximum length
+    char* request = NULL;
+    size_t requestCapacity = 0;
 
-    //The length of the GET request sent to the server
-    int requestLength = 0;
+    //The pipelined connection, and what its responses add up to
+    CatalogAsync* async;
+    BatchStats stats;
+    int requestCount = 0;
+    int succeededCount = 0;
 
-    //The length of the response received from the server
-    int responseLength = 0;
+    //The lines that couldn't be sent, which the callbacks never see
+    int unsentCount = 0;
 
-    //Form the Book REMOVE request
-    strcpy(getRequest, "METHOD:GET,");
-    strcat(getRequest, "TITLE:");
-    strcat(getRequest, bookTitle);
-    strcat(getRequest, ",");
-    strcat(getRequest, "AUTHOR:");
-    strcat(getRequest, bookAuthor);
-    strcat(getRequest, "\n");
+    //The time the batch took
+    double startSeconds;
+    double seconds;
 
-    //Send the GET request to the server
-    requestLength = write(sockfd, getRequest, strlen(getRequest));
-    
-    //If the request wasn't sent to the server, inform the user
-    if (requestLength <= 0) {
-        fprintf(stderr, "ERROR: Client request was not sent to server.\n");
+    if (batchFile == NULL) {
         perror("ERROR: ");
         exit(1);
     }
 
-    //Malloc room for the server's response
-    serverResponse = malloc(sizeof(char)*1000);
+    async = catalogAsyncCreate(client, BATCH_IN_FLIGHT);
 
-    //Get the server's response message
-    responseLength = read(sockfd, serverResponse, 1000);
-    
-    //If the response message couldn't be read, inform the user
-    if (responseLength < 0) {
-        fprintf(stderr, "ERROR: Server response was not received.\n");
+    if (async == NULL) {
         perror("ERROR: ");
         exit(1);
     }
 
-    //Otherwise, display the response message
-    else {
+    memset(&stats, 0, sizeof(stats));
+    startSeconds = monotonicSeconds();
 
-        //Remove trailing newlines from the input
-        serverResponse[responseLength] = '\0';
+    //Queue a request for every line, without waiting for the responses
+    while ((lineLength = getline(&line, &lineCapacity, batchFile)) >= 0) {
 
-        printf("Server response:\n%s\n", serverResponse);
-    }
+        //The batch request sent for the line
+        BatchRequest* batchRequest;
+        int requestId;
 
-    //Free the server response
-    free(serverResponse);
-}
+        lineNumber++;
 
+        //Remove the trailing newline, including a carriage return from a file written on Windows
+        while (lineLength > 0 && (line[lineLength - 1] == '\n' || line[lineLength - 1] == '\r')) {
+            line[--lineLength] = '\0';
+        }
 
+        //Skip blank lines, comments and a CSV header
+        if (lineLength == 0 || line[0] == '#' || strcasecmp(line, "title,author,location") == 0) {
+            continue;
+        }
 
-//Function: removeBook()
-void removeBook(char bookTitle[], char bookAuthor[], char bookLocation[], int sockfd) {
-    
-    //The Book REMOVE request to send to the server
-    char removeRequest[250];
+        if (requestCapacity < (size_t) lineLength + 50) {
+            requestCapacity = lineLength + 50;
+            request = realloc(request, requestCapacity);
+        }
 
-    //The response from the server
-    char *serverResponse;
+        //A request message is sent as it is
+        if (strncmp(line, "METHOD:", 7) == 0 || strncmp(line, "CATALOG:", 8) == 0) {
+            sprintf(request, "%s\n", line);
+        }
 
-    //The length of the SUBMIT request sent to the server
-    int requestLength = 0;
+        //Otherwise the line is the title, author and location of a Book to SUBMIT
+        else {
 
-    //The length of the response received from the server
-    int responseLength = 0;
+            //The CSV fields, without surrounding spaces or quotes
+            char* fields[3];
+            int fieldCount = 0;
+            bool valid = true;
 
-    //Form the Book REMOVE request
-    strcpy(removeRequest, "METHOD:REMOVE,");
-    strcat(removeRequest, "TITLE:");
-    strcat(removeRequest, bookTitle);
-    strcat(removeRequest, ",");
-    strcat(removeRequest, "AUTHOR:");
-    strcat(removeRequest, bookAuthor);
-    strcat(removeRequest, ",");
-    strcat(removeRequest, "LOCATION:");
-    strcat(removeRequest, bookLocation);
-    strcat(removeRequest,"\n");
+            for (char* field = strtok(line, ","); field != NULL; field = strtok(NULL, ",")) {
 
-    //Malloc room for the server's response
-    serverResponse = malloc(sizeof(char)*1000);
+                int fieldLength;
 
-    //Send the REMOVE request to the server
-    requestLength = write(sockfd, removeRequest, strlen(removeRequest));
-    
-    //If the request wasn't sent to the server, inform the user
-    if (requestLength <= 0) {
-        fprintf(stderr, "ERROR: Client request was not sent to server.\n");
-        perror("ERROR: ");
-        exit(1);
+                if (fieldCount == 3) {
+                    valid = false;
+                    break;
+                }
+
+                while (*field == ' ' || *field == '"') {
+                    field++;
+                }
+
+                fieldLength = strlen(field);
+                while (fieldLength > 0 && (field[fieldLength - 1] == ' ' || field[fieldLength - 1] == '"')) {
+                    field[--fieldLength] = '\0';
+                }
+
+                if (fieldLength == 0 || fieldLength > 99) {
+                    valid = false;
+                }
+
+                fields[fieldCount++] = field;
+            }
+
+            //A line that isn't three fields of a Book can't be sent, which counts as a failed request
+            if (valid == false || fieldCount != 3) {
+                printf("RESULT\t%d\t%d\t0\t0.000\tThe line isn't a request or a 'title,author,location' Book.\n", lineNumber, CATALOG_ERROR_ARGUMENT);
+                unsentCount++;
+                requestCount++;
+                continue;
+            }
+
+            sprintf(request, "METHOD:SUBMIT,TITLE:%s,AUTHOR:%s,LOCATION:%s\n", fields[0], fields[1], fields[2]);
+        }
+
+        batchRequest = malloc(sizeof(BatchRequest));
+        batchRequest->line = lineNumber;
+        batchRequest->startSeconds = monotonicSeconds();
+        batchRequest->stats = &stats;
+
+        requestId = catalogAsyncRequest(async, request, completeBatchRequest, batchRequest);
+        requestCount++;
+
+        //If the request couldn't be sent, its callback won't be called, so report it here
+        if (requestId < 0) {
+            flockfile(stdout);
+            printf("RESULT\t%d\t%d\t0\t0.000\t%s\n", lineNumber, requestId, catalogErrorText(requestId));
+            funlockfile(stdout);
+
+            free(batchRequest);
+            unsentCount++;
+        }
     }
 
-    //Get the server's response message
-    responseLength = read(sockfd, serverResponse, 1000);
-    
-    //If the response message couldn't be read, inform the user
-    if (responseLength < 0) {
-        fprintf(stderr, "ERROR: Server response was not received.\n");
-        perror("ERROR: ");
-        exit(1);
+    //Wait for every response, after which the callbacks no longer touch the summary
+    catalogAsyncDrain(async);
+    seconds = monotonicSeconds() - startSeconds;
+    catalogAsyncDestroy(async);
+
+    for (int status = 200; status < 300; status++) {
+        succeededCount += stats.statusCounts[status];
     }
 
-    //Otherwise, display the response message
-    else {
+    //Summarize the latencies of the requests that were sent
+    qsort(stats.latencies, stats.latencyCount, sizeof(double), compareLatencies);
 
-        //Remove trailing newlines from the input
-        serverResponse[responseLength] = '\0';
+    printf("SUMMARY\trequests=%d\tsucceeded=%d\tfailed=%d\tseconds=%.3f\tper_second=%.0f\tp50_ms=%.3f\tp99_ms=%.3f\tmax_ms=%.3f\n",
+           requestCount, succeededCount, requestCount - succeededCount, seconds, seconds > 0 ? requestCount / seconds : 0.0,
+           stats.latencyCount > 0 ? stats.latencies[stats.latencyCount / 2] : 0.0,
+           stats.latencyCount > 0 ? stats.latencies[(int) (stats.latencyCount * 0.99)] : 0.0,
+           stats.latencyCount > 0 ? stats.latencies[stats.latencyCount - 1] : 0.0);
 
-        printf("Server response:\n%s\n", serverResponse);
+    for (int status = 0; status < MAX_STATUS; status++) {
+        if (stats.statusCounts[status] > 0) {
+            printf("STATUS\t%d\t%d\n", status, stats.statusCounts[status]);
+        }
     }
 
-    //Free the server response
-    free(serverResponse);
+    if (stats.errorCount + unsentCount > 0) {
+        printf("STATUS\terror\t%d\n", stats.errorCount + unsentCount);
+    }
+
+    if (batchFile != stdin) {
+        fclose(batchFile);
+    }
+
+    free(line);
+    free(request);
+    free(stats.latencies);
+
+    return succeededCount == requestCount ? 0 : 2;
 }
 
 
 
-//Function: submitBook()
-void submitBook(char bookTitle[], char bookAuthor[], char bookLocation[], int sockfd) {
+//FUNCTION showBook
+bool showBook(const CatalogBook* book, void* context) {
+
+    int* bookCount = context;
 
-    //The Book SUBMIT request to send to the server
-    char submitRequest[250];
+    //The first Book follows the status line
+    if (*bookCount == 0) {
+        printf("202:RETRIEVED\n");
+    }
 
-    //The response from the server
-    char *serverResponse;
+    (*bookCount)++;
 
-    //The length of the SUBMIT request sent to the server
-    int requestLength = 0;
+    printf("TITLE:%s\nAUTHOR:%s\nLOCATION:%s\n\n", book->title, book->author, book->location);
 
-    //The length of the response received from the server
-    int responseLength = 0;
+    return true;
+}
 
-    //Form the Book SUBMIT request
-    strcpy(submitRequest, "METHOD:SUBMIT,");
-    strcat(submitRequest, "TITLE:");
-    strcat(submitRequest, bookTitle);
-    strcat(submitRequest, ",");
-    strcat(submitRequest, "AUTHOR:");
-    strcat(submitRequest, bookAuthor);
-    strcat(submitRequest, ",");
-    strcat(submitRequest, "LOCATION:");
-    strcat(submitRequest, bookLocation);
-    strcat(submitRequest,"\n");
 
-    //Send the SUBMIT request to the server
-    requestLength = write(sockfd, submitRequest, strlen(submitRequest));
 
-    //If the request wasn't sent to the server, inform the user
-    if (requestLength <= 0) {
-        fprintf(stderr, "ERROR: Client request was not sent to server.\n");
-        perror("ERROR: ");
-        exit(1);
-    }
+//FUNCTION showResult
+void showResult(int status, CatalogResult* result) {
 
-    //Malloc room for the server's response
-    serverResponse = malloc(sizeof(char)*1000);
+    //If the request failed before the server answered it, inform the user
+    if (status < 0) {
+        fprintf(stderr, "ERROR: %s\n\n", catalogErrorText(status));
+        return;
+    }
 
-    //Get the server's response message
-    responseLength = read(sockfd, serverResponse, 1000);
-    
-    //If the response message couldn't be read, inform the user
-    if (responseLength < 0) {
-        fprintf(stderr, "ERROR: Server response was not received.\n");
-        perror("ERROR: ");
-        exit(1);
+    //If a replica was behind this session's writes, let the user know the primary answered instead
+    if (result->redirected == true) {
+        printf("The replica hasn't caught up with your changes yet, so the request was sent to the primary.\n");
     }
 
-    //Otherwise, display the response message
-    else {
+    if (result->cached == true) {
+        printf("The result was answered from the client's cache.\n");
+    }
 
-        //Remove trailing newlines from the input
-        serverResponse[responseLength] = '\0';
-        
-        printf("Server response:\n%s\n", serverResponse);
+    //Display the response message, or for a streamed response, its status if it had no Books to display
+    if (result->response != NULL) {
+        printf("Server response:\n%s\n", result->response);
+    }
+    else if (result->bookCount == 0) {
+        printf("%d:%s\n\n", result->status, result->message);
     }
 
     //Free the server response
-    free(serverResponse);
+    catalogFreeResult(result);
 }
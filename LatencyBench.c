@@ -0,0 +1,324 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+//The number of round trips made before timing starts, to warm up both connections
+#define WARMUP_ROUND_TRIPS 1000
+
+//The room for a single framed response
+#define RESPONSE_BUFFER_LENGTH 4096
+
+
+
+/* Name: compareLatencies
+ * Description: This function compares two round trip latencies for qsort.
+ *
+ * Parameter: first             A pointer to the first latency
+ * Parameter: second            A pointer to the second latency
+ * Return: A negative, zero or positive number as the first latency is smaller, equal or larger
+*/
+int compareLatencies(const void* first, const void* second);
+
+
+
+/* Name: connectTcp
+ * Description: This function connects to the server over TCP, with Nagle's algorithm disabled so small requests aren't delayed.
+ *
+ * Parameter: hostName          The hostname of the server
+ * Parameter: portNum           The port number of the server
+ * Return: The socket connection to the server
+*/
+int connectTcp(char hostName[], int portNum);
+
+
+
+/* Name: connectUnix
+ * Description: This function connects to the server over its Unix domain socket.
+ *
+ * Parameter: socketPath        The path of the server's Unix domain socket
+ * Return: The socket connection to the server
+*/
+int connectUnix(char socketPath[]);
+
+
+
+/* Name: measureRoundTrips
+ * Description: This function sends GET requests one at a time over the passed connection and reports the latency distribution of the round trips.
+ *
+ * Parameter: sockfd            The socket connection to the server
+ * Parameter: label             The name of the transport, printed with the results
+ * Parameter: roundTrips        The number of timed round trips
+ * Return: None
+*/
+void measureRoundTrips(int sockfd, char label[], int roundTrips);
+
+
+
+/* Name: roundTrip
+ * Description: This function sends one request and reads its whole framed response.
+ *
+ * Parameter: sockfd            The socket connection to the server
+ * Parameter: request           The request message to send
+ * Parameter: requestLength     The length of the request message
+ * Return: None
+*/
+void roundTrip(int sockfd, char request[], int requestLength);
+
+
+
+//Main loop
+int main(int argc, char **argv) {
+
+    //The number of timed round trips per transport
+    int roundTrips = 100000;
+
+    //The socket connections to the server
+    int tcpfd;
+    int unixfd;
+
+    //The SUBMIT request for the Book every GET request finds
+    char submitRequest[] = "ID:0,METHOD:SUBMIT,TITLE:Latency,AUTHOR:Bench,LOCATION:Shelf\n";
+
+    //Verify the user specified a host, port number and socket path
+    if (argc != 4 && argc != 5) {
+        fprintf(stderr, "usage: %s <hostname> <port> <socket path> [round trips]\n", argv[0]);
+        exit(1);
+    }
+
+    //Grab the number of round trips if one was given
+    if (argc == 5) {
+        roundTrips = atoi(argv[4]);
+    }
+
+    //If the number of round trips is invalid, exit
+    if (roundTrips <= 0) {
+        fprintf(stderr, "usage: [round trips] must be positive.\n");
+        exit(1);
+    }
+
+    //Connect to the same server over both transports
+    tcpfd = connectTcp(argv[1], atoi(argv[2]));
+    unixfd = connectUnix(argv[3]);
+
+    //Make sure there is a Book for the GET requests to find
+    roundTrip(tcpfd, submitRequest, strlen(submitRequest));
+
+    printf("%-12s %12s %12s %12s %12s %12s\n", "transport", "round trips", "mean (us)", "p50 (us)", "p99 (us)", "p99.9 (us)");
+
+    //Measure both transports the same way
+    measureRoundTrips(tcpfd, "tcp", roundTrips);
+    measureRoundTrips(unixfd, "unix", roundTrips);
+
+    close(tcpfd);
+    close(unixfd);
+
+    return 0;
+}
+
+
+
+//FUNCTION compareLatencies
+int compareLatencies(const void* first, const void* second) {
+
+    long firstLatency = *((const long*) first);
+    long secondLatency = *((const long*) second);
+
+    return (firstLatency > secondLatency) - (firstLatency < secondLatency);
+}
+
+
+
+//FUNCTION connectTcp
+int connectTcp(char hostName[], int portNum) {
+
+    int sockfd;
+    struct sockaddr_in serveraddr;
+    struct hostent *server;
+
+    //Flag value for setsockopt
+    int optval = 1;
+
+    //Create the socket
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+    //If the socket couldn't be created, inform the user
+    if (sockfd < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    //Get the server's DNS entry
+    server = gethostbyname(hostName);
+
+    //If the hostname provided was invalid, inform the user
+    if (server == NULL) {
+        fprintf(stderr, "usage: Hostname provided doesn't exist. %s\n", hostName);
+        exit(1);
+    }
+
+    //Build the internet address
+    memset(&serveraddr, 0, sizeof(serveraddr));
+    serveraddr.sin_family = AF_INET;
+    memcpy(&serveraddr.sin_addr.s_addr, server->h_addr_list[0], server->h_length);
+    serveraddr.sin_port = htons(portNum);
+
+    //Create a connection with the server
+    if (connect(sockfd, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    //Send each small request as soon as it is written
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+    return sockfd;
+}
+
+
+
+//FUNCTION connectUnix
+int connectUnix(char socketPath[]) {
+
+    int sockfd;
+    struct sockaddr_un unixaddr;
+
+    //If the socket path is too long, inform the user
+    if (strlen(socketPath) >= sizeof(unixaddr.sun_path)) {
+        fprintf(stderr, "usage: %s <socket path> is too long.\n", socketPath);
+        exit(1);
+    }
+
+    //Create the socket
+    sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    //If the socket couldn't be created, inform the user
+    if (sockfd < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    //Build the socket's address from its path
+    memset(&unixaddr, 0, sizeof(unixaddr));
+    unixaddr.sun_family = AF_UNIX;
+    strcpy(unixaddr.sun_path, socketPath);
+
+    //Create a connection with the server
+    if (connect(sockfd, (struct sockaddr *)&unixaddr, sizeof(unixaddr)) < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    return sockfd;
+}
+
+
+
+//FUNCTION measureRoundTrips
+void measureRoundTrips(int sockfd, char label[], int roundTrips) {
+
+    //The GET request used for every round trip
+    char request[] = "ID:1,METHOD:GET,TITLE:Latency,AUTHOR:Bench\n";
+    int requestLength = strlen(request);
+
+    //The latency of every timed round trip, in nanoseconds
+    long* latencies = malloc(sizeof(long) * roundTrips);
+
+    //The sum of the latencies, for the mean
+    double totalLatency = 0;
+
+    //Warm up the connection and the server's thread before timing
+    for (int i = 0; i < WARMUP_ROUND_TRIPS; i++) {
+        roundTrip(sockfd, request, requestLength);
+    }
+
+    //Time each round trip on its own
+    for (int i = 0; i < roundTrips; i++) {
+
+        struct timespec start;
+        struct timespec end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        roundTrip(sockfd, request, requestLength);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        latencies[i] = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+        totalLatency += latencies[i];
+    }
+
+    //Sort the latencies to read off the percentiles
+    qsort(latencies, roundTrips, sizeof(long), compareLatencies);
+
+    printf("%-12s %12d %12.2f %12.2f %12.2f %12.2f\n", label, roundTrips,
+           totalLatency / roundTrips / 1000.0,
+           latencies[(long) roundTrips * 50 / 100] / 1000.0,
+           latencies[(long) roundTrips * 99 / 100] / 1000.0,
+           latencies[(long) roundTrips * 999 / 1000] / 1000.0);
+
+    free(latencies);
+}
+
+
+
+//FUNCTION roundTrip
+void roundTrip(int sockfd, char request[], int requestLength) {
+
+    //The framed response read from the server
+    char response[RESPONSE_BUFFER_LENGTH];
+
+    //The length of the response read so far
+    int responseLength = 0;
+
+    //The total length of the frame, once its framing line has been read
+    int frameLength = -1;
+
+    //Send the request
+    if (write(sockfd, request, requestLength) != requestLength) {
+        fprintf(stderr, "ERROR: Client request was not sent to server.\n");
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    //Read until the whole frame has arrived
+    while (frameLength < 0 || responseLength < frameLength) {
+
+        int readLength = read(sockfd, response + responseLength, RESPONSE_BUFFER_LENGTH - 1 - responseLength);
+
+        //If the response message couldn't be read, inform the user
+        if (readLength <= 0) {
+            fprintf(stderr, "ERROR: Server response was not received.\n");
+            perror("ERROR: ");
+            exit(1);
+        }
+
+        responseLength += readLength;
+        response[responseLength] = '\0';
+
+        //Once the framing line is complete, work out the length of the whole frame
+        if (frameLength < 0) {
+
+            char* headerEnd = strchr(response, '\n');
+            int bodyLength;
+
+            if (headerEnd != NULL) {
+
+                //If the framing line is malformed, the connection can't be read any further
+                if (sscanf(response, "ID:%*[^,],LENGTH:%d", &bodyLength) != 1 || headerEnd - response + 1 + bodyLength >= RESPONSE_BUFFER_LENGTH) {
+                    fprintf(stderr, "ERROR: Server response was not framed properly.\n");
+                    exit(1);
+                }
+
+                frameLength = headerEnd - response + 1 + bodyLength;
+            }
+        }
+    }
+}
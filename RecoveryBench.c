@@ -0,0 +1,384 @@
+/*
+ * RecoveryBench.c - Measures how long the server takes to recover its Catalog from a snapshot and the write-ahead log written after it.
+ *
+ * The benchmark links against the server's own snapshot and log code, so recovery takes the same path as a restarted server:
+ *     gcc -O2 -pthread -DSERVER_NO_MAIN -o RecoveryBench RecoveryBench.c Server.c
+ *     ./RecoveryBench <directory> [books] [tail records]
+ *
+ * The target is a 10,000,000 Book snapshot with a 1,000,000 record tail, which are the defaults. The snapshot alone takes about 3GB.
+ */
+#define _XOPEN_SOURCE 500
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//The durability mode and record types of the write-ahead log, as defined by Server.c
+#define WAL_ASYNC 2
+#define WAL_SUBMIT 1
+#define WAL_REMOVE 2
+#define WAL_MOVE 3
+
+//A Book in the Catalog, as defined by Server.c
+typedef struct book {
+    char title[100];
+    char author[100];
+    char location[100];
+
+    struct book* previous;
+    struct book* next;
+} Book;
+
+//A named catalog of Books, as defined by Server.c
+typedef struct catalog {
+    char name[100];
+    Book* books;
+    sem_t mutex;
+    struct catalog* nextCatalog;
+} Catalog;
+
+//An entry of the table after a snapshot's records, as defined by Server.c
+typedef struct snapshotCatalog {
+    char name[100];
+    unsigned int recordsChecksum;
+    unsigned long long recordCount;
+} SnapshotCatalog;
+
+//The catalog, snapshot and write-ahead log functions from Server.c
+extern unsigned long long snapshotLsn;
+Catalog* findCatalog(const char name[], bool create);
+long long loadSnapshot(char path[]);
+unsigned long long logMutation(int type, const char title[], const char author[], const char location[], const char newLocation[]);
+int openWriteAheadLog(char path[], int mode, int batchInterval);
+long long writeSnapshot(Catalog* head, char path[], unsigned long long lsn, SnapshotCatalog table[]);
+
+
+
+/* Name: generateFiles
+ * Description: This function writes a snapshot of the given number of Books, then a write-ahead log tail of submissions, removals and moves
+ *              after it. It runs in a child process, so the memory used to build the snapshot is returned before recovery is measured.
+ *
+ * Parameter: snapshotPath          The path of the snapshot to write
+ * Parameter: logPath               The path of the write-ahead log to write
+ * Parameter: bookCount             The number of Books in the snapshot
+ * Parameter: tailCount             The number of records in the log tail
+ * Return: The number of Books the recovered Catalog should have
+*/
+long long generateFiles(char snapshotPath[], char logPath[], long long bookCount, long long tailCount);
+
+
+
+/* Name: measureRecovery
+ * Description: This function loads the snapshot and replays the log tail the way a restarted server does, in a child process, and reports
+ *              the time taken by each step.
+ *
+ * Parameter: snapshotPath          The path of the snapshot
+ * Parameter: logPath               The path of the write-ahead log
+ * Parameter: expectedCount         The number of Books the recovered Catalog should have
+ * Return: None
+*/
+void measureRecovery(char snapshotPath[], char logPath[], long long expectedCount);
+
+
+
+/* Name: secondsSince
+ * Description: This function measures the time elapsed since the given moment.
+ *
+ * Parameter: start                 The moment to measure from
+ * Return: The elapsed time, in seconds
+*/
+double secondsSince(struct timeval* start);
+
+
+
+//Main loop
+int main(int argc, char **argv) {
+
+    //The size of the snapshot and of the log tail after it
+    long long bookCount = 10000000;
+    long long tailCount = 1000000;
+
+    //The paths of the generated files
+    char snapshotPath[1000];
+    char logPath[1000];
+
+    //The number of Books the recovered Catalog should have
+    long long expectedCount;
+
+    //Verify the user specified a directory for the files
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "usage: %s <directory> [books] [tail records]\n", argv[0]);
+        exit(1);
+    }
+
+    //Grab the optional sizes
+    if (argc >= 3) {
+        bookCount = atoll(argv[2]);
+    }
+    if (argc == 4) {
+        tailCount = atoll(argv[3]);
+    }
+
+    if (bookCount < 0 || tailCount < 0) {
+        fprintf(stderr, "usage: [books] and [tail records] can't be negative.\n");
+        exit(1);
+    }
+
+    snprintf(snapshotPath, sizeof(snapshotPath), "%s/recoverybench.snapshot", argv[1]);
+    snprintf(logPath, sizeof(logPath), "%s/recoverybench.log", argv[1]);
+
+    expectedCount = generateFiles(snapshotPath, logPath, bookCount, tailCount);
+
+    measureRecovery(snapshotPath, logPath, expectedCount);
+
+    unlink(snapshotPath);
+    unlink(logPath);
+
+    return 0;
+}
+
+
+
+//FUNCTION generateFiles
+long long generateFiles(char snapshotPath[], char logPath[], long long bookCount, long long tailCount) {
+
+    //The child process writing the files, and the pipe it reports the expected Catalog size on
+    pid_t child;
+    int resultPipe[2];
+    long long expectedCount = -1;
+
+    //The time taken to write each file
+    struct timeval start;
+
+    if (pipe(resultPipe) < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    //Write the files in a child process, without the child repeating anything still buffered for stdout
+    fflush(stdout);
+    child = fork();
+
+    if (child < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    if (child > 0) {
+
+        close(resultPipe[1]);
+
+        if (read(resultPipe[0], &expectedCount, sizeof(long long)) != sizeof(long long)) {
+            fprintf(stderr, "ERROR: The benchmark files could not be written.\n");
+            exit(1);
+        }
+
+        close(resultPipe[0]);
+        waitpid(child, NULL, 0);
+
+        return expectedCount;
+    }
+
+    close(resultPipe[0]);
+
+    //Every Book ever submitted, the location number each one is at, and whether it was removed
+    long long totalCount = bookCount + tailCount;
+    Book* books = calloc(bookCount > 0 ? bookCount : 1, sizeof(Book));
+    int* locations = calloc(totalCount + 1, sizeof(int));
+    bool* removed = calloc(totalCount + 1, sizeof(bool));
+
+    //The number of Books submitted so far, and the number remaining
+    long long submittedCount = bookCount;
+    long long remainingCount = bookCount;
+
+    //The default catalog, which the snapshot and the log tail are written for, and the snapshot's table entry for it
+    Catalog* catalog;
+    SnapshotCatalog table[1];
+
+    //The fields of the record being logged
+    char title[100];
+    char location[100];
+    char newLocation[100];
+
+    if (books == NULL || locations == NULL || removed == NULL) {
+        fprintf(stderr, "ERROR: There isn't enough memory to build a %lld Book snapshot.\n", bookCount);
+        exit(1);
+    }
+
+    //Build the snapshot's Catalog, with authors shared between many Books
+    for (long long i = 0; i < bookCount; i++) {
+        sprintf(books[i].title, "Title %lld", i);
+        sprintf(books[i].author, "Author %lld", i % 10000);
+        sprintf(books[i].location, "Shelf %lld-0", i);
+        books[i].previous = i > 0 ? &books[i - 1] : NULL;
+        books[i].next = i + 1 < bookCount ? &books[i + 1] : NULL;
+    }
+
+    //Write the snapshot of the default catalog as if every Book had been logged before it
+    unlink(snapshotPath);
+    unlink(logPath);
+
+    catalog = findCatalog("", true);
+    catalog->books = bookCount > 0 ? books : NULL;
+
+    gettimeofday(&start, NULL);
+
+    if (writeSnapshot(catalog, snapshotPath, bookCount, table) < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    printf("Wrote a %lld Book snapshot in %.2fs.\n", bookCount, secondsSince(&start));
+
+    catalog->books = NULL;
+    free(books);
+
+    //Start the log after the snapshot
+    snapshotLsn = bookCount;
+
+    if (openWriteAheadLog(logPath, WAL_ASYNC, 0) < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+    srand(1);
+
+    //Log the tail: half submissions of new Books, and a quarter each removals and moves of random remaining Books
+    for (long long i = 0; i < tailCount; i++) {
+
+        int choice = rand() % 4;
+        long long target;
+        char author[100];
+
+        //Submit a new Book
+        if (choice < 2 || remainingCount == 0) {
+
+            target = submittedCount++;
+            remainingCount++;
+
+            sprintf(title, "Title %lld", target);
+            sprintf(author, "Author %lld", target % 10000);
+            sprintf(location, "Shelf %lld-0", target);
+
+            logMutation(WAL_SUBMIT, title, author, location, "");
+            continue;
+        }
+
+        //Pick a random Book that hasn't been removed
+        do {
+            target = ((long long) rand() * RAND_MAX + rand()) % submittedCount;
+        } while (removed[target] == true);
+
+        sprintf(title, "Title %lld", target);
+        sprintf(author, "Author %lld", target % 10000);
+        sprintf(location, "Shelf %lld-%d", target, locations[target]);
+
+        //Remove it
+        if (choice == 2) {
+            removed[target] = true;
+            remainingCount--;
+            logMutation(WAL_REMOVE, title, author, location, "");
+        }
+
+        //Or move it to its next location
+        else {
+            locations[target]++;
+            sprintf(newLocation, "Shelf %lld-%d", target, locations[target]);
+            logMutation(WAL_MOVE, title, author, location, newLocation);
+        }
+    }
+
+    printf("Wrote a %lld record log tail in %.2fs.\n", tailCount, secondsSince(&start));
+
+    //Report the size the recovered Catalog should have
+    if (write(resultPipe[1], &remainingCount, sizeof(long long)) != sizeof(long long)) {
+        exit(1);
+    }
+
+    exit(0);
+}
+
+
+
+//FUNCTION measureRecovery
+void measureRecovery(char snapshotPath[], char logPath[], long long expectedCount) {
+
+    //The child process recovering the Catalog
+    pid_t child;
+
+    //The start of recovery, and the time taken by each step
+    struct timeval start;
+    double snapshotSeconds;
+    double replaySeconds;
+
+    //The number of Books loaded, records replayed and Books recovered
+    long long loadedCount;
+    int replayedCount;
+    long long recoveredCount = 0;
+
+    //Recover in a fresh child process, as a restarted server would
+    fflush(stdout);
+    child = fork();
+
+    if (child < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    if (child > 0) {
+        waitpid(child, NULL, 0);
+        return;
+    }
+
+    //Load the snapshot, then replay the log tail after it
+    gettimeofday(&start, NULL);
+    loadedCount = loadSnapshot(snapshotPath);
+    snapshotSeconds = secondsSince(&start);
+
+    gettimeofday(&start, NULL);
+    replayedCount = openWriteAheadLog(logPath, WAL_ASYNC, 0);
+    replaySeconds = secondsSince(&start);
+
+    if (loadedCount < 0 || replayedCount < 0) {
+        fprintf(stderr, "ERROR: The Catalog could not be recovered.\n");
+        exit(1);
+    }
+
+    //Check the recovered Catalog has every Book it should
+    for (Book* it = findCatalog("", true)->books; it != NULL; it = it->next) {
+        recoveredCount++;
+    }
+
+    printf("%-16s %12s %12s %14s\n", "step", "count", "seconds", "per second");
+    printf("%-16s %12lld %12.3f %14.0f\n", "snapshot load", loadedCount, snapshotSeconds, snapshotSeconds > 0 ? loadedCount / snapshotSeconds : 0.0);
+    printf("%-16s %12d %12.3f %14.0f\n", "log replay", replayedCount, replaySeconds, replaySeconds > 0 ? replayedCount / replaySeconds : 0.0);
+    printf("%-16s %12lld %12.3f\n", "total", recoveredCount, snapshotSeconds + replaySeconds);
+
+    if (recoveredCount != expectedCount) {
+        fprintf(stderr, "ERROR: The recovered Catalog has %lld Books, but should have %lld.\n", recoveredCount, expectedCount);
+        exit(1);
+    }
+
+    exit(0);
+}
+
+
+
+//FUNCTION secondsSince
+double secondsSince(struct timeval* start) {
+
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
@@ -0,0 +1,167 @@
+/*
+ * RequestParsingTest.c - Checks that request fields too long for the server's containers are refused instead of copied.
+ *
+ * The test links against the server's own request handling, so every request takes the same path as one from a client. Building it with
+ * AddressSanitizer also catches any field still copied past its container:
+ *     gcc -g -fsanitize=address -pthread -DSERVER_NO_MAIN -o RequestParsingTest RequestParsingTest.c Server.c
+ *     ./RequestParsingTest
+ *
+ * It prints a line per check and exits with 1 if any of them failed.
+ */
+#define _XOPEN_SOURCE 500
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+//The request handling function from Server.c
+void decipherRequest(char request[], int childfd);
+
+//The server's end of the connection, and the end the responses are read from
+int serverfd;
+int clientfd;
+
+//The number of checks that failed
+int failures = 0;
+
+
+
+/* Name: checkResponse
+ * Description: This function sends a request through the server's request handling and checks that its response starts with the
+ *              expected text, printing the result.
+ *
+ * Parameter: label                 What the check is about, printed with its result
+ * Parameter: request               The request message, without its LF character
+ * Parameter: expected              The text the response must start with
+ * Return: None
+*/
+void checkResponse(const char label[], const char request[], const char expected[]);
+
+
+
+/* Name: repeatedField
+ * Description: This function builds a field made of a single character repeated, to make a field longer than any container.
+ *
+ * Parameter: field                 The container for the field
+ * Parameter: length                The number of characters in the field
+ * Return: None
+*/
+void repeatedField(char field[], int length);
+
+
+
+//Main loop
+int main(int argc, char **argv) {
+
+    //The two ends of the connection
+    int ends[2];
+
+    //A title, author, field name and catalog name longer than the server keeps
+    char longTitle[3001];
+    char longAuthor[201];
+    char longField[21];
+    char longCatalog[101];
+    char longestCatalog[100];
+
+    //A request built around one of them
+    char request[4000];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    serverfd = ends[0];
+    clientfd = ends[1];
+
+    repeatedField(longTitle, 3000);
+    repeatedField(longAuthor, 200);
+    repeatedField(longField, 20);
+    repeatedField(longCatalog, 100);
+    repeatedField(longestCatalog, 99);
+
+    //A field that fits is still accepted
+    checkResponse("fitting SUBMIT", "METHOD:SUBMIT,TITLE:Short Title,AUTHOR:Short Author,LOCATION:Shelf 1", "201: SUBMITTED");
+
+    //A value too long for its container is refused
+    snprintf(request, sizeof(request), "METHOD:SUBMIT,TITLE:%s,AUTHOR:Author,LOCATION:Shelf 1", longTitle);
+    checkResponse("overlong TITLE", request, "404:BAD REQUEST");
+
+    snprintf(request, sizeof(request), "METHOD:GET,AUTHOR:%s", longAuthor);
+    checkResponse("overlong AUTHOR", request, "404:BAD REQUEST");
+
+    snprintf(request, sizeof(request), "METHOD:GETMANY,TITLE:Short Title,AUTHOR:Short Author,TITLE:%s,AUTHOR:Author", longTitle);
+    checkResponse("overlong GETMANY key", request, "404:BAD REQUEST");
+
+    //So is a field name too long for its container
+    snprintf(request, sizeof(request), "METHOD:GET,%s:Short Title", longField);
+    checkResponse("overlong field name", request, "404:BAD REQUEST");
+
+    //And a catalog name too long for a catalog, whether the catalog would be created or only looked up
+    snprintf(request, sizeof(request), "CATALOG:%s,METHOD:SUBMIT,TITLE:Title,AUTHOR:Author,LOCATION:Shelf 1", longCatalog);
+    checkResponse("overlong CATALOG on SUBMIT", request, "404:BAD REQUEST");
+
+    snprintf(request, sizeof(request), "CATALOG:%s,METHOD:GET,TITLE:Title,AUTHOR:Author", longCatalog);
+    checkResponse("overlong CATALOG on GET", request, "404:BAD REQUEST");
+
+    //While the longest name that fits still names a catalog of its own
+    snprintf(request, sizeof(request), "CATALOG:%s,METHOD:SUBMIT,TITLE:Title,AUTHOR:Catalog Author,LOCATION:Shelf 1", longestCatalog);
+    checkResponse("longest CATALOG", request, "201: SUBMITTED");
+
+    snprintf(request, sizeof(request), "CATALOG:%s,METHOD:GET,AUTHOR:Catalog Author", longestCatalog);
+    checkResponse("longest CATALOG kept", request, "202:RETRIEVED");
+
+    //The refused SUBMIT left nothing behind, and the Book that fit is still there
+    checkResponse("refused SUBMIT not applied", "METHOD:GET,AUTHOR:Author", "402:NOT FOUND");
+    checkResponse("fitting Book kept", "METHOD:GET,TITLE:Short Title,AUTHOR:Short Author", "202:RETRIEVED");
+
+    close(serverfd);
+    close(clientfd);
+
+    printf("%s\n", failures == 0 ? "All checks passed." : "Some checks failed.");
+
+    return failures == 0 ? 0 : 1;
+}
+
+
+
+//FUNCTION checkResponse
+void checkResponse(const char label[], const char request[], const char expected[]) {
+
+    //The request, which parsing consumes, and the response read back
+    char* requestCopy = strdup(request);
+    char response[1000];
+    ssize_t responseLength;
+
+    decipherRequest(requestCopy, serverfd);
+    free(requestCopy);
+
+    //The response has been written by the time decipherRequest returns
+    responseLength = read(clientfd, response, sizeof(response) - 1);
+
+    if (responseLength < 0) {
+        responseLength = 0;
+    }
+
+    response[responseLength] = '\0';
+
+    if (strncmp(response, expected, strlen(expected)) == 0) {
+        printf("PASS  %s\n", label);
+    }
+    else {
+        printf("FAIL  %s: expected '%s', got '%.60s'\n", label, expected, response);
+        failures++;
+    }
+}
+
+
+
+//FUNCTION repeatedField
+void repeatedField(char field[], int length) {
+    memset(field, 'x', length);
+    field[length] = '\0';
+}
@@ -0,0 +1,1582 @@
+/*
+ * Router.c - Spreads the Book Catalog across several servers by hashing each Book's author onto a consistent-hash ring.
+ *
+ * Clients connect to the router as if it were a server and send it the same requests. Requests for a single author go straight to the
+ * server that owns the author's hash; title-only GET requests and REMOVEALL requests without an author go to every server and their
+ * responses are merged. A server added with METHOD:ADDNODE,NODE:<host>:<port> only takes over the parts of the ring its points land
+ * on, which are moved to it from their old owners with EXPORT requests, so the rest of the Catalog stays where it is. Requests naming a
+ * CATALOG are routed the same way, and a new server takes over its ranges of every catalog.
+ *     gcc -O2 -pthread -o Router Router.c
+ *     ./Router [-v <points per server>] <port> <host>:<port> [<host>:<port> ...]
+ */
+#define _GNU_SOURCE
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+//The longest request message a client can send, as defined by Server.c
+#define MAX_REQUEST_LENGTH 32768
+
+//The maximum number of (title, author) keys in a single GETMANY request, as defined by Server.c
+#define MAX_GETMANY_KEYS 100
+
+//The longest request ID a client can send, as defined by Server.c
+#define MAX_REQUEST_ID_LENGTH 32
+
+//The maximum number of servers behind the router
+#define MAX_NODES 32
+
+//The number of points each server has on the ring by default. More points spread the Catalog more evenly
+#define DEFAULT_POINTS_PER_NODE 64
+
+//The number of Books moved per round trip while a server is being added
+#define MIGRATION_BATCH 256
+
+
+
+//A server behind the router
+typedef struct node {
+    char host[300];
+    int port;
+} Node;
+
+//A point on the ring, owning the author hashes after the previous point up to and including its own
+typedef struct ringPoint {
+    unsigned int hash;
+    int node;
+} RingPoint;
+
+//The consistent-hash ring, sorted by hash
+typedef struct ring {
+    RingPoint* points;
+    int pointCount;
+} Ring;
+
+//A growable message, used for requests and responses that can't be bounded in advance
+typedef struct responseBuffer {
+    char* text;
+    int length;
+    int capacity;
+} ResponseBuffer;
+
+//A client's connection to one server, and the response bytes read from it but not yet used
+typedef struct backendConnection {
+    int fd;
+    ResponseBuffer received;
+} BackendConnection;
+
+//A client of the router, with its own connection to every server it has sent a request to
+typedef struct session {
+    int childfd;
+    BackendConnection backends[MAX_NODES];
+    unsigned long long nextId;
+} Session;
+
+
+
+//The servers behind the router, in the order they were added
+Node nodes[MAX_NODES];
+int nodeCount = 0;
+
+//The ring, and the lock every request holds while routing by it. Adding a server holds it exclusively until its ranges have moved
+Ring ring = { NULL, 0 };
+pthread_rwlock_t ringLock;
+
+//The number of points each server has on the ring
+int pointsPerNode = DEFAULT_POINTS_PER_NODE;
+
+
+
+/* Name: addNode
+ * Description: This function adds a server to the ring. Every range of author hashes that the new server's points take over is exported from
+ *              its old owner, submitted to the new server and then removed from the old owner, in every catalog on the servers, before the new
+ *              ring is used by any request. If any range can't be moved, the ring is left as it was.
+ *
+ * Parameter: session               The session making the request, whose server connections are used to move the ranges
+ * Parameter: name                  The new server's <host>:<port>
+ * Parameter: response              Where to put the response message
+ * Return: None
+*/
+void addNode(Session* session, char name[], ResponseBuffer* response);
+
+
+
+/* Name: appendResponse
+ * Description: This function appends text to a growable message, doubling its capacity whenever it runs out of room.
+ *
+ * Parameter: response              The message to append to
+ * Parameter: text                  The text to append
+ * Return: None
+*/
+void appendResponse(ResponseBuffer* response, const char text[]);
+
+
+
+/* Name: appendResponseBytes
+ * Description: This function appends bytes to a growable message, doubling its capacity whenever it runs out of room, and keeps it terminated.
+ *
+ * Parameter: response              The message to append to
+ * Parameter: text                  The bytes to append
+ * Parameter: length                The number of bytes to append
+ * Return: None
+*/
+void appendResponseBytes(ResponseBuffer* response, const char text[], int length);
+
+
+
+/* Name: buildRing
+ * Description: This function places every point of the given servers on a new ring and sorts them by hash.
+ *
+ * Parameter: count                 The number of servers, from the first, to place on the ring
+ * Parameter: newRing               Where to put the ring
+ * Return: None
+*/
+void buildRing(int count, Ring* newRing);
+
+
+
+/* Name: closeBackend
+ * Description: This function closes a session's connection to a server, so the next request to it reconnects.
+ *
+ * Parameter: session               The session
+ * Parameter: node                  The server's number
+ * Return: None
+*/
+void closeBackend(Session* session, int node);
+
+
+
+/* Name: compareRingPoints
+ * Description: This function compares two ring points by hash for qsort, breaking ties by server so every ring is built the same way.
+ *
+ * Parameter: first             A pointer to the first point
+ * Parameter: second            A pointer to the second point
+ * Return: A negative, zero or positive number as the first point comes before, with or after the second
+*/
+int compareRingPoints(const void* first, const void* second);
+
+
+
+/* Name: exchange
+ * Description: This function sends a request to a server and reads its response.
+ *
+ * Parameter: session               The session sending the request
+ * Parameter: node                  The server's number
+ * Parameter: request               The request message, without its ending newline character
+ * Parameter: body                  Where to put the response message
+ * Return: 0 if the response was read, or -1 if the server couldn't be reached
+*/
+int exchange(Session* session, int node, char request[], ResponseBuffer* body);
+
+
+
+/* Name: findNode
+ * Description: This function finds the server that owns an author hash: the one with the first point at or after the hash, wrapping around
+ *              to the first point.
+ *
+ * Parameter: searchRing            The ring to search
+ * Parameter: hash                  The author hash
+ * Return: The server's number
+*/
+int findNode(Ring* searchRing, unsigned int hash);
+
+
+
+/* Name: forwardGetMany
+ * Description: This function splits a GETMANY request's keys between the servers that own their authors, sends every server its keys at once,
+ *              then puts the key blocks of their responses back together in the order the client asked for them.
+ *
+ * Parameter: session               The session making the request
+ * Parameter: catalog               The catalog the request names, or blank for the default catalog
+ * Parameter: request               The request message's fields after its METHOD field
+ * Parameter: response              Where to put the response message
+ * Return: None
+*/
+void forwardGetMany(Session* session, char catalog[], char request[], ResponseBuffer* response);
+
+
+
+/* Name: forwardRequest
+ * Description: This function sends a request to the server that owns an author and passes its response back.
+ *
+ * Parameter: session               The session making the request
+ * Parameter: author                The author the request is for
+ * Parameter: request               The whole request message
+ * Parameter: response              Where to put the response message
+ * Return: None
+*/
+void forwardRequest(Session* session, char author[], char request[], ResponseBuffer* response);
+
+
+
+/* Name: hashString
+ * Description: This function hashes a string with 32-bit FNV-1a, the same hash Server.c uses for EXPORT ranges.
+ *
+ * Parameter: text                  The string to hash
+ * Return: The hash
+*/
+unsigned int hashString(const char text[]);
+
+
+
+/* Name: launchClientLoop
+ * Description: This function runs a client's thread. It reads the client's request messages, routes each one in order and sends back its
+ *              response, framed with its request ID if it had one, until the client disconnects.
+ *
+ * Parameter: arg                   The client's socket, in a malloc'd int
+ * Return: NULL
+*/
+void* launchClientLoop(void* arg);
+
+
+
+/* Name: listCatalogs
+ * Description: This function asks every server on the ring for its catalogs and collects their names, each one once.
+ *
+ * Parameter: session               The session making the request
+ * Parameter: names                 Where to put the names, each one on its own line after a leading newline
+ * Return: The number of catalogs, or -1 if a server couldn't be asked
+*/
+int listCatalogs(Session* session, ResponseBuffer* names);
+
+
+
+/* Name: listNodes
+ * Description: This function describes every server on the ring and the share of author hashes it owns.
+ *
+ * Parameter: response              Where to put the response message
+ * Return: None
+*/
+void listNodes(ResponseBuffer* response);
+
+
+
+/* Name: mixHash
+ * Description: This function scrambles the bits of a hash, so ring points named alike still land far apart on the ring.
+ *
+ * Parameter: hash                  The hash to scramble
+ * Return: The scrambled hash
+*/
+unsigned int mixHash(unsigned int hash);
+
+
+
+/* Name: moveRange
+ * Description: This function moves every Book of a catalog whose author hashes into a range from one server to another: it exports them from
+ *              the old server, submits them to the new one and then removes them from the old one, a batch at a time.
+ *
+ * Parameter: session               The session moving the range
+ * Parameter: catalog               The catalog to move the Books of, or blank for the default catalog
+ * Parameter: fromNode              The server that owns the range now
+ * Parameter: toNode                The server taking the range over
+ * Parameter: fromHash              The author hash the range starts after
+ * Parameter: toHash                The last author hash in the range
+ * Return: The number of Books moved, or -1 if they couldn't all be moved
+*/
+long long moveRange(Session* session, char catalog[], int fromNode, int toNode, unsigned int fromHash, unsigned int toHash);
+
+
+
+/* Name: parseRequest
+ * Description: This function takes the next FIELD:value token off the front of a request message, the same way Server.c does. The field
+ *              is cut to 14 characters and the value to 99, so they always fit the buffers they are parsed into.
+ *
+ * Parameter: request               The request message, which loses its first token
+ * Parameter: method                Where to put the token's field, which must have room for 15 characters
+ * Parameter: value                 Where to put the token's value, which must have room for 100 characters
+ * Return: None
+*/
+void parseRequest(char request[], char method[], char value[]);
+
+
+
+/* Name: receiveBackendResponse
+ * Description: This function reads the next framed response from a session's connection to a server.
+ *
+ * Parameter: session               The session
+ * Parameter: node                  The server's number
+ * Parameter: body                  Where to put the response message, without its framing line
+ * Return: 0 if a response was read, or -1 if the connection failed
+*/
+int receiveBackendResponse(Session* session, int node, ResponseBuffer* body);
+
+
+
+/* Name: routeRequest
+ * Description: This function answers a client's request by sending it to the server that owns its author, to every server, or by handling it
+ *              in the router itself.
+ *
+ * Parameter: session               The session making the request
+ * Parameter: request               The request message, without its request ID or ending newline character
+ * Parameter: response              Where to put the response message
+ * Return: None
+*/
+void routeRequest(Session* session, char request[], ResponseBuffer* response);
+
+
+
+/* Name: scatterRequest
+ * Description: This function sends the same request to every server on the ring before reading any response, so the servers answer it at
+ *              the same time, then reads every response.
+ *
+ * Parameter: session               The session making the request
+ * Parameter: request               The request message, without its ending newline character
+ * Parameter: bodies                Where to put each server's response message
+ * Parameter: reached               Whether each server's response was read
+ * Return: None
+*/
+void scatterRequest(Session* session, char request[], ResponseBuffer bodies[], bool reached[]);
+
+
+
+/* Name: sendBackendRequest
+ * Description: This function sends a request to a server, framed with a request ID so its response is framed too, connecting first if the
+ *              session isn't connected to it.
+ *
+ * Parameter: session               The session sending the request
+ * Parameter: node                  The server's number
+ * Parameter: request               The request message, without its ending newline character
+ * Return: 0 if the request was sent, or -1 if the server couldn't be reached
+*/
+int sendBackendRequest(Session* session, int node, char request[]);
+
+
+
+/* Name: writeFully
+ * Description: This function writes every one of the given bytes to a socket.
+ *
+ * Parameter: fd                    The socket to write to
+ * Parameter: buffer                The bytes to write
+ * Parameter: length                The number of bytes to write
+ * Return: 0 if every byte was written, or -1 if the connection ended first
+*/
+int writeFully(int fd, const void* buffer, int length);
+
+
+
+//Main loop
+int main(int argc, char **argv) {
+
+    //The router's listening socket and the client being accepted
+    int listenfd;
+    int childfd;
+    struct sockaddr_in serveraddr;
+
+    //Flag value for setsockopt
+    int optval = 1;
+
+    //The command line option being parsed
+    int option;
+
+    while ((option = getopt(argc, argv, "v:")) != -1) {
+
+        //-v: The number of points each server has on the ring
+        if (option == 'v' && atoi(optarg) > 0) {
+            pointsPerNode = atoi(optarg);
+        }
+
+        else {
+            fprintf(stderr, "usage: %s [-v <points per server>] <port> <host>:<port> [<host>:<port> ...]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    //Verify the user specified a port and at least one server
+    if (argc - optind < 2 || argc - optind - 1 > MAX_NODES) {
+        fprintf(stderr, "usage: %s [-v <points per server>] <port> <host>:<port> [<host>:<port> ...]\n", argv[0]);
+        exit(1);
+    }
+
+    //Grab every server
+    for (int i = optind + 1; i < argc; i++) {
+
+        if (sscanf(argv[i], "%299[^:]:%d", nodes[nodeCount].host, &nodes[nodeCount].port) != 2 || nodes[nodeCount].port <= 0) {
+            fprintf(stderr, "usage: %s isn't a <host>:<port>.\n", argv[i]);
+            exit(1);
+        }
+
+        nodeCount++;
+    }
+
+    //Place the servers on the ring. Adding a server waits for requests in progress, and requests arriving after it wait for the move
+    {
+        pthread_rwlockattr_t attributes;
+
+        pthread_rwlockattr_init(&attributes);
+        pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        pthread_rwlock_init(&ringLock, &attributes);
+        pthread_rwlockattr_destroy(&attributes);
+    }
+
+    buildRing(nodeCount, &ring);
+
+    //Create the listening socket
+    listenfd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (listenfd < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    //Let the router be restarted straight away on the same port
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+    //Build the router's internet address
+    memset(&serveraddr, 0, sizeof(serveraddr));
+    serveraddr.sin_family = AF_INET;
+    serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    serveraddr.sin_port = htons(atoi(argv[optind]));
+
+    if (bind(listenfd, (struct sockaddr *) &serveraddr, sizeof(serveraddr)) < 0 || listen(listenfd, SOMAXCONN) < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    printf("Routing port %s to %d servers with %d points each.\n", argv[optind], nodeCount, pointsPerNode);
+
+    //Give every client its own thread
+    while (1) {
+
+        pthread_t clientThread;
+        int* clientfd;
+
+        childfd = accept(listenfd, NULL, NULL);
+
+        if (childfd < 0) {
+            perror("ERROR: ");
+            continue;
+        }
+
+        clientfd = malloc(sizeof(int));
+        *clientfd = childfd;
+
+        pthread_create(&clientThread, NULL, launchClientLoop, clientfd);
+        pthread_detach(clientThread);
+    }
+
+    return 0;
+}
+
+
+
+//FUNCTION addNode
+void addNode(Session* session, char name[], ResponseBuffer* response) {
+
+    //The ring with the new server on it
+    Ring newRing;
+
+    //The new server's number, and the Books and ranges moved to it
+    int newNode = nodeCount;
+    long long movedCount = 0;
+    int rangeCount = 0;
+
+    //The names of every catalog on the servers, each one after a newline
+    ResponseBuffer catalogNames = { NULL, 0, 0 };
+
+    //The response's summary line
+    char line[400];
+
+    if (nodeCount == MAX_NODES) {
+        appendResponse(response, "409:BUSY\nMESSAGE:The router already has as many servers as it can hold.\n");
+        return;
+    }
+
+    //Get the new server's address
+    if (sscanf(name, "%299[^:]:%d", nodes[newNode].host, &nodes[newNode].port) != 2 || nodes[newNode].port <= 0) {
+        appendResponse(response, "404:BAD REQUEST\nMESSAGE:Request Message needs a NODE field of <host>:<port>.\n");
+        return;
+    }
+
+    //A server can only be on the ring once
+    for (int i = 0; i < nodeCount; i++) {
+        if (strcmp(nodes[i].host, nodes[newNode].host) == 0 && nodes[i].port == nodes[newNode].port) {
+            appendResponse(response, "401:DUPLICATE\nMESSAGE:The server is already on the ring.\n");
+            return;
+        }
+    }
+
+    //Every catalog has Books to move, so find them all before the ring changes
+    if (listCatalogs(session, &catalogNames) < 0) {
+        free(catalogNames.text);
+        appendResponse(response, "503:UNAVAILABLE\nMESSAGE:The server could not be added because not every server could be asked for its catalogs.\n");
+        return;
+    }
+
+    buildRing(nodeCount + 1, &newRing);
+
+    //Each of the new server's points takes over the hashes after the point before it, all of which the old ring gave to the same server
+    for (int i = 0; i < newRing.pointCount; i++) {
+
+        RingPoint* point = &newRing.points[i];
+        RingPoint* previous = &newRing.points[(i + newRing.pointCount - 1) % newRing.pointCount];
+        long long rangeMoved = 0;
+
+        if (point->node != newNode || previous->hash == point->hash) {
+            continue;
+        }
+
+        //Move the range of every catalog in turn
+        for (char* name = catalogNames.text + 1; *name != '\0' && rangeMoved >= 0; name = strchr(name, '\n') + 1) {
+
+            char catalog[100];
+            long long catalogMoved;
+
+            sscanf(name, "%99[^\n]", catalog);
+
+            if (*name == '\n') {
+                catalog[0] = '\0';
+            }
+
+            catalogMoved = moveRange(session, catalog, findNode(&ring, point->hash), newNode, previous->hash, point->hash);
+            rangeMoved = catalogMoved < 0 ? -1 : rangeMoved + catalogMoved;
+        }
+
+        //If a range couldn't be moved, keep routing by the old ring. Books already copied to the new server are never read from it
+        if (rangeMoved < 0) {
+            fprintf(stderr, "ERROR: A range could not be moved to %s:%d.\n", nodes[newNode].host, nodes[newNode].port);
+            free(newRing.points);
+            free(catalogNames.text);
+            closeBackend(session, newNode);
+            appendResponse(response, "500:MIGRATION FAILED\nMESSAGE:The server could not be added because part of the Catalog could not be moved to it.\n");
+            return;
+        }
+
+        movedCount += rangeMoved;
+        rangeCount++;
+    }
+
+    free(catalogNames.text);
+
+    //Route by the new ring from now on
+    free(ring.points);
+    ring = newRing;
+    nodeCount++;
+
+    printf("Added %s:%d, moving %lld Books in %d ranges.\n", nodes[newNode].host, nodes[newNode].port, movedCount, rangeCount);
+    fflush(stdout);
+
+    sprintf(line, "208:NODE ADDED\nNODE:%s:%d\nMOVED:%lld\nRANGES:%d\n", nodes[newNode].host, nodes[newNode].port, movedCount, rangeCount);
+    appendResponse(response, line);
+}
+
+
+
+//FUNCTION appendResponse
+void appendResponse(ResponseBuffer* response, const char text[]) {
+    appendResponseBytes(response, text, strlen(text));
+}
+
+
+
+//FUNCTION appendResponseBytes
+void appendResponseBytes(ResponseBuffer* response, const char text[], int length) {
+
+    //Double the response's capacity until the bytes and terminator fit
+    if (response->length + length + 1 > response->capacity) {
+
+        while (response->length + length + 1 > response->capacity) {
+            response->capacity = response->capacity > 0 ? response->capacity * 2 : 1000;
+        }
+
+        response->text = realloc(response->text, sizeof(char) * response->capacity);
+    }
+
+    //Copy the bytes after the current end of the response, keeping it terminated
+    memcpy(response->text + response->length, text, length);
+    response->length += length;
+    response->text[response->length] = '\0';
+}
+
+
+
+//FUNCTION buildRing
+void buildRing(int count, Ring* newRing) {
+
+    //The name each point is hashed from
+    char pointName[400];
+
+    newRing->pointCount = count * pointsPerNode;
+    newRing->points = malloc(sizeof(RingPoint) * newRing->pointCount);
+
+    //Hash every server's points from its address, so every router places them the same way
+    for (int n = 0; n < count; n++) {
+        for (int p = 0; p < pointsPerNode; p++) {
+
+            RingPoint* point = &newRing->points[n * pointsPerNode + p];
+
+            sprintf(pointName, "%.299s:%d#%d", nodes[n].host, nodes[n].port, p);
+            point->hash = mixHash(hashString(pointName));
+            point->node = n;
+        }
+    }
+
+    qsort(newRing->points, newRing->pointCount, sizeof(RingPoint), compareRingPoints);
+}
+
+
+
+//FUNCTION closeBackend
+void closeBackend(Session* session, int node) {
+
+    BackendConnection* backend = &session->backends[node];
+
+    if (backend->fd >= 0) {
+        close(backend->fd);
+    }
+
+    backend->fd = -1;
+    backend->received.length = 0;
+}
+
+
+
+//FUNCTION compareRingPoints
+int compareRingPoints(const void* first, const void* second) {
+
+    const RingPoint* firstPoint = (const RingPoint*) first;
+    const RingPoint* secondPoint = (const RingPoint*) second;
+
+    if (firstPoint->hash != secondPoint->hash) {
+        return firstPoint->hash < secondPoint->hash ? -1 : 1;
+    }
+
+    return firstPoint->node - secondPoint->node;
+}
+
+
+
+//FUNCTION exchange
+int exchange(Session* session, int node, char request[], ResponseBuffer* body) {
+
+    if (sendBackendRequest(session, node, request) < 0) {
+        return -1;
+    }
+
+    return receiveBackendResponse(session, node, body);
+}
+
+
+
+//FUNCTION findNode
+int findNode(Ring* searchRing, unsigned int hash) {
+
+    //Binary search for the first point at or after the hash
+    int low = 0;
+    int high = searchRing->pointCount;
+
+    while (low < high) {
+
+        int middle = low + (high - low) / 2;
+
+        if (searchRing->points[middle].hash < hash) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    //Past the last point, the ring wraps around to the first
+    return searchRing->points[low == searchRing->pointCount ? 0 : low].node;
+}
+
+
+
+//FUNCTION forwardGetMany
+void forwardGetMany(Session* session, char catalog[], char request[], ResponseBuffer* response) {
+
+    //Every key's title, author and server, and its position in its server's request
+    char titles[MAX_GETMANY_KEYS][100];
+    char authors[MAX_GETMANY_KEYS][100];
+    int keyNodes[MAX_GETMANY_KEYS];
+    int keyPositions[MAX_GETMANY_KEYS];
+    int keyCount = 0;
+
+    //Each server's request and response, and where each key's block starts and ends in the response
+    ResponseBuffer requests[MAX_NODES];
+    ResponseBuffer bodies[MAX_NODES];
+    bool reached[MAX_NODES];
+    int nodeKeyCounts[MAX_NODES];
+    int blockStarts[MAX_GETMANY_KEYS];
+    int blockEnds[MAX_GETMANY_KEYS];
+
+    //A field of the request, and the response's lines
+    char method[15];
+    char value[100];
+    char line[300];
+
+    //Parse TITLE and AUTHOR pairs until the request message is used up, rejecting the same key lists Server.c does
+    while (strlen(request) > 0 && keyCount >= 0) {
+
+        if (keyCount == MAX_GETMANY_KEYS) {
+            keyCount = -1;
+            break;
+        }
+
+        parseRequest(request, method, value);
+        if (strcmp(method, "TITLE") != 0 || strlen(value) == 0) {
+            keyCount = -1;
+            break;
+        }
+        strcpy(titles[keyCount], value);
+
+        parseRequest(request, method, value);
+        if (strcmp(method, "AUTHOR") != 0 || strlen(value) == 0) {
+            keyCount = -1;
+            break;
+        }
+        strcpy(authors[keyCount], value);
+
+        keyCount++;
+    }
+
+    if (keyCount <= 0) {
+        appendResponse(response, "404:BAD REQUEST\nMESSAGE:Request Message has an invalid key list.\n");
+        return;
+    }
+
+    //Build each server's request from the keys it owns
+    for (int n = 0; n < nodeCount; n++) {
+        requests[n] = (ResponseBuffer) { NULL, 0, 0 };
+        bodies[n] = (ResponseBuffer) { NULL, 0, 0 };
+        reached[n] = false;
+        nodeKeyCounts[n] = 0;
+    }
+
+    for (int k = 0; k < keyCount; k++) {
+
+        keyNodes[k] = findNode(&ring, hashString(authors[k]));
+        keyPositions[k] = nodeKeyCounts[keyNodes[k]]++;
+        blockStarts[k] = -1;
+
+        //Each server is asked in the same catalog as the client's request
+        if (requests[keyNodes[k]].length == 0) {
+
+            if (catalog[0] != '\0') {
+                appendResponse(&requests[keyNodes[k]], "CATALOG:");
+                appendResponse(&requests[keyNodes[k]], catalog);
+                appendResponse(&requests[keyNodes[k]], ",");
+            }
+
+            appendResponse(&requests[keyNodes[k]], "METHOD:GETMANY");
+        }
+
+        appendResponse(&requests[keyNodes[k]], ",TITLE:");
+        appendResponse(&requests[keyNodes[k]], titles[k]);
+        appendResponse(&requests[keyNodes[k]], ",AUTHOR:");
+        appendResponse(&requests[keyNodes[k]], authors[k]);
+    }
+
+    //Send every server its keys before reading any response
+    for (int n = 0; n < nodeCount; n++) {
+        if (nodeKeyCounts[n] > 0) {
+            reached[n] = sendBackendRequest(session, n, requests[n].text) == 0;
+        }
+    }
+
+    for (int n = 0; n < nodeCount; n++) {
+        if (reached[n] == true) {
+            reached[n] = receiveBackendResponse(session, n, &bodies[n]) == 0 && strncmp(bodies[n].text, "202:", 4) == 0;
+        }
+    }
+
+    //Find where each key's block is in its server's response. A block's lines follow its KEY line, up to the next KEY or END line
+    for (int k = 0; k < keyCount; k++) {
+
+        char* text = bodies[keyNodes[k]].text;
+        char* block;
+
+        if (reached[keyNodes[k]] == false) {
+            continue;
+        }
+
+        sprintf(line, "\nKEY:%d\n", keyPositions[k] + 1);
+        block = strstr(text, line);
+
+        if (block != NULL) {
+
+            char* end;
+
+            //Skip the KEY line
+            block += strlen(line);
+
+            end = strstr(block, "\nKEY:");
+            if (end == NULL) {
+                end = strstr(block, "\nEND\n");
+            }
+
+            if (end != NULL) {
+                blockStarts[k] = block - text;
+                blockEnds[k] = end - text + 1;
+            }
+        }
+    }
+
+    //Put the blocks back together in the client's order
+    sprintf(line, "202:RETRIEVED\nKEYS:%d\n\n", keyCount);
+    appendResponse(response, line);
+
+    for (int k = 0; k < keyCount; k++) {
+
+        sprintf(line, "KEY:%d\n", k + 1);
+        appendResponse(response, line);
+
+        if (blockStarts[k] >= 0) {
+            appendResponseBytes(response, bodies[keyNodes[k]].text + blockStarts[k], blockEnds[k] - blockStarts[k]);
+        }
+
+        //If the key's server couldn't answer, say so in its block
+        else {
+            appendResponse(response, "TITLE:");
+            appendResponse(response, titles[k]);
+            appendResponse(response, "\nAUTHOR:");
+            appendResponse(response, authors[k]);
+            appendResponse(response, "\n503:UNAVAILABLE\n\n");
+        }
+    }
+
+    appendResponse(response, "END\n");
+
+    for (int n = 0; n < nodeCount; n++) {
+        free(requests[n].text);
+        free(bodies[n].text);
+    }
+}
+
+
+
+//FUNCTION forwardRequest
+void forwardRequest(Session* session, char author[], char request[], ResponseBuffer* response) {
+
+    //The server that owns the author
+    int node = findNode(&ring, hashString(author));
+
+    if (exchange(session, node, request, response) < 0) {
+        response->length = 0;
+        appendResponse(response, "503:UNAVAILABLE\nMESSAGE:The server holding the Book's author could not be reached.\n");
+    }
+}
+
+
+
+//FUNCTION hashString
+unsigned int hashString(const char text[]) {
+
+    //The FNV-1a offset basis
+    unsigned int hash = 2166136261u;
+
+    //Fold in every character with the FNV prime
+    for (int i = 0; text[i] != '\0'; i++) {
+        hash ^= (unsigned char) text[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+
+//FUNCTION launchClientLoop
+void* launchClientLoop(void* arg) {
+
+    //The client's session, with no server connections yet
+    Session session;
+
+    //The request data read from the client and not yet answered
+    char* requestBuffer = malloc(sizeof(char) * (MAX_REQUEST_LENGTH + 1));
+    int bufferedLength = 0;
+
+    session.childfd = *((int*) arg);
+    session.nextId = 0;
+    free(arg);
+
+    for (int n = 0; n < MAX_NODES; n++) {
+        session.backends[n].fd = -1;
+        session.backends[n].received = (ResponseBuffer) { NULL, 0, 0 };
+    }
+
+    //Loop to read client requests until they disconnect
+    while (1) {
+
+        char* requestEnd;
+        int requestLength = read(session.childfd, requestBuffer + bufferedLength, MAX_REQUEST_LENGTH - bufferedLength);
+
+        if (requestLength <= 0) {
+            break;
+        }
+
+        bufferedLength += requestLength;
+
+        //Route every request in the buffer that is terminated properly with a LF character, in order
+        while ((requestEnd = memchr(requestBuffer, '\n', bufferedLength)) != NULL) {
+
+            //The length of the request message including its LF character
+            int messageLength = requestEnd - requestBuffer + 1;
+
+            //The request's ID, and its response
+            char id[MAX_REQUEST_ID_LENGTH] = "";
+            ResponseBuffer response = { NULL, 0, 0 };
+
+            *requestEnd = '\0';
+
+            //Split the request ID off the front of the request, if it has one
+            if (strncmp(requestBuffer, "ID:", 3) == 0) {
+
+                char idType[8];
+                char* idValue = malloc(sizeof(char) * messageLength);
+
+                parseRequest(requestBuffer, idType, idValue);
+
+                //An invalid request ID is answered in a frame with the reserved request ID 0, the same way Server.c does
+                if (strlen(idValue) == 0 || strlen(idValue) >= MAX_REQUEST_ID_LENGTH) {
+                    appendResponse(&response, "404:BAD REQUEST,MESSAGE:Request Message has an invalid request ID.\n");
+                    strcpy(id, "0");
+                }
+                else {
+                    strcpy(id, idValue);
+                }
+
+                free(idValue);
+            }
+
+            if (response.length == 0) {
+                routeRequest(&session, requestBuffer, &response);
+            }
+
+            //Frame the response with its request ID, if it had one, the same way Server.c does, and send it in a single write
+            if (id[0] != '\0') {
+
+                ResponseBuffer framed = { NULL, 0, 0 };
+                char frameHeader[MAX_REQUEST_ID_LENGTH + 32];
+
+                sprintf(frameHeader, "ID:%s,LENGTH:%d\n", id, response.length);
+                appendResponse(&framed, frameHeader);
+                appendResponseBytes(&framed, response.text, response.length);
+
+                free(response.text);
+                response = framed;
+            }
+
+            writeFully(session.childfd, response.text, response.length);
+            free(response.text);
+
+            //Shift any remaining buffered data to the front of the buffer
+            bufferedLength -= messageLength;
+            memmove(requestBuffer, requestBuffer + messageLength, bufferedLength);
+        }
+
+        //If the buffer filled up without an ending newline character, discard it
+        if (bufferedLength == MAX_REQUEST_LENGTH) {
+            char badRequest[] = "404:BAD REQUEST,MESSAGE:Request Message is missing ending newline character.\n";
+
+            writeFully(session.childfd, badRequest, strlen(badRequest));
+            bufferedLength = 0;
+        }
+    }
+
+    //Close the client's socket and every server connection
+    close(session.childfd);
+
+    for (int n = 0; n < MAX_NODES; n++) {
+        closeBackend(&session, n);
+        free(session.backends[n].received.text);
+    }
+
+    free(requestBuffer);
+
+    return NULL;
+}
+
+
+
+//FUNCTION listCatalogs
+int listCatalogs(Session* session, ResponseBuffer* names) {
+
+    //A server's list of catalogs
+    ResponseBuffer listed = { NULL, 0, 0 };
+    int catalogCount = 0;
+
+    appendResponse(names, "\n");
+
+    for (int n = 0; n < nodeCount; n++) {
+
+        if (exchange(session, n, "METHOD:CATALOGS", &listed) < 0 || strncmp(listed.text, "202:RETRIEVED\nCOUNT:", 20) != 0) {
+            free(listed.text);
+            return -1;
+        }
+
+        //Add each name on a CATALOG line that isn't already in the list
+        for (char* line = strstr(listed.text, "\nCATALOG:"); line != NULL; line = strstr(line + 1, "\nCATALOG:")) {
+
+            char entry[104];
+            int nameLength = strcspn(line + 9, "\n");
+
+            if (nameLength > 99) {
+                continue;
+            }
+
+            sprintf(entry, "\n%.*s\n", nameLength, line + 9);
+
+            if (strstr(names->text, entry) == NULL) {
+                appendResponse(names, entry + 1);
+                catalogCount++;
+            }
+        }
+    }
+
+    free(listed.text);
+
+    return catalogCount;
+}
+
+
+
+//FUNCTION listNodes
+void listNodes(ResponseBuffer* response) {
+
+    //The number of author hashes each server owns
+    unsigned long long owned[MAX_NODES] = { 0 };
+    char line[400];
+
+    //Each point owns the hashes after the point before it, wrapping around the ring
+    for (int i = 0; i < ring.pointCount; i++) {
+        unsigned int previous = ring.points[(i + ring.pointCount - 1) % ring.pointCount].hash;
+        owned[ring.points[i].node] += (unsigned int) (ring.points[i].hash - previous);
+    }
+
+    //A ring with a single point gives it every hash
+    if (ring.pointCount == 1) {
+        owned[ring.points[0].node] = 4294967296ULL;
+    }
+
+    sprintf(line, "209:NODES\nCOUNT:%d\nPOINTS:%d\n", nodeCount, pointsPerNode);
+    appendResponse(response, line);
+
+    for (int n = 0; n < nodeCount; n++) {
+        sprintf(line, "NODE:%.299s:%d,SHARE:%.2f%%\n", nodes[n].host, nodes[n].port, owned[n] * 100.0 / 4294967296.0);
+        appendResponse(response, line);
+    }
+}
+
+
+
+//FUNCTION mixHash
+unsigned int mixHash(unsigned int hash) {
+
+    //The 32-bit finalizer from MurmurHash3
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+
+
+//FUNCTION moveRange
+long long moveRange(Session* session, char catalog[], int fromNode, int toNode, unsigned int fromHash, unsigned int toHash) {
+
+    //The field naming the catalog, put in front of every request, and the EXPORT request and its response
+    char catalogField[120] = "";
+    char request[400];
+    ResponseBuffer exported = { NULL, 0, 0 };
+
+    //The next Book in the exported list, and the start of the current batch
+    char* next;
+    char* batch;
+
+    //A moved Book's request, and a response read back
+    ResponseBuffer bookRequest = { NULL, 0, 0 };
+    ResponseBuffer body = { NULL, 0, 0 };
+
+    long long movedCount = 0;
+
+    if (catalog[0] != '\0') {
+        sprintf(catalogField, "CATALOG:%.99s,", catalog);
+    }
+
+    sprintf(request, "%sMETHOD:EXPORT,FROM:%u,TO:%u", catalogField, fromHash, toHash);
+
+    if (exchange(session, fromNode, request, &exported) < 0) {
+        free(exported.text);
+        return -1;
+    }
+
+    //A catalog the old server doesn't have has no Books to move
+    if (strncmp(exported.text, "402:", 4) == 0) {
+        free(exported.text);
+        return 0;
+    }
+
+    if (strncmp(exported.text, "202:RETRIEVED\nCOUNT:", 20) != 0) {
+        free(exported.text);
+        return -1;
+    }
+
+    //Skip to the first Book, after the COUNT line and the blank line after it
+    next = strstr(exported.text, "\n\n") + 2;
+
+    //Move the Books a batch at a time: submit the batch to the new server, then remove it from the old one
+    while (*next != '\0') {
+
+        int batchCount = 0;
+        batch = next;
+
+        for (int step = 0; step < 2; step++) {
+
+            //The server the batch is sent to in this step, and the responses it may answer with
+            int node = step == 0 ? toNode : fromNode;
+            const char* accepted = step == 0 ? "201" : "203";
+            const char* alsoAccepted = step == 0 ? "401" : "402";
+
+            next = batch;
+            batchCount = 0;
+
+            //Send every request of the batch before reading any response
+            while (*next != '\0' && batchCount < MIGRATION_BATCH) {
+
+                char title[100];
+                char author[100];
+                char location[100];
+                char* end = strstr(next, "\n\n");
+
+                if (end == NULL || sscanf(next, "TITLE:%99[^\n]\nAUTHOR:%99[^\n]\nLOCATION:%99[^\n]\n", title, author, location) != 3) {
+                    free(exported.text);
+                    free(bookRequest.text);
+                    free(body.text);
+                    return -1;
+                }
+
+                bookRequest.length = 0;
+                appendResponse(&bookRequest, catalogField);
+                appendResponse(&bookRequest, step == 0 ? "METHOD:SUBMIT,TITLE:" : "METHOD:REMOVE,TITLE:");
+                appendResponse(&bookRequest, title);
+                appendResponse(&bookRequest, ",AUTHOR:");
+                appendResponse(&bookRequest, author);
+                appendResponse(&bookRequest, ",LOCATION:");
+                appendResponse(&bookRequest, location);
+
+                if (sendBackendRequest(session, node, bookRequest.text) < 0) {
+                    free(exported.text);
+                    free(bookRequest.text);
+                    free(body.text);
+                    return -1;
+                }
+
+                next = end + 2;
+                batchCount++;
+            }
+
+            //A Book already on the new server, or already gone from the old one, has still been moved
+            for (int i = 0; i < batchCount; i++) {
+                if (receiveBackendResponse(session, node, &body) < 0 || (strncmp(body.text, accepted, 3) != 0 && strncmp(body.text, alsoAccepted, 3) != 0)) {
+                    free(exported.text);
+                    free(bookRequest.text);
+                    free(body.text);
+                    return -1;
+                }
+            }
+        }
+
+        movedCount += batchCount;
+    }
+
+    free(exported.text);
+    free(bookRequest.text);
+    free(body.text);
+
+    return movedCount;
+}
+
+
+
+//FUNCTION parseRequest
+void parseRequest(char request[], char method[], char value[]) {
+
+    //The ends of the token's field and value
+    char* fieldEnd = strchr(request, ':');
+    char* valueEnd;
+
+    //The lengths of the field and value copied
+    int methodLength;
+    int valueLength;
+
+    //If the request message is used up, or the token has no field, the method and value are blank
+    if (request[0] == '\0' || fieldEnd == NULL) {
+        method[0] = '\0';
+        value[0] = '\0';
+        request[0] = '\0';
+        return;
+    }
+
+    valueEnd = strchr(fieldEnd + 1, ',');
+    if (valueEnd == NULL) {
+        valueEnd = fieldEnd + strlen(fieldEnd);
+    }
+
+    //Copy the field and value out of the token, cut to fit a field name and a Book field
+    methodLength = fieldEnd - request < 14 ? fieldEnd - request : 14;
+    valueLength = valueEnd - fieldEnd - 1 < 99 ? valueEnd - fieldEnd - 1 : 99;
+
+    memcpy(method, request, methodLength);
+    method[methodLength] = '\0';
+    memcpy(value, fieldEnd + 1, valueLength);
+    value[valueLength] = '\0';
+
+    //Shift the rest of the request message to the front, without the token's delimiter
+    if (*valueEnd == ',') {
+        valueEnd++;
+    }
+
+    memmove(request, valueEnd, strlen(valueEnd) + 1);
+}
+
+
+
+//FUNCTION receiveBackendResponse
+int receiveBackendResponse(Session* session, int node, ResponseBuffer* body) {
+
+    BackendConnection* backend = &session->backends[node];
+
+    //Read until a whole frame has arrived
+    while (1) {
+
+        char* headerEnd = backend->received.length > 0 ? memchr(backend->received.text, '\n', backend->received.length) : NULL;
+        char chunk[16384];
+        int readLength;
+
+        //Once the framing line is complete, take the frame if all of it is here
+        if (headerEnd != NULL) {
+
+            int bodyLength;
+            int headerLength = headerEnd - backend->received.text + 1;
+
+            if (sscanf(backend->received.text, "ID:%*[^,],LENGTH:%d", &bodyLength) != 1 || bodyLength < 0) {
+                fprintf(stderr, "ERROR: A response from %s:%d was not framed properly.\n", nodes[node].host, nodes[node].port);
+                closeBackend(session, node);
+                return -1;
+            }
+
+            if (backend->received.length >= headerLength + bodyLength) {
+
+                body->length = 0;
+                appendResponseBytes(body, backend->received.text + headerLength, bodyLength);
+
+                //Keep anything after the frame for the next response
+                backend->received.length -= headerLength + bodyLength;
+                memmove(backend->received.text, backend->received.text + headerLength + bodyLength, backend->received.length);
+
+                return 0;
+            }
+        }
+
+        readLength = read(backend->fd, chunk, sizeof(chunk));
+
+        if (readLength <= 0) {
+            fprintf(stderr, "ERROR: Lost the connection to %s:%d.\n", nodes[node].host, nodes[node].port);
+            closeBackend(session, node);
+            return -1;
+        }
+
+        appendResponseBytes(&backend->received, chunk, readLength);
+    }
+}
+
+
+
+//FUNCTION routeRequest
+void routeRequest(Session* session, char request[], ResponseBuffer* response) {
+
+    //A field of the request, and the request's first two fields
+    char method[15];
+    char value[100];
+    char catalog[100] = "";
+    char firstType[15];
+    char firstValue[100];
+    char secondType[15];
+    char secondValue[100];
+
+    //The whole request, which is forwarded as it is, and the fields after its METHOD field, which are parsed
+    char* fields = strdup(request);
+
+    parseRequest(fields, method, value);
+
+    //A session token is for the servers, which are sent the request as it is
+    if (strcmp(method, "SESSION") == 0) {
+        parseRequest(fields, method, value);
+    }
+
+    //So is the name of a catalog, which only GETMANY requests need to know, since they are rebuilt for each server
+    if (strcmp(method, "CATALOG") == 0) {
+        strcpy(catalog, value);
+        parseRequest(fields, method, value);
+    }
+
+    if (strcmp(method, "METHOD") != 0) {
+        value[0] = '\0';
+    }
+
+    //Adding a server changes the ring, so it waits for every other request to finish
+    if (strcmp(value, "ADDNODE") == 0) {
+
+        parseRequest(fields, firstType, firstValue);
+
+        pthread_rwlock_wrlock(&ringLock);
+
+        if (strcmp(firstType, "NODE") == 0) {
+            addNode(session, firstValue, response);
+        }
+        else {
+            appendResponse(response, "404:BAD REQUEST\nMESSAGE:Request Message needs a NODE field of <host>:<port>.\n");
+        }
+
+        pthread_rwlock_unlock(&ringLock);
+        free(fields);
+        return;
+    }
+
+    pthread_rwlock_rdlock(&ringLock);
+
+    //Every other request routes by the ring as it is when the request starts
+    if (strcmp(value, "GETMANY") == 0) {
+        forwardGetMany(session, catalog, fields, response);
+    }
+
+    else if (strcmp(value, "NODES") == 0) {
+        listNodes(response);
+    }
+
+    //SUBMIT, REMOVE, MOVE and GET requests with an author go to the author's server
+    else if (strcmp(value, "SUBMIT") == 0 || strcmp(value, "REMOVE") == 0 || strcmp(value, "MOVE") == 0 || strcmp(value, "GET") == 0) {
+
+        parseRequest(fields, firstType, firstValue);
+        parseRequest(fields, secondType, secondValue);
+
+        if (strcmp(firstType, "AUTHOR") == 0) {
+            forwardRequest(session, firstValue, request, response);
+        }
+        else if (strcmp(secondType, "AUTHOR") == 0) {
+            forwardRequest(session, secondValue, request, response);
+        }
+
+        //A GET request with only a title is answered by every server
+        else if (strcmp(value, "GET") == 0 && strcmp(firstType, "TITLE") == 0) {
+
+            ResponseBuffer bodies[MAX_NODES];
+            bool reached[MAX_NODES];
+            bool unreachable = false;
+
+            scatterRequest(session, request, bodies, reached);
+
+            //Merge the Books every server found under one header
+            for (int n = 0; n < nodeCount; n++) {
+
+                if (reached[n] == true && strncmp(bodies[n].text, "202:RETRIEVED\n", 14) == 0) {
+
+                    if (response->length == 0) {
+                        appendResponse(response, "202:RETRIEVED\n");
+                    }
+
+                    appendResponse(response, bodies[n].text + 14);
+                }
+
+                unreachable = unreachable || reached[n] == false;
+                free(bodies[n].text);
+            }
+
+            if (response->length == 0 && unreachable == true) {
+                appendResponse(response, "503:UNAVAILABLE\nMESSAGE:Not every server could be reached, and the others have no Books with the given title.\n");
+            }
+            else if (response->length == 0) {
+                appendResponse(response, "402:NOT FOUND\nMESSAGE:There are no Books in the Catalog with the given title.\n");
+            }
+        }
+
+        //Without an author, the server would reject the request, so let the first one do it
+        else {
+            forwardRequest(session, "", request, response);
+        }
+    }
+
+    else if (strcmp(value, "REMOVEALL") == 0) {
+
+        //Find the predicate's author, if it has one
+        firstValue[0] = '\0';
+
+        while (strlen(fields) > 0) {
+            parseRequest(fields, firstType, secondValue);
+
+            if (strcmp(firstType, "AUTHOR") == 0) {
+                strcpy(firstValue, secondValue);
+            }
+        }
+
+        if (firstValue[0] != '\0') {
+            forwardRequest(session, firstValue, request, response);
+        }
+
+        //Books at a location may be on any server, so remove them from every one and add up the counts
+        else {
+
+            ResponseBuffer bodies[MAX_NODES];
+            bool reached[MAX_NODES];
+            int removedCount = 0;
+            int reachedCount = 0;
+
+            scatterRequest(session, request, bodies, reached);
+
+            for (int n = 0; n < nodeCount; n++) {
+
+                int count;
+
+                if (reached[n] == true) {
+
+                    reachedCount++;
+
+                    if (sscanf(bodies[n].text, "203:REMOVED\nCOUNT:%d", &count) == 1) {
+                        removedCount += count;
+                    }
+
+                    //A rejected predicate is rejected by every server the same way
+                    else if (strncmp(bodies[n].text, "404:", 4) == 0 && response->length == 0) {
+                        appendResponse(response, bodies[n].text);
+                    }
+                }
+
+                free(bodies[n].text);
+            }
+
+            if (response->length == 0 && removedCount > 0) {
+                sprintf(secondValue, "203:REMOVED\nCOUNT:%d\n", removedCount);
+                appendResponse(response, secondValue);
+            }
+            else if (response->length == 0 && reachedCount < nodeCount) {
+                appendResponse(response, "503:UNAVAILABLE\nMESSAGE:Not every server could be reached, and the others have no matching Books.\n");
+            }
+            else if (response->length == 0) {
+                appendResponse(response, "402:NOT FOUND\nMESSAGE:There are no Books in the Catalog matching the given author and location.\n");
+            }
+        }
+    }
+
+    //Requests about a single server's state can't be answered for the whole ring
+    else {
+        appendResponse(response, "404:BAD REQUEST\nMESSAGE:Request Message is an invalid type.\n");
+    }
+
+    pthread_rwlock_unlock(&ringLock);
+    free(fields);
+}
+
+
+
+//FUNCTION scatterRequest
+void scatterRequest(Session* session, char request[], ResponseBuffer bodies[], bool reached[]) {
+
+    //Send the request to every server first
+    for (int n = 0; n < nodeCount; n++) {
+        bodies[n] = (ResponseBuffer) { NULL, 0, 0 };
+        reached[n] = sendBackendRequest(session, n, request) == 0;
+    }
+
+    //Then gather their responses
+    for (int n = 0; n < nodeCount; n++) {
+        if (reached[n] == true) {
+            reached[n] = receiveBackendResponse(session, n, &bodies[n]) == 0;
+        }
+    }
+}
+
+
+
+//FUNCTION sendBackendRequest
+int sendBackendRequest(Session* session, int node, char request[]) {
+
+    BackendConnection* backend = &session->backends[node];
+
+    //The framed request
+    ResponseBuffer framed = { NULL, 0, 0 };
+    char idField[40];
+    int result;
+
+    //Connect to the server if this session isn't connected to it yet
+    if (backend->fd < 0) {
+
+        struct sockaddr_in serveraddr;
+        struct hostent server;
+        struct hostent* found;
+        char lookupBuffer[4096];
+        int lookupError;
+        int optval = 1;
+
+        //Every client thread may look a host up at once, so use the reentrant lookup
+        if (gethostbyname_r(nodes[node].host, &server, lookupBuffer, sizeof(lookupBuffer), &found, &lookupError) != 0 || found == NULL) {
+            fprintf(stderr, "ERROR: The server's hostname doesn't exist. %s\n", nodes[node].host);
+            return -1;
+        }
+
+        memset(&serveraddr, 0, sizeof(serveraddr));
+        serveraddr.sin_family = AF_INET;
+        memcpy(&serveraddr.sin_addr.s_addr, found->h_addr_list[0], found->h_length);
+        serveraddr.sin_port = htons(nodes[node].port);
+
+        backend->fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (backend->fd < 0 || connect(backend->fd, (struct sockaddr *) &serveraddr, sizeof(serveraddr)) < 0) {
+            fprintf(stderr, "ERROR: Could not connect to %s:%d.\n", nodes[node].host, nodes[node].port);
+            closeBackend(session, node);
+            return -1;
+        }
+
+        //Send each small request as soon as it is written
+        setsockopt(backend->fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    }
+
+    //Frame the request with a request ID, so the server frames its response
+    sprintf(idField, "ID:%llu,", session->nextId++);
+    appendResponse(&framed, idField);
+    appendResponse(&framed, request);
+    appendResponse(&framed, "\n");
+
+    result = writeFully(backend->fd, framed.text, framed.length);
+    free(framed.text);
+
+    if (result < 0) {
+        closeBackend(session, node);
+    }
+
+    return result;
+}
+
+
+
+//FUNCTION writeFully
+int writeFully(int fd, const void* buffer, int length) {
+
+    //The number of bytes written so far
+    int totalWritten = 0;
+
+    while (totalWritten < length) {
+
+        int writtenLength = write(fd, (const char*) buffer + totalWritten, length - totalWritten);
+
+        if (writtenLength <= 0) {
+            return -1;
+        }
+
+        totalWritten += writtenLength;
+    }
+
+    return 0;
+}
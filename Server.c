@@ -1,8 +1,11 @@
 #define _XOPEN_SOURCE 500
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
@@ -10,10 +13,83 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h> 
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+//The maximum length of a single request message, including the ending newline character
+#define MAX_REQUEST_LENGTH 32768
+
+//The maximum number of (title, author) keys accepted by a single GETMANY request
+#define MAX_GETMANY_KEYS 100
+
+//The number of hash buckets used to group GETMANY keys by title
+#define GETMANY_TABLE_SIZE 256
+
+//The maximum length of a request ID, including its terminator
+#define MAX_REQUEST_ID_LENGTH 32
+
+//The number of worker threads that complete requests carrying a request ID
+#define REQUEST_WORKER_COUNT 8
+
+//The most requests carrying a request ID that a single connection may have queued or running at once. The connection isn't read from
+//while it has this many, so a client that pipelines faster than it's answered is slowed down instead of growing the queue without limit
+#define MAX_IN_FLIGHT_REQUESTS 1024
+
+//How long, in seconds, a response may wait for a client to read before the client is disconnected, so a stalled client can't keep a thread
+#define CLIENT_SEND_TIMEOUT 10
+
+//The durability modes of the write-ahead log: fsync before each mutation's response (sharing fsyncs between concurrent writers),
+//fsync from a background thread every few milliseconds, or write without ever calling fsync
+#define WAL_SYNC 0
+#define WAL_BATCH 1
+#define WAL_ASYNC 2
+
+//The types of write-ahead log records
+#define WAL_SUBMIT 1
+#define WAL_REMOVE 2
+#define WAL_MOVE 3
+
+//The magic number and version at the start of a write-ahead log file
+#define WAL_MAGIC "BOOKWAL"
+#define WAL_VERSION 2
+
+//The most threads used to replay the write-ahead log tail, one per shard of (title, author) hashes
+#define MAX_RECOVERY_SHARDS 64
+
+//The number of records copied at a time when the write-ahead log is truncated after a snapshot
+#define WAL_TRUNCATE_CHUNK 256
+
+//The buckets of a latency histogram: one per nanosecond below 64ns, then 32 for every doubling up to about 18 minutes, which keeps
+//every latency recorded to within about 3%
+#define STATS_EXACT_BUCKETS 64
+#define STATS_SUB_BUCKETS 32
+#define STATS_BUCKET_COUNT (STATS_EXACT_BUCKETS + 34 * STATS_SUB_BUCKETS)
+
+//The number of types of work counted separately by STATS. Requests of an unknown type count as OTHER, and a replica applying its primary's
+//changes and the server's own snapshots and handoffs only ever appear as holders of a catalog's semaphore
+#define STATS_OPERATION_COUNT 17
+#define STATS_OTHER 14
+#define STATS_APPLY 15
+#define STATS_SERVER 16
+
+//The number of (holder, waiter) pairs STATS reports as having blocked requests the longest
+#define STATS_WORST_BLOCKERS 5
+
+//The number of latency bucket bounds in the metrics, which are too coarse for percentiles but are what a metrics scraper aggregates
+#define METRICS_BUCKET_COUNT 19
+
+//The most bytes of a metrics scrape's HTTP request read, and how long to wait for it, in seconds
+#define METRICS_REQUEST_LENGTH 4096
+#define METRICS_REQUEST_TIMEOUT 2
+
 //A doubly linked list representing a Book catalog
 typedef struct book {
     char title[100];
@@ -24,14 +100,784 @@ typedef struct book {
     struct book* next;
 } Book;
 
-//The global book catalog to be accessed by all clients simultaneously
-Book* bookCatalog = NULL;
+//A named catalog of Books. Each catalog has its own semaphore, so requests to different catalogs never wait for each other
+typedef struct catalog {
+
+    //The catalog's name, which is blank for the default catalog
+    char name[100];
+
+    Book* books;
+
+    //Held by a request for the whole time it reads or changes the catalog
+    sem_t mutex;
+
+    struct catalog* nextCatalog;
+
+    //The catalog's run of records from the snapshot loaded at startup, until the run is checked against its checksum. It is checked by
+    //the first thread to hold the catalog's semaphore, so startup never reads every record. If it doesn't match, the catalog is marked
+    //corrupt, and its Books are never served or written to another snapshot
+    Book* uncheckedRecords;
+    long long uncheckedCount;
+    unsigned int uncheckedChecksum;
+    bool corrupt;
+
+    //The semaphore's profile, which is only written while it's held: the type of work holding it (or -1) and since when, how often it
+    //has been taken and how often only after waiting, the total time waited for and held, and the longest hold and what it was
+    int holderOperation;
+    long long heldSince;
+    long long acquisitions;
+    long long contendedAcquisitions;
+    long long waitNs;
+    long long holdNs;
+    long long longestHoldNs;
+    int longestHoldOperation;
+
+    //How long, and how often, each type of work waited for the semaphore behind each type of work that held it when it arrived
+    long long blockedNs[STATS_OPERATION_COUNT][STATS_OPERATION_COUNT];
+    long long blockedCount[STATS_OPERATION_COUNT][STATS_OPERATION_COUNT];
+} Catalog;
+
+//The kinds of replication messages a primary streams to its replicas: the Books of its Catalog, the end of that snapshot, every mutation after it,
+//and a heartbeat when there are no mutations to send
+#define REPLICATION_BOOK 1
+#define REPLICATION_SNAPSHOT_END 2
+#define REPLICATION_MUTATION 3
+#define REPLICATION_HEARTBEAT 4
+
+//How often a primary sends a replica a heartbeat when idle, in milliseconds
+#define REPLICATION_HEARTBEAT_INTERVAL 100
+
+//The most bytes of messages queued for a replica before it is disconnected for falling too far behind. It resynchronizes when it reconnects
+#define MAX_REPLICATION_QUEUE (64 * 1024 * 1024)
+
+//The most bytes of events queued for a subscriber. Events for a subscriber too slow to keep up are dropped, and it is told how many
+#define MAX_SUBSCRIBER_QUEUE (1024 * 1024)
+
+//The number of hash buckets of the table of titles and authors that connections cache GET results for
+#define TRACKING_TABLE_SIZE 4096
+
+//The most titles and authors tracked for a single connection. Tracking one more flushes the connection's whole cache instead
+#define MAX_TRACKED_KEYS 1000
+
+//The most bytes of invalidations queued for a connection while a response is being written to it. An invalidation that doesn't fit
+//replaces them all with a flush of the connection's whole cache
+#define PUSH_QUEUE_LENGTH 4096
+
+//How long a replica holds a read for it to catch up with the session's writes before redirecting the client to the primary, in milliseconds
+#define SESSION_WAIT_INTERVAL 250
+
+//The magic number of a handoff request, and the kinds of handoff items
+#define HANDOFF_MAGIC "BOOKHND"
+#define HANDOFF_TCP_LISTENER 1
+#define HANDOFF_UNIX_LISTENER 2
+#define HANDOFF_CLIENT 3
+#define HANDOFF_DONE 4
+
+//The magic number and version at the start of a snapshot file
+#define SNAPSHOT_MAGIC "BOOKSNP"
+#define SNAPSHOT_VERSION 3
+
+//The size of the snapshot header. The records after it start on a page boundary so they can be mapped and used in place
+#define SNAPSHOT_HEADER_SIZE 4096
+
+//The size of the buffer snapshot records are gathered in before each write
+#define SNAPSHOT_WRITE_BUFFER (64 * 1024)
+
+//The address snapshot records are written for. When the snapshot can be mapped there, its Book links are already correct and need no fixing up
+#define SNAPSHOT_BASE_ADDRESS ((char*) 0x100000000000)
+
+//The header at the start of a snapshot file, followed by the Catalog's Books in list order
+typedef struct snapshotHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int recordSize;
+    unsigned long long recordCount;
+
+    //The log sequence number of the last write-ahead log record included in the snapshot
+    unsigned long long lsn;
+
+    //The address the records' Book links were written for
+    unsigned long long baseAddress;
+
+    //The FNV-1a hash of the catalog table, which holds each catalog's records checksum, and of this header computed with headerChecksum
+    //set to 0. Both are checked at startup, while the records are only checked by their catalog's first use
+    unsigned int tableChecksum;
+    unsigned int headerChecksum;
+
+    //The number of catalogs in the table after the records
+    unsigned long long catalogCount;
+} SnapshotHeader;
+
+//An entry of the table after a snapshot's records, saying which catalog the next run of records belongs to
+typedef struct snapshotCatalog {
+    char name[100];
+
+    //The checksum of the run's records, as combined by snapshotRecordChecksum
+    unsigned int recordsChecksum;
+
+    unsigned long long recordCount;
+} SnapshotCatalog;
+
+//The state of background snapshots, which are written by a forked child from its copy-on-write view of the Catalog
+typedef struct snapshotStatus {
+
+    //Guards every field below
+    pthread_mutex_t lock;
+
+    //The running snapshot's child process (or 0 if none is running), when it started, and the log sequence number it is written at
+    pid_t pid;
+    struct timeval started;
+    unsigned long long lsn;
+
+    //The pipe the child reports its results on
+    int resultfd;
+
+    //The results of the last finished snapshot
+    bool finished;
+    bool failed;
+    long long records;
+    unsigned long long finishedLsn;
+    double durationMs;
+
+    //The memory privately held by the child when it finished, which is the Catalog pages copied on write by either process while it ran
+    long long copiedKb;
+} SnapshotStatus;
+
+//The results a snapshot child reports to the server when it finishes
+typedef struct snapshotResult {
+    long long records;
+    long long copiedKb;
+} SnapshotResult;
+
+//A single Catalog mutation in the write-ahead log. Every record is the same size, so a torn record at the end of the log is easy to find
+typedef struct walRecord {
+    unsigned long long lsn;
+    unsigned int type;
+
+    //The FNV-1a hash of the record, computed with this field set to 0
+    unsigned int checksum;
+
+    char title[100];
+    char author[100];
+    char location[100];
+
+    //The location a MOVE record moves the Book to
+    char newLocation[100];
+
+    //The catalog the Book is in, which is blank for the default catalog
+    char catalog[100];
+} WalRecord;
+
+//The header at the start of a write-ahead log file
+typedef struct walHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int recordSize;
+} WalHeader;
+
+//The append-only write-ahead log of Catalog mutations
+typedef struct writeAheadLog {
+    int fd;
+    int mode;
+
+    //The path of the log file, so it can be rewritten without the records a snapshot has made redundant
+    char path[1000];
+
+    //How often the background thread fsyncs the log in batch mode, in milliseconds
+    int batchInterval;
+
+    //Guards every field below
+    pthread_mutex_t lock;
+
+    //Signalled whenever a flush finishes
+    pthread_cond_t flushed;
+
+    //The records appended since the last flush, and a spare buffer swapped in while they are written
+    char* buffer;
+    int bufferedLength;
+    int bufferCapacity;
+    char* spare;
+    int spareCapacity;
+
+    //The last log sequence number handed out, and the last one known to be on disk
+    unsigned long long lastLsn;
+    unsigned long long durableLsn;
+
+    //Whether a thread is currently writing and fsyncing the log on behalf of every waiting writer
+    bool flushing;
+
+    //The number of flushes that wrote records, for measuring how many records share each fsync
+    unsigned long long flushCount;
+} WriteAheadLog;
+
+//A Book in a recovery shard's index, chained into a hash bucket by (title, author)
+typedef struct recoveryEntry {
+    Book* book;
+    unsigned int hash;
+
+    //The name of the catalog the Book is in
+    const char* catalog;
+
+    //The next entry in the same bucket, or -1
+    int chain;
+
+    //The Book's place in the recovered Catalog: its position in the starting Catalog, or -1 and the index of the tail record that submitted it
+    long long position;
+    long long slot;
+} RecoveryEntry;
+
+//The work shared by every thread replaying the write-ahead log tail
+typedef struct recoveryPlan {
+
+    //The starting Catalog in list order, the (title, author) hash of each Book, and whether the Catalog is the mapped snapshot
+    Book** books;
+    long long bookCount;
+    unsigned int* bookHashes;
+    bool mapped;
+
+    //The catalogs of the starting Catalog. Each one's Books are a run of the array, from its start up to the next catalog's start
+    Catalog** catalogs;
+    long long* catalogStarts;
+    int catalogCount;
+
+    //Each scanning thread's share of every catalog's records checksum, when the catalogs are the mapped snapshot and haven't been
+    //checked yet, indexed by thread and then by catalog
+    unsigned int* recordsChecksums;
+
+    //The records after the snapshot, the (title, author) hash of each, and the log sequence number the first one must have
+    WalRecord* tail;
+    long long tailCount;
+    unsigned int* tailHashes;
+    unsigned long long firstLsn;
+
+    //The number of shards, i.e. threads
+    int shardCount;
+
+    //The first torn or corrupt record and the first record out of sequence each scanning thread found, or tailCount if none
+    long long badRecords[MAX_RECOVERY_SHARDS];
+    long long gapRecords[MAX_RECOVERY_SHARDS];
+
+    //The number of intact, in sequence records to replay
+    long long validCount;
+
+    //Which Books of the starting Catalog were removed, and the Books submitted by each tail record that remain
+    unsigned char* removed;
+    Book** submitted;
+} RecoveryPlan;
+
+//A single recovery thread's share of a plan
+typedef struct recoveryWorker {
+    RecoveryPlan* plan;
+    int number;
+} RecoveryWorker;
+
+//A single message of a replication stream. Primaries and replicas are the same build, so messages are sent in their in-memory layout
+typedef struct replicationMessage {
+    unsigned int kind;
+    unsigned int reserved;
+
+    //The primary's latest log sequence number when the message was sent, and when it was sent, in microseconds since the epoch
+    unsigned long long primaryLsn;
+    long long sentAt;
+
+    //The Book, or the mutation and its log sequence number
+    WalRecord record;
+} ReplicationMessage;
+
+//A replica connected to this server, and the replication messages waiting to be sent to it
+typedef struct replica {
+    int fd;
+
+    //The queued messages, appended by mutations and sent by the replica's thread
+    char* queue;
+    int queuedLength;
+    int queueCapacity;
+
+    //The child process streaming the replica its snapshot, which is sent before any queued mutation
+    pid_t snapshotPid;
+
+    //The last log sequence number the replica has applied, and whether the stream has ended
+    unsigned long long ackedLsn;
+    bool closed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+
+    struct replica* nextReplica;
+} Replica;
+
+//A connection streaming the Catalog's changes, and the events waiting to be sent to it
+typedef struct subscriber {
+    int fd;
+
+    //Only changes to this catalog are sent
+    char catalog[100];
+
+    //Only changes to Books by this author and/or at this location are sent, where either is given
+    char author[100];
+    char location[100];
+
+    //The queued events, appended by mutations and sent by the subscriber's thread
+    char* queue;
+    int queuedLength;
+    int queueCapacity;
+
+    //The number of events dropped since the subscriber was last told, because its queue was full
+    long long droppedCount;
+
+    bool closed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+
+    struct subscriber* nextSubscriber;
+} Subscriber;
+
+//The state of this server's replication from its primary, when it is a replica
+typedef struct replicaState {
+    pthread_mutex_t lock;
+
+    //Whether the stream from the primary is connected, and whether the snapshot has been received over it
+    bool connected;
+    bool synchronized;
+
+    //The primary's last log sequence number applied here, and the primary's latest log sequence number
+    unsigned long long appliedLsn;
+    unsigned long long primaryLsn;
+
+    //Signalled whenever more of the primary's log has been applied, for reads waiting on a session token
+    pthread_cond_t applied;
+
+    //When the primary sent the last message applied here, and when the last message arrived, in microseconds since the epoch
+    long long appliedSentAt;
+    long long lastContact;
+} ReplicaState;
+
+//A growable response message, used for responses that can't be bounded in advance
+typedef struct responseBuffer {
+    char* text;
+    int length;
+    int capacity;
+} ResponseBuffer;
+
+//A single (title, author) key of a GETMANY request and the locations matched for it
+typedef struct manyKey {
+    char* title;
+    char* author;
+
+    //The matched locations, formatted as LOCATION lines
+    ResponseBuffer locations;
+
+    //The index of the next key in the same hash bucket, or -1
+    int chain;
+} ManyKey;
+
+//A client connection, shared by its client loop thread and any worker threads completing its requests
+typedef struct connection {
+    int fd;
+
+    //Set while a response is written, guarded by writeLock. A response is written with sending set rather than with the lock held, so
+    //responses completed concurrently never interleave, and an invalidation never waits on a client that is slow to read
+    pthread_mutex_t writeLock;
+    bool sending;
+    pthread_cond_t sent;
+
+    //The invalidations pushed while a response is being written, which the thread writing it sends after, guarded by writeLock
+    char pushQueue[PUSH_QUEUE_LENGTH];
+    int pushQueueLength;
+
+    //The number of the connection's requests queued or running on worker threads, guarded by writeLock
+    int inFlight;
+    pthread_cond_t drained;
+
+    //The highest log sequence number any of the connection's requests has written or carried as a session token, guarded by writeLock.
+    //A replica doesn't answer the connection's reads until it has applied at least this much of the primary's log
+    unsigned long long sessionLsn;
+
+    //Set once a response or invalidation couldn't be written, after which the connection is shut down and its remaining responses dropped, guarded by writeLock
+    bool broken;
+
+    //The number of titles and authors the connection caches GET results for, guarded by trackingLock
+    int trackedCount;
+
+    //The number of invalidations being pushed to the connection after trackingLock was released, guarded by trackingLock. The connection
+    //isn't freed until they are all written
+    int pushing;
+
+    //Request bytes read but not yet answered: the start of a request taken over from an old server, or the partial request a paused connection
+    //holds during a handoff
+    char* buffered;
+    int bufferedLength;
+
+    //Set while the connection waits between requests for a handoff to finish, and set once the handoff decides its fate: resumed if the handoff
+    //failed, otherwise closed, after its socket was passed to the new server if it took over client connections. Guarded by the registry lock
+    bool paused;
+    bool released;
+    bool resumed;
+
+    //The next connection in the registry
+    struct connection* nextConnection;
+} Connection;
+
+//A title or author a connection caches a GET result for, so it can be told when a change to the catalog makes the result stale.
+//A key is forgotten once the connection has been told, until the connection fetches the result again
+typedef struct trackedKey {
+    Connection* connection;
+
+    //The catalog, whether the key is an author rather than a title, and the title or author
+    char catalog[100];
+    bool byAuthor;
+    char value[100];
+
+    //The next key in the same hash bucket
+    struct trackedKey* nextKey;
+} TrackedKey;
+
+//Every open client connection and accept loop, so a handoff can wait for them all to stop between requests
+typedef struct connectionRegistry {
+    Connection* head;
+    int connectionCount;
+    int pausedCount;
+    int acceptLoopCount;
+
+    //Set while a handoff is in progress, with whether the new server takes over the client connections
+    bool handingOff;
+    bool handingOffClients;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} ConnectionRegistry;
+
+//The request a new server sends the running one to take it over
+typedef struct handoffRequest {
+    char magic[8];
+
+    //Whether the new server also takes over the open client connections, rather than having them closed between requests
+    bool clients;
+
+    //The path the running server writes the Catalog's snapshot to for the new server to load
+    char snapshotPath[1000];
+} HandoffRequest;
+
+//A single item of a handoff, sent with the socket it describes, if any
+typedef struct handoffItem {
+    int kind;
+
+    //For a client connection, the number of request bytes it had read but not answered, sent after the item
+    int bufferedLength;
+
+    //For the end of the handoff, the number of Books in the snapshot (or -1 if it couldn't be written) and its log sequence number
+    long long records;
+    unsigned long long lsn;
+
+    //For the Unix domain socket listener, its path
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+} HandoffItem;
+
+//A single request message and the connection it arrived on
+typedef struct requestJob {
+    Connection* connection;
+
+    //The client's request ID echoed in the response, or blank if the request didn't carry one
+    char id[MAX_REQUEST_ID_LENGTH];
+
+    char* request;
+
+    struct requestJob* next;
+} RequestJob;
+
+//The queue of requests carrying a request ID, waiting for a worker thread
+typedef struct requestQueue {
+    RequestJob* head;
+    RequestJob* tail;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} RequestQueue;
+
+//The number of latencies in each bucket of a histogram, in nanoseconds
+typedef struct latencyHistogram {
+    long long counts[STATS_BUCKET_COUNT];
+    long long total;
+    long long sumNs;
+    long long maxNs;
+} LatencyHistogram;
+
+//The requests of a single type answered by a thread
+typedef struct operationStats {
+    long long requests;
+    long long errors;
+
+    //The time from reading each request to sending its response, the part of it spent waiting for the catalog semaphore, and the part
+    //spent holding it
+    LatencyHistogram serviceTime;
+    LatencyHistogram lockWait;
+    LatencyHistogram lockHold;
+} OperationStats;
+
+//The statistics a single thread records without taking any lock, which are only merged with every other thread's when a STATS request
+//reads them. Each type of request is allocated the first time the thread answers one, so a connection only costs the types it uses
+typedef struct threadStats {
+    OperationStats* operations[STATS_OPERATION_COUNT];
+
+    //The bytes of requests read, and of responses and invalidations written
+    long long bytesIn;
+    long long bytesOut;
+
+    //The next running thread's statistics
+    struct threadStats* nextStats;
+} ThreadStats;
+
+//A type of work that kept another waiting for a catalog's semaphore, and for how long in all
+typedef struct blocker {
+    Catalog* catalog;
+    int holder;
+    int waiter;
+    long long blockedNs;
+    long long count;
+} Blocker;
+
+//Every catalog in the server, in the order they were created, starting with the default catalog. Catalogs are never freed once created
+Catalog* catalogs = NULL;
+pthread_mutex_t catalogsLock = PTHREAD_MUTEX_INITIALIZER;
+
+//The catalog the current thread's request is for, so its mutations are logged under the catalog's name
+__thread Catalog* currentCatalog = NULL;
 
 //Global variable for the parent socket
 int parentfd; 
 
-//The semaphore variable to ensure process synchronization
-sem_t mutex;
+//Global variables for the optional Unix domain socket listener and its path, for clients on the same host
+int unixfd = -1;
+char unixSocketPath[sizeof(((struct sockaddr_un*) 0)->sun_path)] = "";
+
+//Every open client connection and accept loop
+ConnectionRegistry connectionRegistry = { NULL, 0, 0, 0, false, false, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+//The socket new servers connect to to take this one over, and its path
+int handoffListenfd = -1;
+char handoffPath[sizeof(((struct sockaddr_un*) 0)->sun_path)] = "";
+
+//A pipe that becomes readable while a handoff is in progress, waking every accept loop and client loop
+int handoffPipe[2] = { -1, -1 };
+
+//Held by a handoff from start to exit, and by a shutdown, so a SIGTERM during a handoff can't remove the socket paths the new server now owns
+pthread_mutex_t shutdownLock = PTHREAD_MUTEX_INITIALIZER;
+
+//The replicas connected to this server
+Replica* replicas = NULL;
+pthread_mutex_t replicasLock = PTHREAD_MUTEX_INITIALIZER;
+
+//The connections streaming the Catalog's changes
+Subscriber* subscribers = NULL;
+pthread_mutex_t subscribersLock = PTHREAD_MUTEX_INITIALIZER;
+
+//The titles and authors connections cache GET results for, hashed by catalog and key
+TrackedKey* trackingTable[TRACKING_TABLE_SIZE];
+pthread_mutex_t trackingLock = PTHREAD_MUTEX_INITIALIZER;
+
+//Signalled, with trackingLock, whenever the invalidations being pushed to a connection are written
+pthread_cond_t pushesFinished = PTHREAD_COND_INITIALIZER;
+
+//The primary this server replicates, if it is a replica
+char primaryHost[300] = "";
+int primaryPort = 0;
+ReplicaState replicaState = { PTHREAD_MUTEX_INITIALIZER, false, false, 0, 0, PTHREAD_COND_INITIALIZER, 0, 0 };
+
+//The requests waiting for a worker thread
+RequestQueue requestQueue = { NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+//The request the current thread is answering, so responses are framed and written to the right connection
+__thread RequestJob* currentRequest = NULL;
+
+//The write-ahead log, which is only open when the server is started with a log path
+WriteAheadLog writeAheadLog = { -1, WAL_SYNC, "", 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, NULL, 0, 0, 0, false, 0 };
+
+//The path of the snapshot file, or blank if snapshots are disabled
+char snapshotPath[1000] = "";
+
+//The Books mapped from the snapshot file at startup. They are used in place, so they must never be passed to free
+char* snapshotRecords = NULL;
+size_t snapshotLength = 0;
+
+//The catalogs of the snapshot loaded at startup, in the order their Books are stored
+SnapshotCatalog* snapshotCatalogs = NULL;
+int snapshotCatalogCount = 0;
+
+//The log sequence number of the last write-ahead log record included in the loaded snapshot
+unsigned long long snapshotLsn = 0;
+
+//The running and last finished background snapshots
+SnapshotStatus snapshotStatus = { PTHREAD_MUTEX_INITIALIZER, 0, { 0, 0 }, 0, -1, false, false, 0, 0, 0, 0 };
+
+//The log sequence number of the last mutation logged by the current thread's request
+__thread unsigned long long lastLoggedLsn = 0;
+
+//Where the current thread's responses are held back until its catalog's semaphore is released and its mutations are durable, or NULL to send them immediately
+__thread ResponseBuffer* deferredResponse = NULL;
+
+//The types of work counted separately by STATS, in the order of their statistics
+const char* statsOperationNames[STATS_OPERATION_COUNT] = { "SUBMIT", "GET", "GETMANY", "REMOVE", "MOVE", "REMOVEALL", "EXPORT", "SNAPSHOT",
+                                                           "SNAPSHOTSTATUS", "REPLICATE", "REPLICATION", "SUBSCRIBE", "CATALOGS", "STATS", "OTHER",
+                                                           "APPLY", "SERVER" };
+
+//The statistics of every running thread that has recorded any, and those of the threads that have exited, merged together
+ThreadStats* statsRegistry = NULL;
+ThreadStats retiredStats;
+pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+//The current thread's statistics, or NULL before it has recorded any
+__thread ThreadStats* currentStats = NULL;
+
+//The status code of the first response to the current thread's request, i.e. 402, or 0 before it has responded
+__thread int responseStatus = 0;
+
+//The admin port metrics are served on over HTTP, or 0 if they aren't
+int metricsPort = 0;
+
+//The upper bounds of the metrics' latency buckets, in seconds
+const double metricsBucketBounds[METRICS_BUCKET_COUNT] = { 0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+                                                           0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+
+//The Books allocated on the heap, and the Books mapped from the snapshot that have since been removed, so the metrics can report the
+//Catalog's size without walking it. Both are changed by any thread creating or freeing a Book, so only with atomic additions
+long long heapBookCount = 0;
+long long freedSnapshotBookCount = 0;
+
+
+
+/* Name: acquireCatalog
+ * Description: This function waits for a catalog's semaphore, profiling how long it waited and which type of work held the semaphore
+ *              when it arrived.
+ *
+ * Parameter: catalog               The catalog
+ * Parameter: operation             The type of work taking the semaphore, as an index into statsOperationNames
+ * Return: None
+*/
+void acquireCatalog(Catalog* catalog, int operation);
+
+
+
+/* Name: addStat
+ * Description: This function adds to a statistic only one thread writes at a time, either the thread that owns it or the holder of the
+ *              semaphore of the catalog it profiles, so the addition needs no lock. It is stored whole so a STATS request reading it at the
+ *              same time never sees half of it.
+ *
+ * Parameter: stat                  The statistic
+ * Parameter: amount                The amount to add
+ * Return: None
+*/
+void addStat(long long* stat, long long amount);
+
+
+
+/* Name: appendHistogramMetric
+ * Description: This function appends a latency histogram to the metrics as a Prometheus histogram, with its counts gathered into the
+ *              metrics' coarser buckets.
+ *
+ * Parameter: response              The metrics to append to
+ * Parameter: name                  The histogram's metric name
+ * Parameter: operation             The type of request the latencies are of, given as the histogram's operation label
+ * Parameter: histogram             The histogram
+ * Return: None
+*/
+void appendHistogramMetric(ResponseBuffer* response, const char name[], const char operation[], LatencyHistogram* histogram);
+
+
+
+/* Name: appendLabelValue
+ * Description: This function appends text to the metrics as the value of a label, escaping the characters Prometheus requires.
+ *
+ * Parameter: response              The metrics to append to
+ * Parameter: value                 The label's value
+ * Return: None
+*/
+void appendLabelValue(ResponseBuffer* response, const char value[]);
+
+
+
+/* Name: appendResponse
+ * Description: This function appends the passed text to the end of a growable response message, doubling its capacity when it is full.
+ *
+ * Parameter: response              The response message to append to
+ * Parameter: text                  The text to append
+ * Return: None
+*/
+void appendResponse(ResponseBuffer* response, const char text[]);
+
+
+
+/* Name: appendResponseBytes
+ * Description: This function appends the given number of bytes to the end of a growable response message, doubling its capacity when it is full.
+ *
+ * Parameter: response              The response message to append to
+ * Parameter: text                  The bytes to append
+ * Parameter: length                The number of bytes to append
+ * Return: None
+*/
+void appendResponseBytes(ResponseBuffer* response, const char text[], int length);
+
+
+
+/* Name: applyWalRecord
+ * Description: This function applies a single mutation record to its catalog, with no client to respond to. It must be called while the
+ *              catalog's semaphore is held.
+ *
+ * Parameter: catalog               The catalog named by the record
+ * Parameter: record                The mutation to apply
+ * Return: None
+*/
+void applyWalRecord(Catalog* catalog, WalRecord* record);
+
+
+
+/* Name: bucketUpperNs
+ * Description: This function finds the largest latency a latency histogram bucket holds.
+ *
+ * Parameter: bucket                The bucket's index
+ * Return: The latency in nanoseconds
+*/
+long long bucketUpperNs(int bucket);
+
+
+
+/* Name: checkSnapshotRecords
+ * Description: This function checks a catalog's run of records from the snapshot loaded at startup against the run's checksum, the first
+ *              time it is called for the catalog, and marks the catalog corrupt if they don't match. It must be called before any of the
+ *              run's Books are read or changed, with the catalog's semaphore held once clients are connected.
+ *
+ * Parameter: catalog               The catalog
+ * Return: True if the catalog's Books can be used, or false if they are corrupt
+*/
+bool checkSnapshotRecords(Catalog* catalog);
+
+
+
+/* Name: collectStats
+ * Description: This function merges the statistics of every thread, running or exited. The caller frees each type of request merged.
+ *
+ * Parameter: total                 The statistics to merge into, which are zeroed first
+ * Return: None
+*/
+void collectStats(ThreadStats* total);
+
+
+
+/* Name: currentMicros
+ * Description: This function reads the wall clock time, which primaries and replicas on the same host share for measuring replication lag.
+ *
+ * Return: The time in microseconds since the epoch
+*/
+long long currentMicros();
+
+
+
+/* Name: currentNanos
+ * Description: This function reads the monotonic clock, for measuring how long requests take.
+ *
+ * Return: The time in nanoseconds
+*/
+long long currentNanos();
 
 
 
@@ -48,6 +894,75 @@ void decipherRequest(char request[], int childfd);
 
 
 
+/* Name: exportBooks
+ * Description: This function returns every Book whose author hashes into the given range, so a router can move that part of the Catalog to
+ *              another server. The range runs from just after the first hash up to and including the second, wrapping past the largest hash
+ *              when the first is not smaller. A range from a hash to itself covers every author.
+ *
+ * Parameter: head                  The Book Catalog's head
+ * Parameter: fromHash              The author hash the range starts after
+ * Parameter: toHash                The last author hash in the range
+ * Parameter: childfd               The socket connection to the client
+ * Return: None
+*/
+void exportBooks(Book* head, unsigned int fromHash, unsigned int toHash, int childfd);
+
+
+
+/* Name: findCatalog
+ * Description: This function looks up a catalog by name, and can create it if it doesn't exist yet. New catalogs are added at the end of the
+ *              list, so catalogs keep the order they were created in.
+ *
+ * Parameter: name                  The name of the catalog, or blank for the default catalog
+ * Parameter: create                Whether to create the catalog if it doesn't exist
+ * Return: The catalog, or NULL if it doesn't exist and wasn't created
+*/
+Catalog* findCatalog(const char name[], bool create);
+
+
+
+/* Name: findThreadStats
+ * Description: This function finds the current thread's statistics, allocating them and adding them to the registry the first time.
+ *
+ * Return: The thread's statistics
+*/
+ThreadStats* findThreadStats();
+
+
+
+/* Name: flushWriteAheadLog
+ * Description: This function writes every buffered write-ahead log record to the log file, and fsyncs it unless the log is in async mode.
+ *              It must be called with the log's lock held, which is released while the records are written. If another thread is already
+ *              flushing, this function waits for it to finish instead. Every writer waiting on the log is woken once the flush finishes,
+ *              so concurrent writers share a single fsync.
+ *
+ * Return: None
+*/
+void flushWriteAheadLog();
+
+
+
+/* Name: forgetTrackedKeys
+ * Description: This function forgets every title and author a connection caches GET results for. It must be called with trackingLock
+ *              held, and a caller that tells the connection to flush its cache does so after releasing it.
+ *
+ * Parameter: connection            The connection, or NULL for every connection
+ * Return: None
+*/
+void forgetTrackedKeys(Connection* connection);
+
+
+
+/* Name: freeBook
+ * Description: This function frees a Book removed from the Catalog, unless it is one of the Books mapped from the snapshot file.
+ *
+ * Parameter: book                  The Book to free
+ * Return: None
+*/
+void freeBook(Book* book);
+
+
+
 /* Name: getBooksByAuthor
  * Description: This function attempts to GET all of the Books with the matching author specified in the user's request.
  *              If no books were found, a NOT FOUND response message will be returned, otherwise, a response with all of the associated Books
@@ -76,6 +991,23 @@ void getBooksWithTitle(Book* head, char title[100], int childfd);
 
 
 
+/* Name: getManyBooks
+ * Description: This function attempts to GET the locations of several Books at once, one per (title, author) key of a GETMANY request.
+ *              Rather than scanning the Catalog once per key, the keys are grouped into a hash table by title and the Catalog is scanned
+ *              a single time, prefetching the next Book while the current one is compared so the cache misses of the walk overlap.
+ *              One response is returned holding a KEY block per requested key in request order, terminated by an END line.
+ *
+ * Parameter: head                  The head pointer to the Book Catalog
+ * Parameter: titles                The titles of the keys to search for
+ * Parameter: authors               The authors of the keys to search for
+ * Parameter: keyCount              The number of keys requested
+ * Parameter: childfd               The socket connection to the client
+ * Return: None
+*/
+void getManyBooks(Book* head, char titles[][100], char authors[][100], int keyCount, int childfd);
+
+
+
 /* Name: getSpecificBook
  * Description: This function attemps to GET all of the locations of the Book with the matching title and author specified by the user's request.
  *              If no Books were found, a NOT FOUND response message will be returned, otherwise a response with all of the associated Book locations
@@ -92,7 +1024,9 @@ void getSpecificBook(Book* head, char title[100], char author[100], int childfd)
 
 
 /* Name: handleServerClose
- * Description: Event signal handler provided to avoid port number not closing properly
+ * Description: This function shuts the server down on SIGINT or SIGTERM, closing its listening sockets so the port is freed, once the requests
+ *              holding catalogs have finished and any write-ahead log records still buffered are written. It runs on the signal watcher thread
+ *              rather than in a signal handler, so it can take locks. If a handoff is in progress, it waits for the handoff to exit the process.
  * 
  * Return: None
 */ 
@@ -100,973 +1034,7296 @@ void handleServerClose();
 
 
 
-/* Name: launchClientLoop
- * Description: This function runs the client connection loop in a separate thread per client.
- * 
- * Parameter: fd                    The child socket fd of the client connected
- * Return: NULL
-*/ 
-void* launchClientLoop(void* fd);
+/* Name: handOffServer
+ * Description: This function hands the server over to a new server process connected to the handoff socket. Every accept loop stops, and every
+ *              client connection finishes its in-flight requests and pauses between requests. The Catalog is then written to the snapshot the
+ *              new server loads, and the listening sockets (and the client connections, if the new server takes them) are passed to it with
+ *              SCM_RIGHTS, so no connection is ever refused. If anything fails, the server resumes where it stopped. If the new snapshot
+ *              replaces this server's own, the write-ahead log is truncated to the records after it.
+ *
+ * Parameter: takeoverfd            The new server's connection to the handoff socket
+ * Return: 0 once the server has been handed over, or -1 if it resumed
+*/
+int handOffServer(int takeoverfd);
 
 
 
-/* Name: parseRequest
- * Description: This function takes the request message from the client and breaks it apart to get all of the passed request tokens.
- *              The tokens are used by decipherRequest to determine the type of request, and if it's valid.
- * 
- * Parameter: request               The request message received from the client
- * Parameter: method                The method or header type i.e. METHOD, AUTHOR, TITLE
- * Parameter: value                 The method or header value i.e. GET, SUBMIT, REMOVE
- * Return: None
-*/ 
-void parseRequest(char request[], char method[], char value[]);
+/* Name: hashBytes
+ * Description: This function computes the 32-bit FNV-1a hash of the given bytes.
+ *
+ * Parameter: bytes                 The bytes to hash
+ * Parameter: length                The number of bytes to hash
+ * Return: The hash of the bytes
+*/
+unsigned int hashBytes(const void* bytes, int length);
 
 
 
-/* Name: removeAllBooks
- * Description: This function removes all of the Books from the Catalog. This function is called when the server is killed.
+/* Name: hashString
+ * Description: This function computes the 32-bit FNV-1a hash of the passed string.
  *
- * Parameter: head                  A pointer to the Book Catalog's head
- * Return: None
+ * Parameter: text                  The string to hash
+ * Return: The hash of the string
 */
-void removeAllBooks(Book** head);
+unsigned int hashString(const char text[]);
 
 
 
-/* Name: removeBook
- * Description: This function attempts to remove the Book with the given information from the Catalog. If the Book doesn't exist within the catalog,
- *              a NOT FOUND response message is returned. Otherwise, a REMOVED response message is returned.
- * 
- * Parameter: head                  A pointer to the Book Catalog's head
- * Parameter: title                 The title of the Book to remove
- * Parameter: author                The name of the author of the Book to remove
- * Parameter: location              The location of the Book to remove
- * Parameter: childfd               The socket connection to the client
- * Return: None
-*/ 
-void removeBook(Book** head, char author[100], char title[100], char location[100], int childfd);
+/* Name: histogramPercentile
+ * Description: This function finds the latency a given fraction of a histogram's latencies are no larger than.
+ *
+ * Parameter: histogram             The histogram
+ * Parameter: fraction              The fraction, i.e. 0.99
+ * Return: The latency in nanoseconds, as the upper end of the bucket it falls in, but never more than the largest latency
+*/
+long long histogramPercentile(LatencyHistogram* histogram, double fraction);
+
+
+
+/* Name: isWalRecordIntact
+ * Description: This function checks a write-ahead log record against its checksum.
+ *
+ * Parameter: record                The record to check
+ * Return: true if the record is intact, otherwise false
+*/
+bool isWalRecordIntact(const WalRecord* record);
+
+
+
+/* Name: launchAcceptLoop
+ * Description: This function waits for clients to connect on the passed listening socket, and launches a client loop thread for each one.
+ *              It serves both the TCP listener and the optional Unix domain socket listener. It stops when a handoff starts, leaving new
+ *              connections in the listening socket's backlog for the new server.
+ *
+ * Parameter: fd                    A pointer to the listening socket fd
+ * Return: NULL
+*/
+void* launchAcceptLoop(void* fd);
+
+
+
+/* Name: launchClientLoop
+ * Description: This function runs the client connection loop in a separate thread per client. When a handoff starts, the loop pauses between
+ *              requests until the handoff decides whether the connection is resumed or closed.
+ * 
+ * Parameter: arg                   The client's registered Connection
+ * Return: NULL
+*/ 
+void* launchClientLoop(void* arg);
+
+
+
+/* Name: launchHandoffListener
+ * Description: This function runs the thread that waits for a new server to connect to the handoff socket, hands the server over to it, and
+ *              exits the process once it has.
+ *
+ * Parameter: arg                   Unused
+ * Return: NULL
+*/
+void* launchHandoffListener(void* arg);
+
+
+
+/* Name: launchMetricsListener
+ * Description: This function runs the thread that serves metrics in Prometheus text format over HTTP at /metrics on the admin port, one
+ *              scrape at a time. If the port is still held, i.e. by the server this one took over, it keeps trying until it's free.
+ *
+ * Parameter: arg                   Unused
+ * Return: NULL
+*/
+void* launchMetricsListener(void* arg);
+
+
+
+/* Name: launchRecoveryScanner
+ * Description: This function runs a thread that checks and hashes its range of the write-ahead log tail, and hashes its range of the
+ *              starting Catalog, so the records and Books can be sorted into shards.
+ *
+ * Parameter: arg                   The thread's RecoveryWorker
+ * Return: NULL
+*/
+void* launchRecoveryScanner(void* arg);
+
+
+
+/* Name: launchRecoveryShard
+ * Description: This function runs a thread that indexes the starting Catalog's Books in its shard, then replays the shard's records in log
+ *              order against the index.
+ *
+ * Parameter: arg                   The thread's RecoveryWorker
+ * Return: NULL
+*/
+void* launchRecoveryShard(void* arg);
+
+
+
+/* Name: launchReplicaAcknowledger
+ * Description: This function runs the thread that reads a replica's acknowledgements, i.e. the last log sequence number it has applied, and
+ *              ends the replica's stream when it disconnects.
+ *
+ * Parameter: arg                   The Replica
+ * Return: NULL
+*/
+void* launchReplicaAcknowledger(void* arg);
+
+
+
+/* Name: launchReplicaLoop
+ * Description: This function runs the thread that keeps a replica in step with its primary. It connects to the primary, loads the snapshot
+ *              streamed to it in place of the Catalog, then applies every mutation the primary streams after it, acknowledging what it has
+ *              applied. If the connection is lost, it reconnects and starts again from a new snapshot.
+ *
+ * Parameter: arg                   Unused
+ * Return: NULL
+*/
+void* launchReplicaLoop(void* arg);
+
+
+
+/* Name: launchRequestWorker
+ * Description: This function runs a worker thread that takes requests carrying a request ID off the request queue and completes them.
+ *              Requests from the same connection may complete concurrently and out of order, so every response is framed with its request ID.
+ *
+ * Parameter: arg                   Unused
+ * Return: NULL
+*/
+void* launchRequestWorker(void* arg);
+
+
+
+/* Name: launchSignalWatcher
+ * Description: This function runs the thread that waits for SIGUSR1, starting a background snapshot for it, and for SIGINT and SIGTERM, shutting
+ *              the server down for them. The signals are blocked in every other thread, so they are handled on an ordinary thread that can
+ *              wait on every catalog's semaphore.
+ *
+ * Parameter: arg                   Unused
+ * Return: NULL
+*/
+void* launchSignalWatcher(void* arg);
+
+
+
+/* Name: launchSnapshotReaper
+ * Description: This function runs the thread that waits for a background snapshot's child process to finish, then records and reports
+ *              the snapshot's duration and the memory copied on write while it ran. Once a snapshot succeeds, the write-ahead log is
+ *              truncated to the records after it.
+ *
+ * Parameter: arg                   Unused
+ * Return: NULL
+*/
+void* launchSnapshotReaper(void* arg);
+
+
+
+/* Name: launchWalFlusher
+ * Description: This function runs the background thread that flushes and fsyncs the write-ahead log every batch interval in batch mode.
+ *
+ * Parameter: arg                   Unused
+ * Return: NULL
+*/
+void* launchWalFlusher(void* arg);
+
+
+
+/* Name: loadSnapshot
+ * Description: This function loads the Catalog from the snapshot file by mapping it into memory and using its Books in place, rather than
+ *              allocating and linking each one. The snapshot is mapped at the address its Book links were written for, so when that address
+ *              is free no Book has to be touched and startup time doesn't depend on the Catalog's size. Otherwise, the links are fixed up in one pass.
+ *              The header and catalog table are checked here. Each catalog's records are checked by its first use (checkSnapshotRecords),
+ *              or here while their links are fixed up, so a corrupt snapshot is never served and checking it doesn't cost a pass of its own.
+ *              The snapshot's log sequence number is returned through snapshotLsn so only later write-ahead log records are replayed.
+ *              Each catalog in the snapshot is created if needed and given its run of the records.
+ *
+ * Parameter: path                  The path of the snapshot file
+ * Return: The number of Books loaded, 0 if there is no snapshot file yet, or -1 if the snapshot is invalid
+*/
+long long loadSnapshot(char path[]);
+
+
+
+/* Name: lockAllCatalogs
+ * Description: This function waits for every catalog's semaphore, for the operations that need the whole server to be between requests,
+ *              such as forking a snapshot. The list of catalogs is held too, so no catalog can be created until unlockAllCatalogs is called.
+ *
+ * Parameter: operation             The type of work taking the semaphores, as an index into statsOperationNames
+ * Return: None
+*/
+void lockAllCatalogs(int operation);
+
+
+
+/* Name: logMutation
+ * Description: This function gives a Catalog mutation the next log sequence number, appends it to the write-ahead log, if the log is open,
+ *              and queues it for every connected replica and subscriber. The record is logged under the name of the current thread's catalog.
+ *              It is called while the catalog's semaphore is held, so the log and the replicas get mutations in the same order they were applied. In async mode the record is written to the log file straight away; otherwise
+ *              it is buffered until the next flush.
+ *
+ * Parameter: type                  The type of mutation, i.e. WAL_SUBMIT, WAL_REMOVE or WAL_MOVE
+ * Parameter: title                 The title of the Book
+ * Parameter: author                The name of the author of the Book
+ * Parameter: location              The location of the Book
+ * Parameter: newLocation           The location a MOVE mutation moves the Book to, or blank
+ * Return: The log sequence number of the mutation
+*/
+unsigned long long logMutation(int type, const char title[], const char author[], const char location[], const char newLocation[]);
+
+
+
+/* Name: mergeStats
+ * Description: This function adds one set of statistics to another. The statistics added from may belong to a running thread, so they are
+ *              read with the same whole loads addStat stores them with.
+ *
+ * Parameter: total                 The statistics to add to, which no other thread may be using
+ * Parameter: stats                 The statistics to add
+ * Return: None
+*/
+void mergeStats(ThreadStats* total, ThreadStats* stats);
+
+
+
+/* Name: moveBook
+ * Description: This function attempts to move the Book with the given information to a new location by changing its location in place.
+ *              The Book is never absent from the Catalog while it moves. If the Book doesn't exist, a NOT FOUND response message is returned,
+ *              and if the same Book already exists at the new location, a DUPLICATE response message is returned. Otherwise, a MOVED response message is returned.
+ *
+ * Parameter: head                  The head pointer to the Book Catalog
+ * Parameter: title                 The title of the Book to move
+ * Parameter: author                The name of the author of the Book to move
+ * Parameter: location              The current location of the Book to move
+ * Parameter: newLocation           The location to move the Book to
+ * Parameter: childfd               The socket connection to the client
+ * Return: None
+*/
+void moveBook(Book* head, char title[100], char author[100], char location[100], char newLocation[100], int childfd);
+
+
+
+/* Name: openConnection
+ * Description: This function creates and registers the Connection for a client socket, so a handoff can account for it from the moment it is
+ *              accepted, and starts its client loop thread.
+ *
+ * Parameter: childfd               The client's socket
+ * Parameter: buffered              Allocated request bytes already read from the client, which are answered first and freed by the connection, or NULL
+ * Parameter: bufferedLength        The number of bytes already read
+ * Return: None
+*/
+void openConnection(int childfd, char buffered[], int bufferedLength);
+
+
+
+/* Name: openWriteAheadLog
+ * Description: This function opens the write-ahead log at the given path, creating it if needed. The records written after the loaded snapshot
+ *              are found without reading the ones before it, and replayed into the Catalog first, stopping at the first torn or corrupt record,
+ *              which is cut off the end of the log. If the snapshot's records they change turn out corrupt, the snapshot is dropped and the
+ *              whole log is replayed instead. New mutations are then appended after the replayed ones. In batch mode, the background flusher
+ *              thread is started.
+ *
+ * Parameter: path                  The path of the write-ahead log file
+ * Parameter: mode                  The durability mode, i.e. WAL_SYNC, WAL_BATCH or WAL_ASYNC
+ * Parameter: batchInterval         How often to fsync the log in batch mode, in milliseconds
+ * Return: The number of records replayed, or -1 if the log couldn't be opened
+*/
+int openWriteAheadLog(char path[], int mode, int batchInterval);
+
+
+
+/* Name: parseRequest
+ * Description: This function takes the request message from the client and breaks it apart to get all of the passed request tokens.
+ *              The tokens are used by decipherRequest to determine the type of request, and if it's valid.
+ *              A method or value that doesn't fit its container is cut to fit, and the whole token is still taken off the request.
+ * 
+ * Parameter: request               The request message received from the client
+ * Parameter: method                The method or header type i.e. METHOD, AUTHOR, TITLE
+ * Parameter: methodSize            The size of the method container, including its terminator
+ * Parameter: value                 The method or header value i.e. GET, SUBMIT, REMOVE
+ * Parameter: valueSize             The size of the value container, including its terminator
+ * Return: True if the method and value both fit their containers, otherwise false
+*/ 
+bool parseRequest(char request[], char method[], int methodSize, char value[], int valueSize);
+
+
+
+/* Name: publishEvent
+ * Description: This function queues a mutation as an event for every subscriber whose filter it matches. A subscriber whose queue is full
+ *              has the event dropped and counted instead, so a slow subscriber never holds up the mutation. It is called by logMutation with
+ *              the write-ahead log lock held.
+ *
+ * Parameter: record                The mutation, with its log sequence number
+ * Return: None
+*/
+void publishEvent(WalRecord* record);
+
+
+
+/* Name: publishInvalidation
+ * Description: This function pushes an invalidation to every connection caching a GET result for the changed Book's title or author in
+ *              its catalog, and forgets those keys. It is called by logMutation after the write-ahead log lock is released, but while the
+ *              catalog can't change, so a GET of the catalog is always tracked before any change after it is published.
+ *
+ * Parameter: record                The mutation, or NULL to flush every connection's cache because every catalog was replaced
+ * Return: None
+*/
+void publishInvalidation(WalRecord* record);
+
+
+
+/* Name: publishMutation
+ * Description: This function queues a mutation for every connected replica. A replica whose queue is full is disconnected rather than
+ *              holding up the primary. It is called by logMutation with the write-ahead log lock held.
+ *
+ * Parameter: record                The mutation, with its log sequence number
+ * Return: None
+*/
+void publishMutation(WalRecord* record);
+
+
+
+/* Name: pushInvalidation
+ * Description: This function writes an invalidation to a connection as a response framed with request ID 0, which no request uses, or
+ *              queues it for the thread writing a response to the connection to send after. It never waits for the client to read.
+ *              It must be called without trackingLock held, for a connection that can't be freed meanwhile.
+ *
+ * Parameter: connection            The connection
+ * Parameter: text                  The invalidation, i.e. '212:INVALIDATE\nCATALOG:\nTITLE:Networking\nAUTHOR:Clayton\n'
+ * Return: None
+*/
+void pushInvalidation(Connection* connection, const char text[]);
+
+
+
+/* Name: queueRequest
+ * Description: This function hands a request carrying a request ID to the worker threads, counting it as in flight on its connection.
+ *              If the connection already has MAX_IN_FLIGHT_REQUESTS in flight, it first waits for one of them to finish.
+ *
+ * Parameter: connection            The connection the request arrived on
+ * Parameter: id                    The request ID to echo in the response
+ * Parameter: request               The request message, without its request ID field
+ * Return: None
+*/
+void queueRequest(Connection* connection, char id[], char request[]);
+
+
+
+/* Name: readFully
+ * Description: This function reads exactly the given number of bytes from a socket.
+ *
+ * Parameter: fd                    The socket to read from
+ * Parameter: buffer                Where to put the bytes
+ * Parameter: length                The number of bytes to read
+ * Return: 0 if every byte was read, or -1 if the connection ended first
+*/
+int readFully(int fd, void* buffer, int length);
+
+
+
+/* Name: readPrivateDirtyKb
+ * Description: This function reads how much memory the current process holds privately and has written, from /proc/self/smaps_rollup.
+ *              In a snapshot child, this is the Catalog memory copied on write by either process since the fork. It uses only system calls,
+ *              so it is safe in the child.
+ *
+ * Return: The private dirty memory in kB, or -1 if it couldn't be read
+*/
+long long readPrivateDirtyKb();
+
+
+
+/* Name: receiveHandoffItem
+ * Description: This function receives a single handoff item and the socket sent with it, if any.
+ *
+ * Parameter: fd                    The connection to the old server's handoff socket
+ * Parameter: item                  The item received
+ * Parameter: passedfd              The socket received with the item, or -1
+ * Return: 0 if the item was received, or -1 if it couldn't be
+*/
+int receiveHandoffItem(int fd, HandoffItem* item, int* passedfd);
+
+
+
+/* Name: recordLatency
+ * Description: This function counts a latency in one of the current thread's histograms.
+ *
+ * Parameter: histogram             The histogram
+ * Parameter: latencyNs             The latency in nanoseconds
+ * Return: None
+*/
+void recordLatency(LatencyHistogram* histogram, long long latencyNs);
+
+
+
+/* Name: recordRequest
+ * Description: This function counts a request the current thread has answered, with its service time, its lock wait time, and whether
+ *              its response reported an error.
+ *
+ * Parameter: operation             The type of request, as an index into statsOperationNames
+ * Parameter: startNs               When the request started being answered, from currentNanos
+ * Parameter: lockWaitNs            How long the request waited for the catalog semaphore, or -1 if it never took it
+ * Parameter: lockHoldNs            How long the request held the catalog semaphore
+ * Return: None
+*/
+void recordRequest(int operation, long long startNs, long long lockWaitNs, long long lockHoldNs);
+
+
+
+/* Name: recoveryHash
+ * Description: This function hashes a Book's catalog, title and author, which decides the shard it is replayed by.
+ *
+ * Parameter: catalog               The name of the Book's catalog
+ * Parameter: title                 The Book's title
+ * Parameter: author                The Book's author
+ * Return: The hash
+*/
+unsigned int recoveryHash(const char catalog[], const char title[], const char author[]);
+
+
+
+/* Name: releaseCatalog
+ * Description: This function releases a catalog's semaphore taken by acquireCatalog, profiling how long it was held.
+ *
+ * Parameter: catalog               The catalog
+ * Return: None
+*/
+void releaseCatalog(Catalog* catalog);
+
+
+
+/* Name: removeAllBooks
+ * Description: This function removes all of the Books from the Catalog. This function is called when the server is killed.
+ *
+ * Parameter: head                  A pointer to the Book Catalog's head
+ * Return: None
+*/
+void removeAllBooks(Book** head);
+
+
+
+/* Name: removeBook
+ * Description: This function attempts to remove the Book with the given information from the Catalog. If the Book doesn't exist within the catalog,
+ *              a NOT FOUND response message is returned. Otherwise, a REMOVED response message is returned.
+ * 
+ * Parameter: head                  A pointer to the Book Catalog's head
+ * Parameter: title                 The title of the Book to remove
+ * Parameter: author                The name of the author of the Book to remove
+ * Parameter: location              The location of the Book to remove
+ * Parameter: childfd               The socket connection to the client
+ * Return: None
+*/ 
+void removeBook(Book** head, char author[100], char title[100], char location[100], int childfd);
+
+
+
+/* Name: removeMatchingBooks
+ * Description: This function removes every Book matching the given author and/or location from the Catalog in a single pass, and returns
+ *              the number of Books removed in a REMOVED response message. A blank author or location matches any Book, but at least one must be given.
+ *              If no Books match, a NOT FOUND response message is returned.
+ *
+ * Parameter: head                  A pointer to the Book Catalog's head
+ * Parameter: author                The name of the author of the Books to remove, or blank
+ * Parameter: location              The location of the Books to remove, or blank
+ * Parameter: childfd               The socket connection to the client
+ * Return: None
+*/
+void removeMatchingBooks(Book** head, char author[100], char location[100], int childfd);
+
+
+
+/* Name: replayWalTail
+ * Description: This function applies the write-ahead log records written after the snapshot to the Catalog in bulk. The records are checked
+ *              and hashed in parallel, then each thread replays the records of its own shard of (title, author) hashes against its own hash
+ *              index of the Catalog, since records for different shards never touch the same Book. The Catalog is then relinked in one pass,
+ *              with the surviving Books in the order a record-by-record replay would have left them. No responses are sent.
+ *
+ * Parameter: tail                  The records after the snapshot, in log order
+ * Parameter: tailCount             The number of records
+ * Return: The number of records replayed, which stops before the first torn or corrupt record, -1 if records are missing, or -2 if
+ *         the snapshot's records of a catalog the records change are corrupt
+*/
+long long replayWalTail(WalRecord tail[], long long tailCount);
+
+
+
+/* Name: reportReplication
+ * Description: This function sends the client the server's replication state: as a primary, every replica and how far behind it is; as a
+ *              replica, how far behind its primary it is in log sequence numbers and milliseconds.
+ *
+ * Parameter: childfd               The client's socket
+ * Return: None
+*/
+void reportReplication(int childfd);
+
+
+
+/* Name: reportStats
+ * Description: This function merges the statistics of every thread, running or exited, and sends them as a STATS response: the open
+ *              connections, the bytes read and written, and for every type of request answered, its count, errors, and service, lock wait
+ *              and lock hold time percentiles. Then for every catalog's semaphore, how contended it is and its longest hold, and last the
+ *              types of work that have kept others waiting the longest.
+ *
+ * Parameter: childfd               The socket connection to the client
+ * Return: None
+*/
+void reportStats(int childfd);
+
+
+
+/* Name: requestFieldsFit
+ * Description: This function checks that every field of a request message fits the containers decipherRequest parses it into, without
+ *              changing the message. It splits the fields the same way parseRequest does, so it's checked once before any of them are copied.
+ *
+ * Parameter: request               The request message received from the client
+ * Parameter: methodSize            The size of a method container, including its terminator
+ * Parameter: valueSize             The size of a value container, including its terminator
+ * Return: True if every method and value fits, otherwise false
+*/
+bool requestFieldsFit(const char request[], int methodSize, int valueSize);
+
+
+
+/* Name: retireThreadStats
+ * Description: This function merges the current thread's statistics into those of the exited threads and frees them, before it exits.
+ *
+ * Return: None
+*/
+void retireThreadStats();
+
+
+
+/* Name: sendHandoffItem
+ * Description: This function sends a single handoff item, with a socket attached using SCM_RIGHTS if one is given.
+ *
+ * Parameter: fd                    The new server's connection to the handoff socket
+ * Parameter: item                  The item to send
+ * Parameter: passedfd              The socket to send with the item, or -1
+ * Return: 0 if the item was sent, or -1 if it couldn't be
+*/
+int sendHandoffItem(int fd, HandoffItem* item, int passedfd);
+
+
+
+/* Name: sendServerResponse
+ * Description: This function attempts to send the passed server response to the client socket specified by childfd.
+ *              If the response answers a request carrying a request ID, it is preceded by an 'ID:<id>,LENGTH:<length>' line so the client
+ *              can match it to its request. If unsuccessful, an error message will be reported on the server and the connection is shut down,
+ *              which its client loop sees as a disconnect.
+ * 
+ * Parameter: childfd           The socket fd of the client connection
+ * Parameter: response          The server response to send to the client
+ * Parameter: length            The length of the response to send to the client
+ * Return: None
+*/ 
+void sendServerResponse(int childfd, const char response[], int length);
+
+
+
+/* Name: serveMetrics
+ * Description: This function answers a single metrics scrape: the size and memory of the Catalog, the open connections and bytes moved,
+ *              every type of request's counts and latency histograms, and every catalog semaphore's contention. Nothing it reads needs a
+ *              catalog's semaphore.
+ *
+ * Parameter: scrapefd              The scraper's connection, which is closed by the caller
+ * Return: None
+*/
+void serveMetrics(int scrapefd);
+
+
+
+/* Name: serveReplica
+ * Description: This function streams a replica the mutations queued for it, once its snapshot has been sent, with heartbeats while there are
+ *              none, until the replica disconnects, falls too far behind or the server is handed off. It runs on the replica's client loop thread,
+ *              outside the Catalog semaphore.
+ *
+ * Parameter: replica               The Replica returned by startReplica
+ * Return: None
+*/
+void serveReplica(Replica* replica);
+
+
+
+/* Name: serveSubscriber
+ * Description: This function streams a subscriber the events queued for it, telling it first whenever events were dropped, until it
+ *              disconnects or the server is handed off. It runs on the subscriber's client loop thread, outside the Catalog semaphore.
+ *
+ * Parameter: subscriber            The Subscriber to stream to
+ * Return: None
+*/
+void serveSubscriber(Subscriber* subscriber);
+
+
+
+/* Name: snapshotRecordChecksum
+ * Description: This function computes a single record's share of its catalog's records checksum in a snapshot. The shares are added
+ *              together, so a run can be checked in parts by several threads, and each is weighted by the record's position so Books
+ *              that swapped places don't match.
+ *
+ * Parameter: record                The record as it is in the snapshot file
+ * Parameter: position              The record's position in its catalog's run, from 0
+ * Return: The record's share of the checksum
+*/
+unsigned int snapshotRecordChecksum(const Book* record, long long position);
+
+
+
+/* Name: startBackgroundSnapshot
+ * Description: This function forks the server so the child can write the snapshot from its copy-on-write view of the Catalog while the
+ *              parent keeps serving requests. It must be called while every catalog's semaphore is held, which makes the fork a consistent
+ *              point in the write-ahead log. Only one background snapshot runs at a time.
+ *
+ * Return: The child's process ID, 0 if a snapshot is already running, or -1 if the snapshot couldn't be started
+*/
+pid_t startBackgroundSnapshot();
+
+
+
+/* Name: startReplica
+ * Description: This function registers a new replica and forks a child to stream it the Catalog's Books from its copy-on-write view. It is
+ *              called while every catalog's semaphore is held, so the snapshot and the mutations queued after it meet at a single log sequence number.
+ *
+ * Parameter: childfd               The replica's socket
+ * Return: The Replica, or NULL if the snapshot couldn't be started
+*/
+Replica* startReplica(int childfd);
+
+
+
+/* Name: statsOperation
+ * Description: This function finds the type of request a method is counted as by STATS.
+ *
+ * Parameter: method                The request's method, i.e. 'GET'
+ * Return: The type of request, as an index into statsOperationNames
+*/
+int statsOperation(const char method[]);
+
+
+
+/* Name: submitBook
+ * Description: This function attempts to submit the Book with the given information to the Catalog. 
+ *              The Book will be inserted to the back of the Catalog list in-order to check if the submission is a duplicate. 
+ *              Duplicate Book submissions will be ignored, and a DUPLICATE response message will be returned. Otherwise, a SUBMITTED response message is returned.
+ * 
+ * Parameter: head                  A pointer to the Book Catalog's head
+ * Parameter: title                 The title of the Book to submit
+ * Parameter: author                The name of the author of the Book to submit
+ * Parameter: location              The location of the Book to submit
+ * Parameter: childfd               The socket connection to the client
+ * Return: None
+*/ 
+void submitBook(Book** head, char title[100], char author[100], char location[100], int childfd);
+
+
+
+/* Name: takeOverServer
+ * Description: This function connects to a running server's handoff socket and takes it over: the running server writes its Catalog to the
+ *              given snapshot path and passes its listening sockets, and optionally its client connections, to this process. The listening
+ *              sockets are stored in parentfd and unixfd, and the client connections are started once the Catalog has been loaded.
+ *
+ * Parameter: path                  The path of the running server's handoff socket
+ * Parameter: clients               Whether to take over the running server's client connections too
+ * Parameter: clientfds             The client sockets taken over
+ * Parameter: clientBuffers         The request bytes each client socket had read but not answered
+ * Parameter: clientLengths         The number of those bytes
+ * Return: The number of client connections taken over, or -1 if the server couldn't be taken over
+*/
+int takeOverServer(char path[], bool clients, int** clientfds, char*** clientBuffers, int** clientLengths);
+
+
+
+/* Name: trackKey
+ * Description: This function records that a connection caches the result of a GET for a title or author, so it is pushed an invalidation
+ *              when a Book with that title or author changes. It is called while the catalog can't change.
+ *
+ * Parameter: connection            The connection
+ * Parameter: catalog               The name of the catalog the GET read
+ * Parameter: byAuthor              Whether the key is an author rather than a title
+ * Parameter: value                 The title or author
+ * Return: None
+*/
+void trackKey(Connection* connection, const char catalog[], bool byAuthor, const char value[]);
+
+
+
+/* Name: trackingBucket
+ * Description: This function finds the hash bucket a title or author is tracked in.
+ *
+ * Parameter: catalog               The name of the catalog
+ * Parameter: byAuthor              Whether the key is an author rather than a title
+ * Parameter: value                 The title or author
+ * Return: The bucket's index in trackingTable
+*/
+unsigned int trackingBucket(const char catalog[], bool byAuthor, const char value[]);
+
+
+
+/* Name: truncateWriteAheadLog
+ * Description: This function drops the records a snapshot already holds from the start of the write-ahead log, so the log doesn't grow
+ *              forever and restarts don't have to skip past them. The records after the snapshot are copied into a new log file, which is
+ *              fsynced and renamed over the old one, so a crash leaves either the old log or the new one. Appends wait while it runs.
+ *              It must only be called once the snapshot is durable.
+ *
+ * Parameter: lsn                   The log sequence number of the last record in the snapshot
+ * Return: The number of records dropped, or -1 if the log couldn't be rewritten, in which case the old log is kept
+*/
+long long truncateWriteAheadLog(unsigned long long lsn);
+
+
+
+/* Name: unlinkBook
+ * Description: This function unlinks the passed Book from the Catalog, moving the head pointer if it was the first Book, and frees it.
+ *
+ * Parameter: head                  A pointer to the Book Catalog's head
+ * Parameter: book                  The Book to unlink
+ * Return: None
+*/
+void unlinkBook(Book** head, Book* book);
+
+
+
+/* Name: unloadSnapshot
+ * Description: This function empties every catalog of the Books mapped from the snapshot at startup and unmaps it, so the Catalog can be
+ *              rebuilt from the whole write-ahead log instead. It is only called at startup, before any client connects.
+ *
+ * Return: None
+*/
+void unloadSnapshot();
+
+
+
+/* Name: unlockAllCatalogs
+ * Description: This function releases every catalog's semaphore and the list of catalogs, taken by lockAllCatalogs.
+ *
+ * Return: None
+*/
+void unlockAllCatalogs();
+
+
+
+/* Name: waitForReplication
+ * Description: This function waits briefly for a replica to apply the primary's log up to a session's log sequence number, so a client
+ *              reading from the replica sees its own writes to the primary.
+ *
+ * Parameter: lsn                   The session's log sequence number
+ * Return: true if the replica has applied it, or false if the replica is still behind after SESSION_WAIT_INTERVAL
+*/
+bool waitForReplication(unsigned long long lsn);
+
+
+
+/* Name: waitForWriteAheadLog
+ * Description: This function waits until the write-ahead log record with the given log sequence number is on disk, flushing the log itself
+ *              if no other thread is already doing so.
+ *
+ * Parameter: lsn                   The log sequence number to wait for
+ * Return: None
+*/
+void waitForWriteAheadLog(unsigned long long lsn);
+
+
+
+/* Name: walFlushCount
+ * Description: This function returns the number of flushes of the write-ahead log that wrote records, for measuring group commit.
+ *
+ * Return: The number of flushes
+*/
+unsigned long long walFlushCount();
+
+
+
+/* Name: writeFully
+ * Description: This function writes every one of the given bytes to a file or socket.
+ *
+ * Parameter: fd                    The file or socket to write to
+ * Parameter: buffer                The bytes to write
+ * Parameter: length                The number of bytes to write
+ * Return: 0 if every byte was written, or -1 if the write failed first
+*/
+int writeFully(int fd, const void* buffer, int length);
+
+
+
+/* Name: writePushes
+ * Description: This function writes the invalidations queued for a connection without waiting for the client to read. A connection that
+ *              can't take them all now is shut down, since its cache would otherwise be left stale. It must be called with the connection's
+ *              writeLock held, while no response is being written to it.
+ *
+ * Parameter: connection            The connection
+ * Return: None
+*/
+void writePushes(Connection* connection);
+
+
+
+/* Name: writeSnapshot
+ * Description: This function writes every Book in every catalog to the snapshot file, one catalog after another, with their links rewritten
+ *              for the snapshot base address. A table after the records says which catalog each run of records belongs to.
+ *              The snapshot is written to a temporary file, fsynced and renamed over the old one, so a crash never leaves a partial snapshot.
+ *              It must be called while every catalog's semaphore is held, so the snapshot matches the write-ahead log up to its log sequence number.
+ *              It allocates nothing and uses only system calls rather than stdio, so it is safe in a child forked from the threaded server.
+ *              It refuses to write a catalog found corrupt, since the new snapshot's checksums would make its Books look valid.
+ *
+ * Parameter: head                  The first catalog in the list of catalogs
+ * Parameter: path                  The path of the snapshot file
+ * Parameter: lsn                   The log sequence number of the last mutation applied to the Catalog
+ * Parameter: table                 Room for an entry for every catalog, which the catalog table is built in
+ * Return: The number of Books written, or -1 if the snapshot couldn't be written
+*/
+long long writeSnapshot(Catalog* head, char path[], unsigned long long lsn, SnapshotCatalog table[]);
+
+
+
+#ifndef SERVER_NO_MAIN
+//Main loop
+int main(int argc, char **argv) {
+
+    //The port number to listen on
+    int portNum;
+
+    //The server address struct
+    struct sockaddr_in serveraddr; 
+
+    //The Unix domain socket address struct
+    struct sockaddr_un unixaddr;
+
+    //Flag value for setsockopt
+    int optval;
+
+    //The command line option being read
+    int option;
+
+    //The path of the write-ahead log, or NULL to keep the Catalog in memory only
+    char* walPath = NULL;
+
+    //The durability mode of the write-ahead log, and its fsync interval in batch mode
+    int walMode = WAL_SYNC;
+    int walInterval = 0;
+
+    //The number of write-ahead log records replayed into the Catalog
+    int replayedCount;
+
+    //The signals that start a background snapshot and shut the server down, and the thread waiting for them
+    sigset_t watchedSignals;
+    pthread_t signalThread;
+
+    //The handoff socket of a running server to take over, and whether to take over its client connections too
+    char* takeoverPath = NULL;
+    bool takeoverClients = false;
+
+    //The client connections taken over, and the request bytes each had read but not answered
+    int takenCount = 0;
+    int* takenfds = NULL;
+    char** takenBuffers = NULL;
+    int* takenLengths = NULL;
+
+    //The handoff socket address struct
+    struct sockaddr_un handoffaddr;
+
+    //Read the command line options
+    while ((option = getopt(argc, argv, "u:w:d:s:H:T:CR:M:")) != -1) {
+
+        //-u: Also listen on a Unix domain socket at the given path
+        if (option == 'u' && strlen(optarg) < sizeof(unixSocketPath)) {
+            strcpy(unixSocketPath, optarg);
+        }
+
+        //-w: Log every Catalog mutation to a write-ahead log at the given path
+        else if (option == 'w') {
+            walPath = optarg;
+        }
+
+        //-s: Load the Catalog from a snapshot file at startup, and write it there on a SNAPSHOT request
+        else if (option == 's' && strlen(optarg) < sizeof(snapshotPath) - 4) {
+            strcpy(snapshotPath, optarg);
+        }
+
+        //-d: The write-ahead log's durability mode, one of 'sync', 'batch:<milliseconds>' or 'async'
+        else if (option == 'd' && strcmp(optarg, "sync") == 0) {
+            walMode = WAL_SYNC;
+        }
+        else if (option == 'd' && sscanf(optarg, "batch:%d", &walInterval) == 1 && walInterval > 0) {
+            walMode = WAL_BATCH;
+        }
+        else if (option == 'd' && strcmp(optarg, "async") == 0) {
+            walMode = WAL_ASYNC;
+        }
+
+        //-H: Accept handoffs to a new server process on a Unix domain socket at the given path
+        else if (option == 'H' && strlen(optarg) < sizeof(handoffPath)) {
+            strcpy(handoffPath, optarg);
+        }
+
+        //-T: Take over the running server whose handoff socket is at the given path, instead of binding the port
+        else if (option == 'T') {
+            takeoverPath = optarg;
+        }
+
+        //-C: When taking over, take over the running server's client connections too
+        else if (option == 'C') {
+            takeoverClients = true;
+        }
+
+        //-R: Run as a read-only replica of the primary at the given host and port
+        else if (option == 'R' && sscanf(optarg, "%299[^:]:%d", primaryHost, &primaryPort) == 2 && primaryPort > 0) {
+            continue;
+        }
+
+        //-M: Serve metrics over HTTP at /metrics on the given admin port
+        else if (option == 'M' && (metricsPort = atoi(optarg)) > 0) {
+            continue;
+        }
+
+        else {
+            fprintf(stderr, "usage: %s [-u <socket path>] [-w <log path>] [-d sync|batch:<ms>|async] [-s <snapshot path>] [-H <handoff path>] [-T <handoff path> [-C]] [-R <primary host>:<port>] [-M <admin port>] <port>\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    //Verify the user provided a port number to connect to
+    if (argc - optind != 1) {
+        fprintf(stderr, "usage: %s [-u <socket path>] [-w <log path>] [-d sync|batch:<ms>|async] [-s <snapshot path>] [-H <handoff path>] [-T <handoff path> [-C]] [-R <primary host>:<port>] [-M <admin port>] <port>\n", argv[0]);
+        exit(1);
+    }
+
+    //A replica's Catalog is rebuilt from its primary every time it connects, so it keeps no write-ahead log of its own
+    if (primaryPort > 0 && walPath != NULL) {
+        fprintf(stderr, "usage: -R <primary host>:<port> can't be used with -w <log path>.\n");
+        exit(1);
+    }
+
+    //The running server hands its Catalog over through the snapshot, so a snapshot path is needed to take it over
+    if (takeoverPath != NULL && snapshotPath[0] == '\0') {
+        fprintf(stderr, "usage: -T <handoff path> needs -s <snapshot path> to load the running server's Catalog from.\n");
+        exit(1);
+    }
+
+    //Get the port number from the command line
+    portNum = atoi(argv[optind]);
+
+    //If the user gave a negative port number, exit
+    if (portNum < 0) {
+        fprintf(stderr, "usage: %s <port> must be non-negative.", argv[optind]);
+        exit(1);
+    }
+
+    //The pipe that wakes every accept loop and client loop when a handoff starts
+    if (pipe(handoffPipe) < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    //If taking over a running server, receive its listening sockets (and client connections) once it has written its Catalog to the snapshot
+    if (takeoverPath != NULL) {
+
+        takenCount = takeOverServer(takeoverPath, takeoverClients, &takenfds, &takenBuffers, &takenLengths);
+
+        if (takenCount < 0) {
+            fprintf(stderr, "ERROR: The server with handoff socket %s could not be taken over.\n", takeoverPath);
+            exit(1);
+        }
+
+        printf("Took over the server with handoff socket %s and %d client connections.\n", takeoverPath, takenCount);
+    }
+
+    //Otherwise, create the parent (server) socket
+    else {
+
+        parentfd = socket(AF_INET, SOCK_STREAM, 0);
+
+        //If there was an error creating the parent socket, inform the user
+        if (parentfd < 0) {
+            perror("ERROR: ");
+            exit(1);
+        }
+
+        //Code that allows socket to be rebound to immediately without error
+        optval = 1;
+        setsockopt(parentfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval , sizeof(int));
+
+        //Build the server's internet address with an IP address and port number
+        serveraddr.sin_family = AF_INET;
+        serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+        serveraddr.sin_port = htons((unsigned short)portNum);
+
+        //Bind the parent socket id to the port number
+        if (bind(parentfd, (struct sockaddr *) &serveraddr, sizeof(serveraddr)) < 0) {
+            perror("ERROR: ");
+            exit(1);
+        }
+
+        //Listen for any connection requests. The backlog is large so connections made during a handoff wait for the new server rather than being dropped
+        if (listen(parentfd, SOMAXCONN) < 0) {
+            perror("ERROR: ");
+            exit(1);
+        }
+    }
+
+    //Create the default catalog, whose semaphore makes sure only one request accesses it at a time
+    findCatalog("", true);
+
+    //Block SIGUSR1, SIGINT and SIGTERM in every thread, and start the thread that waits for them to take a background snapshot or shut down.
+    //Until then, SIGINT and SIGTERM end the server straight away, since there are no clients or buffered log records yet
+    sigemptyset(&watchedSignals);
+    sigaddset(&watchedSignals, SIGUSR1);
+    sigaddset(&watchedSignals, SIGINT);
+    sigaddset(&watchedSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &watchedSignals, NULL);
+    pthread_create(&signalThread, NULL, launchSignalWatcher, NULL);
+    pthread_detach(signalThread);
+
+    //If a snapshot was given, load the Catalog from it before any client connects
+    if (snapshotPath[0] != '\0') {
+
+        //The number of Books loaded from the snapshot
+        long long loadedCount = loadSnapshot(snapshotPath);
+
+        //If the snapshot is invalid and there is a write-ahead log, which keeps every mutation, rebuild the whole Catalog from the log instead
+        if (loadedCount < 0 && walPath != NULL) {
+            fprintf(stderr, "ERROR: The snapshot %s could not be loaded, so the Catalog is rebuilt from the whole write-ahead log.\n", snapshotPath);
+        }
+
+        //Otherwise, inform the user rather than serve a partial Catalog
+        else if (loadedCount < 0) {
+            fprintf(stderr, "ERROR: The snapshot %s could not be loaded.\n", snapshotPath);
+            exit(1);
+        }
+
+        else {
+            printf("Loaded %lld Books from snapshot %s.\n", loadedCount, snapshotPath);
+        }
+    }
+
+    //If a write-ahead log was given, rebuild the rest of the Catalog from it before any client connects
+    if (walPath != NULL) {
+
+        replayedCount = openWriteAheadLog(walPath, walMode, walInterval);
+
+        //If the log couldn't be opened, inform the user
+        if (replayedCount < 0) {
+            perror("ERROR: ");
+            exit(1);
+        }
+
+        printf("Replayed %d write-ahead log records from %s.\n", replayedCount, walPath);
+    }
+
+    //If this is a replica, follow the primary from its own thread
+    if (primaryPort > 0) {
+
+        //The replication thread
+        pthread_t replicaThread;
+
+        pthread_create(&replicaThread, NULL, launchReplicaLoop, NULL);
+        pthread_detach(replicaThread);
+    }
+
+    //Start the worker threads that complete requests carrying a request ID
+    for (int i = 0; i < REQUEST_WORKER_COUNT; i++) {
+        pthread_t workerThread;
+        pthread_create(&workerThread, NULL, launchRequestWorker, NULL);
+        pthread_detach(workerThread);
+    }
+
+    //If a socket path was given and no Unix domain socket listener was taken over, also listen on one so local clients skip the TCP stack
+    if (unixSocketPath[0] != '\0' && unixfd < 0) {
+
+        //Create the Unix domain socket
+        unixfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        //If there was an error creating the socket, inform the user
+        if (unixfd < 0) {
+            perror("ERROR: ");
+            exit(1);
+        }
+
+        //Build the socket's address from its path, removing any socket left over from an earlier run
+        memset(&unixaddr, 0, sizeof(unixaddr));
+        unixaddr.sun_family = AF_UNIX;
+        strcpy(unixaddr.sun_path, unixSocketPath);
+        unlink(unixSocketPath);
+
+        //Bind the socket to its path and listen for connection requests
+        if (bind(unixfd, (struct sockaddr *) &unixaddr, sizeof(unixaddr)) < 0 || listen(unixfd, SOMAXCONN) < 0) {
+            perror("ERROR: ");
+            exit(1);
+        }
+    }
+
+    //Accept local clients on their own thread
+    if (unixfd >= 0) {
+
+        //The Unix domain socket's accept loop thread
+        pthread_t unixThread;
+
+        pthread_create(&unixThread, NULL, launchAcceptLoop, (void*) &unixfd);
+        pthread_detach(unixThread);
+    }
+
+    //Resume the client connections taken over, now that the Catalog is loaded
+    for (int i = 0; i < takenCount; i++) {
+        openConnection(takenfds[i], takenBuffers[i], takenLengths[i]);
+    }
+
+    free(takenfds);
+    free(takenBuffers);
+    free(takenLengths);
+
+    //If a handoff path was given, wait for a new server to take this one over
+    if (handoffPath[0] != '\0') {
+
+        //The handoff socket's thread
+        pthread_t handoffThread;
+
+        //Create the handoff socket, removing any socket left over from an earlier server
+        handoffListenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        memset(&handoffaddr, 0, sizeof(handoffaddr));
+        handoffaddr.sun_family = AF_UNIX;
+        strcpy(handoffaddr.sun_path, handoffPath);
+        unlink(handoffPath);
+
+        if (handoffListenfd < 0 || bind(handoffListenfd, (struct sockaddr *) &handoffaddr, sizeof(handoffaddr)) < 0 || listen(handoffListenfd, 1) < 0) {
+            perror("ERROR: ");
+            exit(1);
+        }
+
+        pthread_create(&handoffThread, NULL, launchHandoffListener, NULL);
+        pthread_detach(handoffThread);
+    }
+
+    //If an admin port was given, serve metrics on it from a thread of its own, so scrapes never wait behind clients
+    if (metricsPort > 0) {
+
+        //The metrics listener's thread
+        pthread_t metricsThread;
+
+        pthread_create(&metricsThread, NULL, launchMetricsListener, NULL);
+        pthread_detach(metricsThread);
+    }
+
+    //Main loop to wait for a connection request
+    launchAcceptLoop((void*) &parentfd);
+
+    //The accept loop only stops for a handoff, which exits the process once it is done
+    pthread_exit(NULL);
+
+    return 0;
+}
+#endif
+
+
+
+//FUNCTION launchAcceptLoop
+void* launchAcceptLoop(void* fd) {
+
+    //The listening socket to accept clients on
+    int listenfd = *((int*)fd);
+
+    //The child socket number
+    int childfd; 
+
+    //The length of the client's address
+    socklen_t clientLength;
+
+    //The client address struct, large enough for both internet and Unix domain addresses
+    struct sockaddr_storage clientaddr; 
+
+    //The hostnet information for the client
+    struct hostent *hostp; 
+
+    //The host IP address string
+    char *hostaddrp;
+
+    //The listening socket and the handoff pipe, either of which wakes the loop
+    struct pollfd waits[2] = { { listenfd, POLLIN, 0 }, { handoffPipe[0], POLLIN, 0 } };
+
+    //Count the loop as running, so a handoff waits for it to stop
+    pthread_mutex_lock(&connectionRegistry.lock);
+    connectionRegistry.acceptLoopCount++;
+    pthread_mutex_unlock(&connectionRegistry.lock);
+
+    //Main loop to wait for a connection request
+    while (1) {
+
+        //Wait for a client to connect or a handoff to start
+        if (poll(waits, 2, -1) < 0) {
+            continue;
+        }
+
+        //If a handoff has started, stop accepting and leave new connections waiting in the backlog for the new server
+        if (waits[1].revents & POLLIN) {
+            break;
+        }
+
+        //Get the length of the client's address
+        clientLength = sizeof(clientaddr);
+
+        //Accept the client
+        childfd = accept(listenfd, (struct sockaddr *) &clientaddr, &clientLength);
+        
+        //If the client's connection wasn't accepted, error
+        if (childfd < 0) {
+            perror("ERROR: ");
+            exit(1);
+        }
+
+        //Clients on the Unix domain socket are on this host and have no IP address
+        if (clientaddr.ss_family == AF_UNIX) {
+            printf("Server established local connection on socket fd %d.\n", childfd);
+        }
+
+        //Otherwise, determine who the client is by their IP address
+        else {
+
+            //The client's internet address
+            struct sockaddr_in* inetaddr = (struct sockaddr_in*) &clientaddr;
+
+            hostp = gethostbyaddr((const char *)&inetaddr->sin_addr.s_addr, sizeof(inetaddr->sin_addr.s_addr), AF_INET);
+        
+            //If something went wrong getting the host address
+            if (hostp == NULL) {
+                perror("ERROR: ");
+                exit(1);
+            }
+
+            //Get the client's IP address
+            hostaddrp = inet_ntoa(inetaddr->sin_addr);
+        
+            //If there was an error getting the client's IP address inform the user
+            if (hostaddrp == NULL) {
+                perror("ERROR: ");
+                exit(1);
+            }
+
+            //If the connection was established successfully, inform the user
+            printf("Server established connection with %s (%s), and socket fd %d.\n", hostp->h_name, hostaddrp, childfd);
+        }
+
+        //Register the connection and create a thread for it
+        openConnection(childfd, NULL, 0);
+    }
+
+    //The loop has stopped, so wake the handoff waiting for it
+    pthread_mutex_lock(&connectionRegistry.lock);
+    connectionRegistry.acceptLoopCount--;
+    pthread_cond_broadcast(&connectionRegistry.changed);
+    pthread_mutex_unlock(&connectionRegistry.lock);
+
+    return NULL;
+}
+
+
+
+//FUNCTION handleServerClose
+void handleServerClose() {
+
+    //Let a handoff in progress finish, since once it succeeds the new server owns the listening sockets and socket paths
+    pthread_mutex_lock(&shutdownLock);
+
+    // global server socket parentfd
+    close(parentfd);
+
+    //Close the Unix domain socket listener and remove its path
+    if (unixfd >= 0) {
+        close(unixfd);
+        unlink(unixSocketPath);
+    }
+
+    //Wait for the requests holding catalogs to finish, and keep every catalog so no more can start
+    lockAllCatalogs(STATS_SERVER);
+
+    //Write out any write-ahead log records still buffered in batch mode
+    if (writeAheadLog.fd >= 0) {
+        pthread_mutex_lock(&writeAheadLog.lock);
+        flushWriteAheadLog();
+        pthread_mutex_unlock(&writeAheadLog.lock);
+    }
+
+    //Clear every online catalog
+    for (Catalog* it = catalogs; it != NULL; it = it->nextCatalog) {
+        removeAllBooks(&it->books);
+    }
+    
+    //Close the server
+    exit(0);
+}
+
+
+
+//FUNCTION sendServerResponse
+void sendServerResponse(int childfd, const char response[], int length) {
+
+    //The response framing line for requests carrying a request ID
+    char frameHeader[MAX_REQUEST_ID_LENGTH + 32];
+    int headerLength = 0;
+
+    //The number of bytes of the response sent so far, and whether it couldn't all be sent
+    int totalSent = 0;
+    bool failed = false;
+
+    //Remember the status code of the request's first response, i.e. the 404 of '404:BAD REQUEST', for STATS to count errors by
+    if (responseStatus == 0) {
+        for (int i = 0; i < length && i < 3 && response[i] >= '0' && response[i] <= '9'; i++) {
+            responseStatus = responseStatus * 10 + response[i] - '0';
+        }
+    }
+
+    //If the request is being answered under its catalog's semaphore, hold the response back for decipherRequest to send once it is released
+    if (deferredResponse != NULL) {
+        appendResponseBytes(deferredResponse, response, length);
+        return;
+    }
+
+    //Mutations replayed from the write-ahead log have no client to respond to
+    if (childfd < 0) {
+        return;
+    }
+
+    //Responses to a connection's requests may be completed by several threads, so write the whole response at once
+    if (currentRequest != NULL) {
+        pthread_mutex_lock(&currentRequest->connection->writeLock);
+
+        while (currentRequest->connection->sending == true) {
+            pthread_cond_wait(&currentRequest->connection->sent, &currentRequest->connection->writeLock);
+        }
+
+        //A connection that has already failed a write is being closed, so its response is dropped
+        if (currentRequest->connection->broken == true) {
+            pthread_mutex_unlock(&currentRequest->connection->writeLock);
+            return;
+        }
+
+        //Frame the response with its request ID and length
+        if (currentRequest->id[0] != '\0') {
+            headerLength = sprintf(frameHeader, "ID:%s,LENGTH:%d\n", currentRequest->id, length);
+        }
+
+        //Write without the lock, so invalidations pushed meanwhile are queued rather than waiting for the client to read
+        currentRequest->connection->sending = true;
+        pthread_mutex_unlock(&currentRequest->connection->writeLock);
+    }
+
+    //Large responses may only be partially written at a time, so keep writing until all of it is sent
+    while (totalSent < headerLength + length) {
+
+        //The rest of the framing line and the response, sent together so a small framed response is a single packet
+        struct iovec parts[2];
+        struct msghdr message;
+        int partCount = 0;
+        int sentBytes;
+
+        if (totalSent < headerLength) {
+            parts[partCount].iov_base = frameHeader + totalSent;
+            parts[partCount].iov_len = headerLength - totalSent;
+            partCount++;
+        }
+
+        parts[partCount].iov_base = (char*) response + (totalSent > headerLength ? totalSent - headerLength : 0);
+        parts[partCount].iov_len = length - (totalSent > headerLength ? totalSent - headerLength : 0);
+        partCount++;
+
+        //Send without raising SIGPIPE, so a client that reset its connection can't end the server
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = parts;
+        message.msg_iovlen = partCount;
+        sentBytes = sendmsg(childfd, &message, MSG_NOSIGNAL);
+
+        if (sentBytes < 0 && errno == EINTR) {
+            continue;
+        }
+
+        //If the response wasn't sent, the client has gone or stopped reading, so disconnect it. The client loop sees the shutdown and closes the socket
+        if (sentBytes < 0) {
+            fprintf(stderr, "ERROR: The server response to socket fd %d was not sent, so the client is disconnected: %s\n", childfd, strerror(errno));
+            shutdown(childfd, SHUT_RDWR);
+            failed = true;
+            break;
+        }
+
+        totalSent += sentBytes;
+    }
+
+    //Send the invalidations pushed while the response was written, and let the next response be written
+    if (currentRequest != NULL) {
+        pthread_mutex_lock(&currentRequest->connection->writeLock);
+
+        currentRequest->connection->sending = false;
+
+        if (failed == true) {
+            currentRequest->connection->broken = true;
+        }
+
+        writePushes(currentRequest->connection);
+
+        pthread_cond_signal(&currentRequest->connection->sent);
+        pthread_mutex_unlock(&currentRequest->connection->writeLock);
+    }
+
+    addStat(&findThreadStats()->bytesOut, totalSent);
+}
+
+
+
+//FUNCTION launchClientLoop
+void* launchClientLoop(void* arg) {
+
+    //The connection shared with the worker threads completing this client's requests
+    Connection* connection = (Connection*) arg;
+
+    //Get the client's socket ID (Responses are only returned to this client)
+    int childfd = connection->fd;
+
+    //The request being answered on this thread, for requests without a request ID
+    RequestJob inlineRequest = { connection, "", NULL, NULL };
+
+    //The buffered request messages from the client, which may arrive split across or packed into reads
+    char* requestBuffer = malloc(sizeof(char) * MAX_REQUEST_LENGTH);
+
+    //The number of bytes currently held in the request buffer, starting with any taken over from an old server
+    int bufferedLength = connection->bufferedLength;
+
+    //The client's socket and the handoff pipe, either of which wakes the loop
+    struct pollfd waits[2] = { { childfd, POLLIN, 0 }, { handoffPipe[0], POLLIN, 0 } };
+
+    //Whether the connection is closed because it was handed off, and whether it has answered the requests already sent when the handoff started
+    bool handedOff = false;
+    bool drainedForHandoff = false;
+
+    //Take over any request bytes already read, which the connection owns
+    memcpy(requestBuffer, connection->buffered, bufferedLength);
+    free(connection->buffered);
+
+    //Responses written from this thread go to this connection
+    currentRequest = &inlineRequest;
+
+    //Loop to read client requests until they disconnect
+    while (childfd >= 0) {
+
+        //The length of the data read from the client
+        int requestLength; 
+
+        //The end of the next complete request message in the buffer
+        char* requestEnd;
+
+        //Answer any complete requests taken over before reading more
+        requestLength = 0;
+
+        if (bufferedLength > 0 && memchr(requestBuffer, '\n', bufferedLength) != NULL) {
+            goto answerRequests;
+        }
+
+        //Wait for the client to send more or a handoff to start
+        if (poll(waits, 2, -1) < 0) {
+            continue;
+        }
+
+        //If the connection will be closed by a handoff, answer the requests the client had already sent first, once, rather than drop them
+        if ((waits[1].revents & POLLIN) && (waits[0].revents & POLLIN) && drainedForHandoff == false && connectionRegistry.handingOffClients == false) {
+            drainedForHandoff = true;
+        }
+
+        //If a handoff has started, pause between requests until it decides whether this connection is resumed or closed
+        else if (waits[1].revents & POLLIN) {
+
+            //Whether the connection caches any GET results
+            bool tracking;
+
+            //Finish the requests still running on worker threads first
+            pthread_mutex_lock(&connection->writeLock);
+            while (connection->inFlight > 0) {
+                pthread_cond_wait(&connection->drained, &connection->writeLock);
+            }
+            pthread_mutex_unlock(&connection->writeLock);
+
+            //A new server taking the connection over won't know what it caches, so have the client flush its cache now
+            pthread_mutex_lock(&trackingLock);
+            tracking = connection->trackedCount > 0;
+            forgetTrackedKeys(connection);
+            pthread_mutex_unlock(&trackingLock);
+
+            if (tracking == true) {
+                pushInvalidation(connection, "213:FLUSH\n");
+            }
+
+            //Leave the partial request read so far with the connection, for the handoff to pass on
+            pthread_mutex_lock(&connectionRegistry.lock);
+
+            connection->buffered = requestBuffer;
+            connection->bufferedLength = bufferedLength;
+            connection->paused = true;
+            connectionRegistry.pausedCount++;
+            pthread_cond_broadcast(&connectionRegistry.changed);
+
+            while (connection->released == false) {
+                pthread_cond_wait(&connectionRegistry.changed, &connectionRegistry.lock);
+            }
+
+            connection->paused = false;
+            connection->released = false;
+            connectionRegistry.pausedCount--;
+
+            pthread_mutex_unlock(&connectionRegistry.lock);
+
+            //If the handoff failed, carry on serving the client
+            if (connection->resumed == true) {
+                connection->resumed = false;
+                drainedForHandoff = false;
+                continue;
+            }
+
+            handedOff = true;
+            break;
+        }
+
+        //Read the client's request data after anything already buffered
+        requestLength = read(childfd, requestBuffer + bufferedLength, MAX_REQUEST_LENGTH - bufferedLength);
+        
+        //If there was an error reading the client's request, inform the user and treat it as a disconnect
+        if (requestLength < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            fprintf(stderr, "ERROR: Client request from socket fd %d could not be read: %s\n", childfd, strerror(errno));
+            break;
+        }
+
+        //Else if the client disconnects, stop listening for requests
+        else if (requestLength == 0) {
+            printf("Client with socket fd %d has disconnected.\n", childfd);
+            break;
+        }
+
+        bufferedLength += requestLength;
+        addStat(&findThreadStats()->bytesIn, requestLength);
+
+answerRequests:
+
+        //Handle every request in the buffer that is terminated properly with a LF character
+        while ((requestEnd = memchr(requestBuffer, '\n', bufferedLength)) != NULL) {
+
+            //The length of the request message including its LF character
+            int messageLength = requestEnd - requestBuffer + 1;
+
+            //Terminate the request
+            *requestEnd = '\0';
+
+            //If the request starts with a request ID, it may be completed out of order by a worker thread
+            if (strncmp(requestBuffer, "ID:", 3) == 0) {
+
+                //The request ID's field name and value
+                char idType[8];
+                char idValue[MAX_REQUEST_ID_LENGTH];
+
+                //Split the request ID off the front of the request. Request IDs must fit in the response's framing line, so an invalid one
+                //is answered in a frame with the reserved request ID 0, where a pipelining client can't mistake it for another response
+                if (parseRequest(requestBuffer, idType, sizeof(idType), idValue, sizeof(idValue)) == false || strlen(idValue) == 0) {
+                    strcpy(inlineRequest.id, "0");
+                    sendServerResponse(childfd, "404:BAD REQUEST,MESSAGE:Request Message has an invalid request ID.\n", 67);
+                    inlineRequest.id[0] = '\0';
+                }
+                else {
+                    queueRequest(connection, idValue, requestBuffer);
+                }
+            }
+
+            //Otherwise, find out what the request was and answer it in order
+            else {
+                decipherRequest(requestBuffer, childfd);
+            }
+
+            //Shift any remaining buffered data to the front of the buffer
+            bufferedLength -= messageLength;
+            memmove(requestBuffer, requestBuffer + messageLength, bufferedLength);
+        }
+
+        //If the buffer filled up without an ending newline character, send an error message back to the user and discard it
+        if (bufferedLength == MAX_REQUEST_LENGTH) {
+            sendServerResponse(childfd, "404:BAD REQUEST,MESSAGE:Request Message is missing ending newline character.\n", 78);
+            bufferedLength = 0;
+        }
+    }
+
+    //Wait for the worker threads to finish this client's requests before the connection is closed
+    pthread_mutex_lock(&connection->writeLock);
+    while (connection->inFlight > 0) {
+        pthread_cond_wait(&connection->drained, &connection->writeLock);
+    }
+    pthread_mutex_unlock(&connection->writeLock);
+
+    //Stop tracking what the connection caches, and wait for any invalidation already being pushed to it, before it's freed
+    pthread_mutex_lock(&trackingLock);
+    forgetTrackedKeys(connection);
+
+    while (connection->pushing > 0) {
+        pthread_cond_wait(&pushesFinished, &trackingLock);
+    }
+
+    pthread_mutex_unlock(&trackingLock);
+
+    //Take the connection out of the registry
+    pthread_mutex_lock(&connectionRegistry.lock);
+
+    for (Connection** it = &connectionRegistry.head; *it != NULL; it = &(*it)->nextConnection) {
+        if (*it == connection) {
+            *it = connection->nextConnection;
+            break;
+        }
+    }
+
+    connectionRegistry.connectionCount--;
+    pthread_cond_broadcast(&connectionRegistry.changed);
+    pthread_mutex_unlock(&connectionRegistry.lock);
+
+    if (handedOff == true) {
+        printf("Client with socket fd %d was handed off.\n", childfd);
+    }
+
+    //Close the client's socket and free the connection
+    currentRequest = NULL;
+    close(childfd);
+    pthread_mutex_destroy(&connection->writeLock);
+    pthread_cond_destroy(&connection->drained);
+    pthread_cond_destroy(&connection->sent);
+    free(connection);
+
+    //Free the request buffer
+    free(requestBuffer);
+
+    //Keep the thread's statistics once it has exited
+    retireThreadStats();
+
+    return NULL;
+}
+
+
+
+//FUNCTION queueRequest
+void queueRequest(Connection* connection, char id[], char request[]) {
+
+    //Copy the request so the client loop can keep reading into its buffer
+    RequestJob* job = malloc(sizeof(RequestJob));
+    job->connection = connection;
+    strcpy(job->id, id);
+    job->request = strdup(request);
+    job->next = NULL;
+
+    //Count the request as in flight on its connection, first waiting for room if the connection already has as many as it may
+    pthread_mutex_lock(&connection->writeLock);
+
+    while (connection->inFlight >= MAX_IN_FLIGHT_REQUESTS) {
+        pthread_cond_wait(&connection->drained, &connection->writeLock);
+    }
+
+    connection->inFlight++;
+    pthread_mutex_unlock(&connection->writeLock);
+
+    //Add the request to the back of the queue and wake a worker thread
+    pthread_mutex_lock(&requestQueue.lock);
+
+    if (requestQueue.tail == NULL) {
+        requestQueue.head = job;
+    }
+    else {
+        requestQueue.tail->next = job;
+    }
+    requestQueue.tail = job;
+
+    pthread_cond_signal(&requestQueue.ready);
+    pthread_mutex_unlock(&requestQueue.lock);
+}
+
+
+
+//FUNCTION launchRequestWorker
+void* launchRequestWorker(void* arg) {
+
+    //Complete queued requests until the server closes
+    while (1) {
+
+        RequestJob* job;
+
+        //Wait for a request to be queued, then take it off the front of the queue
+        pthread_mutex_lock(&requestQueue.lock);
+
+        while (requestQueue.head == NULL) {
+            pthread_cond_wait(&requestQueue.ready, &requestQueue.lock);
+        }
+
+        job = requestQueue.head;
+        requestQueue.head = job->next;
+        if (requestQueue.head == NULL) {
+            requestQueue.tail = NULL;
+        }
+
+        pthread_mutex_unlock(&requestQueue.lock);
+
+        //Find out what the request was, framing the response with its request ID
+        currentRequest = job;
+        decipherRequest(job->request, job->connection->fd);
+        currentRequest = NULL;
+
+        //The request is no longer in flight, so wake the client loop if it is waiting to close the connection or to queue another request
+        pthread_mutex_lock(&job->connection->writeLock);
+        job->connection->inFlight--;
+        if (job->connection->inFlight == 0 || job->connection->inFlight == MAX_IN_FLIGHT_REQUESTS - 1) {
+            pthread_cond_broadcast(&job->connection->drained);
+        }
+        pthread_mutex_unlock(&job->connection->writeLock);
+
+        free(job->request);
+        free(job);
+    }
+
+    return NULL;
+}
+
+
+
+//FUNCTION decipherRequest 
+void decipherRequest(char request[], int childfd) {
+
+    //In sync mode, responses are held back until the request's mutations are durable in the write-ahead log
+    ResponseBuffer heldResponse = { NULL, 0, 0 };
+
+    //A replica to stream mutations to once the Catalog semaphore is released
+    Replica* replica = NULL;
+
+    //A subscriber to stream events to once the Catalog semaphore is released
+    Subscriber* subscriber = NULL;
+
+    //Containers for the type and value of the request header line i.e. 'METHOD:GET' or 'METHOD:REMOVE'. The value is as long as any
+    //other field's, since the header can also be a catalog's name
+    char requestHeaderType[15];
+    char requestHeaderValue[100];
+
+    //The session's log sequence number, which a replica must have applied before answering a read
+    unsigned long long sessionLsn = 0;
+
+    //The name of the catalog the request is for, and the catalog itself
+    char catalogName[100] = "";
+    Catalog* catalog;
+
+    //Whether the request is about the whole server, rather than a single catalog
+    bool wholeServer;
+
+    //Whether the client caches the result of the GET, and so must be told when a change makes it stale
+    bool tracked = false;
+
+    //When the request started being answered, how long it waited for its catalog and when it got it, and the type of request STATS
+    //counts it as
+    long long startNs = currentNanos();
+    long long lockWaitNs;
+    long long lockedNs;
+    int operation;
+
+    lastLoggedLsn = 0;
+    responseStatus = 0;
+
+    //A field too long for its container is refused before any field is copied out of the request
+    if (requestFieldsFit(request, sizeof(requestHeaderType), sizeof(requestHeaderValue)) == false) {
+        sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:Request Message has a field that is too long.\n", 70);
+        recordRequest(STATS_OTHER, startNs, -1, 0);
+        return;
+    }
+
+    //Parse the request message to see what type of request this is, after the session token if it carries one
+    parseRequest(request, requestHeaderType, sizeof(requestHeaderType), requestHeaderValue, sizeof(requestHeaderValue));
+
+    if (strcmp(requestHeaderType, "SESSION") == 0) {
+        sessionLsn = strtoull(requestHeaderValue, NULL, 10);
+        parseRequest(request, requestHeaderType, sizeof(requestHeaderType), requestHeaderValue, sizeof(requestHeaderValue));
+    }
+
+    //And after the name of the catalog if it names one. Requests that don't name one go to the default catalog. The copy is bounded, and a
+    //name too long for a catalog was already refused with the other overlong fields
+    if (strcmp(requestHeaderType, "CATALOG") == 0) {
+        snprintf(catalogName, sizeof(catalogName), "%s", requestHeaderValue);
+        parseRequest(request, requestHeaderType, sizeof(requestHeaderType), requestHeaderValue, sizeof(requestHeaderValue));
+    }
+
+    //And after the tracking flag if the client will cache the result
+    if (strcmp(requestHeaderType, "TRACK") == 0) {
+        tracked = strcmp(requestHeaderValue, "ON") == 0 && currentRequest != NULL;
+        parseRequest(request, requestHeaderType, sizeof(requestHeaderType), requestHeaderValue, sizeof(requestHeaderValue));
+    }
+
+    //Only a SUBMIT creates the catalog it names, so a request naming a catalog that doesn't exist can't leave an empty one behind
+    catalog = findCatalog(catalogName, strcmp(requestHeaderValue, "SUBMIT") == 0 && primaryPort == 0);
+    operation = statsOperation(requestHeaderValue);
+
+    //A request for the Books of a catalog that doesn't exist finds none of them
+    if (catalog == NULL && (strcmp(requestHeaderValue, "GET") == 0 || strcmp(requestHeaderValue, "GETMANY") == 0 || strcmp(requestHeaderValue, "REMOVE") == 0
+                            || strcmp(requestHeaderValue, "MOVE") == 0 || strcmp(requestHeaderValue, "REMOVEALL") == 0 || strcmp(requestHeaderValue, "EXPORT") == 0)) {
+
+        //A client caching the answer is told first that it's already stale, since a SUBMIT may create the catalog at any moment and there is
+        //no catalog to track the GET's key under until then
+        if (tracked == true && strcmp(requestHeaderValue, "GET") == 0) {
+
+            //The GET's title and author, and the invalidation naming them
+            char keyType[15];
+            char keyValue[100];
+            char keyTitle[100] = "";
+            char keyAuthor[100] = "";
+            char invalidation[400];
+
+            while (strlen(request) > 0) {
+
+                parseRequest(request, keyType, sizeof(keyType), keyValue, sizeof(keyValue));
+
+                if (strcmp(keyType, "TITLE") == 0) {
+                    strcpy(keyTitle, keyValue);
+                }
+                else if (strcmp(keyType, "AUTHOR") == 0) {
+                    strcpy(keyAuthor, keyValue);
+                }
+            }
+
+            snprintf(invalidation, sizeof(invalidation), "212:INVALIDATE\nCATALOG:%s\nTITLE:%s\nAUTHOR:%s\n", catalogName, keyTitle, keyAuthor);
+            pushInvalidation(currentRequest->connection, invalidation);
+        }
+
+        sendServerResponse(childfd, "402:NOT FOUND\nMESSAGE:The catalog specified could not be found.\n", 64);
+        recordRequest(operation, startNs, -1, 0);
+        return;
+    }
+
+    //Every other request about a catalog that doesn't exist, i.e. SUBSCRIBE, or about the whole server, is answered under the default catalog
+    if (catalog == NULL) {
+        catalog = findCatalog("", true);
+    }
+
+    currentCatalog = catalog;
+
+    //The connection's session covers every log sequence number its requests have carried or written
+    if (currentRequest != NULL) {
+        pthread_mutex_lock(&currentRequest->connection->writeLock);
+
+        if (sessionLsn > currentRequest->connection->sessionLsn) {
+            currentRequest->connection->sessionLsn = sessionLsn;
+        }
+        sessionLsn = currentRequest->connection->sessionLsn;
+
+        pthread_mutex_unlock(&currentRequest->connection->writeLock);
+    }
+
+    //A replica only answers a read once it has caught up with the session's writes, and otherwise sends the client to the primary
+    if (primaryPort > 0 && sessionLsn > 0 && (strcmp(requestHeaderValue, "GET") == 0 || strcmp(requestHeaderValue, "GETMANY") == 0)
+        && waitForReplication(sessionLsn) == false) {
+
+        char redirectResponse[500];
+
+        pthread_mutex_lock(&replicaState.lock);
+        sprintf(redirectResponse, "307:REDIRECT\nPRIMARY:%s:%d\nAPPLIED:%llu\nSESSION:%llu\nMESSAGE:The replica hasn't caught up with this session's writes. Read from the primary.\n",
+                primaryHost, primaryPort, replicaState.appliedLsn, sessionLsn);
+        pthread_mutex_unlock(&replicaState.lock);
+
+        sendServerResponse(childfd, redirectResponse, strlen(redirectResponse));
+        recordRequest(operation, startNs, -1, 0);
+        return;
+    }
+
+    //Every response is built while the catalog is held but sent once it's released, so a client that reads slowly never keeps the catalog
+    //locked. Mutations' responses are also given their log sequence number, and in sync mode wait until the mutations are durable
+    deferredResponse = &heldResponse;
+
+    //Requests that fork a copy of the Catalog or list the catalogs need the whole server between requests, and every other request only its catalog
+    wholeServer = strcmp(requestHeaderValue, "SNAPSHOT") == 0 || strcmp(requestHeaderValue, "REPLICATE") == 0 || strcmp(requestHeaderValue, "CATALOGS") == 0;
+
+     //Have the thread check if it can send a request message, otherwise have it wait, timing how long it waits
+    lockWaitNs = currentNanos();
+
+    if (wholeServer == true) {
+        lockAllCatalogs(operation);
+    }
+    else {
+        acquireCatalog(catalog, operation);
+    }
+
+    lockedNs = currentNanos();
+    lockWaitNs = lockedNs - lockWaitNs;
+
+    //Containers for the type and value of a request line i.e. 'AUTHOR:Clayton' or 'TITLE:Networking'
+    char requestMethodType[15];
+    char requestMethodValue[100];
+
+    //Containers for the Book's title, author, and location data
+    char requestTitle[100];
+    char requestAuthor[100];
+    char requestLocation[100];
+
+    //A replica's Catalog only changes by following its primary, so refuse any request that would change it
+    if (primaryPort > 0 && (strcmp(requestHeaderValue, "SUBMIT") == 0 || strcmp(requestHeaderValue, "REMOVE") == 0
+                            || strcmp(requestHeaderValue, "MOVE") == 0 || strcmp(requestHeaderValue, "REMOVEALL") == 0)) {
+        sendServerResponse(childfd, "403:READ ONLY\nMESSAGE:This server is a replica. Send changes to its primary.\n", 77);
+    }
+
+    //A catalog whose snapshot records turned out corrupt on its first use is refused rather than served
+    else if (wholeServer == false && catalog->corrupt == true) {
+        sendServerResponse(childfd, "500:CORRUPT CATALOG\nMESSAGE:The catalog's records in the snapshot are corrupt.\n", 79);
+    }
+
+    //SUBMIT REQUEST
+    else if (strcmp(requestHeaderValue, "SUBMIT") == 0) {
+
+        //Get the Book's Title and clear the method type
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestTitle, sizeof(requestTitle));
+        requestMethodType[0] = '\0';
+
+        //Get the Book's Author and clear the method type
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestAuthor, sizeof(requestAuthor));
+        requestMethodType[0] = '\0';
+
+        //Get the Book's Location and clear the method type
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestLocation, sizeof(requestLocation));
+        requestMethodType[0] = '\0';
+
+        //SUBMIT A BOOK
+        submitBook(&catalog->books, requestTitle, requestAuthor, requestLocation, childfd);
+    }
+
+    //GET REQUEST
+    else if (strcmp(requestHeaderValue, "GET") == 0) {
+
+        //Parse the request for the first METHOD field and value
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestMethodValue, sizeof(requestMethodValue));
+
+        //If the METHOD field is "AUTHOR", this is a GET Request for books by an AUTHOR
+        if (strcmp(requestMethodType, "AUTHOR") == 0) {
+
+            //Copy the Book's author
+            strcpy(requestAuthor, requestMethodValue);
+
+            //Track the author for a client caching the result
+            if (tracked == true) {
+                trackKey(currentRequest->connection, catalog->name, true, requestAuthor);
+            }
+
+            //GET BOOKS BY AUTHOR
+            getBooksByAuthor(catalog->books, requestAuthor, childfd);
+        }
+
+        //Else if the METHOD field is "TITLE"
+        else if (strcmp(requestMethodType, "TITLE") == 0) {
+
+            //Copy the Book's title
+            strcpy(requestTitle, requestMethodValue);
+
+            //Track the title for a client caching the result. Any change to the Book a specific GET names has the same title
+            if (tracked == true) {
+                trackKey(currentRequest->connection, catalog->name, false, requestTitle);
+            }
+
+            //Clear the requestMethodType and requestMethodValue
+            requestMethodType[0] = '\0';
+            requestMethodValue[0] = '\0';
+
+            //Check for an "AUTHOR" field
+            parseRequest(request, requestMethodType, sizeof(requestMethodType), requestMethodValue, sizeof(requestMethodValue));
+
+            //If the request has an "AUTHOR" field
+            if (strcmp(requestMethodType, "AUTHOR") == 0) {
+
+                //Copy the Book's author
+                strcpy(requestAuthor, requestMethodValue);
+
+                //CALL THE SPECIFIC GET BOOK WITH AUTHOR AND TITLE FUNCTION
+                getSpecificBook(catalog->books, requestTitle, requestAuthor, childfd);
+            }
+
+            //Else the request doesn't have an AUTHOR field
+            else {
+
+                //GET BOOKS WITH TITLE
+                getBooksWithTitle(catalog->books, requestTitle, childfd);
+            }
+        }
+
+        //Else the METHOD field is invalid
+        else {
+            
+            //Inform the user that their request was invalid
+            sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:Request Message has an invalid field.", 62);
+        }
+    }
+
+    //GETMANY REQUEST
+    else if (strcmp(requestHeaderValue, "GETMANY") == 0) {
+
+        //Containers for the title and author of every requested key
+        char keyTitles[MAX_GETMANY_KEYS][100];
+        char keyAuthors[MAX_GETMANY_KEYS][100];
+
+        //The number of keys in the request, or -1 if the key list is malformed
+        int keyCount = 0;
+
+        //Container for a key field's value
+        char keyValue[100];
+
+        //Parse TITLE and AUTHOR pairs until the request message is used up
+        while (strlen(request) > 0 && keyCount >= 0) {
+
+            //Too many keys were passed
+            if (keyCount == MAX_GETMANY_KEYS) {
+                keyCount = -1;
+                break;
+            }
+
+            //Get the key's Title
+            if (parseRequest(request, requestMethodType, sizeof(requestMethodType), keyValue, sizeof(keyValue)) == false
+                || strcmp(requestMethodType, "TITLE") != 0 || strlen(keyValue) == 0) {
+                keyCount = -1;
+                break;
+            }
+            strcpy(keyTitles[keyCount], keyValue);
+
+            //Get the key's Author
+            if (parseRequest(request, requestMethodType, sizeof(requestMethodType), keyValue, sizeof(keyValue)) == false
+                || strcmp(requestMethodType, "AUTHOR") != 0 || strlen(keyValue) == 0) {
+                keyCount = -1;
+                break;
+            }
+            strcpy(keyAuthors[keyCount], keyValue);
+
+            keyCount++;
+        }
+
+        //GET MANY BOOKS
+        if (keyCount > 0) {
+            getManyBooks(catalog->books, keyTitles, keyAuthors, keyCount, childfd);
+        }
+
+        //Else the key list is empty or invalid
+        else {
+            sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:Request Message has an invalid key list.\n", 65);
+        }
+    }
+
+    //REMOVE REQUEST
+    else if (strcmp(requestHeaderValue, "REMOVE") == 0) {
+        
+        //Get the Book's Title and clear the method type
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestTitle, sizeof(requestTitle));
+        requestMethodType[0] = '\0';
+
+        //Get the Book's Author and clear the method type
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestAuthor, sizeof(requestAuthor));
+        requestMethodType[0] = '\0';
+
+        //Get the Book's Location and clear the method type
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestLocation, sizeof(requestLocation));
+        requestMethodType[0] = '\0';
+
+        //CALL THE SPECIFIC REMOVE BOOK FUNCTION
+        removeBook(&catalog->books, requestTitle, requestAuthor, requestLocation, childfd);
+    }
+
+    //MOVE REQUEST
+    else if (strcmp(requestHeaderValue, "MOVE") == 0) {
+
+        //Container for the Book's new location
+        char requestNewLocation[100];
+
+        //Get the Book's Title and clear the method type
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestTitle, sizeof(requestTitle));
+        requestMethodType[0] = '\0';
+
+        //Get the Book's Author and clear the method type
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestAuthor, sizeof(requestAuthor));
+        requestMethodType[0] = '\0';
+
+        //Get the Book's current Location and clear the method type
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestLocation, sizeof(requestLocation));
+        requestMethodType[0] = '\0';
+
+        //Get the Book's new Location
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestNewLocation, sizeof(requestNewLocation));
+
+        //MOVE A BOOK
+        if (strcmp(requestMethodType, "NEWLOCATION") == 0 && strlen(requestNewLocation) > 0) {
+            moveBook(catalog->books, requestTitle, requestAuthor, requestLocation, requestNewLocation, childfd);
+        }
+
+        //Else the new location is missing
+        else {
+            sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:Request Message is missing the NEWLOCATION field.\n", 74);
+        }
+    }
+
+    //SNAPSHOT REQUEST
+    else if (strcmp(requestHeaderValue, "SNAPSHOT") == 0) {
+
+        //The snapshot's child process
+        pid_t snapshotPid;
+
+        //The response message to send back to the client
+        char snapshotResponse[100];
+
+        //Snapshots can only be written when the server was given a snapshot path
+        if (snapshotPath[0] == '\0') {
+            sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:The server was not started with a snapshot path.\n", 73);
+        }
+
+        //Fork a child to write every Book, as of the last logged mutation, to the snapshot
+        else if ((snapshotPid = startBackgroundSnapshot()) < 0) {
+            perror("ERROR: ");
+            sendServerResponse(childfd, "500:SNAPSHOT FAILED\nMESSAGE:The snapshot could not be started.\n", 63);
+        }
+
+        //Only one snapshot is written at a time
+        else if (snapshotPid == 0) {
+            sendServerResponse(childfd, "409:BUSY\nMESSAGE:A snapshot is already being written.\n", 54);
+        }
+
+        else {
+            sprintf(snapshotResponse, "205:SNAPSHOT STARTED\nPID:%d\nLSN:%llu\n", (int) snapshotPid, writeAheadLog.lastLsn);
+            sendServerResponse(childfd, snapshotResponse, strlen(snapshotResponse));
+        }
+    }
+
+    //SNAPSHOTSTATUS REQUEST
+    else if (strcmp(requestHeaderValue, "SNAPSHOTSTATUS") == 0) {
+
+        //The response message to send back to the client
+        char statusResponse[300];
+
+        pthread_mutex_lock(&snapshotStatus.lock);
+
+        sprintf(statusResponse, "206:SNAPSHOT STATUS\nRUNNING:%s\n", snapshotStatus.pid != 0 ? "yes" : "no");
+
+        //Report the last finished snapshot, if any
+        if (snapshotStatus.finished == true) {
+            sprintf(statusResponse + strlen(statusResponse), "LAST:%s\nRECORDS:%lld\nLSN:%llu\nDURATION:%.1fms\nCOPIED:%lldkB\n",
+                    snapshotStatus.failed == true ? "failed" : "written", snapshotStatus.records, snapshotStatus.finishedLsn,
+                    snapshotStatus.durationMs, snapshotStatus.copiedKb);
+        }
+
+        pthread_mutex_unlock(&snapshotStatus.lock);
+
+        sendServerResponse(childfd, statusResponse, strlen(statusResponse));
+    }
+
+    //REMOVEALL REQUEST
+    else if (strcmp(requestHeaderValue, "REMOVEALL") == 0) {
+
+        //Start with a blank author and location, which match any Book
+        requestAuthor[0] = '\0';
+        requestLocation[0] = '\0';
+
+        //Get the AUTHOR and/or LOCATION fields of the predicate
+        while (strlen(request) > 0) {
+
+            parseRequest(request, requestMethodType, sizeof(requestMethodType), requestMethodValue, sizeof(requestMethodValue));
+
+            if (strcmp(requestMethodType, "AUTHOR") == 0) {
+                strcpy(requestAuthor, requestMethodValue);
+            }
+            else if (strcmp(requestMethodType, "LOCATION") == 0) {
+                strcpy(requestLocation, requestMethodValue);
+            }
+
+            //Any other field makes the predicate invalid
+            else {
+                requestAuthor[0] = '\0';
+                requestLocation[0] = '\0';
+                break;
+            }
+        }
+
+        //REMOVE EVERY MATCHING BOOK
+        if (requestAuthor[0] != '\0' || requestLocation[0] != '\0') {
+            removeMatchingBooks(&catalog->books, requestAuthor, requestLocation, childfd);
+        }
+
+        //Else the predicate is missing, which would otherwise remove the whole Catalog
+        else {
+            sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:Request Message needs an AUTHOR or LOCATION field.\n", 75);
+        }
+    }
+
+    //EXPORT REQUEST
+    else if (strcmp(requestHeaderValue, "EXPORT") == 0) {
+
+        //The author hash range to export
+        unsigned int fromHash;
+        unsigned int toHash;
+
+        //Get the start of the range
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestMethodValue, sizeof(requestMethodValue));
+        if (strcmp(requestMethodType, "FROM") != 0 || sscanf(requestMethodValue, "%u", &fromHash) != 1) {
+            requestHeaderValue[0] = '\0';
+        }
+
+        //Get the end of the range
+        parseRequest(request, requestMethodType, sizeof(requestMethodType), requestMethodValue, sizeof(requestMethodValue));
+        if (strcmp(requestMethodType, "TO") != 0 || sscanf(requestMethodValue, "%u", &toHash) != 1) {
+            requestHeaderValue[0] = '\0';
+        }
+
+        //EXPORT THE BOOKS IN THE RANGE
+        if (requestHeaderValue[0] != '\0') {
+            exportBooks(catalog->books, fromHash, toHash, childfd);
+        }
+
+        //Else the range is missing or malformed
+        else {
+            sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:Request Message needs FROM and TO hash fields.\n", 71);
+        }
+    }
+
+    //REPLICATE REQUEST
+    else if (strcmp(requestHeaderValue, "REPLICATE") == 0) {
+
+        //The stream takes over the connection, so it can't be answered by a worker thread
+        if (currentRequest != NULL && currentRequest->id[0] != '\0') {
+            sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:A REPLICATE request can't carry a request ID.\n", 70);
+        }
+
+        //Start the replica's snapshot at the current log sequence number
+        else if ((replica = startReplica(childfd)) == NULL) {
+            perror("ERROR: ");
+            sendServerResponse(childfd, "500:REPLICATION FAILED\nMESSAGE:The replica's snapshot could not be started.\n", 76);
+        }
+    }
+
+    //REPLICATION REQUEST
+    else if (strcmp(requestHeaderValue, "REPLICATION") == 0) {
+        reportReplication(childfd);
+    }
+
+    //STATS REQUEST
+    else if (strcmp(requestHeaderValue, "STATS") == 0) {
+        reportStats(childfd);
+    }
+
+    //SUBSCRIBE REQUEST
+    else if (strcmp(requestHeaderValue, "SUBSCRIBE") == 0) {
+
+        //The response message to send back to the client
+        char subscribeResponse[300];
+
+        //Start with a blank author and location, which match any Book
+        requestAuthor[0] = '\0';
+        requestLocation[0] = '\0';
+
+        //Get the optional AUTHOR and LOCATION fields of the filter
+        while (strlen(request) > 0 && requestHeaderValue[0] != '\0') {
+
+            parseRequest(request, requestMethodType, sizeof(requestMethodType), requestMethodValue, sizeof(requestMethodValue));
+
+            if (strcmp(requestMethodType, "AUTHOR") == 0) {
+                strcpy(requestAuthor, requestMethodValue);
+            }
+            else if (strcmp(requestMethodType, "LOCATION") == 0) {
+                strcpy(requestLocation, requestMethodValue);
+            }
+
+            //Any other field makes the filter invalid
+            else {
+                requestHeaderValue[0] = '\0';
+            }
+        }
+
+        //The stream takes over the connection, so it can't be answered by a worker thread
+        if (currentRequest != NULL && currentRequest->id[0] != '\0') {
+            sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:A SUBSCRIBE request can't carry a request ID.\n", 70);
+        }
+
+        else if (requestHeaderValue[0] == '\0') {
+            sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:A SUBSCRIBE filter can only have AUTHOR and LOCATION fields.\n", 85);
+        }
+
+        //Register the subscriber while the Catalog can't change, so it gets every change after the log sequence number it is told
+        else {
+
+            subscriber = malloc(sizeof(Subscriber));
+            subscriber->fd = childfd;
+            strcpy(subscriber->catalog, catalogName);
+            strcpy(subscriber->author, requestAuthor);
+            strcpy(subscriber->location, requestLocation);
+            subscriber->queue = NULL;
+            subscriber->queuedLength = 0;
+            subscriber->queueCapacity = 0;
+            subscriber->droppedCount = 0;
+            subscriber->closed = false;
+            pthread_mutex_init(&subscriber->lock, NULL);
+            pthread_cond_init(&subscriber->ready, NULL);
+
+            pthread_mutex_lock(&writeAheadLog.lock);
+            pthread_mutex_lock(&subscribersLock);
+            subscriber->nextSubscriber = subscribers;
+            subscribers = subscriber;
+            pthread_mutex_unlock(&subscribersLock);
+            sprintf(subscribeResponse, "210:SUBSCRIBED\nLSN:%llu\n\n", writeAheadLog.lastLsn);
+            pthread_mutex_unlock(&writeAheadLog.lock);
+
+            //The response is sent before serveSubscriber writes any events, which queue up for it until then
+            sendServerResponse(childfd, subscribeResponse, strlen(subscribeResponse));
+        }
+    }
+
+    //CATALOGS REQUEST
+    else if (strcmp(requestHeaderValue, "CATALOGS") == 0) {
+
+        //The list of catalogs, which can't change while every catalog is held
+        ResponseBuffer catalogsResponse = { NULL, 0, 0 };
+        char countLine[40];
+        int catalogCount = 0;
+
+        for (Catalog* it = catalogs; it != NULL; it = it->nextCatalog) {
+            catalogCount++;
+        }
+
+        sprintf(countLine, "202:RETRIEVED\nCOUNT:%d\n\n", catalogCount);
+        appendResponse(&catalogsResponse, countLine);
+
+        //Name every catalog, with the default catalog's name left blank
+        for (Catalog* it = catalogs; it != NULL; it = it->nextCatalog) {
+            appendResponse(&catalogsResponse, "CATALOG:");
+            appendResponse(&catalogsResponse, it->name);
+            appendResponse(&catalogsResponse, "\n");
+        }
+
+        sendServerResponse(childfd, catalogsResponse.text, catalogsResponse.length);
+        free(catalogsResponse.text);
+    }
+
+    //INVALID REQUEST (Needs to be turned into a WRITE ERROR EVENTUALLY)
+    else {
+        sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:Request Message is an invalid type.\n", 61);
+    }
+
+    //Once a thread has had its request read and a response returned, unblock other threads
+    lockedNs = currentNanos() - lockedNs;
+
+    if (wholeServer == true) {
+        unlockAllCatalogs();
+    }
+    else {
+        releaseCatalog(catalog);
+    }
+
+    currentCatalog = NULL;
+
+    //A stream keeps the thread until its client disconnects, so count the request as answered once the stream starts
+    if (replica != NULL || subscriber != NULL) {
+        recordRequest(operation, startNs, lockWaitNs, lockedNs);
+    }
+
+    //Send the held back response outside the semaphore, first waiting for the mutations to be durable so other writers can share the fsync
+    if (deferredResponse != NULL) {
+        deferredResponse = NULL;
+
+        if (lastLoggedLsn > 0 && writeAheadLog.fd >= 0 && writeAheadLog.mode == WAL_SYNC) {
+            waitForWriteAheadLog(lastLoggedLsn);
+        }
+
+        //Give the client the log sequence number of its last mutation, as a session token to read its writes back from a replica
+        if (lastLoggedLsn > 0 && heldResponse.length > 0) {
+
+            char lsnLine[40];
+
+            sprintf(lsnLine, "LSN:%llu\n", lastLoggedLsn);
+            appendResponse(&heldResponse, lsnLine);
+
+            if (currentRequest != NULL) {
+                pthread_mutex_lock(&currentRequest->connection->writeLock);
+                if (lastLoggedLsn > currentRequest->connection->sessionLsn) {
+                    currentRequest->connection->sessionLsn = lastLoggedLsn;
+                }
+                pthread_mutex_unlock(&currentRequest->connection->writeLock);
+            }
+        }
+
+        if (heldResponse.length > 0) {
+            sendServerResponse(childfd, heldResponse.text, heldResponse.length);
+        }
+
+        free(heldResponse.text);
+    }
+
+    //Stream a new replica its mutations until it disconnects
+    if (replica != NULL) {
+        serveReplica(replica);
+    }
+
+    //Stream a new subscriber its events until it disconnects
+    if (subscriber != NULL) {
+        serveSubscriber(subscriber);
+    }
+
+    //Count the request now its response is sent
+    if (replica == NULL && subscriber == NULL) {
+        recordRequest(operation, startNs, lockWaitNs, lockedNs);
+    }
+}
+
+
+
+//FUNCTION parseRequest
+bool parseRequest(char requestMessage[], char method[], int methodSize, char value[], int valueSize) {
+
+    //The length of the request message passed
+    int requestLength = strlen(requestMessage);
+
+    //The length of the HEADER:VALUE or METHOD:VALUE token
+    int tokenLength = 0;
+
+    //The length of the HEADER or METHOD i.e. 'METHOD', 'TITLE', 'AUTHOR'
+    int methodLength = 0;
+
+    //The length of the VALUE for a given HEADER or METHOD i.e. 'GET', 'SUBMIT', 'Book Title'
+    int valueLength = 0;
+
+    //Whether the method and value fit their containers
+    bool fits = true;
+
+    //If the passed request message is blank, set the method and value to be blank and return
+    if (strlen(requestMessage) == 0) {
+        strcpy(method, "");
+        strcpy(value, "");
+        return true;
+    }
+
+    //Loop through the original message string and get the length of the method's header value
+    for (int i = 0; i < requestLength; i++) {
+
+        //Stop at the delimitter
+        if (requestMessage[i] == ':') {
+            break;
+        }
+
+        //Increment the length
+        else {
+            methodLength++;
+        }
+    }
+
+    //Copy the method's header from the request message, cut to fit its container
+    if (methodLength < methodSize) {
+        memcpy(method, requestMessage, methodLength);
+        method[methodLength] = '\0';
+    }
+    else {
+        memcpy(method, requestMessage, methodSize - 1);
+        method[methodSize - 1] = '\0';
+        fits = false;
+    }
+
+    //Loop through the original message string and get the length of the method's value
+    for (int j = methodLength + 1; j < requestLength; j++) {
+
+        //Stop at the delimitter
+        if (requestMessage[j] == ',') {
+            break;
+        }
+
+        //Increment the length
+        else {
+            valueLength++;
+        }
+    }
+
+    //Copy the method's value from the string, cut to fit its container
+    if (valueLength < valueSize) {
+        memcpy(value, requestMessage + methodLength + 1, valueLength);
+        value[valueLength] = '\0';
+    }
+    else {
+        memcpy(value, requestMessage + methodLength + 1, valueSize - 1);
+        value[valueSize - 1] = '\0';
+        fits = false;
+    }
+
+    //Calculate the length of the method + the value and + 2 for the delimitters
+    tokenLength = methodLength + valueLength + 2;
+
+    //If there are still more tokens to parse, we will need to keep them
+    if (requestLength - tokenLength > 0) {
+
+        //Shift the characters after the parsed token to the front of the request message, including the terminator
+        memmove(requestMessage, requestMessage + tokenLength, requestLength - tokenLength + 1);
+    }
+
+    //We're done parsing the request message, so it can be fully erased
+    else {
+        requestMessage[0] = '\0';
+    }
+
+    return fits;
+}
+
+
+
+//FUNCTION requestFieldsFit
+bool requestFieldsFit(const char request[], int methodSize, int valueSize) {
+
+    //The start of the current token, and the ends of its method and value
+    const char* token = request;
+    const char* methodEnd;
+    const char* valueEnd;
+
+    while (*token != '\0') {
+
+        //The method runs up to the next delimitter, or the end of the message
+        methodEnd = strchr(token, ':');
+        if (methodEnd == NULL) {
+            methodEnd = token + strlen(token);
+        }
+
+        if (methodEnd - token >= methodSize) {
+            return false;
+        }
+
+        //The value runs from after it up to the next comma, or the end of the message
+        if (*methodEnd == '\0') {
+            return true;
+        }
+
+        valueEnd = strchr(methodEnd + 1, ',');
+        if (valueEnd == NULL) {
+            valueEnd = methodEnd + 1 + strlen(methodEnd + 1);
+        }
+
+        if (valueEnd - methodEnd - 1 >= valueSize) {
+            return false;
+        }
+
+        //Move on to the next token, past the comma
+        token = *valueEnd == ',' ? valueEnd + 1 : valueEnd;
+    }
+
+    return true;
+}
+
+
+
+//FUNCTION appendResponse
+void appendResponse(ResponseBuffer* response, const char text[]) {
+    appendResponseBytes(response, text, strlen(text));
+}
+
+
+
+//FUNCTION appendResponseBytes
+void appendResponseBytes(ResponseBuffer* response, const char text[], int length) {
+
+    //Double the response's capacity until the bytes and terminator fit
+    if (response->length + length + 1 > response->capacity) {
+
+        while (response->length + length + 1 > response->capacity) {
+            response->capacity = response->capacity > 0 ? response->capacity * 2 : 1000;
+        }
+
+        response->text = realloc(response->text, sizeof(char) * response->capacity);
+    }
+
+    //Copy the bytes after the current end of the response, keeping it terminated
+    memcpy(response->text + response->length, text, length);
+    response->length += length;
+    response->text[response->length] = '\0';
+}
+
+
+
+//FUNCTION hashBytes
+unsigned int hashBytes(const void* bytes, int length) {
+
+    //The FNV-1a offset basis
+    unsigned int hash = 2166136261u;
+
+    //Fold in every byte with the FNV prime
+    for (int i = 0; i < length; i++) {
+        hash ^= ((const unsigned char*) bytes)[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+
+//FUNCTION hashString
+unsigned int hashString(const char text[]) {
+
+    //The FNV-1a offset basis
+    unsigned int hash = 2166136261u;
+
+    //Fold in every character with the FNV prime
+    for (int i = 0; text[i] != '\0'; i++) {
+        hash ^= (unsigned char) text[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+
+//Search the list by book title
+void getBooksByAuthor(Book* head, char author[100], int childfd) {
+
+    //Boolean to check if any Book matches were found
+    bool found = false;
+
+    //The response message to send back to the client, grown as Books are found so a large match never overflows it
+    ResponseBuffer serverResponse = { NULL, 0, 0 };
+
+    //Iterate though
+    while(head != NULL) {
+
+        //if a match is found add it to the matchList string
+        if (strcmp(head->author, author) == 0) {
+
+            //If this is the first match, set up the server response
+            if (found == false) {
+                found = true;
+                appendResponse(&serverResponse, "202:RETRIEVED\n");
+            }
+
+            //Append the matched Book Location to the Server Response
+            appendResponse(&serverResponse, "TITLE:");
+            appendResponse(&serverResponse, head->title);
+            appendResponse(&serverResponse, "\n");
+            appendResponse(&serverResponse, "AUTHOR:");
+            appendResponse(&serverResponse, author);
+            appendResponse(&serverResponse, "\n");
+            appendResponse(&serverResponse, "LOCATION:");
+            appendResponse(&serverResponse, head->location);
+            appendResponse(&serverResponse, "\n\n");
+        }
+
+        head = head->next;
+    }
+
+    //If there were Books found for the given title, inform the user
+    if (found == false) {
+        appendResponse(&serverResponse, "402:NOT FOUND\nMESSAGE:There are no Books in the Catalog with the given author.\n");
+        sendServerResponse(childfd, serverResponse.text, serverResponse.length);
+    }
+
+    //If there were Books found for the given title    
+    else {
+
+        //Pass the Book locations to the user
+        sendServerResponse(childfd, serverResponse.text, serverResponse.length);
+    }
+
+    //Free the server response message
+    free(serverResponse.text);
+}
+
+
+
+//Search the list by book title
+void getBooksWithTitle(Book* head, char title[100], int childfd) {
+
+    //Boolean to check if any Book matches were found
+    bool found = false;
+
+    //The response message to send back to the client, grown as Books are found
+    ResponseBuffer serverResponse = { NULL, 0, 0 };
+
+    //Iterate though
+    while(head != NULL) {
+
+        //if a match is found add it to the matchList string
+        if (strcmp(head->title, title) == 0) {
+
+            //If this is the first match, set up the server response
+            if (found == false) {
+                found = true;
+                appendResponse(&serverResponse, "202:RETRIEVED\n");
+            }
+
+            //Append the matched Book Location to the Server Response
+            appendResponse(&serverResponse, "TITLE:");
+            appendResponse(&serverResponse, title);
+            appendResponse(&serverResponse, "\n");
+            appendResponse(&serverResponse, "AUTHOR:");
+            appendResponse(&serverResponse, head->author);
+            appendResponse(&serverResponse, "\n");
+            appendResponse(&serverResponse, "LOCATION:");
+            appendResponse(&serverResponse, head->location);
+            appendResponse(&serverResponse, "\n\n");
+        }
+
+        head = head->next;
+    }
+
+    //If there were Books found for the given title, inform the user
+    if (found == false) {
+        appendResponse(&serverResponse, "402:NOT FOUND\nMESSAGE:There are no Books in the Catalog with the given title.\n");
+        sendServerResponse(childfd, serverResponse.text, serverResponse.length);
+    }
+
+    //If there were Books found for the given title
+    else {
+
+        //Pass the Book locations to the user
+        sendServerResponse(childfd, serverResponse.text, serverResponse.length);
+    }
+
+    //Free the server response message
+    free(serverResponse.text);
+}
+
+
+
+//Search the list for the Specified Book
+void getSpecificBook(Book* head, char title[100], char author[100], int childfd) {
+
+    //Boolean to check if any Book matches were found
+    bool found = false;
+
+    //The response message to send back to the client, grown as locations are found
+    ResponseBuffer serverResponse = { NULL, 0, 0 };
+
+    //Iterate though
+    while(head != NULL) {
+
+        //if a match is found add it to the matchList string
+        if (strcmp(head->title, title) == 0 && strcmp(head->author, author) == 0) {
+
+            //If this is the first match, set found to true and build the response message 
+            if (found == false) {
+                found = true;
+                appendResponse(&serverResponse, "202:RETRIEVED\n");
+            }
+
+            //Append the matched Book Location to the Server Response
+            appendResponse(&serverResponse, "LOCATION:");
+            appendResponse(&serverResponse, head->location);
+            appendResponse(&serverResponse, "\n\n");
+        }
+
+        //Check the next Book in the Catalog
+        head = head->next;
+    }
+
+    //If there were Books found for the given title, inform the user
+    if (found == false) {
+        appendResponse(&serverResponse, "402:NOT FOUND\nMESSAGE: There were no Books with the given title and author in the Catalog.\n");
+        sendServerResponse(childfd, serverResponse.text, serverResponse.length);
+    }
+
+    //If there were Books found for the given title
+    else {
+        
+        //Pass the Book locations to the user
+        sendServerResponse(childfd, serverResponse.text, serverResponse.length);
+    }
+
+    //Free the server response message
+    free(serverResponse.text);
+}
+
+
+
+//FUNCTION exportBooks
+void exportBooks(Book* head, unsigned int fromHash, unsigned int toHash, int childfd) {
+
+    //The response message to send back to the client, and the Books in it
+    ResponseBuffer serverResponse = { NULL, 0, 0 };
+    ResponseBuffer books = { NULL, 0, 0 };
+    int bookCount = 0;
+
+    //The text form of the Book count
+    char countLine[32];
+
+    //Collect every Book whose author hash is in the range
+    for (Book* it = head; it != NULL; it = it->next) {
+
+        //How far past the start of the range the author hash is, which wraps the same way the range does
+        unsigned int offset = hashString(it->author) - fromHash;
+
+        if (fromHash != toHash && (offset == 0 || offset > toHash - fromHash)) {
+            continue;
+        }
+
+        appendResponse(&books, "TITLE:");
+        appendResponse(&books, it->title);
+        appendResponse(&books, "\nAUTHOR:");
+        appendResponse(&books, it->author);
+        appendResponse(&books, "\nLOCATION:");
+        appendResponse(&books, it->location);
+        appendResponse(&books, "\n\n");
+        bookCount++;
+    }
+
+    //Lead with the number of Books, which may be none
+    sprintf(countLine, "COUNT:%d\n\n", bookCount);
+    appendResponse(&serverResponse, "202:RETRIEVED\n");
+    appendResponse(&serverResponse, countLine);
+
+    if (books.length > 0) {
+        appendResponseBytes(&serverResponse, books.text, books.length);
+    }
+
+    sendServerResponse(childfd, serverResponse.text, serverResponse.length);
+
+    free(serverResponse.text);
+    free(books.text);
+}
+
+
+
+//Search the list for several Specified Books in a single pass
+void getManyBooks(Book* head, char titles[][100], char authors[][100], int keyCount, int childfd) {
+
+    //The requested keys, and the first key of each hash bucket (or -1)
+    ManyKey keys[MAX_GETMANY_KEYS];
+    int buckets[GETMANY_TABLE_SIZE];
+
+    //The text form of a key number
+    char keyNumber[16];
+
+    //The response message to send back to the client
+    ResponseBuffer serverResponse = { NULL, 0, 0 };
+
+    //Start with every bucket empty
+    for (int i = 0; i < GETMANY_TABLE_SIZE; i++) {
+        buckets[i] = -1;
+    }
+
+    //Group the keys into buckets by the hash of their title
+    for (int k = 0; k < keyCount; k++) {
+
+        unsigned int bucket = hashString(titles[k]) % GETMANY_TABLE_SIZE;
+
+        keys[k].title = titles[k];
+        keys[k].author = authors[k];
+        keys[k].locations = (ResponseBuffer) { NULL, 0, 0 };
+        keys[k].chain = buckets[bucket];
+        buckets[bucket] = k;
+    }
+
+    //Iterate through the Catalog once for all of the keys
+    while (head != NULL) {
+
+        Book* next = head->next;
+
+        //Start loading the next Book's title, author and link while the current Book is compared
+        if (next != NULL) {
+            __builtin_prefetch(next->title);
+            __builtin_prefetch(next->author);
+            __builtin_prefetch(&next->next);
+        }
+
+        //Compare the Book against only the keys that share its title's bucket
+        for (int k = buckets[hashString(head->title) % GETMANY_TABLE_SIZE]; k != -1; k = keys[k].chain) {
+
+            //If a match is found, add its location to the key's matches
+            if (strcmp(head->title, keys[k].title) == 0 && strcmp(head->author, keys[k].author) == 0) {
+                appendResponse(&keys[k].locations, "LOCATION:");
+                appendResponse(&keys[k].locations, head->location);
+                appendResponse(&keys[k].locations, "\n");
+            }
+        }
+
+        head = next;
+    }
+
+    //Form the response header with the number of keys
+    sprintf(keyNumber, "%d", keyCount);
+    appendResponse(&serverResponse, "202:RETRIEVED\nKEYS:");
+    appendResponse(&serverResponse, keyNumber);
+    appendResponse(&serverResponse, "\n\n");
+
+    //Append a block for every key in request order
+    for (int k = 0; k < keyCount; k++) {
+
+        sprintf(keyNumber, "%d", k + 1);
+        appendResponse(&serverResponse, "KEY:");
+        appendResponse(&serverResponse, keyNumber);
+        appendResponse(&serverResponse, "\nTITLE:");
+        appendResponse(&serverResponse, keys[k].title);
+        appendResponse(&serverResponse, "\nAUTHOR:");
+        appendResponse(&serverResponse, keys[k].author);
+        appendResponse(&serverResponse, "\n");
+
+        //If there were no Books found for the key, say so in its block
+        if (keys[k].locations.length == 0) {
+            appendResponse(&serverResponse, "402:NOT FOUND\n\n");
+        }
+
+        //Otherwise pass along the key's Book locations
+        else {
+            appendResponse(&serverResponse, keys[k].locations.text);
+            appendResponse(&serverResponse, "\n");
+        }
+
+        free(keys[k].locations.text);
+    }
+
+    //Terminate the response so the client knows it has all of it
+    appendResponse(&serverResponse, "END\n");
+
+    //Pass the Book locations to the user
+    sendServerResponse(childfd, serverResponse.text, serverResponse.length);
+
+    //Free the server response message
+    free(serverResponse.text);
+}
+
+
+
+//FUNCTION Move a specific book to a new location in place
+void moveBook(Book* head, char title[100], char author[100], char location[100], char newLocation[100], int childfd) {
+
+    //The Book to move, once found
+    Book* match = NULL;
+
+    //Boolean to check if the Book already exists at the new location
+    bool duplicate = false;
+
+    //The response message to send back to the client
+    char* serverResponse;
+    serverResponse = malloc(sizeof(char) * 1000);
+
+    //Iterate through the Catalog once, looking for both the Book and a copy of it at the new location
+    while (head != NULL) {
+
+        if (strcmp(head->title, title) == 0 && strcmp(head->author, author) == 0) {
+
+            //The Book to move
+            if (strcmp(head->location, location) == 0) {
+                match = head;
+            }
+
+            //The same Book at the new location
+            else if (strcmp(head->location, newLocation) == 0) {
+                duplicate = true;
+            }
+        }
+
+        head = head->next;
+    }
+
+    //If the Book wasn't found, inform the user
+    if (match == NULL) {
+        strcpy(serverResponse, "402:NOT FOUND\nMESSAGE:The Book specified could not be found in the Catalog.\n");
+    }
+
+    //If the Book is already at the new location, inform the user
+    else if (duplicate == true) {
+        strcpy(serverResponse, "401:DUPLICATE\nMESSAGE:The Book specified already exists at the new location.\n");
+    }
+
+    //Otherwise, change the Book's location in place
+    else {
+        logMutation(WAL_MOVE, title, author, location, newLocation);
+        strcpy(match->location, newLocation);
+
+        //Build the MOVED Server Response Message
+        strcpy(serverResponse, "204:MOVED\nTITLE:");
+        strcat(serverResponse, title);
+        strcat(serverResponse, "\nAUTHOR:");
+        strcat(serverResponse, author);
+        strcat(serverResponse, "\nLOCATION:");
+        strcat(serverResponse, newLocation);
+        strcat(serverResponse, "\n");
+    }
+
+    //Send the Server Response Message
+    sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+
+    //Free the server response message
+    free(serverResponse);
+}
+
+
+
+//FUNCTION Remove ALL Books from Catalog
+void removeAllBooks(Book** head) {
+
+    //Temporary Book object for modifying the Catalog
+    Book* temp = *head;
+
+    //If the Catalog is empty, return
+    if (temp == NULL) {
+        return;
+    }
+
+    //Otherwise,
+    else {
+
+        //Free the first n-1 Books in the Catalog
+        while (temp->next != NULL) {
+            temp = temp->next;
+            freeBook(temp->previous);
+        }
+
+        //Free the last Book in the Catalog and set the head pointer to NULL
+        freeBook(temp);
+        temp = NULL;
+
+        //Save the changes made to the original Catalog
+        *head = temp;
+    }
+}
+
+
+
+//FUNCTION Remove a specific book from the list
+void removeBook(Book** head, char title[100], char author[100], char location[100], int childfd) {
+
+    //Temporary Book iterator for the Catalog
+    Book* it = *head;
+
+    //The response message to send back to the client
+    char* serverResponse;
+    serverResponse = malloc(sizeof(char) * 1000);
+
+    //CASE ONE: BOOK CATALOG IS EMPTY
+    if (it == NULL) {
+        
+        strcpy(serverResponse, "402:NOT FOUND\nMESSAGE:The Book Catalog is empty and thus does not contain the Book specified.\n");
+        sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+    }
+
+    //CASE TWO: SEARCH THE BOOK CATALOG
+    else {
+
+        //Iterate through the Book Catalog for the desired Book to Remove
+        while(it != NULL) {
+
+            //If there's a match, stop iterating
+            if (strcmp(it->title, title) == 0 && strcmp(it->author, author) == 0 && strcmp(it->location, location) == 0) {
+                break;
+            }
+
+            //Keep iterating
+            else {
+                it = it->next;
+            }
+        }
+
+        //If the Book wasn't found in the list
+        if (it == NULL) {
+
+            //Write to the client that the book was not found
+            strcpy(serverResponse, "402:NOT FOUND\nMESSAGE:The Book specified could not be found in the Catalog.\n");
+            sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+        }
+
+        //Otherwise, remove the Book entry from the Catalog
+        else {
+
+            //Log the removal, then unlink and free the Book
+            logMutation(WAL_REMOVE, title, author, location, "");
+            unlinkBook(head, it);
+
+            //Build the REMOVED Server Response Message
+            strcpy(serverResponse, "203:REMOVED\nTITLE:");
+            strcat(serverResponse, title);
+            strcat(serverResponse, "\nAUTHOR:");
+            strcat(serverResponse, author);
+            strcat(serverResponse, "\nLOCATION:");
+            strcat(serverResponse, location);
+            strcat(serverResponse, "\n");
+
+            //Send the Server Response Message
+            sendServerResponse(childfd, serverResponse, strlen(serverResponse));   
+        }
+    }
+
+    //Free the server response message
+    free(serverResponse);
+}
+
+
+
+//FUNCTION Remove every book matching an author and/or location from the list
+void removeMatchingBooks(Book** head, char author[100], char location[100], int childfd) {
+
+    //Temporary Book iterator for the Catalog
+    Book* it = *head;
+
+    //The number of Books removed
+    int removedCount = 0;
+
+    //The response message to send back to the client
+    char* serverResponse;
+    serverResponse = malloc(sizeof(char) * 1000);
+
+    //Iterate through the Book Catalog once, unlinking every match as it is passed
+    while (it != NULL) {
+
+        //Save the next Book before the current one can be freed
+        Book* next = it->next;
+
+        //A blank author or location matches any Book
+        if ((author[0] == '\0' || strcmp(it->author, author) == 0) && (location[0] == '\0' || strcmp(it->location, location) == 0)) {
+            logMutation(WAL_REMOVE, it->title, it->author, it->location, "");
+            unlinkBook(head, it);
+            removedCount++;
+        }
+
+        it = next;
+    }
+
+    //If no Books matched, inform the user
+    if (removedCount == 0) {
+        strcpy(serverResponse, "402:NOT FOUND\nMESSAGE:There are no Books in the Catalog matching the given author and location.\n");
+    }
+
+    //Otherwise, build the REMOVED Server Response Message with the number of Books removed
+    else {
+        sprintf(serverResponse, "203:REMOVED\nCOUNT:%d\n", removedCount);
+    }
+
+    //Send the Server Response Message
+    sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+
+    //Free the server response message
+    free(serverResponse);
+}
+
+
+
+//FUNCTION Unlink a book from the list and free it
+void unlinkBook(Book** head, Book* book) {
+
+    //If this is the first Book in the Catalog, move the head pointer to the second Book
+    if (book->previous == NULL) {
+        *head = book->next;
+    }
+
+    //Otherwise, set the previous node to point to the one after the one being deleted
+    else {
+        book->previous->next = book->next;
+    }
+
+    //If this isn't the last Book in the Catalog, set the next node to point to the one before the one being deleted
+    if (book->next != NULL) {
+        book->next->previous = book->previous;
+    }
+
+    //Free the Book node
+    freeBook(book);
+}
+
+
+
+//Append a new member to the end of the list -- CHECKED
+void submitBook(Book** head, char title[100], char author[100], char location[100], int childfd) {
+
+    //Temporary head pointer to modify the Catalog list
+    Book* temp = *head;
+
+    //The new Book to be added
+    Book* newBook;
+
+    //The response message to send back to the client
+    char* serverResponse;
+    serverResponse = malloc(sizeof(char) * 1000);
+
+    //Malloc the new Book Struct
+    newBook = malloc(sizeof(Book));
+    __atomic_fetch_add(&heapBookCount, 1, __ATOMIC_RELAXED);
+
+    //add the new data to the entry
+    strcpy(newBook->title, title);
+    strcpy(newBook->author, author);
+    strcpy(newBook->location, location);
+
+    //Since end of list, next will always be NULL
+    newBook->next = NULL;
+    
+    //If list empty, new node is the head
+    if(temp == NULL) {
+        newBook->previous = NULL;
+        newBook->next = NULL;
+        temp = newBook;
+
+        //Set the passed head pointer to the temporary one to save the changes
+        *head = temp;
+
+        //Log the submission
+        logMutation(WAL_SUBMIT, title, author, location, "");
+
+        //Form the server response message
+        strcpy(serverResponse, "201: SUBMITTED\n");
+        strcat(serverResponse, "TITLE:");
+        strcat(serverResponse, title);
+        strcat(serverResponse, "\n");
+        strcat(serverResponse, "AUTHOR:");
+        strcat(serverResponse, author);
+        strcat(serverResponse, "\n");
+        strcat(serverResponse, "LOCATION:");
+        strcat(serverResponse, location);
+        strcat(serverResponse, "\n");
+
+        //Send the server response message
+        sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+    }
+
+    else {
+
+        //Otherwise traverse to the end of the list
+        Book* it = temp;
+        
+        bool duplicate = false;
+
+        //Traverse the list to the last Book, checking every Book including the last one
+        while(1) {
+
+            //If the Book submission is a duplicate, it can't be added to the Catalog
+            if (strcmp(title, it->title) == 0 && strcmp(author, it->author) == 0 && strcmp(location, it->location) == 0) {
+                duplicate = true;
+                break;
+            }
+
+            //Stop at the last Book
+            if (it->next == NULL) {
+                break;
+            }
+
+            it = it->next;
+        }
+
+        //If this is a duplicate Book submission, inform the user
+        if (duplicate == true) {
+            
+            //Write to the client that the Book is a duplicate
+            strcpy(serverResponse, "401:DUPLICATE\nMESSAGE:The Book specified is a duplicate submission and could not be added to the Catalog.\n");
+            sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+
+            //The new Book is never added, so free it
+            free(newBook);
+            __atomic_fetch_sub(&heapBookCount, 1, __ATOMIC_RELAXED);
+        }
+
+        //Otherwise, add the Book to the end of the Catalog
+        else {
+
+            //Insert the next and previous node info
+            newBook->previous = it;
+            it->next = newBook;
+
+            //Set the passed head pointer to the temporary one to save the changes
+            *head = temp;
+
+            //Log the submission
+            logMutation(WAL_SUBMIT, title, author, location, "");
+
+            //Form the server response message
+            strcpy(serverResponse, "201: SUBMITTED\n");
+            strcat(serverResponse, "TITLE:");
+            strcat(serverResponse, title);
+            strcat(serverResponse, "\n");
+            strcat(serverResponse, "AUTHOR:");
+            strcat(serverResponse, author);
+            strcat(serverResponse, "\n");
+            strcat(serverResponse, "LOCATION:");
+            strcat(serverResponse, location);
+            strcat(serverResponse, "\n");
+
+            //Send the server response message
+            sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+        }
+    }
+
+    //Free the server response message
+    free(serverResponse);
+}
+
+
+
+//FUNCTION flushWriteAheadLog
+void flushWriteAheadLog() {
+
+    //The records being written, and the last log sequence number among them
+    char* records;
+    int recordsLength;
+    int recordsCapacity;
+    unsigned long long flushedLsn;
+
+    //If another thread is already flushing, wait for it instead
+    if (writeAheadLog.flushing == true) {
+        pthread_cond_wait(&writeAheadLog.flushed, &writeAheadLog.lock);
+        return;
+    }
+
+    //Take every buffered record, swapping in the spare buffer so writers can keep appending during the write
+    writeAheadLog.flushing = true;
+    records = writeAheadLog.buffer;
+    recordsLength = writeAheadLog.bufferedLength;
+    flushedLsn = writeAheadLog.lastLsn;
+
+    recordsCapacity = writeAheadLog.bufferCapacity;
+
+    writeAheadLog.buffer = writeAheadLog.spare;
+    writeAheadLog.bufferCapacity = writeAheadLog.spareCapacity;
+    writeAheadLog.bufferedLength = 0;
+    writeAheadLog.spare = records;
+    writeAheadLog.spareCapacity = recordsCapacity;
+
+    pthread_mutex_unlock(&writeAheadLog.lock);
+
+    //The number of bytes of the records written so far
+    int totalWritten = 0;
+
+    //Write the records to the end of the log file
+    while (totalWritten < recordsLength) {
+
+        int writtenBytes = write(writeAheadLog.fd, records + totalWritten, recordsLength - totalWritten);
+
+        //If the records couldn't be written, the log can no longer be trusted, so stop the server
+        if (writtenBytes < 0) {
+            fprintf(stderr, "ERROR: The write-ahead log could not be written.\n");
+            perror("ERROR: ");
+            exit(1);
+        }
+
+        totalWritten += writtenBytes;
+    }
+
+    //Make the records durable, unless the log is in async mode
+    if (writeAheadLog.mode != WAL_ASYNC && fdatasync(writeAheadLog.fd) < 0) {
+        fprintf(stderr, "ERROR: The write-ahead log could not be synced.\n");
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    //Wake every writer waiting on these records
+    pthread_mutex_lock(&writeAheadLog.lock);
+
+    writeAheadLog.durableLsn = flushedLsn;
+    writeAheadLog.flushing = false;
+    writeAheadLog.flushCount++;
+
+    pthread_cond_broadcast(&writeAheadLog.flushed);
+}
+
+
+
+//FUNCTION launchWalFlusher
+void* launchWalFlusher(void* arg) {
+
+    //Flush the log every batch interval until the server closes
+    while (1) {
+
+        usleep(writeAheadLog.batchInterval * 1000);
+
+        pthread_mutex_lock(&writeAheadLog.lock);
+
+        if (writeAheadLog.durableLsn < writeAheadLog.lastLsn) {
+            flushWriteAheadLog();
+        }
+
+        pthread_mutex_unlock(&writeAheadLog.lock);
+    }
+
+    return NULL;
+}
+
+
+
+//FUNCTION logMutation
+unsigned long long logMutation(int type, const char title[], const char author[], const char location[], const char newLocation[]) {
+
+    //The record to append
+    WalRecord record;
+
+    //Build the record, zeroing it first so its unused bytes and checksum are predictable
+    memset(&record, 0, sizeof(WalRecord));
+    record.type = type;
+    strncpy(record.title, title, 99);
+    strncpy(record.author, author, 99);
+    strncpy(record.location, location, 99);
+    strncpy(record.newLocation, newLocation, 99);
+
+    //Mutations outside any request, such as a benchmark's, belong to the default catalog
+    if (currentCatalog != NULL) {
+        strcpy(record.catalog, currentCatalog->name);
+    }
+
+    pthread_mutex_lock(&writeAheadLog.lock);
+
+    //Give the record the next log sequence number and checksum it
+    record.lsn = ++writeAheadLog.lastLsn;
+    record.checksum = hashBytes(&record, sizeof(WalRecord));
+
+    //Send the record to every replica and subscriber, in log sequence number order
+    publishMutation(&record);
+    publishEvent(&record);
+
+    //If the log isn't open, mutations are kept in memory only
+    if (writeAheadLog.fd < 0) {
+        writeAheadLog.durableLsn = record.lsn;
+    }
+
+    //In async mode, hand the record straight to the operating system
+    else if (writeAheadLog.mode == WAL_ASYNC) {
+
+        if (write(writeAheadLog.fd, &record, sizeof(WalRecord)) != sizeof(WalRecord)) {
+            fprintf(stderr, "ERROR: The write-ahead log could not be written.\n");
+            perror("ERROR: ");
+            exit(1);
+        }
+
+        writeAheadLog.durableLsn = record.lsn;
+    }
+
+    //Otherwise, buffer the record until the next flush
+    else {
+
+        //Double the buffer's capacity when it is full
+        if (writeAheadLog.bufferedLength + (int) sizeof(WalRecord) > writeAheadLog.bufferCapacity) {
+            writeAheadLog.bufferCapacity = writeAheadLog.bufferCapacity > 0 ? writeAheadLog.bufferCapacity * 2 : 64 * sizeof(WalRecord);
+            writeAheadLog.buffer = realloc(writeAheadLog.buffer, writeAheadLog.bufferCapacity);
+        }
+
+        memcpy(writeAheadLog.buffer + writeAheadLog.bufferedLength, &record, sizeof(WalRecord));
+        writeAheadLog.bufferedLength += sizeof(WalRecord);
+    }
+
+    pthread_mutex_unlock(&writeAheadLog.lock);
+
+    //Tell the clients caching the Book's title or author that their results are stale
+    publishInvalidation(&record);
+
+    //Remember the mutation so the request's response can wait for it
+    lastLoggedLsn = record.lsn;
+
+    return record.lsn;
+}
+
+
+
+//FUNCTION openWriteAheadLog
+int openWriteAheadLog(char path[], int mode, int batchInterval) {
+
+    //The log file's header
+    WalHeader header;
+
+    //The size of the log file, and where it is mapped for replay
+    struct stat fileInfo;
+    char* mapping;
+
+    //The records in the file, the first one after the snapshot, and the number replayed
+    WalRecord* records;
+    long long recordCount;
+    long long start = 0;
+    long long replayedCount = 0;
+
+    //Open the log, creating it if it doesn't exist
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    snprintf(writeAheadLog.path, sizeof(writeAheadLog.path), "%s", path);
+
+    //Start after the last record included in the loaded snapshot, if any
+    writeAheadLog.lastLsn = snapshotLsn;
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    //If the log is new, write its header
+    if (read(fd, &header, sizeof(WalHeader)) != sizeof(WalHeader)) {
+
+        memset(&header, 0, sizeof(WalHeader));
+        strcpy(header.magic, WAL_MAGIC);
+        header.version = WAL_VERSION;
+        header.recordSize = sizeof(WalRecord);
+
+        if (ftruncate(fd, 0) < 0 || pwrite(fd, &header, sizeof(WalHeader), 0) != sizeof(WalHeader) || fsync(fd) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    //Otherwise, refuse a file that isn't a log of this version
+    else if (strcmp(header.magic, WAL_MAGIC) != 0 || header.version != WAL_VERSION || header.recordSize != sizeof(WalRecord)) {
+        fprintf(stderr, "ERROR: %s is not a version %d write-ahead log.\n", path, WAL_VERSION);
+        close(fd);
+        return -1;
+    }
+
+    //Replay the records after the snapshot
+    else {
+
+        if (fstat(fd, &fileInfo) < 0) {
+            close(fd);
+            return -1;
+        }
+
+        //Any partial record at the end was torn by a crash
+        recordCount = (fileInfo.st_size - sizeof(WalHeader)) / sizeof(WalRecord);
+
+        if (recordCount > 0) {
+
+            //Map the log rather than read it, so the records before the snapshot are never touched
+            mapping = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                return -1;
+            }
+
+            records = (WalRecord*) (mapping + sizeof(WalHeader));
+
+            //Records have consecutive log sequence numbers, so the first one after the snapshot can be found from the first record in the file
+            if (isWalRecordIntact(&records[0]) == true && records[0].lsn <= writeAheadLog.lastLsn) {
+
+                start = writeAheadLog.lastLsn + 1 - records[0].lsn;
+
+                if (start > recordCount) {
+                    start = recordCount;
+                }
+
+                //If the record before it isn't the snapshot's last one, the log isn't laid out as expected, so search from the start
+                if (isWalRecordIntact(&records[start - 1]) == false || records[start - 1].lsn != writeAheadLog.lastLsn) {
+                    start = 0;
+                }
+            }
+
+            //Otherwise skip the records included in the snapshot one at a time, stopping at the first torn or corrupt record
+            if (start == 0) {
+                while (start < recordCount && isWalRecordIntact(&records[start]) == true && records[start].lsn <= writeAheadLog.lastLsn) {
+                    start++;
+                }
+            }
+
+            //Replay the rest in bulk
+            replayedCount = replayWalTail(records + start, recordCount - start);
+
+            //If the snapshot's records the tail changes are corrupt, drop the snapshot and rebuild the Catalog from the whole log instead
+            if (replayedCount == -2) {
+                fprintf(stderr, "ERROR: The snapshot is corrupt, so the Catalog is rebuilt from the whole of %s.\n", path);
+
+                unloadSnapshot();
+                writeAheadLog.lastLsn = 0;
+                start = 0;
+
+                replayedCount = replayWalTail(records, recordCount);
+            }
+
+            munmap(mapping, fileInfo.st_size);
+
+            //An intact record out of sequence means records are missing, so the Catalog can't be rebuilt
+            if (replayedCount < 0) {
+                fprintf(stderr, "ERROR: %s is missing records after log sequence number %llu.\n", path, writeAheadLog.lastLsn);
+                close(fd);
+                return -1;
+            }
+
+            writeAheadLog.lastLsn += replayedCount;
+        }
+
+        //Cut any torn or corrupt tail off the log so new records follow the last valid one
+        if (ftruncate(fd, sizeof(WalHeader) + (start + replayedCount) * sizeof(WalRecord)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    //New records are appended after the replayed ones
+    lseek(fd, 0, SEEK_END);
+
+    writeAheadLog.durableLsn = writeAheadLog.lastLsn;
+    writeAheadLog.mode = mode;
+    writeAheadLog.batchInterval = batchInterval;
+    writeAheadLog.fd = fd;
+
+    //In batch mode, fsync the log from a background thread
+    if (mode == WAL_BATCH) {
+        pthread_t flusherThread;
+        pthread_create(&flusherThread, NULL, launchWalFlusher, NULL);
+        pthread_detach(flusherThread);
+    }
+
+    return replayedCount;
+}
+
+
+
+//FUNCTION replayWalTail
+long long replayWalTail(WalRecord tail[], long long tailCount) {
+
+    //The work shared by the recovery threads
+    RecoveryPlan plan;
+    RecoveryWorker workers[MAX_RECOVERY_SHARDS];
+    pthread_t threads[MAX_RECOVERY_SHARDS];
+
+    //The last Book linked into the catalog being recovered, and its place in the order
+    Book* last = NULL;
+    long long lastIndex = -2;
+
+    //Every catalog with Books after replay and the last Book linked into each, for linking the submitted Books after the others
+    Catalog** linkedCatalogs;
+    Book** linkedLasts;
+    int linkedCount = 0;
+    int linkedCapacity;
+
+    //The catalog of the last submitted Book linked, which the next one is usually in too
+    int linked = -1;
+
+    //Whether any catalog's records from the snapshot are corrupt
+    bool corrupt = false;
+
+    if (tailCount == 0) {
+        return 0;
+    }
+
+    memset(&plan, 0, sizeof(RecoveryPlan));
+    plan.tail = tail;
+    plan.tailCount = tailCount;
+    plan.firstLsn = writeAheadLog.lastLsn + 1;
+
+    //Use a shard for every core
+    plan.shardCount = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (plan.shardCount < 1) {
+        plan.shardCount = 1;
+    }
+    else if (plan.shardCount > MAX_RECOVERY_SHARDS) {
+        plan.shardCount = MAX_RECOVERY_SHARDS;
+    }
+
+    //The starting catalogs, each one's Books a run of the array
+    for (Catalog* it = catalogs; it != NULL; it = it->nextCatalog) {
+        plan.catalogCount++;
+    }
+
+    plan.catalogs = malloc(sizeof(Catalog*) * (plan.catalogCount + snapshotCatalogCount + 1));
+    plan.catalogStarts = malloc(sizeof(long long) * (plan.catalogCount + snapshotCatalogCount + 1));
+    plan.catalogCount = 0;
+
+    //At startup the catalogs are either empty or exactly the mapped snapshot, whose records are already an array of runs in list order that
+    //the scanning threads can index themselves. Otherwise, gather the catalogs into an array so it can be split between the threads
+    plan.mapped = snapshotRecords != NULL;
+
+    for (int c = 0; c < snapshotCatalogCount && plan.mapped == true; c++) {
+
+        plan.catalogs[c] = findCatalog(snapshotCatalogs[c].name, false);
+        plan.catalogStarts[c] = plan.bookCount;
+
+        if (plan.catalogs[c] == NULL || plan.catalogs[c]->books != (Book*) snapshotRecords + plan.bookCount) {
+            plan.mapped = false;
+        }
+
+        plan.bookCount += snapshotCatalogs[c].recordCount;
+    }
+
+    if (plan.mapped == true) {
+        plan.catalogCount = snapshotCatalogCount;
+    }
+    else {
+
+        plan.bookCount = 0;
+
+        for (Catalog* catalog = catalogs; catalog != NULL; catalog = catalog->nextCatalog) {
+
+            //The Books are about to be read and changed, so any still unchecked from the snapshot are checked first
+            if (checkSnapshotRecords(catalog) == false) {
+                corrupt = true;
+            }
+
+            if (catalog->books == NULL) {
+                continue;
+            }
+
+            plan.catalogs[plan.catalogCount] = catalog;
+            plan.catalogStarts[plan.catalogCount++] = plan.bookCount;
+
+            for (Book* it = catalog->books; it != NULL; it = it->next) {
+                plan.bookCount++;
+            }
+        }
+    }
+
+    plan.catalogStarts[plan.catalogCount] = plan.bookCount;
+
+    plan.books = malloc(sizeof(Book*) * (plan.bookCount + 1));
+    plan.bookHashes = malloc(sizeof(unsigned int) * (plan.bookCount + 1));
+    plan.tailHashes = malloc(sizeof(unsigned int) * tailCount);
+    plan.removed = calloc(plan.bookCount + 1, sizeof(unsigned char));
+    plan.submitted = calloc(tailCount, sizeof(Book*));
+    plan.recordsChecksums = calloc(plan.shardCount * plan.catalogCount + 1, sizeof(unsigned int));
+
+    if (plan.mapped == false) {
+
+        plan.bookCount = 0;
+
+        for (int c = 0; c < plan.catalogCount; c++) {
+            for (Book* it = plan.catalogs[c]->books; it != NULL; it = it->next) {
+                plan.books[plan.bookCount++] = it;
+            }
+        }
+    }
+
+    //Check and hash the records and Books in parallel
+    for (int i = 0; i < plan.shardCount; i++) {
+        workers[i].plan = &plan;
+        workers[i].number = i;
+        pthread_create(&threads[i], NULL, launchRecoveryScanner, &workers[i]);
+    }
+
+    for (int i = 0; i < plan.shardCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    //Add up each mapped catalog's records checksum, and compare it with the snapshot's before any of its Books are changed
+    for (int c = 0; c < plan.catalogCount && plan.mapped == true; c++) {
+
+        unsigned int recordsChecksum = 0;
+
+        for (int i = 0; i < plan.shardCount; i++) {
+            recordsChecksum += plan.recordsChecksums[i * plan.catalogCount + c];
+        }
+
+        if (plan.catalogs[c]->uncheckedRecords != NULL && recordsChecksum != plan.catalogs[c]->uncheckedChecksum) {
+            fprintf(stderr, "ERROR: The snapshot's records for catalog '%s' are corrupt.\n", plan.catalogs[c]->name);
+            plan.catalogs[c]->corrupt = true;
+            corrupt = true;
+        }
+
+        plan.catalogs[c]->uncheckedRecords = NULL;
+    }
+
+    //Replay up to the first torn or corrupt record, unless an intact record before it is out of sequence
+    plan.validCount = tailCount;
+
+    for (int i = 0; i < plan.shardCount; i++) {
+        if (plan.badRecords[i] < plan.validCount) {
+            plan.validCount = plan.badRecords[i];
+        }
+    }
+
+    for (int i = 0; i < plan.shardCount; i++) {
+        if (plan.gapRecords[i] < plan.validCount || corrupt == true) {
+            free(plan.recordsChecksums);
+            free(plan.books);
+            free(plan.bookHashes);
+            free(plan.tailHashes);
+            free(plan.removed);
+            free(plan.submitted);
+            free(plan.catalogs);
+            free(plan.catalogStarts);
+            return corrupt == true ? -2 : -1;
+        }
+    }
+
+    //Replay every shard in parallel
+    for (int i = 0; i < plan.shardCount; i++) {
+        pthread_create(&threads[i], NULL, launchRecoveryShard, &workers[i]);
+    }
+
+    for (int i = 0; i < plan.shardCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    //Relink each catalog in one pass: the starting Books that remain in their order, then the submitted Books that remain in log order.
+    //Neighbouring starting Books are already linked to each other, so only the links around removed Books and new ones are written,
+    //which leaves untouched snapshot pages shared with the file
+    linkedCapacity = plan.catalogCount + 16;
+    linkedCatalogs = malloc(sizeof(Catalog*) * linkedCapacity);
+    linkedLasts = malloc(sizeof(Book*) * linkedCapacity);
+
+    for (int c = 0; c < plan.catalogCount; c++) {
+
+        last = NULL;
+        lastIndex = -2;
+        plan.catalogs[c]->books = NULL;
+
+        for (long long i = plan.catalogStarts[c]; i < plan.catalogStarts[c + 1]; i++) {
+
+            //Take the next Book in order, freeing the removed starting Books along the way
+            Book* book = plan.books[i];
+
+            if (plan.removed[i] != 0) {
+                freeBook(book);
+                continue;
+            }
+
+            //The Book right after the last one kept is still linked to it
+            if (i == lastIndex + 1 && last != NULL) {
+                last = book;
+                lastIndex = i;
+                continue;
+            }
+
+            book->previous = last;
+
+            if (last == NULL) {
+                plan.catalogs[c]->books = book;
+            }
+            else {
+                last->next = book;
+            }
+
+            last = book;
+            lastIndex = i;
+        }
+
+        linkedCatalogs[linkedCount] = plan.catalogs[c];
+        linkedLasts[linkedCount++] = last;
+    }
+
+    for (long long i = 0; i < plan.validCount; i++) {
+
+        Book* book = plan.submitted[i];
+
+        if (book == NULL) {
+            continue;
+        }
+
+        //Find the catalog the Book was submitted to, creating it if the log is the first to mention it
+        if (linked < 0 || strcmp(linkedCatalogs[linked]->name, tail[i].catalog) != 0) {
+
+            for (linked = 0; linked < linkedCount; linked++) {
+                if (strcmp(linkedCatalogs[linked]->name, tail[i].catalog) == 0) {
+                    break;
+                }
+            }
+
+            if (linked == linkedCount) {
+
+                //Double the catalogs' capacity when they are full
+                if (linkedCount == linkedCapacity) {
+                    linkedCapacity *= 2;
+                    linkedCatalogs = realloc(linkedCatalogs, sizeof(Catalog*) * linkedCapacity);
+                    linkedLasts = realloc(linkedLasts, sizeof(Book*) * linkedCapacity);
+                }
+
+                linkedCatalogs[linkedCount] = findCatalog(tail[i].catalog, true);
+                linkedLasts[linkedCount++] = NULL;
+            }
+        }
+
+        book->previous = linkedLasts[linked];
+
+        if (linkedLasts[linked] == NULL) {
+            linkedCatalogs[linked]->books = book;
+        }
+        else {
+            linkedLasts[linked]->next = book;
+        }
+
+        linkedLasts[linked] = book;
+    }
+
+    //End every catalog at its last Book
+    for (int c = 0; c < linkedCount; c++) {
+        if (linkedLasts[c] != NULL && linkedLasts[c]->next != NULL) {
+            linkedLasts[c]->next = NULL;
+        }
+    }
+
+    free(linkedCatalogs);
+    free(linkedLasts);
+    free(plan.books);
+    free(plan.bookHashes);
+    free(plan.tailHashes);
+    free(plan.removed);
+    free(plan.submitted);
+    free(plan.recordsChecksums);
+    free(plan.catalogs);
+    free(plan.catalogStarts);
+
+    return plan.validCount;
+}
+
+
+
+//FUNCTION truncateWriteAheadLog
+long long truncateWriteAheadLog(unsigned long long lsn) {
+
+    //The new log file, the header written at its start, and the first record of the old one
+    char temporaryPath[1010];
+    int truncatedfd;
+    WalHeader header;
+    WalRecord first;
+
+    //The size of the old log, the records in it, and the first one after the snapshot
+    struct stat fileInfo;
+    long long recordCount;
+    long long start;
+
+    //The records being copied
+    WalRecord* chunk;
+
+    //The directory holding the log, fsynced so the rename is durable
+    char directoryPath[1000];
+    char* lastSlash;
+    int directoryfd;
+
+    if (writeAheadLog.fd < 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&writeAheadLog.lock);
+
+    //Wait for any flush to finish, since it writes to the log without holding the lock, and no other can start while it's held
+    while (writeAheadLog.flushing == true) {
+        pthread_cond_wait(&writeAheadLog.flushed, &writeAheadLog.lock);
+    }
+
+    if (fstat(writeAheadLog.fd, &fileInfo) < 0) {
+        pthread_mutex_unlock(&writeAheadLog.lock);
+        return -1;
+    }
+
+    //The records on disk have consecutive log sequence numbers, so the first one after the snapshot is found from the first record. If the
+    //log already starts after the snapshot, there is nothing to drop
+    recordCount = (fileInfo.st_size - sizeof(WalHeader)) / sizeof(WalRecord);
+
+    if (recordCount == 0 || pread(writeAheadLog.fd, &first, sizeof(WalRecord), sizeof(WalHeader)) != sizeof(WalRecord) || first.lsn > lsn) {
+        pthread_mutex_unlock(&writeAheadLog.lock);
+        return 0;
+    }
+
+    start = lsn + 1 - first.lsn;
+
+    if (start > recordCount) {
+        start = recordCount;
+    }
+
+    //Copy the header and the records after the snapshot into a new log
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", writeAheadLog.path);
+    truncatedfd = open(temporaryPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (truncatedfd < 0) {
+        pthread_mutex_unlock(&writeAheadLog.lock);
+        return -1;
+    }
+
+    chunk = malloc(WAL_TRUNCATE_CHUNK * sizeof(WalRecord));
+
+    memset(&header, 0, sizeof(WalHeader));
+    strcpy(header.magic, WAL_MAGIC);
+    header.version = WAL_VERSION;
+    header.recordSize = sizeof(WalRecord);
+
+    bool copied = chunk != NULL && writeFully(truncatedfd, &header, sizeof(WalHeader)) == 0;
+
+    for (long long i = start; i < recordCount && copied == true; i += WAL_TRUNCATE_CHUNK) {
+
+        int length = (recordCount - i < WAL_TRUNCATE_CHUNK ? recordCount - i : WAL_TRUNCATE_CHUNK) * sizeof(WalRecord);
+
+        copied = pread(writeAheadLog.fd, chunk, length, sizeof(WalHeader) + i * sizeof(WalRecord)) == length
+                 && writeFully(truncatedfd, chunk, length) == 0;
+    }
+
+    free(chunk);
+
+    //Keep the old log if the new one couldn't be made durable in its place
+    if (copied == false || fsync(truncatedfd) < 0 || rename(temporaryPath, writeAheadLog.path) < 0) {
+        close(truncatedfd);
+        unlink(temporaryPath);
+        pthread_mutex_unlock(&writeAheadLog.lock);
+        return -1;
+    }
+
+    //Make the rename itself durable by fsyncing the directory
+    strcpy(directoryPath, writeAheadLog.path);
+    lastSlash = strrchr(directoryPath, '/');
+
+    if (lastSlash == NULL) {
+        strcpy(directoryPath, ".");
+    }
+    else if (lastSlash == directoryPath) {
+        directoryPath[1] = '\0';
+    }
+    else {
+        *lastSlash = '\0';
+    }
+
+    directoryfd = open(directoryPath, O_RDONLY);
+
+    if (directoryfd >= 0) {
+        fsync(directoryfd);
+        close(directoryfd);
+    }
+
+    //Append to the new log from here on, under the same descriptor, whose offset is already at its end
+    dup2(truncatedfd, writeAheadLog.fd);
+    close(truncatedfd);
+
+    pthread_mutex_unlock(&writeAheadLog.lock);
+
+    return start;
+}
+
+
+
+//FUNCTION waitForWriteAheadLog
+void waitForWriteAheadLog(unsigned long long lsn) {
+
+    pthread_mutex_lock(&writeAheadLog.lock);
+
+    //Flush, or wait for the thread already flushing, until the record is on disk
+    while (writeAheadLog.durableLsn < lsn) {
+        flushWriteAheadLog();
+    }
+
+    pthread_mutex_unlock(&writeAheadLog.lock);
+}
+
+
+
+//FUNCTION walFlushCount
+unsigned long long walFlushCount() {
+
+    unsigned long long flushCount;
+
+    pthread_mutex_lock(&writeAheadLog.lock);
+    flushCount = writeAheadLog.flushCount;
+    pthread_mutex_unlock(&writeAheadLog.lock);
+
+    return flushCount;
+}
+
+
+
+//FUNCTION freeBook
+void freeBook(Book* book) {
+
+    //Books mapped from the snapshot file were never allocated
+    if ((char*) book >= snapshotRecords && (char*) book < snapshotRecords + snapshotLength) {
+        __atomic_fetch_add(&freedSnapshotBookCount, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    free(book);
+    __atomic_fetch_sub(&heapBookCount, 1, __ATOMIC_RELAXED);
+}
+
+
+
+//FUNCTION loadSnapshot
+long long loadSnapshot(char path[]) {
+
+    //The snapshot file and its header
+    int fd;
+    SnapshotHeader header;
+
+    //The checksum stored in the header
+    unsigned int storedChecksum;
+
+    //The size of the file and the address it was mapped at
+    struct stat fileInfo;
+    char* mapping;
+
+    //The catalog table after the records, and the number of records it accounts for
+    SnapshotCatalog* table;
+    unsigned long long tableRecordCount = 0;
+
+    //Open the snapshot file. If there isn't one yet, the Catalog starts empty
+    fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return 0;
+    }
+
+    //Read and check the header
+    if (pread(fd, &header, sizeof(SnapshotHeader), 0) != sizeof(SnapshotHeader) || fstat(fd, &fileInfo) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    storedChecksum = header.headerChecksum;
+    header.headerChecksum = 0;
+
+    if (strcmp(header.magic, SNAPSHOT_MAGIC) != 0 || header.version != SNAPSHOT_VERSION || header.recordSize != sizeof(Book)
+        || storedChecksum != hashBytes(&header, sizeof(SnapshotHeader))
+        || (unsigned long long) fileInfo.st_size != SNAPSHOT_HEADER_SIZE + header.recordCount * sizeof(Book) + header.catalogCount * sizeof(SnapshotCatalog)) {
+        close(fd);
+        return -1;
+    }
+
+    //An empty snapshot has no records to map
+    if (header.recordCount == 0) {
+        snapshotLsn = header.lsn;
+        close(fd);
+        return 0;
+    }
+
+    //Map the file privately at the address its links were written for, so changes to the Books stay in memory and the file is untouched
+    mapping = mmap((void*) header.baseAddress, fileInfo.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    //The mapping holds its own reference to the file
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+
+    table = (SnapshotCatalog*) (mapping + SNAPSHOT_HEADER_SIZE + header.recordCount * sizeof(Book));
+
+    //Verify the catalog table, which holds the records' checksums, before any of it is used
+    if (hashBytes(table, header.catalogCount * sizeof(SnapshotCatalog)) != header.tableChecksum) {
+        fprintf(stderr, "ERROR: The snapshot's catalog table is corrupt.\n");
+        munmap(mapping, fileInfo.st_size);
+        return -1;
+    }
+
+    //The table must account for every record, in runs that aren't empty
+    for (unsigned long long c = 0; c < header.catalogCount; c++) {
+
+        if (table[c].recordCount == 0) {
+            tableRecordCount = header.recordCount + 1;
+            break;
+        }
+
+        tableRecordCount += table[c].recordCount;
+        table[c].name[99] = '\0';
+    }
+
+    if (tableRecordCount != header.recordCount) {
+        munmap(mapping, fileInfo.st_size);
+        return -1;
+    }
+
+    //If the mapping landed elsewhere, fix up every Book's links for where the records actually are, within each catalog's run. Every record
+    //is touched anyway, so each one is checked first, while it's still exactly as written
+    if (mapping != (char*) header.baseAddress) {
+
+        Book* records = (Book*) (mapping + SNAPSHOT_HEADER_SIZE);
+        unsigned long long start = 0;
+
+        for (unsigned long long c = 0; c < header.catalogCount; c++) {
+
+            unsigned long long end = start + table[c].recordCount;
+            unsigned int recordsChecksum = 0;
+
+            for (unsigned long long i = start; i < end; i++) {
+                recordsChecksum += snapshotRecordChecksum(&records[i], i - start);
+                records[i].previous = i > start ? &records[i - 1] : NULL;
+                records[i].next = i + 1 < end ? &records[i + 1] : NULL;
+            }
+
+            if (recordsChecksum != table[c].recordsChecksum) {
+                fprintf(stderr, "ERROR: The snapshot's records are corrupt.\n");
+                munmap(mapping, fileInfo.st_size);
+                return -1;
+            }
+
+            start = end;
+        }
+    }
+
+    snapshotRecords = mapping + SNAPSHOT_HEADER_SIZE;
+    snapshotLength = header.recordCount * sizeof(Book);
+    snapshotCatalogs = table;
+    snapshotCatalogCount = header.catalogCount;
+
+    //Each catalog's records are in list order, so the first one of its run is its head. Records mapped in place are left for the catalog's
+    //first use to check
+    for (unsigned long long c = 0, start = 0; c < header.catalogCount; start += table[c].recordCount, c++) {
+
+        Catalog* catalog = findCatalog(table[c].name, true);
+
+        catalog->books = (Book*) snapshotRecords + start;
+
+        if (mapping == (char*) header.baseAddress) {
+            catalog->uncheckedRecords = catalog->books;
+            catalog->uncheckedCount = table[c].recordCount;
+            catalog->uncheckedChecksum = table[c].recordsChecksum;
+        }
+    }
+
+    snapshotLsn = header.lsn;
+
+    return header.recordCount;
+}
+
+
+
+//FUNCTION writeSnapshot
+long long writeSnapshot(Catalog* head, char path[], unsigned long long lsn, SnapshotCatalog table[]) {
+
+    //The temporary file the snapshot is written to before it replaces the old one
+    char temporaryPath[1010];
+    int snapshotfd;
+
+    //The header, written once the records have been counted and checksummed
+    SnapshotHeader header;
+    char headerBlock[SNAPSHOT_HEADER_SIZE];
+
+    //The records gathered for the next write, each a copy of a Book with its links rewritten for the base address
+    char writeBuffer[SNAPSHOT_WRITE_BUFFER];
+    int bufferedLength = 0;
+    Book* record;
+
+    //The number of Books written so far
+    unsigned long long recordCount = 0;
+
+    //The directory holding the snapshot, fsynced so the rename is durable
+    char directoryPath[1000];
+    char* lastSlash;
+    int directoryfd;
+
+    //A corrupt catalog's Books can't be trusted, so don't write them into a snapshot
+    for (Catalog* catalog = head; catalog != NULL; catalog = catalog->nextCatalog) {
+        if (catalog->corrupt == true) {
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    strcpy(temporaryPath, path);
+    strcat(temporaryPath, ".tmp");
+
+    snapshotfd = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (snapshotfd < 0) {
+        return -1;
+    }
+
+    //Leave room for the header
+    memset(headerBlock, 0, SNAPSHOT_HEADER_SIZE);
+    memset(&header, 0, sizeof(SnapshotHeader));
+
+    if (writeFully(snapshotfd, headerBlock, SNAPSHOT_HEADER_SIZE) < 0) {
+        close(snapshotfd);
+        unlink(temporaryPath);
+        return -1;
+    }
+
+    //Write every catalog's Books in list order, so each Book's links point at its neighbouring records in the same catalog
+    for (Catalog* catalog = head; catalog != NULL; catalog = catalog->nextCatalog) {
+
+        //The number of records written before the catalog's first Book, and the checksum of the catalog's records
+        unsigned long long catalogStart = recordCount;
+        unsigned int recordsChecksum = 0;
+
+        //A catalog without Books is left out, and created again when it is next used
+        if (catalog->books == NULL) {
+            continue;
+        }
+
+        for (Book* it = catalog->books; it != NULL; it = it->next) {
+
+            Book* base = (Book*) (SNAPSHOT_BASE_ADDRESS + SNAPSHOT_HEADER_SIZE);
+
+            //Write out the gathered records once there's no room for another
+            if (bufferedLength + (int) sizeof(Book) > SNAPSHOT_WRITE_BUFFER) {
+
+                if (writeFully(snapshotfd, writeBuffer, bufferedLength) < 0) {
+                    close(snapshotfd);
+                    unlink(temporaryPath);
+                    return -1;
+                }
+
+                bufferedLength = 0;
+            }
+
+            record = (Book*) (writeBuffer + bufferedLength);
+            memcpy(record, it, sizeof(Book));
+            record->previous = recordCount > catalogStart ? &base[recordCount - 1] : NULL;
+            record->next = it->next != NULL ? &base[recordCount + 1] : NULL;
+
+            recordsChecksum += snapshotRecordChecksum(record, recordCount - catalogStart);
+            bufferedLength += sizeof(Book);
+            recordCount++;
+        }
+
+        memset(&table[header.catalogCount], 0, sizeof(SnapshotCatalog));
+        strcpy(table[header.catalogCount].name, catalog->name);
+        table[header.catalogCount].recordsChecksum = recordsChecksum;
+        table[header.catalogCount].recordCount = recordCount - catalogStart;
+        header.catalogCount++;
+    }
+
+    //Write the last of the records, then the table after them, which the header's checksum covers
+    header.tableChecksum = hashBytes(table, header.catalogCount * sizeof(SnapshotCatalog));
+
+    if (writeFully(snapshotfd, writeBuffer, bufferedLength) < 0
+        || writeFully(snapshotfd, table, header.catalogCount * sizeof(SnapshotCatalog)) < 0) {
+        close(snapshotfd);
+        unlink(temporaryPath);
+        return -1;
+    }
+
+    //Fill in and checksum the header
+    strcpy(header.magic, SNAPSHOT_MAGIC);
+    header.version = SNAPSHOT_VERSION;
+    header.recordSize = sizeof(Book);
+    header.recordCount = recordCount;
+    header.lsn = lsn;
+    header.baseAddress = (unsigned long long) SNAPSHOT_BASE_ADDRESS;
+    header.headerChecksum = hashBytes(&header, sizeof(SnapshotHeader));
+
+    memcpy(headerBlock, &header, sizeof(SnapshotHeader));
+
+    //Write the header over its placeholder and make the whole file durable
+    if (pwrite(snapshotfd, headerBlock, SNAPSHOT_HEADER_SIZE, 0) != SNAPSHOT_HEADER_SIZE || fsync(snapshotfd) < 0) {
+        close(snapshotfd);
+        unlink(temporaryPath);
+        return -1;
+    }
+
+    close(snapshotfd);
+
+    //Replace the old snapshot in a single step
+    if (rename(temporaryPath, path) < 0) {
+        unlink(temporaryPath);
+        return -1;
+    }
+
+    //Make the rename itself durable by fsyncing the directory
+    strcpy(directoryPath, path);
+    lastSlash = strrchr(directoryPath, '/');
+
+    if (lastSlash == NULL) {
+        strcpy(directoryPath, ".");
+    }
+    else if (lastSlash == directoryPath) {
+        directoryPath[1] = '\0';
+    }
+    else {
+        *lastSlash = '\0';
+    }
+
+    directoryfd = open(directoryPath, O_RDONLY);
+
+    if (directoryfd >= 0) {
+        fsync(directoryfd);
+        close(directoryfd);
+    }
+
+    return recordCount;
+}
+
+
+
+//FUNCTION checkSnapshotRecords
+bool checkSnapshotRecords(Catalog* catalog) {
+
+    //The checksum of the catalog's run of records as they are now
+    unsigned int recordsChecksum = 0;
+
+    if (catalog->uncheckedRecords == NULL) {
+        return catalog->corrupt == false;
+    }
+
+    for (long long i = 0; i < catalog->uncheckedCount; i++) {
+        recordsChecksum += snapshotRecordChecksum(&catalog->uncheckedRecords[i], i);
+    }
+
+    //A corrupt catalog is kept, so it can be refused rather than served or written into the next snapshot
+    if (recordsChecksum != catalog->uncheckedChecksum) {
+        fprintf(stderr, "ERROR: The snapshot's records for catalog '%s' are corrupt.\n", catalog->name);
+        catalog->corrupt = true;
+    }
+
+    catalog->uncheckedRecords = NULL;
+
+    return catalog->corrupt == false;
+}
+
+
+
+//FUNCTION snapshotRecordChecksum
+unsigned int snapshotRecordChecksum(const Book* record, long long position) {
+
+    //Weight each record by its position, so that records swapped within the run change the sum
+    return hashBytes(record, sizeof(Book)) * (unsigned int) (2 * position + 1);
+}
+
+
+
+//FUNCTION unloadSnapshot
+void unloadSnapshot() {
+
+    if (snapshotRecords == NULL) {
+        snapshotLsn = 0;
+        return;
+    }
+
+    //Every catalog's Books were the snapshot's records, since nothing has been replayed onto them yet
+    for (Catalog* catalog = catalogs; catalog != NULL; catalog = catalog->nextCatalog) {
+        catalog->books = NULL;
+        catalog->uncheckedRecords = NULL;
+        catalog->corrupt = false;
+    }
+
+    munmap(snapshotRecords - SNAPSHOT_HEADER_SIZE, SNAPSHOT_HEADER_SIZE + snapshotLength + snapshotCatalogCount * sizeof(SnapshotCatalog));
+
+    snapshotRecords = NULL;
+    snapshotLength = 0;
+    snapshotCatalogs = NULL;
+    snapshotCatalogCount = 0;
+    snapshotLsn = 0;
+}
+
+
+
+//FUNCTION launchSignalWatcher
+void* launchSignalWatcher(void* arg) {
+
+    //The signals to wait for
+    sigset_t watchedSignals;
+    int signal;
+
+    sigemptyset(&watchedSignals);
+    sigaddset(&watchedSignals, SIGUSR1);
+    sigaddset(&watchedSignals, SIGINT);
+    sigaddset(&watchedSignals, SIGTERM);
+
+    //Start a background snapshot every time SIGUSR1 arrives
+    while (sigwait(&watchedSignals, &signal) == 0) {
+
+        //SIGINT and SIGTERM shut the server down, which never returns
+        if (signal == SIGINT || signal == SIGTERM) {
+            handleServerClose();
+        }
+
+        //Snapshots can only be written when the server was given a snapshot path
+        if (snapshotPath[0] == '\0') {
+            fprintf(stderr, "ERROR: SIGUSR1 received, but the server was not started with a snapshot path.\n");
+            continue;
+        }
+
+        //Fork at a consistent point, between requests to every catalog
+        lockAllCatalogs(STATS_SERVER);
+
+        if (startBackgroundSnapshot() < 0) {
+            perror("ERROR: ");
+        }
+
+        unlockAllCatalogs();
+    }
+
+    return NULL;
+}
+
+
+
+//FUNCTION launchSnapshotReaper
+void* launchSnapshotReaper(void* arg) {
+
+    //The child's exit status and reported results
+    int status;
+    SnapshotResult result = { -1, -1 };
+
+    //When the child finished
+    struct timeval finished;
+
+    //The child's process ID and result pipe
+    pid_t pid;
+    int resultfd;
+
+    pthread_mutex_lock(&snapshotStatus.lock);
+    pid = snapshotStatus.pid;
+    resultfd = snapshotStatus.resultfd;
+    pthread_mutex_unlock(&snapshotStatus.lock);
+
+    //Read the child's results, which arrive just before it exits, then reap it
+    if (read(resultfd, &result, sizeof(SnapshotResult)) != sizeof(SnapshotResult)) {
+        result.records = -1;
+    }
+
+    waitpid(pid, &status, 0);
+    gettimeofday(&finished, NULL);
+    close(resultfd);
+
+    //Record the results of the snapshot and allow the next one to start
+    pthread_mutex_lock(&snapshotStatus.lock);
+
+    snapshotStatus.finished = true;
+    snapshotStatus.failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0 || result.records < 0;
+    snapshotStatus.records = result.records;
+    snapshotStatus.finishedLsn = snapshotStatus.lsn;
+    snapshotStatus.copiedKb = result.copiedKb;
+    snapshotStatus.durationMs = (finished.tv_sec - snapshotStatus.started.tv_sec) * 1000.0 + (finished.tv_usec - snapshotStatus.started.tv_usec) / 1000.0;
+    snapshotStatus.pid = 0;
+
+    //Report the snapshot so memory headroom can be sized from the pages copied
+    if (snapshotStatus.failed == true) {
+        fprintf(stderr, "ERROR: The background snapshot at log sequence number %llu could not be written.\n", snapshotStatus.finishedLsn);
+    }
+    else {
+        printf("Background snapshot of %lld Books at log sequence number %llu written in %.1fms, with %lldkB copied on write.\n",
+               snapshotStatus.records, snapshotStatus.finishedLsn, snapshotStatus.durationMs, snapshotStatus.copiedKb);
+        fflush(stdout);
+    }
+
+    bool failed = snapshotStatus.failed;
+    unsigned long long lsn = snapshotStatus.finishedLsn;
+
+    pthread_mutex_unlock(&snapshotStatus.lock);
+
+    //The snapshot now holds every record up to its log sequence number, so only the ones after it need to stay in the log
+    if (failed == false && truncateWriteAheadLog(lsn) < 0) {
+        fprintf(stderr, "ERROR: The write-ahead log could not be truncated after the snapshot, so it is kept whole.\n");
+        perror("ERROR: ");
+    }
+
+    return NULL;
+}
+
+
+
+//FUNCTION readPrivateDirtyKb
+long long readPrivateDirtyKb() {
+
+    //The memory summary of the process, read whole since it is only a few lines, and the Private_Dirty line in it
+    int rollupfd = open("/proc/self/smaps_rollup", O_RDONLY);
+    char summary[4096];
+    int summaryLength = 0;
+    char* line;
+
+    if (rollupfd < 0) {
+        return -1;
+    }
+
+    while (summaryLength < (int) sizeof(summary) - 1) {
+
+        int readLength = read(rollupfd, summary + summaryLength, sizeof(summary) - 1 - summaryLength);
+
+        if (readLength <= 0) {
+            break;
+        }
+
+        summaryLength += readLength;
+    }
+
+    close(rollupfd);
+    summary[summaryLength] = '\0';
+
+    //Find the Private_Dirty line
+    line = strstr(summary, "Private_Dirty:");
+
+    if (line == NULL) {
+        return -1;
+    }
+
+    return strtoll(line + strlen("Private_Dirty:"), NULL, 10);
+}
+
+
+
+//FUNCTION startBackgroundSnapshot
+pid_t startBackgroundSnapshot() {
+
+    //The pipe the child reports its results on
+    int resultPipe[2];
+
+    //The child's process ID
+    pid_t pid;
+
+    //The child's catalog table, allocated before the fork since the child mustn't allocate: another thread may have held the heap's lock
+    //when it was forked, and the child has no thread to release it
+    SnapshotCatalog* table;
+    int catalogCount = 0;
+
+    pthread_mutex_lock(&snapshotStatus.lock);
+
+    //Only one snapshot is written at a time
+    if (snapshotStatus.pid != 0) {
+        pthread_mutex_unlock(&snapshotStatus.lock);
+        return 0;
+    }
+
+    //A catalog whose snapshot records are corrupt is never written into a new snapshot
+    for (Catalog* it = catalogs; it != NULL; it = it->nextCatalog) {
+
+        if (it->corrupt == true) {
+            pthread_mutex_unlock(&snapshotStatus.lock);
+            errno = EIO;
+            return -1;
+        }
+
+        catalogCount++;
+    }
+
+    table = malloc(sizeof(SnapshotCatalog) * (catalogCount + 1));
+
+    if (pipe(resultPipe) < 0) {
+        free(table);
+        pthread_mutex_unlock(&snapshotStatus.lock);
+        return -1;
+    }
+
+    gettimeofday(&snapshotStatus.started, NULL);
+    snapshotStatus.lsn = writeAheadLog.lastLsn;
+
+    pid = fork();
+
+    //THE CHILD: write the snapshot from the Catalog as it was at the fork, report the results, and exit without running any server cleanup.
+    //Only system calls are used, never stdio or the heap, whose locks may have been held by other threads at the fork
+    if (pid == 0) {
+
+        SnapshotResult result;
+
+        close(resultPipe[0]);
+
+        result.records = writeSnapshot(catalogs, snapshotPath, snapshotStatus.lsn, table);
+        result.copiedKb = readPrivateDirtyKb();
+
+        if (write(resultPipe[1], &result, sizeof(SnapshotResult)) != sizeof(SnapshotResult)) {
+            _exit(1);
+        }
+
+        _exit(result.records < 0 ? 1 : 0);
+    }
+
+    close(resultPipe[1]);
+    free(table);
+
+    //If the fork failed, no snapshot is running
+    if (pid < 0) {
+        close(resultPipe[0]);
+        pthread_mutex_unlock(&snapshotStatus.lock);
+        return -1;
+    }
+
+    //THE PARENT: wait for the child on its own thread and keep serving requests
+    snapshotStatus.pid = pid;
+    snapshotStatus.resultfd = resultPipe[0];
+
+    pthread_mutex_unlock(&snapshotStatus.lock);
+
+    pthread_t reaperThread;
+    pthread_create(&reaperThread, NULL, launchSnapshotReaper, NULL);
+    pthread_detach(reaperThread);
+
+    return pid;
+}
+
+
+
+//FUNCTION isWalRecordIntact
+bool isWalRecordIntact(const WalRecord* record) {
+
+    //A copy of the record with its checksum field zeroed, as it was when the checksum was computed
+    WalRecord copy = *record;
+    copy.checksum = 0;
+
+    return record->checksum == hashBytes(&copy, sizeof(WalRecord));
+}
+
+
+
+//FUNCTION launchRecoveryScanner
+void* launchRecoveryScanner(void* arg) {
+
+    RecoveryWorker* worker = (RecoveryWorker*) arg;
+    RecoveryPlan* plan = worker->plan;
+
+    //This thread's range of the records and of the Books
+    long long tailStart = plan->tailCount * worker->number / plan->shardCount;
+    long long tailEnd = plan->tailCount * (worker->number + 1) / plan->shardCount;
+    long long bookStart = plan->bookCount * worker->number / plan->shardCount;
+    long long bookEnd = plan->bookCount * (worker->number + 1) / plan->shardCount;
+
+    plan->badRecords[worker->number] = plan->tailCount;
+    plan->gapRecords[worker->number] = plan->tailCount;
+
+    //Check and hash the records, stopping at the first one that can't be replayed
+    for (long long i = tailStart; i < tailEnd; i++) {
+
+        if (isWalRecordIntact(&plan->tail[i]) == false) {
+            plan->badRecords[worker->number] = i;
+            break;
+        }
+
+        if (plan->tail[i].lsn != plan->firstLsn + i) {
+            plan->gapRecords[worker->number] = i;
+            break;
+        }
+
+        plan->tailHashes[i] = recoveryHash(plan->tail[i].catalog, plan->tail[i].title, plan->tail[i].author);
+    }
+
+    //Hash the Books with their catalog's name, filling in their part of the array if the catalogs are the mapped snapshot
+    for (long long i = bookStart, c = 0; i < bookEnd; i++) {
+
+        while (plan->catalogStarts[c + 1] <= i) {
+            c++;
+        }
+
+        //The mapped records are still exactly as written, so check them along the way
+        if (plan->mapped == true) {
+            plan->books[i] = (Book*) snapshotRecords + i;
+            plan->recordsChecksums[worker->number * plan->catalogCount + c] += snapshotRecordChecksum(plan->books[i], i - plan->catalogStarts[c]);
+        }
+
+        plan->bookHashes[i] = recoveryHash(plan->catalogs[c]->name, plan->books[i]->title, plan->books[i]->author);
+    }
+
+    return NULL;
+}
+
+
+
+//FUNCTION launchRecoveryShard
+void* launchRecoveryShard(void* arg) {
+
+    RecoveryWorker* worker = (RecoveryWorker*) arg;
+    RecoveryPlan* plan = worker->plan;
+    int shard = worker->number;
+
+    //The shard's index of the Books its records could touch: a power of two number of buckets, each the first entry of its chain or -1
+    RecoveryEntry* entries;
+    int entryCount = 0;
+    int entryCapacity;
+    int* buckets;
+    unsigned int bucketMask = 15;
+
+    //Which buckets the shard's records fall in
+    unsigned char* wanted;
+
+    //The number of the shard's records
+    long long recordCount = 0;
+
+    //Size the index for the shard's records, which is usually far fewer Books than the Catalog holds
+    for (long long i = 0; i < plan->validCount; i++) {
+        if (plan->tailHashes[i] % plan->shardCount == (unsigned int) shard) {
+            recordCount++;
+        }
+    }
+
+    while (bucketMask + 1 < recordCount * 2) {
+        bucketMask = bucketMask * 2 + 1;
+    }
+
+    entryCapacity = recordCount + 16;
+    entries = malloc(sizeof(RecoveryEntry) * entryCapacity);
+    buckets = malloc(sizeof(int) * (bucketMask + 1));
+    wanted = calloc(bucketMask + 1, sizeof(unsigned char));
+
+    for (unsigned int i = 0; i <= bucketMask; i++) {
+        buckets[i] = -1;
+    }
+
+    for (long long i = 0; i < plan->validCount; i++) {
+        if (plan->tailHashes[i] % plan->shardCount == (unsigned int) shard) {
+            wanted[(plan->tailHashes[i] / plan->shardCount) & bucketMask] = 1;
+        }
+    }
+
+    //Index only the shard's Books that share a bucket with one of its records, since no other Book can be touched
+    for (long long i = 0, c = 0; i < plan->bookCount; i++) {
+
+        unsigned int hash = plan->bookHashes[i];
+        unsigned int bucket;
+
+        while (plan->catalogStarts[c + 1] <= i) {
+            c++;
+        }
+
+        if (hash % plan->shardCount != (unsigned int) shard || wanted[bucket = (hash / plan->shardCount) & bucketMask] == 0) {
+            continue;
+        }
+
+        //Double the entries' capacity when they are full
+        if (entryCount == entryCapacity) {
+            entryCapacity *= 2;
+            entries = realloc(entries, sizeof(RecoveryEntry) * entryCapacity);
+        }
+
+        entries[entryCount] = (RecoveryEntry) { plan->books[i], hash, plan->catalogs[c]->name, buckets[bucket], i, -1 };
+        buckets[bucket] = entryCount++;
+    }
+
+    //Replay the shard's records in log order
+    for (long long i = 0; i < plan->validCount; i++) {
+
+        WalRecord* record = &plan->tail[i];
+        unsigned int hash = plan->tailHashes[i];
+        unsigned int bucket;
+
+        //The entry for the record's exact Book and the one before it in the chain, and whether a MOVE's new location is taken
+        int match = -1;
+        int previous = -1;
+        bool duplicate = false;
+
+        if (hash % plan->shardCount != (unsigned int) shard) {
+            continue;
+        }
+
+        bucket = (hash / plan->shardCount) & bucketMask;
+
+        //Search the bucket for the record's Book, and for the same Book at a MOVE's new location
+        for (int e = buckets[bucket], before = -1; e != -1; before = e, e = entries[e].chain) {
+
+            Book* book = entries[e].book;
+
+            if (entries[e].hash != hash || strcmp(book->title, record->title) != 0 || strcmp(book->author, record->author) != 0
+                || strcmp(entries[e].catalog, record->catalog) != 0) {
+                continue;
+            }
+
+            if (strcmp(book->location, record->location) == 0) {
+                match = e;
+                previous = before;
+            }
+            else if (record->type == WAL_MOVE && strcmp(book->location, record->newLocation) == 0) {
+                duplicate = true;
+            }
+        }
+
+        //A SUBMIT of a Book not already in the Catalog adds it
+        if (record->type == WAL_SUBMIT && match == -1) {
+
+            Book* newBook = malloc(sizeof(Book));
+
+            __atomic_fetch_add(&heapBookCount, 1, __ATOMIC_RELAXED);
+
+            //Double the entries' capacity when they are full
+            if (entryCount == entryCapacity) {
+                entryCapacity *= 2;
+                entries = realloc(entries, sizeof(RecoveryEntry) * entryCapacity);
+            }
+
+            strcpy(newBook->title, record->title);
+            strcpy(newBook->author, record->author);
+            strcpy(newBook->location, record->location);
+            newBook->previous = NULL;
+            newBook->next = NULL;
+
+            plan->submitted[i] = newBook;
+
+            entries[entryCount] = (RecoveryEntry) { newBook, hash, record->catalog, buckets[bucket], -1, i };
+            buckets[bucket] = entryCount++;
+        }
+
+        //A REMOVE of a Book in the Catalog takes it out of the index and the recovered Catalog
+        else if (record->type == WAL_REMOVE && match != -1) {
+
+            if (previous == -1) {
+                buckets[bucket] = entries[match].chain;
+            }
+            else {
+                entries[previous].chain = entries[match].chain;
+            }
+
+            if (entries[match].position >= 0) {
+                plan->removed[entries[match].position] = 1;
+            }
+            else {
+                free(entries[match].book);
+                __atomic_fetch_sub(&heapBookCount, 1, __ATOMIC_RELAXED);
+                plan->submitted[entries[match].slot] = NULL;
+            }
+        }
+
+        //A MOVE of a Book in the Catalog to a free location changes it in place
+        else if (record->type == WAL_MOVE && match != -1 && duplicate == false) {
+            strcpy(entries[match].book->location, record->newLocation);
+        }
+    }
+
+    free(entries);
+    free(buckets);
+    free(wanted);
+
+    return NULL;
+}
+
+
+
+//FUNCTION recoveryHash
+unsigned int recoveryHash(const char catalog[], const char title[], const char author[]) {
+    return (hashString(catalog) * 31 + hashString(title)) * 31 + hashString(author);
+}
+
+
+
+//FUNCTION handOffServer
+int handOffServer(int takeoverfd) {
+
+    //The new server's request, and the item being sent to it
+    HandoffRequest request;
+    HandoffItem item;
+
+    //Whether every item was sent
+    bool sent = true;
+
+    //A byte to wake every loop with
+    char wake = 1;
+
+    //The snapshot's catalog table
+    SnapshotCatalog* table;
+    int catalogCount = 0;
+
+    if (read(takeoverfd, &request, sizeof(HandoffRequest)) != sizeof(HandoffRequest) || strcmp(request.magic, HANDOFF_MAGIC) != 0) {
+        return -1;
+    }
+
+    request.snapshotPath[sizeof(request.snapshotPath) - 1] = '\0';
+
+    printf("Handing the server off to a new server process.\n");
+
+    //Stop every accept loop, and pause every client connection between requests
+    pthread_mutex_lock(&connectionRegistry.lock);
+
+    connectionRegistry.handingOff = true;
+    connectionRegistry.handingOffClients = request.clients;
+
+    if (write(handoffPipe[1], &wake, 1) != 1) {
+        connectionRegistry.handingOff = false;
+        pthread_mutex_unlock(&connectionRegistry.lock);
+        return -1;
+    }
+
+    while (connectionRegistry.acceptLoopCount > 0 || connectionRegistry.pausedCount < connectionRegistry.connectionCount) {
+        pthread_cond_wait(&connectionRegistry.changed, &connectionRegistry.lock);
+    }
+
+    pthread_mutex_unlock(&connectionRegistry.lock);
+
+    //Let any background snapshot finish, so it can't replace the one written for the new server
+    while (1) {
+
+        pthread_mutex_lock(&snapshotStatus.lock);
+        bool snapshotRunning = snapshotStatus.pid != 0;
+        pthread_mutex_unlock(&snapshotStatus.lock);
+
+        if (snapshotRunning == false) {
+            break;
+        }
+
+        usleep(1000);
+    }
+
+    //Nothing can change the Catalog now, so make the log durable and write the snapshot the new server loads
+    lockAllCatalogs(STATS_SERVER);
+
+    if (writeAheadLog.fd >= 0) {
+        pthread_mutex_lock(&writeAheadLog.lock);
+        flushWriteAheadLog();
+        pthread_mutex_unlock(&writeAheadLog.lock);
+    }
+
+    for (Catalog* it = catalogs; it != NULL; it = it->nextCatalog) {
+        catalogCount++;
+    }
+
+    table = malloc(sizeof(SnapshotCatalog) * (catalogCount + 1));
+
+    memset(&item, 0, sizeof(HandoffItem));
+    item.lsn = writeAheadLog.lastLsn;
+    item.records = writeSnapshot(catalogs, request.snapshotPath, item.lsn, table);
+
+    free(table);
+
+    //If the new server's snapshot replaces this one, the log only needs the records after it. Otherwise this server's own snapshot may still
+    //need them, should the handoff fail
+    if (item.records >= 0 && strcmp(request.snapshotPath, snapshotPath) == 0 && truncateWriteAheadLog(item.lsn) < 0) {
+        fprintf(stderr, "ERROR: The write-ahead log could not be truncated after the snapshot, so it is kept whole.\n");
+        perror("ERROR: ");
+    }
+
+    unlockAllCatalogs();
+
+    //Pass the listening sockets, so connections keep queueing in the same backlogs
+    if (item.records >= 0) {
+
+        HandoffItem listener;
+
+        memset(&listener, 0, sizeof(HandoffItem));
+        listener.kind = HANDOFF_TCP_LISTENER;
+        sent = sendHandoffItem(takeoverfd, &listener, parentfd) == 0;
+
+        if (sent == true && unixfd >= 0) {
+            listener.kind = HANDOFF_UNIX_LISTENER;
+            strcpy(listener.path, unixSocketPath);
+            sent = sendHandoffItem(takeoverfd, &listener, unixfd) == 0;
+        }
+    }
+
+    //Pass the client connections with the partial requests they hold, if the new server takes them
+    pthread_mutex_lock(&connectionRegistry.lock);
+
+    if (item.records >= 0 && sent == true && request.clients == true) {
+        for (Connection* it = connectionRegistry.head; it != NULL && sent == true; it = it->nextConnection) {
+
+            HandoffItem client;
+
+            memset(&client, 0, sizeof(HandoffItem));
+            client.kind = HANDOFF_CLIENT;
+            client.bufferedLength = it->bufferedLength;
+
+            sent = sendHandoffItem(takeoverfd, &client, it->fd) == 0 && write(takeoverfd, it->buffered, it->bufferedLength) == it->bufferedLength;
+        }
+    }
+
+    //Tell the new server the handoff is complete, with the snapshot to load
+    item.kind = HANDOFF_DONE;
+
+    if (item.records < 0 || sent == false || sendHandoffItem(takeoverfd, &item, -1) < 0) {
+
+        char drain;
+
+        fprintf(stderr, "ERROR: The handoff failed, so the server is resuming.\n");
+
+        //Resume every client connection and accept loop
+        if (read(handoffPipe[0], &drain, 1) != 1) {
+            perror("ERROR: ");
+        }
+
+        connectionRegistry.handingOff = false;
+
+        for (Connection* it = connectionRegistry.head; it != NULL; it = it->nextConnection) {
+            it->released = true;
+            it->resumed = true;
+        }
+
+        pthread_cond_broadcast(&connectionRegistry.changed);
+        pthread_mutex_unlock(&connectionRegistry.lock);
+
+        pthread_t acceptThread;
+        pthread_create(&acceptThread, NULL, launchAcceptLoop, (void*) &parentfd);
+        pthread_detach(acceptThread);
+
+        if (unixfd >= 0) {
+            pthread_create(&acceptThread, NULL, launchAcceptLoop, (void*) &unixfd);
+            pthread_detach(acceptThread);
+        }
+
+        return -1;
+    }
+
+    //Close every client connection: the new server either has them or the clients reconnect to it
+    for (Connection* it = connectionRegistry.head; it != NULL; it = it->nextConnection) {
+        it->released = true;
+    }
+
+    pthread_cond_broadcast(&connectionRegistry.changed);
+
+    //Wait for the connections to close
+    while (connectionRegistry.connectionCount > 0) {
+        pthread_cond_wait(&connectionRegistry.changed, &connectionRegistry.lock);
+    }
+
+    pthread_mutex_unlock(&connectionRegistry.lock);
+
+    printf("Handed off %lld Books at log sequence number %llu.\n", item.records, item.lsn);
+
+    return 0;
+}
+
+
+
+//FUNCTION launchHandoffListener
+void* launchHandoffListener(void* arg) {
+
+    //Wait for new servers until one takes this one over
+    while (1) {
+
+        int takeoverfd = accept(handoffListenfd, NULL, NULL);
+
+        if (takeoverfd < 0) {
+            perror("ERROR: ");
+            continue;
+        }
+
+        //Once handed off, the new server owns the listening sockets and the socket paths, which it may have already bound its own handoff
+        //socket to, so exit without removing them. The Catalog lives on in the snapshot, so there is nothing to clean up. A shutdown
+        //signalled meanwhile waits, and only goes ahead if the handoff fails
+        pthread_mutex_lock(&shutdownLock);
+
+        if (handOffServer(takeoverfd) == 0) {
+            close(takeoverfd);
+            close(handoffListenfd);
+            exit(0);
+        }
+
+        pthread_mutex_unlock(&shutdownLock);
+
+        close(takeoverfd);
+    }
+
+    return NULL;
+}
+
+
+
+//FUNCTION openConnection
+void openConnection(int childfd, char buffered[], int bufferedLength) {
+
+    //The connection shared with the worker threads completing this client's requests
+    Connection* connection = malloc(sizeof(Connection));
+
+    //The client's thread
+    pthread_t clientThread;
+
+    //Flag value for setsockopt
+    int optval = 1;
+
+    //How long a response may wait for the client to read
+    struct timeval sendTimeout = { CLIENT_SEND_TIMEOUT, 0 };
+
+    //Send each response as soon as it is written, so responses to pipelined requests aren't held back waiting for acknowledgements.
+    //Unix domain sockets have no such delay, and ignore the option
+    setsockopt(childfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    setsockopt(childfd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+    connection->fd = childfd;
+    connection->inFlight = 0;
+    connection->sessionLsn = 0;
+    connection->broken = false;
+    connection->trackedCount = 0;
+    connection->pushing = 0;
+    connection->sending = false;
+    connection->pushQueueLength = 0;
+    pthread_mutex_init(&connection->writeLock, NULL);
+    pthread_cond_init(&connection->sent, NULL);
+    pthread_cond_init(&connection->drained, NULL);
+
+    connection->buffered = buffered;
+    connection->bufferedLength = bufferedLength;
+    connection->paused = false;
+    connection->released = false;
+    connection->resumed = false;
+
+    //Register the connection before its thread starts, so a handoff never misses it
+    pthread_mutex_lock(&connectionRegistry.lock);
+    connection->nextConnection = connectionRegistry.head;
+    connectionRegistry.head = connection;
+    connectionRegistry.connectionCount++;
+    pthread_mutex_unlock(&connectionRegistry.lock);
+
+    //Bind the main loop function to the thread and pass the connection
+    pthread_create(&clientThread, NULL, launchClientLoop, (void*) connection);
+
+    //Detatch the thread so that it will close automatically
+    pthread_detach(clientThread);
+}
+
+
+
+//FUNCTION receiveHandoffItem
+int receiveHandoffItem(int fd, HandoffItem* item, int* passedfd) {
+
+    //The item's bytes, and room for the socket sent with it
+    struct iovec part = { item, sizeof(HandoffItem) };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr message;
+    struct cmsghdr* controlMessage;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    *passedfd = -1;
+
+    if (recvmsg(fd, &message, MSG_WAITALL) != sizeof(HandoffItem)) {
+        return -1;
+    }
+
+    //Take the socket, if one was sent
+    controlMessage = CMSG_FIRSTHDR(&message);
+
+    if (controlMessage != NULL && controlMessage->cmsg_level == SOL_SOCKET && controlMessage->cmsg_type == SCM_RIGHTS) {
+        memcpy(passedfd, CMSG_DATA(controlMessage), sizeof(int));
+    }
+
+    return 0;
+}
+
+
+
+//FUNCTION sendHandoffItem
+int sendHandoffItem(int fd, HandoffItem* item, int passedfd) {
+
+    //The item's bytes, and the socket sent with them
+    struct iovec part = { item, sizeof(HandoffItem) };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr message;
+    struct cmsghdr* controlMessage;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+
+    //Attach the socket, if any
+    if (passedfd >= 0) {
+
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        controlMessage = CMSG_FIRSTHDR(&message);
+        controlMessage->cmsg_level = SOL_SOCKET;
+        controlMessage->cmsg_type = SCM_RIGHTS;
+        controlMessage->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(controlMessage), &passedfd, sizeof(int));
+    }
+
+    return sendmsg(fd, &message, 0) == sizeof(HandoffItem) ? 0 : -1;
+}
+
+
+
+//FUNCTION takeOverServer
+int takeOverServer(char path[], bool clients, int** clientfds, char*** clientBuffers, int** clientLengths) {
+
+    //The connection to the running server's handoff socket
+    int fd;
+    struct sockaddr_un handoffaddr;
+
+    //The request sent, and the item being received
+    HandoffRequest request;
+    HandoffItem item;
+    int passedfd;
+
+    //The number of client connections taken over
+    int clientCount = 0;
+
+    *clientfds = NULL;
+    *clientBuffers = NULL;
+    *clientLengths = NULL;
+
+    if (strlen(path) >= sizeof(handoffaddr.sun_path)) {
+        return -1;
+    }
+
+    //Connect to the running server
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&handoffaddr, 0, sizeof(handoffaddr));
+    handoffaddr.sun_family = AF_UNIX;
+    strcpy(handoffaddr.sun_path, path);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *) &handoffaddr, sizeof(handoffaddr)) < 0) {
+        perror("ERROR: ");
+        return -1;
+    }
+
+    //Ask it to write its Catalog to this server's snapshot
+    memset(&request, 0, sizeof(HandoffRequest));
+    strcpy(request.magic, HANDOFF_MAGIC);
+    request.clients = clients;
+    strcpy(request.snapshotPath, snapshotPath);
+
+    if (write(fd, &request, sizeof(HandoffRequest)) != sizeof(HandoffRequest)) {
+        close(fd);
+        return -1;
+    }
+
+    //Receive the listening sockets and client connections until the handoff is complete
+    while (receiveHandoffItem(fd, &item, &passedfd) == 0) {
+
+        if (item.kind == HANDOFF_TCP_LISTENER && passedfd >= 0) {
+            parentfd = passedfd;
+        }
+
+        else if (item.kind == HANDOFF_UNIX_LISTENER && passedfd >= 0) {
+            unixfd = passedfd;
+            item.path[sizeof(item.path) - 1] = '\0';
+            strcpy(unixSocketPath, item.path);
+        }
+
+        else if (item.kind == HANDOFF_CLIENT && passedfd >= 0 && item.bufferedLength >= 0 && item.bufferedLength <= MAX_REQUEST_LENGTH) {
+
+            //The partial request the connection held follows the item
+            char* buffered = malloc(sizeof(char) * (item.bufferedLength + 1));
+            int totalRead = 0;
+
+            while (totalRead < item.bufferedLength) {
+
+                int readLength = read(fd, buffered + totalRead, item.bufferedLength - totalRead);
+
+                if (readLength <= 0) {
+                    close(fd);
+                    return -1;
+                }
+
+                totalRead += readLength;
+            }
+
+            *clientfds = realloc(*clientfds, sizeof(int) * (clientCount + 1));
+            *clientBuffers = realloc(*clientBuffers, sizeof(char*) * (clientCount + 1));
+            *clientLengths = realloc(*clientLengths, sizeof(int) * (clientCount + 1));
+
+            (*clientfds)[clientCount] = passedfd;
+            (*clientBuffers)[clientCount] = buffered;
+            (*clientLengths)[clientCount] = item.bufferedLength;
+            clientCount++;
+        }
+
+        //The handoff is complete once the running server says so, and only succeeded if its Catalog reached the snapshot
+        else if (item.kind == HANDOFF_DONE) {
+
+            close(fd);
+
+            if (item.records < 0 || parentfd <= 0) {
+                return -1;
+            }
+
+            printf("The running server wrote %lld Books at log sequence number %llu to %s.\n", item.records, item.lsn, snapshotPath);
+
+            return clientCount;
+        }
+    }
+
+    //The running server went away before finishing, so it has resumed or exited
+    close(fd);
+
+    return -1;
+}
+
+
+
+//FUNCTION applyWalRecord
+void applyWalRecord(Catalog* catalog, WalRecord* record) {
+
+    //Log the mutation under its own catalog's name
+    currentCatalog = catalog;
+
+    //Apply the mutation with no client to respond to
+    if (record->type == WAL_SUBMIT) {
+        submitBook(&catalog->books, record->title, record->author, record->location, -1);
+    }
+    else if (record->type == WAL_REMOVE) {
+        removeBook(&catalog->books, record->title, record->author, record->location, -1);
+    }
+    else if (record->type == WAL_MOVE) {
+        moveBook(catalog->books, record->title, record->author, record->location, record->newLocation, -1);
+    }
+
+    currentCatalog = NULL;
+}
+
+
+
+//FUNCTION currentMicros
+long long currentMicros() {
+
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+
+
+//FUNCTION launchReplicaAcknowledger
+void* launchReplicaAcknowledger(void* arg) {
+
+    Replica* replica = (Replica*) arg;
+
+    //The acknowledgement lines read so far
+    char acknowledgements[256];
+    int bufferedLength = 0;
+
+    //Read ACK:<log sequence number> lines until the replica disconnects
+    while (1) {
+
+        char* lineEnd;
+        int readLength = read(replica->fd, acknowledgements + bufferedLength, sizeof(acknowledgements) - 1 - bufferedLength);
+
+        if (readLength <= 0) {
+            break;
+        }
+
+        bufferedLength += readLength;
+        acknowledgements[bufferedLength] = '\0';
+
+        while ((lineEnd = strchr(acknowledgements, '\n')) != NULL) {
+
+            unsigned long long ackedLsn;
+
+            if (sscanf(acknowledgements, "ACK:%llu", &ackedLsn) == 1) {
+                pthread_mutex_lock(&replica->lock);
+                replica->ackedLsn = ackedLsn;
+                pthread_mutex_unlock(&replica->lock);
+            }
+
+            bufferedLength -= lineEnd - acknowledgements + 1;
+            memmove(acknowledgements, lineEnd + 1, bufferedLength + 1);
+        }
+
+        //Anything else that fills the buffer isn't an acknowledgement
+        if (bufferedLength == sizeof(acknowledgements) - 1) {
+            bufferedLength = 0;
+        }
+    }
+
+    //The replica is gone, so end its stream
+    pthread_mutex_lock(&replica->lock);
+    replica->closed = true;
+    pthread_cond_signal(&replica->ready);
+    pthread_mutex_unlock(&replica->lock);
+
+    return NULL;
+}
+
+
+
+//FUNCTION launchReplicaLoop
+void* launchReplicaLoop(void* arg) {
+
+    //Follow the primary for as long as the server runs, reconnecting whenever the stream is lost
+    while (1) {
+
+        //The connection to the primary
+        int fd;
+        struct sockaddr_in primaryaddr;
+        struct hostent *primary;
+
+        //The message being read, and the catalogs being loaded from the snapshot, which are only lists of Books until they are swapped in
+        ReplicationMessage message;
+        Catalog* stagedCatalogs = NULL;
+        Catalog* stagedCatalog = NULL;
+        Book* snapshotTail = NULL;
+
+        //The last acknowledgement sent
+        unsigned long long ackedLsn = 0;
+        long long lastAckAt = 0;
+
+        //Get the primary's DNS entry. Only this thread looks hosts up, so the shared result is safe to use
+        primary = gethostbyname(primaryHost);
+
+        if (primary == NULL) {
+            fprintf(stderr, "ERROR: The primary's hostname doesn't exist. %s\n", primaryHost);
+            sleep(1);
+            continue;
+        }
+
+        //Build the primary's internet address
+        memset(&primaryaddr, 0, sizeof(primaryaddr));
+        primaryaddr.sin_family = AF_INET;
+        memcpy(&primaryaddr.sin_addr.s_addr, primary->h_addr_list[0], primary->h_length);
+        primaryaddr.sin_port = htons(primaryPort);
+
+        //Connect to the primary and ask it for a replication stream
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (fd < 0 || connect(fd, (struct sockaddr *)&primaryaddr, sizeof(primaryaddr)) < 0 || writeFully(fd, "METHOD:REPLICATE\n", 17) < 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            sleep(1);
+            continue;
+        }
+
+        printf("Replicating the primary at %s:%d.\n", primaryHost, primaryPort);
+        fflush(stdout);
+
+        pthread_mutex_lock(&replicaState.lock);
+        replicaState.connected = true;
+        replicaState.synchronized = false;
+        pthread_mutex_unlock(&replicaState.lock);
+
+        //Apply messages until the stream ends
+        while (readFully(fd, &message, sizeof(ReplicationMessage)) == 0) {
+
+            long long now = currentMicros();
+
+            //Collect the snapshot's Books into a new list for each catalog, in the primary's order
+            if (message.kind == REPLICATION_BOOK) {
+
+                Book* book = malloc(sizeof(Book));
+
+                __atomic_fetch_add(&heapBookCount, 1, __ATOMIC_RELAXED);
+
+                //The primary sends each catalog's Books together, so a new name starts the next catalog
+                message.record.catalog[99] = '\0';
+
+                if (stagedCatalog == NULL || strcmp(stagedCatalog->name, message.record.catalog) != 0) {
+
+                    Catalog* next = malloc(sizeof(Catalog));
+
+                    strcpy(next->name, message.record.catalog);
+                    next->books = NULL;
+                    next->nextCatalog = NULL;
+
+                    if (stagedCatalog == NULL) {
+                        stagedCatalogs = next;
+                    }
+                    else {
+                        stagedCatalog->nextCatalog = next;
+                    }
+
+                    stagedCatalog = next;
+                    snapshotTail = NULL;
+                }
+
+                memcpy(book->title, message.record.title, 100);
+                memcpy(book->author, message.record.author, 100);
+                memcpy(book->location, message.record.location, 100);
+                book->title[99] = book->author[99] = book->location[99] = '\0';
+                book->previous = snapshotTail;
+                book->next = NULL;
+
+                if (snapshotTail == NULL) {
+                    stagedCatalog->books = book;
+                }
+                else {
+                    snapshotTail->next = book;
+                }
+
+                snapshotTail = book;
+            }
+
+            //Once the snapshot is complete, swap it in for every catalog
+            else if (message.kind == REPLICATION_SNAPSHOT_END) {
+
+                //Create the snapshot's catalogs first, since none can be created while every catalog is held
+                for (Catalog* staged = stagedCatalogs; staged != NULL; staged = staged->nextCatalog) {
+                    findCatalog(staged->name, true);
+                }
+
+                lockAllCatalogs(STATS_APPLY);
+
+                for (Catalog* it = catalogs; it != NULL; it = it->nextCatalog) {
+
+                    removeAllBooks(&it->books);
+
+                    for (Catalog* staged = stagedCatalogs; staged != NULL; staged = staged->nextCatalog) {
+                        if (strcmp(staged->name, it->name) == 0) {
+                            it->books = staged->books;
+                            staged->books = NULL;
+                        }
+                    }
+                }
+
+                //Every cached GET result may be stale now
+                publishInvalidation(NULL);
+
+                unlockAllCatalogs();
+
+                while (stagedCatalogs != NULL) {
+                    stagedCatalog = stagedCatalogs->nextCatalog;
+                    free(stagedCatalogs);
+                    stagedCatalogs = stagedCatalog;
+                }
+
+                stagedCatalog = NULL;
+                snapshotTail = NULL;
+
+                pthread_mutex_lock(&replicaState.lock);
+                replicaState.synchronized = true;
+                replicaState.appliedLsn = message.primaryLsn;
+                replicaState.appliedSentAt = message.sentAt;
+                pthread_cond_broadcast(&replicaState.applied);
+                pthread_mutex_unlock(&replicaState.lock);
+
+                printf("Loaded the primary's snapshot at log sequence number %llu.\n", message.primaryLsn);
+                fflush(stdout);
+            }
+
+            //Apply each mutation after the snapshot in order
+            else if (message.kind == REPLICATION_MUTATION && message.record.lsn > replicaState.appliedLsn) {
+
+                Catalog* catalog;
+
+                message.record.catalog[99] = '\0';
+                catalog = findCatalog(message.record.catalog, true);
+
+                acquireCatalog(catalog, STATS_APPLY);
+                applyWalRecord(catalog, &message.record);
+                releaseCatalog(catalog);
+
+                pthread_mutex_lock(&replicaState.lock);
+                replicaState.appliedLsn = message.record.lsn;
+                replicaState.appliedSentAt = message.sentAt;
+                pthread_cond_broadcast(&replicaState.applied);
+                pthread_mutex_unlock(&replicaState.lock);
+            }
+
+            //Every message says how far ahead the primary is
+            pthread_mutex_lock(&replicaState.lock);
+            replicaState.primaryLsn = message.primaryLsn;
+            replicaState.lastContact = now;
+
+            //When caught up, the primary's heartbeat time is as current as any mutation
+            if (message.kind == REPLICATION_HEARTBEAT && replicaState.synchronized == true && replicaState.appliedLsn >= message.primaryLsn) {
+                replicaState.appliedSentAt = message.sentAt;
+            }
+
+            //Acknowledge what has been applied, at most once per heartbeat interval
+            if (replicaState.appliedLsn != ackedLsn && now - lastAckAt >= REPLICATION_HEARTBEAT_INTERVAL * 1000) {
+
+                char acknowledgement[40];
+
+                ackedLsn = replicaState.appliedLsn;
+                lastAckAt = now;
+                sprintf(acknowledgement, "ACK:%llu\n", ackedLsn);
+
+                if (writeFully(fd, acknowledgement, strlen(acknowledgement)) < 0) {
+                    pthread_mutex_unlock(&replicaState.lock);
+                    break;
+                }
+            }
+
+            pthread_mutex_unlock(&replicaState.lock);
+        }
+
+        //The stream was lost, so discard any partial snapshot and reconnect
+        fprintf(stderr, "ERROR: Lost the replication stream from %s:%d. Reconnecting.\n", primaryHost, primaryPort);
+        close(fd);
+
+        while (stagedCatalogs != NULL) {
+            stagedCatalog = stagedCatalogs->nextCatalog;
+            removeAllBooks(&stagedCatalogs->books);
+            free(stagedCatalogs);
+            stagedCatalogs = stagedCatalog;
+        }
+
+        pthread_mutex_lock(&replicaState.lock);
+        replicaState.connected = false;
+        pthread_mutex_unlock(&replicaState.lock);
+
+        sleep(1);
+    }
+
+    return NULL;
+}
+
+
+
+//FUNCTION publishMutation
+void publishMutation(WalRecord* record) {
+
+    //The message queued for every replica
+    ReplicationMessage message;
+
+    pthread_mutex_lock(&replicasLock);
+
+    if (replicas == NULL) {
+        pthread_mutex_unlock(&replicasLock);
+        return;
+    }
+
+    memset(&message, 0, sizeof(ReplicationMessage));
+    message.kind = REPLICATION_MUTATION;
+    message.primaryLsn = record->lsn;
+    message.sentAt = currentMicros();
+    message.record = *record;
+
+    for (Replica* it = replicas; it != NULL; it = it->nextReplica) {
+
+        pthread_mutex_lock(&it->lock);
+
+        //A replica too far behind is disconnected, and resynchronizes from a new snapshot when it reconnects
+        if (it->closed == false && it->queuedLength + (int) sizeof(ReplicationMessage) > MAX_REPLICATION_QUEUE) {
+            fprintf(stderr, "ERROR: The replica on socket fd %d fell too far behind and was disconnected.\n", it->fd);
+            it->closed = true;
+        }
+
+        else if (it->closed == false) {
+
+            //Double the queue's capacity when it is full
+            if (it->queuedLength + (int) sizeof(ReplicationMessage) > it->queueCapacity) {
+                it->queueCapacity = it->queueCapacity > 0 ? it->queueCapacity * 2 : 64 * sizeof(ReplicationMessage);
+                it->queue = realloc(it->queue, it->queueCapacity);
+            }
+
+            memcpy(it->queue + it->queuedLength, &message, sizeof(ReplicationMessage));
+            it->queuedLength += sizeof(ReplicationMessage);
+        }
+
+        pthread_cond_signal(&it->ready);
+        pthread_mutex_unlock(&it->lock);
+    }
+
+    pthread_mutex_unlock(&replicasLock);
+}
+
+
+
+//FUNCTION readFully
+int readFully(int fd, void* buffer, int length) {
+
+    //The number of bytes read so far
+    int totalRead = 0;
+
+    while (totalRead < length) {
+
+        int readLength = read(fd, (char*) buffer + totalRead, length - totalRead);
+
+        if (readLength <= 0) {
+            return -1;
+        }
+
+        totalRead += readLength;
+    }
+
+    return 0;
+}
+
+
+
+//FUNCTION reportReplication
+void reportReplication(int childfd) {
+
+    //The response message to send back to the client
+    ResponseBuffer serverResponse = { NULL, 0, 0 };
+    char line[512];
+
+    //How far behind the primary a replica is, in milliseconds, or -1 before it has a snapshot
+    double lagMs = 0.0;
+
+    //As a replica, report how far behind the primary this server is
+    if (primaryPort > 0) {
+
+        pthread_mutex_lock(&replicaState.lock);
+
+        sprintf(line, "207:REPLICATION\nROLE:replica\nPRIMARY:%s:%d\nCONNECTED:%s\nSYNCHRONIZED:%s\nAPPLIED:%llu\nPRIMARYLSN:%llu\n",
+                primaryHost, primaryPort, replicaState.connected == true ? "yes" : "no", replicaState.synchronized == true ? "yes" : "no",
+                replicaState.appliedLsn, replicaState.primaryLsn);
+        appendResponse(&serverResponse, line);
+
+        //The lag in mutations, and in time since the primary sent the oldest mutation not yet applied, which is none when caught up
+        if (replicaState.synchronized == false) {
+            lagMs = -1.0;
+        }
+        else if (replicaState.connected == false || replicaState.appliedLsn < replicaState.primaryLsn) {
+            lagMs = (currentMicros() - replicaState.appliedSentAt) / 1000.0;
+        }
+
+        sprintf(line, "LAG:%llu\nLAGMS:%.1f\n", replicaState.primaryLsn - replicaState.appliedLsn, lagMs);
+        appendResponse(&serverResponse, line);
+
+        pthread_mutex_unlock(&replicaState.lock);
+    }
+
+    //As a primary, report every replica and how far behind it is
+    else {
+
+        int replicaCount = 0;
+
+        pthread_mutex_lock(&replicasLock);
+
+        for (Replica* it = replicas; it != NULL; it = it->nextReplica) {
+            replicaCount++;
+        }
+
+        sprintf(line, "207:REPLICATION\nROLE:primary\nLSN:%llu\nREPLICAS:%d\n", writeAheadLog.lastLsn, replicaCount);
+        appendResponse(&serverResponse, line);
+
+        for (Replica* it = replicas; it != NULL; it = it->nextReplica) {
+
+            pthread_mutex_lock(&it->lock);
+            sprintf(line, "REPLICA:%d,ACKED:%llu,LAG:%llu,QUEUED:%d\n", it->fd, it->ackedLsn,
+                    writeAheadLog.lastLsn > it->ackedLsn ? writeAheadLog.lastLsn - it->ackedLsn : 0, it->queuedLength);
+            pthread_mutex_unlock(&it->lock);
+
+            appendResponse(&serverResponse, line);
+        }
+
+        pthread_mutex_unlock(&replicasLock);
+    }
+
+    sendServerResponse(childfd, serverResponse.text, serverResponse.length);
+
+    free(serverResponse.text);
+}
+
+
+
+//FUNCTION serveReplica
+void serveReplica(Replica* replica) {
+
+    //The thread reading the replica's acknowledgements
+    pthread_t acknowledgerThread;
+
+    //The messages being sent, swapped out of the queue so mutations can keep queueing during the write
+    char* sending = NULL;
+    int sendingLength;
+    int sendingCapacity = 0;
+
+    //The status of the snapshot child
+    int status;
+
+    pthread_create(&acknowledgerThread, NULL, launchReplicaAcknowledger, replica);
+
+    //The snapshot comes first, so wait for the child to finish streaming it
+    waitpid(replica->snapshotPid, &status, 0);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        pthread_mutex_lock(&replica->lock);
+        replica->closed = true;
+        pthread_mutex_unlock(&replica->lock);
+    }
+
+    printf("Streaming mutations to the replica on socket fd %d.\n", replica->fd);
+
+    //Send queued mutations, or a heartbeat when there are none, until the stream ends
+    while (1) {
+
+        struct timespec deadline;
+        ReplicationMessage heartbeat;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += REPLICATION_HEARTBEAT_INTERVAL * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        pthread_mutex_lock(&replica->lock);
+
+        while (replica->queuedLength == 0 && replica->closed == false) {
+            if (pthread_cond_timedwait(&replica->ready, &replica->lock, &deadline) != 0) {
+                break;
+            }
+        }
+
+        //A handoff ends the stream, and the replica reconnects to the new server
+        if (replica->closed == true || connectionRegistry.handingOff == true) {
+            pthread_mutex_unlock(&replica->lock);
+            break;
+        }
+
+        //Take every queued message
+        {
+            char* queue = replica->queue;
+            int queueCapacity = replica->queueCapacity;
+
+            sendingLength = replica->queuedLength;
+            replica->queue = sending;
+            replica->queueCapacity = sendingCapacity;
+            replica->queuedLength = 0;
+            sending = queue;
+            sendingCapacity = queueCapacity;
+        }
+
+        pthread_mutex_unlock(&replica->lock);
+
+        //With nothing queued, tell the replica the primary is still there and where its log is
+        if (sendingLength == 0) {
+
+            memset(&heartbeat, 0, sizeof(ReplicationMessage));
+            heartbeat.kind = REPLICATION_HEARTBEAT;
+            heartbeat.sentAt = currentMicros();
+
+            pthread_mutex_lock(&writeAheadLog.lock);
+            heartbeat.primaryLsn = writeAheadLog.lastLsn;
+            pthread_mutex_unlock(&writeAheadLog.lock);
+
+            if (writeFully(replica->fd, &heartbeat, sizeof(ReplicationMessage)) < 0) {
+                break;
+            }
+        }
+
+        else if (writeFully(replica->fd, sending, sendingLength) < 0) {
+            break;
+        }
+    }
+
+    //Take the replica out of the list, so no more mutations are queued for it
+    pthread_mutex_lock(&replicasLock);
+
+    for (Replica** it = &replicas; *it != NULL; it = &(*it)->nextReplica) {
+        if (*it == replica) {
+            *it = replica->nextReplica;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&replicasLock);
+
+    //End the connection, which also ends the acknowledgement thread and the client loop
+    shutdown(replica->fd, SHUT_RDWR);
+    pthread_join(acknowledgerThread, NULL);
+
+    printf("Stopped streaming to the replica on socket fd %d.\n", replica->fd);
+
+    pthread_mutex_destroy(&replica->lock);
+    pthread_cond_destroy(&replica->ready);
+    free(replica->queue);
+    free(sending);
+    free(replica);
+}
+
+
+
+//FUNCTION startReplica
+Replica* startReplica(int childfd) {
+
+    //The replica, and the child streaming it the snapshot
+    Replica* replica;
+    pid_t pid;
+
+    //The snapshot's log sequence number
+    unsigned long long lsn;
 
+    //A catalog whose snapshot records are corrupt is never streamed to a replica
+    for (Catalog* it = catalogs; it != NULL; it = it->nextCatalog) {
 
+        if (it->corrupt == true) {
+            errno = EIO;
+            return NULL;
+        }
+    }
 
-/* Name: sendServerResponse
- * Description: This function attempts to send the passed server response to the client socket specified by childfd.
- *              If unsuccessful, an error message will be reported on the server.
- * 
- * Parameter: childfd           The socket fd of the client connection
- * Parameter: response          The server response to send to the client
- * Parameter: length            The length of the response to send to the client
- * Return: None
-*/ 
-void sendServerResponse(int childfd, char response[100], int length);
+    pthread_mutex_lock(&writeAheadLog.lock);
+    lsn = writeAheadLog.lastLsn;
+    pthread_mutex_unlock(&writeAheadLog.lock);
 
+    pid = fork();
 
+    //THE CHILD: stream every Book as of the fork, then the end of the snapshot, using only the socket so nothing shared is touched
+    if (pid == 0) {
 
-/* Name: submitBook
- * Description: This function attempts to submit the Book with the given information to the Catalog. 
- *              The Book will be inserted to the back of the Catalog list in-order to check if the submission is a duplicate. 
- *              Duplicate Book submissions will be ignored, and a DUPLICATE response message will be returned. Otherwise, a SUBMITTED response message is returned.
- * 
- * Parameter: head                  A pointer to the Book Catalog's head
- * Parameter: title                 The title of the Book to submit
- * Parameter: author                The name of the author of the Book to submit
- * Parameter: location              The location of the Book to submit
- * Parameter: childfd               The socket connection to the client
- * Return: None
-*/ 
-void submitBook(Book** head, char title[100], char author[100], char location[100], int childfd);
+        ReplicationMessage message;
 
+        memset(&message, 0, sizeof(ReplicationMessage));
+        message.kind = REPLICATION_BOOK;
+        message.primaryLsn = lsn;
 
+        for (Catalog* catalog = catalogs; catalog != NULL; catalog = catalog->nextCatalog) {
 
-//Main loop
-int main(int argc, char **argv) {
-    
-    //The child socket number
-    int childfd; 
+            memcpy(message.record.catalog, catalog->name, 100);
 
-    //The port number to listen on
-    int portNum;
+            for (Book* it = catalog->books; it != NULL; it = it->next) {
 
-    //The length of the client's address
-    int clientLength;
+                memcpy(message.record.title, it->title, 100);
+                memcpy(message.record.author, it->author, 100);
+                memcpy(message.record.location, it->location, 100);
 
-    //The server address struct
-    struct sockaddr_in serveraddr; 
+                if (writeFully(childfd, &message, sizeof(ReplicationMessage)) < 0) {
+                    _exit(1);
+                }
+            }
+        }
 
-    //The client address struct
-    struct sockaddr_in clientaddr; 
+        memset(&message, 0, sizeof(ReplicationMessage));
+        message.kind = REPLICATION_SNAPSHOT_END;
+        message.primaryLsn = lsn;
+        message.sentAt = currentMicros();
 
-    //The hostnet information for the client
-    struct hostent *hostp; 
+        _exit(writeFully(childfd, &message, sizeof(ReplicationMessage)) < 0 ? 1 : 0);
+    }
 
-    //The host IP address string
-    char *hostaddrp;
+    if (pid < 0) {
+        return NULL;
+    }
 
-    //Flag value for setsockopt
-    int optval;
+    //THE PARENT: register the replica so every mutation after the snapshot is queued for it
+    replica = malloc(sizeof(Replica));
+    replica->fd = childfd;
+    replica->queue = NULL;
+    replica->queuedLength = 0;
+    replica->queueCapacity = 0;
+    replica->snapshotPid = pid;
+    replica->ackedLsn = 0;
+    replica->closed = false;
+    pthread_mutex_init(&replica->lock, NULL);
+    pthread_cond_init(&replica->ready, NULL);
+
+    pthread_mutex_lock(&replicasLock);
+    replica->nextReplica = replicas;
+    replicas = replica;
+    pthread_mutex_unlock(&replicasLock);
+
+    printf("Started a replica on socket fd %d at log sequence number %llu.\n", childfd, lsn);
+
+    return replica;
+}
 
-    //Bind the CTRL+C shortcut to an event handler
-    sigset(SIGINT, &handleServerClose);
-    sigset(SIGTERM, &handleServerClose);
 
-    //Verify the user provided a port number to connect to
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
-        exit(1);
+
+//FUNCTION writeFully
+int writeFully(int fd, const void* buffer, int length) {
+
+    //The number of bytes written so far
+    int totalWritten = 0;
+
+    while (totalWritten < length) {
+
+        int writtenLength = write(fd, (const char*) buffer + totalWritten, length - totalWritten);
+
+        if (writtenLength <= 0) {
+            return -1;
+        }
+
+        totalWritten += writtenLength;
     }
 
-    //Get the port number from the command line
-    portNum = atoi(argv[1]);
+    return 0;
+}
 
-    //If the user gave a negative port number, exit
-    if (portNum < 0) {
-        fprintf(stderr, "usage: %s <port> must be non-negative.", argv[1]);
-        exit(1);
+
+
+//FUNCTION writePushes
+void writePushes(Connection* connection) {
+
+    //The number of bytes of the queued invalidations sent so far
+    int totalSent = 0;
+
+    while (totalSent < connection->pushQueueLength && connection->broken == false) {
+
+        int sentBytes = send(connection->fd, connection->pushQueue + totalSent, connection->pushQueueLength - totalSent, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (sentBytes < 0 && errno == EINTR) {
+            continue;
+        }
+
+        //A client too far behind to take an invalidation would keep serving the stale result, so disconnect it instead, which also has the
+        //client drop its cache. The client loop sees the shutdown and closes the socket
+        if (sentBytes < 0) {
+            fprintf(stderr, "ERROR: An invalidation to socket fd %d was not sent, so the client is disconnected: %s\n", connection->fd, strerror(errno));
+            shutdown(connection->fd, SHUT_RDWR);
+            connection->broken = true;
+            break;
+        }
+
+        totalSent += sentBytes;
     }
 
-    //Create the parent (server) socket
-    parentfd = socket(AF_INET, SOCK_STREAM, 0);
+    connection->pushQueueLength = 0;
 
-    //If there was an error creating the parent socket, inform the user
-    if (parentfd < 0) {
-        perror("ERROR: ");
-        exit(1);
+    addStat(&findThreadStats()->bytesOut, totalSent);
+}
+
+
+
+//FUNCTION waitForReplication
+bool waitForReplication(unsigned long long lsn) {
+
+    //The latest the replica will wait until
+    struct timespec deadline;
+    bool caughtUp;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += SESSION_WAIT_INTERVAL * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    pthread_mutex_lock(&replicaState.lock);
+
+    //Wait for the log sequence number to be applied, or for the deadline to pass
+    while (replicaState.synchronized == false || replicaState.appliedLsn < lsn) {
+        if (pthread_cond_timedwait(&replicaState.applied, &replicaState.lock, &deadline) != 0) {
+            break;
+        }
     }
 
-    //Code that allows socket to be rebound to immediately without error
-    optval = 1;
-    setsockopt(parentfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval , sizeof(int));
+    caughtUp = replicaState.synchronized == true && replicaState.appliedLsn >= lsn;
 
-    //Build the server's internet address with an IP address and port number
-    serveraddr.sin_family = AF_INET;
-    serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serveraddr.sin_port = htons((unsigned short)portNum);
+    pthread_mutex_unlock(&replicaState.lock);
 
-    //Bind the parent socket id to the port number
-    if (bind(parentfd, (struct sockaddr *) &serveraddr, sizeof(serveraddr)) < 0) {
-        perror("ERROR: ");
-        exit(1);
+    return caughtUp;
+}
+
+
+
+//FUNCTION publishEvent
+void publishEvent(WalRecord* record) {
+
+    //The event, formed once for every subscriber it matches
+    ResponseBuffer event = { NULL, 0, 0 };
+    char lsnLine[40];
+
+    pthread_mutex_lock(&subscribersLock);
+
+    for (Subscriber* it = subscribers; it != NULL; it = it->nextSubscriber) {
+
+        //Skip subscribers to other catalogs, and those whose filter the change doesn't match. A move matches a location filter at either end
+        if (strcmp(it->catalog, record->catalog) != 0) {
+            continue;
+        }
+        if (it->author[0] != '\0' && strcmp(it->author, record->author) != 0) {
+            continue;
+        }
+        if (it->location[0] != '\0' && strcmp(it->location, record->location) != 0
+            && (record->type != WAL_MOVE || strcmp(it->location, record->newLocation) != 0)) {
+            continue;
+        }
+
+        //Form the event the first time it is needed
+        if (event.length == 0) {
+
+            appendResponse(&event, record->type == WAL_SUBMIT ? "EVENT:SUBMIT\n" : record->type == WAL_REMOVE ? "EVENT:REMOVE\n" : "EVENT:MOVE\n");
+            sprintf(lsnLine, "LSN:%llu\n", record->lsn);
+            appendResponse(&event, lsnLine);
+            appendResponse(&event, "TITLE:");
+            appendResponse(&event, record->title);
+            appendResponse(&event, "\nAUTHOR:");
+            appendResponse(&event, record->author);
+            appendResponse(&event, "\nLOCATION:");
+            appendResponse(&event, record->location);
+            appendResponse(&event, "\n");
+
+            if (record->type == WAL_MOVE) {
+                appendResponse(&event, "NEWLOCATION:");
+                appendResponse(&event, record->newLocation);
+                appendResponse(&event, "\n");
+            }
+
+            appendResponse(&event, "\n");
+        }
+
+        pthread_mutex_lock(&it->lock);
+
+        //A subscriber too slow to keep up loses the event rather than holding up the mutation
+        if (it->queuedLength + event.length > MAX_SUBSCRIBER_QUEUE) {
+            it->droppedCount++;
+        }
+
+        else {
+
+            //Double the queue's capacity when it is full
+            if (it->queuedLength + event.length > it->queueCapacity) {
+                while (it->queuedLength + event.length > it->queueCapacity) {
+                    it->queueCapacity = it->queueCapacity > 0 ? it->queueCapacity * 2 : 4096;
+                }
+                it->queue = realloc(it->queue, it->queueCapacity);
+            }
+
+            memcpy(it->queue + it->queuedLength, event.text, event.length);
+            it->queuedLength += event.length;
+            pthread_cond_signal(&it->ready);
+        }
+
+        pthread_mutex_unlock(&it->lock);
     }
 
-    //Listen for any connection requests, up to 5
-    if (listen(parentfd, 5) < 0) {
-        perror("ERROR: ");
-        exit(1);
+    pthread_mutex_unlock(&subscribersLock);
+
+    free(event.text);
+}
+
+
+
+//FUNCTION publishInvalidation
+void publishInvalidation(WalRecord* record) {
+
+    //The connections tracking the Book's title or author, each told once
+    Connection** notified = NULL;
+    int notifiedCount = 0;
+
+    //The invalidation pushed to them
+    char invalidation[400] = "213:FLUSH\n";
+
+    pthread_mutex_lock(&trackingLock);
+
+    //Every catalog was replaced, so every connection tracking anything flushes its whole cache
+    if (record == NULL) {
+
+        pthread_mutex_lock(&connectionRegistry.lock);
+
+        for (Connection* it = connectionRegistry.head; it != NULL; it = it->nextConnection) {
+            if (it->trackedCount > 0) {
+                notified = realloc(notified, sizeof(Connection*) * (notifiedCount + 1));
+                notified[notifiedCount++] = it;
+            }
+        }
+
+        pthread_mutex_unlock(&connectionRegistry.lock);
+
+        forgetTrackedKeys(NULL);
     }
 
-    //Get the length of the client's address
-    clientLength = sizeof(clientaddr);
-    
-    //Main loop to wait for a connection request
+    //Take the keys naming the Book's title, then those naming its author, out of the table
+    for (int pass = 0; pass < 2 && record != NULL; pass++) {
+
+        bool byAuthor = pass == 1;
+        const char* value = byAuthor == true ? record->author : record->title;
+        TrackedKey** it = &trackingTable[trackingBucket(record->catalog, byAuthor, value)];
+
+        while (*it != NULL) {
+
+            TrackedKey* key = *it;
+            bool listed = false;
+
+            if (key->byAuthor != byAuthor || strcmp(key->value, value) != 0 || strcmp(key->catalog, record->catalog) != 0) {
+                it = &key->nextKey;
+                continue;
+            }
+
+            *it = key->nextKey;
+            key->connection->trackedCount--;
+
+            for (int i = 0; i < notifiedCount; i++) {
+                listed = listed || notified[i] == key->connection;
+            }
+
+            if (listed == false) {
+                notified = realloc(notified, sizeof(Connection*) * (notifiedCount + 1));
+                notified[notifiedCount++] = key->connection;
+            }
+
+            free(key);
+        }
+    }
+
+    //The invalidation names the title and author both, since a client drops every result for either
+    if (record != NULL) {
+        snprintf(invalidation, sizeof(invalidation), "212:INVALIDATE\nCATALOG:%s\nTITLE:%s\nAUTHOR:%s\n", record->catalog, record->title, record->author);
+    }
+
+    //Keep the connections from being freed, then push to them without trackingLock, so one slow connection never holds up tracking
+    for (int i = 0; i < notifiedCount; i++) {
+        notified[i]->pushing++;
+    }
+
+    pthread_mutex_unlock(&trackingLock);
+
+    for (int i = 0; i < notifiedCount; i++) {
+        pushInvalidation(notified[i], invalidation);
+    }
+
+    if (notifiedCount > 0) {
+
+        pthread_mutex_lock(&trackingLock);
+
+        for (int i = 0; i < notifiedCount; i++) {
+            notified[i]->pushing--;
+        }
+
+        pthread_cond_broadcast(&pushesFinished);
+        pthread_mutex_unlock(&trackingLock);
+    }
+
+    free(notified);
+}
+
+
+
+//FUNCTION pushInvalidation
+void pushInvalidation(Connection* connection, const char text[]) {
+
+    //The invalidation framed as a response to request ID 0
+    char message[500];
+    int length = snprintf(message, sizeof(message), "ID:0,LENGTH:%d\n%s", (int) strlen(text), text);
+
+    pthread_mutex_lock(&connection->writeLock);
+
+    //A connection that has already failed a write is being closed, and will be told nothing more
+    if (connection->broken == true) {
+        pthread_mutex_unlock(&connection->writeLock);
+        return;
+    }
+
+    //Queue the invalidation, or a flush of the whole cache in place of everything queued if it doesn't fit
+    if (connection->pushQueueLength + length <= PUSH_QUEUE_LENGTH) {
+        memcpy(connection->pushQueue + connection->pushQueueLength, message, length);
+        connection->pushQueueLength += length;
+    }
+    else {
+        connection->pushQueueLength = sprintf(connection->pushQueue, "ID:0,LENGTH:10\n213:FLUSH\n");
+    }
+
+    //Write it now between responses, or leave it for the thread writing a response to send after
+    if (connection->sending == false) {
+        writePushes(connection);
+    }
+
+    pthread_mutex_unlock(&connection->writeLock);
+}
+
+
+
+//FUNCTION forgetTrackedKeys
+void forgetTrackedKeys(Connection* connection) {
+
+    //Free the keys
+    for (int i = 0; i < TRACKING_TABLE_SIZE; i++) {
+
+        TrackedKey** it = &trackingTable[i];
+
+        while (*it != NULL) {
+
+            TrackedKey* key = *it;
+
+            if (connection != NULL && key->connection != connection) {
+                it = &key->nextKey;
+                continue;
+            }
+
+            *it = key->nextKey;
+            key->connection->trackedCount--;
+            free(key);
+        }
+    }
+}
+
+
+
+//FUNCTION trackKey
+void trackKey(Connection* connection, const char catalog[], bool byAuthor, const char value[]) {
+
+    //The bucket the key goes in, and the key
+    unsigned int bucket = trackingBucket(catalog, byAuthor, value);
+    TrackedKey* key;
+
+    //Whether the connection's cache has to be flushed to make room
+    bool flush = false;
+
+    pthread_mutex_lock(&trackingLock);
+
+    //A key the connection already tracks needs nothing more
+    for (key = trackingTable[bucket]; key != NULL; key = key->nextKey) {
+        if (key->connection == connection && key->byAuthor == byAuthor && strcmp(key->value, value) == 0 && strcmp(key->catalog, catalog) == 0) {
+            pthread_mutex_unlock(&trackingLock);
+            return;
+        }
+    }
+
+    //A connection caching too much starts again with an empty cache, so the table stays bounded
+    if (connection->trackedCount >= MAX_TRACKED_KEYS) {
+        forgetTrackedKeys(connection);
+        flush = true;
+    }
+
+    key = malloc(sizeof(TrackedKey));
+    key->connection = connection;
+    strcpy(key->catalog, catalog);
+    key->byAuthor = byAuthor;
+    strcpy(key->value, value);
+
+    key->nextKey = trackingTable[bucket];
+    trackingTable[bucket] = key;
+    connection->trackedCount++;
+
+    pthread_mutex_unlock(&trackingLock);
+
+    //The connection is the one the request came on, so it can't be freed before this is pushed
+    if (flush == true) {
+        pushInvalidation(connection, "213:FLUSH\n");
+    }
+}
+
+
+
+//FUNCTION trackingBucket
+unsigned int trackingBucket(const char catalog[], bool byAuthor, const char value[]) {
+    return (hashString(catalog) * 31 + hashString(value) * 2 + (byAuthor == true ? 1 : 0)) % TRACKING_TABLE_SIZE;
+}
+
+
+
+//FUNCTION serveSubscriber
+void serveSubscriber(Subscriber* subscriber) {
+
+    //The events being sent, swapped out of the queue so mutations can keep queueing during the write
+    char* sending = NULL;
+    int sendingLength;
+    int sendingCapacity = 0;
+
+    //The number of events dropped, which the subscriber is told before the events after them
+    long long droppedCount;
+
+    //The subscriber's socket, watched for it disconnecting
+    struct pollfd wait = { subscriber->fd, POLLIN, 0 };
+
+    printf("Streaming changes to the subscriber on socket fd %d.\n", subscriber->fd);
+
+    //Send queued events until the subscriber disconnects
     while (1) {
 
-        //Wait for a client to connect
-        childfd = accept(parentfd, (struct sockaddr *) &clientaddr, (socklen_t*) &clientLength);
-        
-        //If the client's connection wasn't accepted, error
-        if (childfd < 0) {
-            perror("ERROR: ");
-            exit(1);
+        struct timespec deadline;
+        char input[256];
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += REPLICATION_HEARTBEAT_INTERVAL * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        pthread_mutex_lock(&subscriber->lock);
+
+        while (subscriber->queuedLength == 0 && subscriber->droppedCount == 0) {
+            if (pthread_cond_timedwait(&subscriber->ready, &subscriber->lock, &deadline) != 0) {
+                break;
+            }
         }
-        
-        //Determine who the client is by their IP address
-        hostp = gethostbyaddr((const char *)&clientaddr.sin_addr.s_addr, sizeof(clientaddr.sin_addr.s_addr), AF_INET);
-        
-        //If something went wrong getting the host address
-        if (hostp == NULL) {
-            perror("ERROR: ");
-            exit(1);
+
+        //Take every queued event, and the number dropped before them
+        {
+            char* queue = subscriber->queue;
+            int queueCapacity = subscriber->queueCapacity;
+
+            sendingLength = subscriber->queuedLength;
+            subscriber->queue = sending;
+            subscriber->queueCapacity = sendingCapacity;
+            subscriber->queuedLength = 0;
+            sending = queue;
+            sendingCapacity = queueCapacity;
+        }
+
+        droppedCount = subscriber->droppedCount;
+        subscriber->droppedCount = 0;
+
+        pthread_mutex_unlock(&subscriber->lock);
+
+        //A handoff ends the stream, and the subscriber resubscribes to the new server
+        if (connectionRegistry.handingOff == true) {
+            break;
+        }
+
+        //The subscriber only sends to disconnect, and anything it does send is ignored
+        if (poll(&wait, 1, 0) > 0 && read(subscriber->fd, input, sizeof(input)) <= 0) {
+            break;
+        }
+
+        //Tell the subscriber how many events it missed, so it knows to read the Catalog again
+        if (droppedCount > 0) {
+
+            char droppedEvent[60];
+
+            sprintf(droppedEvent, "EVENT:DROPPED\nCOUNT:%lld\n\n", droppedCount);
+
+            if (writeFully(subscriber->fd, droppedEvent, strlen(droppedEvent)) < 0) {
+                break;
+            }
+        }
+
+        if (sendingLength > 0 && writeFully(subscriber->fd, sending, sendingLength) < 0) {
+            break;
+        }
+    }
+
+    //Take the subscriber out of the list, so no more events are queued for it
+    pthread_mutex_lock(&subscribersLock);
+
+    for (Subscriber** it = &subscribers; *it != NULL; it = &(*it)->nextSubscriber) {
+        if (*it == subscriber) {
+            *it = subscriber->nextSubscriber;
+            break;
         }
+    }
+
+    pthread_mutex_unlock(&subscribersLock);
+
+    //End the connection, which also ends the client loop
+    shutdown(subscriber->fd, SHUT_RDWR);
+
+    printf("Stopped streaming to the subscriber on socket fd %d.\n", subscriber->fd);
+
+    pthread_mutex_destroy(&subscriber->lock);
+    pthread_cond_destroy(&subscriber->ready);
+    free(subscriber->queue);
+    free(sending);
+    free(subscriber);
+}
 
-        //Get the client's IP address
-        hostaddrp = inet_ntoa(clientaddr.sin_addr);
-        
-        //If there was an error getting the client's IP address inform the user
-        if (hostaddrp == NULL) {
-            perror("ERROR: ");
-            exit(1);
-        }
 
-        //If the connection was established successfully, inform the user
-        printf("Server established connection with %s (%s), and socket fd %d.\n", hostp->h_name, hostaddrp, childfd);
 
-        //Create a thread for the client's connection
-        pthread_t clientThread;
+//FUNCTION findCatalog
+Catalog* findCatalog(const char name[], bool create) {
 
-        //Bind the main loop function to the thread and pass the child fd
-        pthread_create(&clientThread, NULL, launchClientLoop, (void*) &childfd);
+    //The link to the catalog, or to where a new one would go at the end of the list
+    Catalog** it;
+    Catalog* catalog;
 
-        //Detatch the thread so that it will close automatically
-        pthread_detach(clientThread);
+    pthread_mutex_lock(&catalogsLock);
 
+    for (it = &catalogs; *it != NULL; it = &(*it)->nextCatalog) {
+        if (strcmp((*it)->name, name) == 0) {
+            break;
+        }
     }
 
-    return 0;
-}
+    //Create the catalog empty, with its own semaphore free and its profile zeroed
+    if (*it == NULL && create == true) {
 
+        Catalog* created = calloc(1, sizeof(Catalog));
 
+        strncpy(created->name, name, 99);
+        created->name[99] = '\0';
+        created->books = NULL;
+        sem_init(&created->mutex, 0, 1);
+        created->nextCatalog = NULL;
+        created->holderOperation = -1;
+        created->longestHoldOperation = -1;
 
-//Event signal handler to avoid port number not closing properly
-void handleServerClose() {
-    
-    // global server socket parentfd
-    close(parentfd);
+        //Link it in only once it's ready, since STATS walks the list without the lock
+        __atomic_store_n(it, created, __ATOMIC_RELEASE);
+    }
 
-    //Clear the online catalog
-    removeAllBooks(&bookCatalog);
-    
-    //Close the server
-    exit(0);
+    catalog = *it;
+
+    pthread_mutex_unlock(&catalogsLock);
+
+    return catalog;
 }
 
 
 
-//FUNCTION sendServerResponse
-void sendServerResponse(int childfd, char response[100], int length) {
+//FUNCTION lockAllCatalogs
+void lockAllCatalogs(int operation) {
 
-    //Inform the user that their request was invalid
-    int sentBytes = write(childfd, response, length);
+    //Hold the list first, so every catalog is waited for in the same order and none is added while they are held
+    pthread_mutex_lock(&catalogsLock);
 
-    //If the response wasn't sent, inform the user
-    if (sentBytes < 0) {
-        fprintf(stderr, "ERROR: The server response was not sent.\n");
-        perror("ERROR: ");
-        exit(1);
+    for (Catalog* it = catalogs; it != NULL; it = it->nextCatalog) {
+        acquireCatalog(it, operation);
     }
 }
 
 
 
-//FUNCTION launchClientLoop
-void* launchClientLoop(void* fd) {
+//FUNCTION unlockAllCatalogs
+void unlockAllCatalogs() {
 
-    //Get the client's socket ID (Responses are only returned to this client)
-    int childfd = *((int*)fd);
+    for (Catalog* it = catalogs; it != NULL; it = it->nextCatalog) {
+        releaseCatalog(it);
+    }
 
-    //Loop to read client requests until they disconnect
-    while (childfd >= 0) {
-    
-        //The request message from the client
-        char requestMessage[250] = ""; 
+    pthread_mutex_unlock(&catalogsLock);
+}
 
-        //The length of the client request message
-        int requestLength; 
 
-        //Read the client's request
-        requestLength = read(childfd, requestMessage, 250);
-        
-        //If there was an error reading the client's request, inform the user
-        if (requestLength < 0) {
-            fprintf(stderr, "ERROR: Client request could not be read.\n");
-            perror("ERROR: ");
-            exit(1);
-        }
 
-        //Else if the client disconnects, stop listening for requests
-        else if (requestLength == 0) {
-            printf("Client with socket fd %d has disconnected.\n", childfd);
-            break;
-        }
+//FUNCTION acquireCatalog
+void acquireCatalog(Catalog* catalog, int operation) {
 
-        //Else a request was successfully received
-        else {
+    //When the wait started, and the type of work holding the semaphore then, if any
+    long long startNs = currentNanos();
+    int holder = __atomic_load_n(&catalog->holderOperation, __ATOMIC_RELAXED);
+    long long waitNs;
 
-            //Make sure the request is terminated properly with a LF character
-            if (requestMessage[requestLength-1] == '\n') {
-                requestMessage[requestLength-1] = '\0';     
+    sem_wait(&catalog->mutex);
 
-                //Find out what the request was         
-                decipherRequest(requestMessage, childfd);
-            }
+    //The profile is only ever written by the holder, so the counts need no other lock
+    catalog->heldSince = currentNanos();
+    waitNs = catalog->heldSince - startNs;
 
-            //Otherwise, send an error message back to the user
-            else {
-                sendServerResponse(childfd, "404:BAD REQUEST,MESSAGE:Request Message is missing ending newline character.\n", 78);
-            }
-        }
-    }
+    __atomic_store_n(&catalog->holderOperation, operation, __ATOMIC_RELAXED);
 
-    return NULL;
+    //Check any records still as mapped from the snapshot on their first use, so loading it doesn't have to read them all
+    checkSnapshotRecords(catalog);
+
+    addStat(&catalog->acquisitions, 1);
+    addStat(&catalog->waitNs, waitNs);
+
+    //Blame the wait on the work that held the semaphore when it started. Later holders it queued behind go unblamed, but the first is
+    //the one most likely to be long
+    if (holder >= 0) {
+        addStat(&catalog->contendedAcquisitions, 1);
+        addStat(&catalog->blockedNs[holder][operation], waitNs);
+        addStat(&catalog->blockedCount[holder][operation], 1);
+    }
 }
 
 
 
-//FUNCTION decipherRequest 
-void decipherRequest(char request[], int childfd) {
+//FUNCTION addStat
+void addStat(long long* stat, long long amount) {
 
-     //Have the thread check if it can send a request message, otherwise have it wait
-    sem_wait(&mutex);
+    __atomic_store_n(stat, __atomic_load_n(stat, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
 
-    //Containers for the type and value of the request header line i.e. 'METHOD:GET' or 'METHOD:REMOVE'
-    char requestHeaderType[15];
-    char requestHeaderValue[15];
 
-    //Containers for the type and value of a request line i.e. 'AUTHOR:Clayton' or 'TITLE:Networking'
-    char requestMethodType[15];
-    char requestMethodValue[100];
 
-    //Containers for the Book's title, author, and location data
-    char requestTitle[100];
-    char requestAuthor[50];
-    char requestLocation[50];
+//FUNCTION currentNanos
+long long currentNanos() {
 
-    //Parse the request message to see what type of request this is
-    parseRequest(request, requestHeaderType, requestHeaderValue);
+    struct timespec now;
 
-    //SUBMIT REQUEST
-    if (strcmp(requestHeaderValue, "SUBMIT") == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-        //Get the Book's Title and clear the method type
-        parseRequest(request, requestMethodType, requestTitle);
-        requestMethodType[0] = '\0';
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
 
-        //Get the Book's Author and clear the method type
-        parseRequest(request, requestMethodType, requestAuthor);
-        requestMethodType[0] = '\0';
 
-        //Get the Book's Location and clear the method type
-        parseRequest(request, requestMethodType, requestLocation);
-        requestMethodType[0] = '\0';
 
-        //SUBMIT A BOOK
-        submitBook(&bookCatalog, requestTitle, requestAuthor, requestLocation, childfd);
+//FUNCTION findThreadStats
+ThreadStats* findThreadStats() {
+
+    if (currentStats == NULL) {
+
+        currentStats = calloc(1, sizeof(ThreadStats));
+
+        pthread_mutex_lock(&statsLock);
+        currentStats->nextStats = statsRegistry;
+        statsRegistry = currentStats;
+        pthread_mutex_unlock(&statsLock);
     }
 
-    //GET REQUEST
-    else if (strcmp(requestHeaderValue, "GET") == 0) {
+    return currentStats;
+}
 
-        //Parse the request for the first METHOD field and value
-        parseRequest(request, requestMethodType, requestMethodValue);
 
-        //If the METHOD field is "AUTHOR", this is a GET Request for books by an AUTHOR
-        if (strcmp(requestMethodType, "AUTHOR") == 0) {
 
-            //Copy the Book's author
-            strcpy(requestAuthor, requestMethodValue);
+//FUNCTION histogramPercentile
+long long histogramPercentile(LatencyHistogram* histogram, double fraction) {
 
-            //GET BOOKS BY AUTHOR
-            getBooksByAuthor(bookCatalog, requestAuthor, childfd);
-        }
+    //The number of latencies that must be no larger than the answer, and the number counted so far
+    long long needed = (long long) (histogram->total * fraction + 0.999999);
+    long long counted = 0;
 
-        //Else if the METHOD field is "TITLE"
-        else if (strcmp(requestMethodType, "TITLE") == 0) {
+    if (histogram->total == 0) {
+        return 0;
+    }
 
-            //Copy the Book's title
-            strcpy(requestTitle, requestMethodValue);
+    for (int bucket = 0; bucket < STATS_BUCKET_COUNT; bucket++) {
 
-            //Clear the requestMethodType and requestMethodValue
-            requestMethodType[0] = '\0';
-            requestMethodValue[0] = '\0';
+        counted += histogram->counts[bucket];
 
-            //Check for an "AUTHOR" field
-            parseRequest(request, requestMethodType, requestMethodValue);
+        if (counted >= needed && counted > 0) {
+            return bucketUpperNs(bucket) < histogram->maxNs ? bucketUpperNs(bucket) : histogram->maxNs;
+        }
+    }
 
-            //If the request has an "AUTHOR" field
-            if (strcmp(requestMethodType, "AUTHOR") == 0) {
+    return histogram->maxNs;
+}
 
-                //Copy the Book's author
-                strcpy(requestAuthor, requestMethodValue);
 
-                //CALL THE SPECIFIC GET BOOK WITH AUTHOR AND TITLE FUNCTION
-                getSpecificBook(bookCatalog, requestTitle, requestAuthor, childfd);
-            }
 
-            //Else the request doesn't have an AUTHOR field
-            else {
+//FUNCTION mergeStats
+void mergeStats(ThreadStats* total, ThreadStats* stats) {
 
-                //GET BOOKS WITH TITLE
-                getBooksWithTitle(bookCatalog, requestTitle, childfd);
-            }
+    total->bytesIn += __atomic_load_n(&stats->bytesIn, __ATOMIC_RELAXED);
+    total->bytesOut += __atomic_load_n(&stats->bytesOut, __ATOMIC_RELAXED);
+
+    for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++) {
+
+        //The thread's statistics for the type of request, which recordRequest only publishes once they're zeroed
+        OperationStats* from = __atomic_load_n(&stats->operations[operation], __ATOMIC_ACQUIRE);
+        OperationStats* to;
+
+        if (from == NULL) {
+            continue;
         }
 
-        //Else the METHOD field is invalid
-        else {
-            
-            //Inform the user that their request was invalid
-            sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:Request Message has an invalid field.", 62);
+        if (total->operations[operation] == NULL) {
+            total->operations[operation] = calloc(1, sizeof(OperationStats));
         }
-    }
 
-    //REMOVE REQUEST
-    else if (strcmp(requestHeaderValue, "REMOVE") == 0) {
-        
-        //Get the Book's Title and clear the method type
-        parseRequest(request, requestMethodType, requestTitle);
-        requestMethodType[0] = '\0';
+        to = total->operations[operation];
 
-        //Get the Book's Author and clear the method type
-        parseRequest(request, requestMethodType, requestAuthor);
-        requestMethodType[0] = '\0';
+        to->requests += __atomic_load_n(&from->requests, __ATOMIC_RELAXED);
+        to->errors += __atomic_load_n(&from->errors, __ATOMIC_RELAXED);
 
-        //Get the Book's Location and clear the method type
-        parseRequest(request, requestMethodType, requestLocation);
-        requestMethodType[0] = '\0';
+        //Add every histogram, bucket by bucket
+        for (int which = 0; which < 3; which++) {
 
-        //CALL THE SPECIFIC REMOVE BOOK FUNCTION
-        removeBook(&bookCatalog, requestTitle, requestAuthor, requestLocation, childfd);
-    }
+            LatencyHistogram* fromHistogram = which == 0 ? &from->serviceTime : which == 1 ? &from->lockWait : &from->lockHold;
+            LatencyHistogram* toHistogram = which == 0 ? &to->serviceTime : which == 1 ? &to->lockWait : &to->lockHold;
+            long long maxNs = __atomic_load_n(&fromHistogram->maxNs, __ATOMIC_RELAXED);
 
-    //INVALID REQUEST (Needs to be turned into a WRITE ERROR EVENTUALLY)
-    else {
-        sendServerResponse(childfd, "404:BAD REQUEST\nMESSAGE:Request Message is an invalid type.\n", 61);
-    }
+            for (int bucket = 0; bucket < STATS_BUCKET_COUNT; bucket++) {
+                toHistogram->counts[bucket] += __atomic_load_n(&fromHistogram->counts[bucket], __ATOMIC_RELAXED);
+            }
 
-    //Once a thread has had its request read and a response returned, unblock other threads
-    sem_post(&mutex);
+            toHistogram->total += __atomic_load_n(&fromHistogram->total, __ATOMIC_RELAXED);
+            toHistogram->sumNs += __atomic_load_n(&fromHistogram->sumNs, __ATOMIC_RELAXED);
+
+            if (maxNs > toHistogram->maxNs) {
+                toHistogram->maxNs = maxNs;
+            }
+        }
+    }
 }
 
 
 
-//FUNCTION parseRequest
-void parseRequest(char requestMessage[], char method[], char value[]) {
+//FUNCTION recordLatency
+void recordLatency(LatencyHistogram* histogram, long long latencyNs) {
 
-    //The length of the request message passed
-    int requestLength = strlen(requestMessage);
+    //The histogram bucket the latency falls in
+    int bucket;
 
-    //The length of the HEADER:VALUE or METHOD:VALUE token
-    int tokenLength = 0;
+    if (latencyNs < 0) {
+        latencyNs = 0;
+    }
 
-    //The length of the HEADER or METHOD i.e. 'METHOD', 'TITLE', 'AUTHOR'
-    int methodLength = 0;
+    //Below the exact buckets, every nanosecond has a bucket of its own
+    if (latencyNs < STATS_EXACT_BUCKETS) {
+        bucket = latencyNs;
+    }
 
-    //The length of the VALUE for a given HEADER or METHOD i.e. 'GET', 'SUBMIT', 'Book Title'
-    int valueLength = 0;
+    //Above them, the latency's top six bits pick its bucket within its doubling
+    else {
 
-    //This will hold a copy of the request message to truncate the original
-    char newRequestMessage[300];
+        int shift = 63 - __builtin_clzll(latencyNs) - 5;
 
-    //If the passed request message is blank, set the method and value to be blank and return
-    if (strlen(requestMessage) == 0) {
-        strcpy(method, "");
-        strcpy(value, "");
-        return;
+        bucket = STATS_EXACT_BUCKETS + (shift - 1) * STATS_SUB_BUCKETS + (int) (latencyNs >> shift) - STATS_SUB_BUCKETS;
+
+        if (bucket >= STATS_BUCKET_COUNT) {
+            bucket = STATS_BUCKET_COUNT - 1;
+        }
     }
 
-    //Loop through the original message string and get the length of the method's header value
-    for (int i = 0; i < requestLength; i++) {
+    addStat(&histogram->counts[bucket], 1);
+    addStat(&histogram->total, 1);
+    addStat(&histogram->sumNs, latencyNs);
 
-        //Stop at the delimitter
-        if (requestMessage[i] == ':') {
-            break;
-        }
+    if (latencyNs > histogram->maxNs) {
+        __atomic_store_n(&histogram->maxNs, latencyNs, __ATOMIC_RELAXED);
+    }
+}
 
-        //Increment the length
-        else {
-            methodLength++;
-        }
+
+
+//FUNCTION recordRequest
+void recordRequest(int operation, long long startNs, long long lockWaitNs, long long lockHoldNs) {
+
+    ThreadStats* stats = findThreadStats();
+    OperationStats* operationStats = stats->operations[operation];
+
+    //Allocate the type of request the first time the thread answers one, and only publish it to STATS once it's zeroed
+    if (operationStats == NULL) {
+        operationStats = calloc(1, sizeof(OperationStats));
+        __atomic_store_n(&stats->operations[operation], operationStats, __ATOMIC_RELEASE);
     }
 
-    //Copy the method's header from the request message
-    strncpy(method, requestMessage, methodLength);
-    method[methodLength] = '\0';
+    addStat(&operationStats->requests, 1);
 
-    //Loop through the original message string and get the length of the method's value
-    for (int j = methodLength + 1; j < requestLength; j++) {
+    //Every client or server error counts, except a search that found nothing, which is an answer rather than a failure
+    if (responseStatus >= 400 && responseStatus != 402) {
+        addStat(&operationStats->errors, 1);
+    }
 
-        //Stop at the delimitter
-        if (requestMessage[j] == ',') {
-            break;
-        }
+    recordLatency(&operationStats->serviceTime, currentNanos() - startNs);
 
-        //Increment the length
-        else {
-            valueLength++;
-        }
+    if (lockWaitNs >= 0) {
+        recordLatency(&operationStats->lockWait, lockWaitNs);
+        recordLatency(&operationStats->lockHold, lockHoldNs);
     }
+}
 
-    //Copy the method's value from the string
-    strncpy(value, requestMessage + methodLength + 1, valueLength);
-    value[valueLength] = '\0';
 
-    //Calculate the length of the method + the value and + 2 for the delimitters
-    tokenLength = methodLength + valueLength + 2;
 
-    //If there are still more tokens to parse, we will need to keep them
-    if (requestLength - tokenLength > 0) {
+//FUNCTION releaseCatalog
+void releaseCatalog(Catalog* catalog) {
 
-        //Make a cropped copy of the original string including only the characters after the parsed token
-        strncpy(newRequestMessage, requestMessage + tokenLength, requestLength - tokenLength);
-        newRequestMessage[requestLength - tokenLength] = '\0';
+    long long holdNs = currentNanos() - catalog->heldSince;
 
-        //Clear the original message string
-        requestMessage[0] = '\0';
+    addStat(&catalog->holdNs, holdNs);
 
-        //Copy the string's copy into the original string
-        strcpy(requestMessage, newRequestMessage);
-        requestMessage[requestLength-1] = '\0';
+    if (holdNs > catalog->longestHoldNs) {
+        __atomic_store_n(&catalog->longestHoldNs, holdNs, __ATOMIC_RELAXED);
+        __atomic_store_n(&catalog->longestHoldOperation, catalog->holderOperation, __ATOMIC_RELAXED);
     }
 
-    //We're done parsing the request message, so it can be fully erased
-    else {
-        requestMessage[0] = '\0';
-    }
+    __atomic_store_n(&catalog->holderOperation, -1, __ATOMIC_RELAXED);
+
+    sem_post(&catalog->mutex);
 }
 
 
 
-//Search the list by book title
-void getBooksByAuthor(Book* head, char author[100], int childfd) {
+//FUNCTION reportStats
+void reportStats(int childfd) {
 
-    //Boolean to check if any Book matches were found
-    bool found = false;
+    //Every thread's statistics merged together
+    ThreadStats total;
 
     //The response message to send back to the client
-    char* serverResponse;
-    serverResponse = malloc(sizeof(char) * 1000);
+    ResponseBuffer serverResponse = { NULL, 0, 0 };
+    char line[512];
 
-    //Iterate though
-    while(head != NULL) {
+    //The request and error counts of every type of request together
+    long long requestCount = 0;
+    long long errorCount = 0;
+    int connectionCount;
 
-        //if a match is found add it to the matchList string
-        if (strcmp(head->author, author) == 0) {
+    //The pairs of holder and waiter that have cost the most waiting on any catalog's semaphore, longest first
+    Blocker worstBlockers[STATS_WORST_BLOCKERS];
+    int blockerCount = 0;
 
-            //If this is the first match, set up the server response
-            if (found == false) {
-                found = true;
-                strcpy(serverResponse, "202:RETRIEVED\n");
-            }
+    collectStats(&total);
 
-            //Append the matched Book Location to the Server Response
-            strcat(serverResponse, "TITLE:");
-            strcat(serverResponse, head->title);
-            strcat(serverResponse, "\n");
-            strcat(serverResponse, "AUTHOR:");
-            strcat(serverResponse, author);
-            strcat(serverResponse, "\n");
-            strcat(serverResponse, "LOCATION:");
-            strcat(serverResponse, head->location);
-            strcat(serverResponse, "\n\n");
-        }
+    pthread_mutex_lock(&connectionRegistry.lock);
+    connectionCount = connectionRegistry.connectionCount;
+    pthread_mutex_unlock(&connectionRegistry.lock);
 
-        head = head->next;
+    for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++) {
+        if (total.operations[operation] != NULL) {
+            requestCount += total.operations[operation]->requests;
+            errorCount += total.operations[operation]->errors;
+        }
     }
 
-    //If there were Books found for the given title, inform the user
-    if (found == false) {
-        strcpy(serverResponse, "402:NOT FOUND\nMESSAGE:There are no Books in the Catalog with the given author.\n");
-        sendServerResponse(childfd, serverResponse, strlen(serverResponse));
-    }
+    sprintf(line, "208:STATS\nCONNECTIONS:%d\nREQUESTS:%lld\nERRORS:%lld\nBYTESIN:%lld\nBYTESOUT:%lld\n\n", connectionCount, requestCount, errorCount,
+            total.bytesIn, total.bytesOut);
+    appendResponse(&serverResponse, line);
 
-    //If there were Books found for the given title    
-    else {
+    //Describe every type of request answered, with its latencies in microseconds
+    for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++) {
 
-        //Pass the Book locations to the user
-        sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+        OperationStats* stats = total.operations[operation];
+
+        if (stats == NULL) {
+            continue;
+        }
+
+        sprintf(line, "OPERATION:%s,REQUESTS:%lld,ERRORS:%lld\n", statsOperationNames[operation], stats->requests, stats->errors);
+        appendResponse(&serverResponse, line);
+
+        for (int which = 0; which < 3; which++) {
+
+            LatencyHistogram* histogram = which == 0 ? &stats->serviceTime : which == 1 ? &stats->lockWait : &stats->lockHold;
+
+            sprintf(line, "HISTOGRAM:%s,COUNT:%lld,MEANUS:%.1f,P50US:%.1f,P90US:%.1f,P99US:%.1f,P999US:%.1f,MAXUS:%.1f\n",
+                    which == 0 ? "SERVICE" : which == 1 ? "LOCKWAIT" : "LOCKHOLD",
+                    histogram->total, histogram->total > 0 ? histogram->sumNs / 1000.0 / histogram->total : 0.0,
+                    histogramPercentile(histogram, 0.50) / 1000.0, histogramPercentile(histogram, 0.90) / 1000.0,
+                    histogramPercentile(histogram, 0.99) / 1000.0, histogramPercentile(histogram, 0.999) / 1000.0, histogram->maxNs / 1000.0);
+            appendResponse(&serverResponse, line);
+        }
+
+        appendResponse(&serverResponse, "\n");
+        free(stats);
     }
 
-    //Free the server response message
-    free(serverResponse);
-}
+    //Profile every catalog's semaphore, reading the counts its holders write without taking it. Catalogs are only ever appended to the
+    //list once they're ready, and never freed
+    for (Catalog* it = __atomic_load_n(&catalogs, __ATOMIC_ACQUIRE); it != NULL; it = __atomic_load_n(&it->nextCatalog, __ATOMIC_ACQUIRE)) {
 
+        int longestHolder = __atomic_load_n(&it->longestHoldOperation, __ATOMIC_RELAXED);
 
+        sprintf(line, "LOCK:%s,ACQUIRED:%lld,CONTENDED:%lld,WAITUS:%.1f,HOLDUS:%.1f,LONGESTHOLDUS:%.1f,LONGESTHOLDER:%s\n", it->name,
+                __atomic_load_n(&it->acquisitions, __ATOMIC_RELAXED), __atomic_load_n(&it->contendedAcquisitions, __ATOMIC_RELAXED),
+                __atomic_load_n(&it->waitNs, __ATOMIC_RELAXED) / 1000.0, __atomic_load_n(&it->holdNs, __ATOMIC_RELAXED) / 1000.0,
+                __atomic_load_n(&it->longestHoldNs, __ATOMIC_RELAXED) / 1000.0, longestHolder >= 0 ? statsOperationNames[longestHolder] : "");
+        appendResponse(&serverResponse, line);
 
-//Search the list by book title
-void getBooksWithTitle(Book* head, char title[100], int childfd) {
+        //Keep the pairs of holder and waiter that have cost the most waiting so far, longest first
+        for (int holder = 0; holder < STATS_OPERATION_COUNT; holder++) {
 
-    //Boolean to check if any Book matches were found
-    bool found = false;
+            for (int waiter = 0; waiter < STATS_OPERATION_COUNT; waiter++) {
 
-    //The response message to send back to the client
-    char* serverResponse;
-    serverResponse = malloc(sizeof(char) * 1000);
+                long long blockedNs = __atomic_load_n(&it->blockedNs[holder][waiter], __ATOMIC_RELAXED);
+                int rank = blockerCount;
 
-    //Iterate though
-    while(head != NULL) {
+                if (blockedNs == 0) {
+                    continue;
+                }
 
-        //if a match is found add it to the matchList string
-        if (strcmp(head->title, title) == 0) {
+                while (rank > 0 && worstBlockers[rank - 1].blockedNs < blockedNs) {
+                    if (rank < STATS_WORST_BLOCKERS) {
+                        worstBlockers[rank] = worstBlockers[rank - 1];
+                    }
+                    rank--;
+                }
 
-            //If this is the first match, set up the server response
-            if (found == false) {
-                found = true;
-                strcpy(serverResponse, "202:RETRIEVED\n");
-            }
+                if (rank < STATS_WORST_BLOCKERS) {
+                    worstBlockers[rank] = (Blocker) { it, holder, waiter, blockedNs, __atomic_load_n(&it->blockedCount[holder][waiter], __ATOMIC_RELAXED) };
 
-            //Append the matched Book Location to the Server Response
-            strcat(serverResponse, "TITLE:");
-            strcat(serverResponse, title);
-            strcat(serverResponse, "\n");
-            strcat(serverResponse, "AUTHOR:");
-            strcat(serverResponse, head->author);
-            strcat(serverResponse, "\n");
-            strcat(serverResponse, "LOCATION:");
-            strcat(serverResponse, head->location);
-            strcat(serverResponse, "\n\n");
+                    if (blockerCount < STATS_WORST_BLOCKERS) {
+                        blockerCount++;
+                    }
+                }
+            }
         }
+    }
 
-        head = head->next;
+    appendResponse(&serverResponse, "\n");
+
+    //Name the work that has kept other requests waiting the longest, i.e. GET scans holding up SUBMITs
+    for (int rank = 0; rank < blockerCount; rank++) {
+        sprintf(line, "BLOCKING:%s,HOLDER:%s,WAITER:%s,WAITS:%lld,WAITUS:%.1f\n", worstBlockers[rank].catalog->name,
+                statsOperationNames[worstBlockers[rank].holder], statsOperationNames[worstBlockers[rank].waiter], worstBlockers[rank].count,
+                worstBlockers[rank].blockedNs / 1000.0);
+        appendResponse(&serverResponse, line);
     }
 
-    //If there were Books found for the given title, inform the user
-    if (found == false) {
-        strcpy(serverResponse, "402:NOT FOUND\nMESSAGE:There are no Books in the Catalog with the given title.\n");
-        sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+    sendServerResponse(childfd, serverResponse.text, serverResponse.length);
+
+    free(serverResponse.text);
+}
+
+
+
+//FUNCTION retireThreadStats
+void retireThreadStats() {
+
+    if (currentStats == NULL) {
+        return;
     }
 
-    //If there were Books found for the given title
-    else {
+    pthread_mutex_lock(&statsLock);
 
-        //Pass the Book locations to the user
-        sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+    //Take the thread's statistics out of the registry, then keep them with the other exited threads'
+    for (ThreadStats** it = &statsRegistry; *it != NULL; it = &(*it)->nextStats) {
+        if (*it == currentStats) {
+            *it = currentStats->nextStats;
+            break;
+        }
     }
 
-    //Free the server response message
-    free(serverResponse);
+    mergeStats(&retiredStats, currentStats);
+
+    pthread_mutex_unlock(&statsLock);
+
+    for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++) {
+        free(currentStats->operations[operation]);
+    }
+
+    free(currentStats);
+    currentStats = NULL;
 }
 
 
 
-//Search the list for the Specified Book
-void getSpecificBook(Book* head, char title[100], char author[100], int childfd) {
+//FUNCTION statsOperation
+int statsOperation(const char method[]) {
 
-    //Boolean to check if any Book matches were found
-    bool found = false;
+    //Find the method among the types of request, counting every unknown method as OTHER
+    for (int operation = 0; operation < STATS_OTHER; operation++) {
+        if (strcmp(method, statsOperationNames[operation]) == 0) {
+            return operation;
+        }
+    }
 
-    //The response message to send back to the client
-    char* serverResponse;
-    serverResponse = malloc(sizeof(char) * 1000);
+    return STATS_OTHER;
+}
 
-    //Iterate though
-    while(head != NULL) {
 
-        //if a match is found add it to the matchList string
-        if (strcmp(head->title, title) == 0 && strcmp(head->author, author) == 0) {
 
-            //If this is the first match, set found to true and build the response message 
-            if (found == false) {
-                found = true;
-                strcpy(serverResponse, "202:RETRIEVED\n");
-            }
+//FUNCTION appendHistogramMetric
+void appendHistogramMetric(ResponseBuffer* response, const char name[], const char operation[], LatencyHistogram* histogram) {
 
-            //Append the matched Book Location to the Server Response
-            strcat(serverResponse, "LOCATION:");
-            strcat(serverResponse, head->location);
-            strcat(serverResponse, "\n\n");
-        }
+    //The histogram's latencies no longer than each bound, and the next bucket of the histogram to count
+    long long counted = 0;
+    int bucket = 0;
+    char line[256];
 
-        //Check the next Book in the Catalog
-        head = head->next;
-    }
+    for (int bound = 0; bound < METRICS_BUCKET_COUNT; bound++) {
 
-    //If there were Books found for the given title, inform the user
-    if (found == false) {
-        strcpy(serverResponse, "402:NOT FOUND\nMESSAGE: There were no Books with the given title and author in the Catalog.\n");
-        sendServerResponse(childfd, serverResponse, strlen(serverResponse));
-    }
+        //Count every bucket that lies wholly within the bound, which undercounts a bound by at most one bucket's width
+        while (bucket < STATS_BUCKET_COUNT && bucketUpperNs(bucket) <= (long long) (metricsBucketBounds[bound] * 1e9)) {
+            counted += histogram->counts[bucket];
+            bucket++;
+        }
 
-    //If there were Books found for the given title
-    else {
-        
-        //Pass the Book locations to the user
-        sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+        sprintf(line, "%s_bucket{operation=\"%s\",le=\"%g\"} %lld\n", name, operation, metricsBucketBounds[bound], counted);
+        appendResponse(response, line);
     }
 
-    //Free the server response message
-    free(serverResponse);
+    sprintf(line, "%s_bucket{operation=\"%s\",le=\"+Inf\"} %lld\n%s_sum{operation=\"%s\"} %.9f\n%s_count{operation=\"%s\"} %lld\n", name, operation,
+            histogram->total, name, operation, histogram->sumNs / 1e9, name, operation, histogram->total);
+    appendResponse(response, line);
 }
 
 
 
-//FUNCTION Remove ALL Books from Catalog
-void removeAllBooks(Book** head) {
+//FUNCTION appendLabelValue
+void appendLabelValue(ResponseBuffer* response, const char value[]) {
 
-    //Temporary Book object for modifying the Catalog
-    Book* temp = *head;
+    for (int i = 0; value[i] != '\0'; i++) {
 
-    //If the Catalog is empty, return
-    if (temp == NULL) {
-        return;
+        //Backslashes, double quotes and line feeds are escaped with a backslash, and everything else is written as it is
+        if (value[i] == '\\' || value[i] == '"') {
+            appendResponseBytes(response, "\\", 1);
+            appendResponseBytes(response, &value[i], 1);
+        }
+        else if (value[i] == '\n') {
+            appendResponseBytes(response, "\\n", 2);
+        }
+        else {
+            appendResponseBytes(response, &value[i], 1);
+        }
     }
+}
 
-    //Otherwise,
-    else {
 
-        //Free the first n-1 Books in the Catalog
-        while (temp->next != NULL) {
-            temp = temp->next;
-            free(temp->previous);
-        }
 
-        //Free the last Book in the Catalog and set the head pointer to NULL
-        free(temp);
-        temp = NULL;
+//FUNCTION bucketUpperNs
+long long bucketUpperNs(int bucket) {
 
-        //Save the changes made to the original Catalog
-        *head = temp;
+    //The bits each of the bucket's doubling's sub-buckets is shifted left by
+    int shift;
+
+    if (bucket < STATS_EXACT_BUCKETS) {
+        return bucket;
     }
+
+    shift = (bucket - STATS_EXACT_BUCKETS) / STATS_SUB_BUCKETS + 1;
+
+    return (((long long) ((bucket - STATS_EXACT_BUCKETS) % STATS_SUB_BUCKETS + STATS_SUB_BUCKETS) + 1) << shift) - 1;
 }
 
 
 
-//FUNCTION Remove a specific book from the list
-void removeBook(Book** head, char title[100], char author[100], char location[100], int childfd) {
+//FUNCTION collectStats
+void collectStats(ThreadStats* total) {
 
-    Book* temp = *head;
+    memset(total, 0, sizeof(ThreadStats));
 
-    //The response message to send back to the client
-    char* serverResponse;
-    serverResponse = malloc(sizeof(char) * 1000);
+    //Merge the exited threads' statistics with every running thread's, none of which can exit while the registry is held
+    pthread_mutex_lock(&statsLock);
 
-    //CASE ONE: BOOK CATALOG IS EMPTY
-    if (temp == NULL) {
-        
-        strcpy(serverResponse, "402:NOT FOUND\nMESSAGE:The Book Catalog is empty and thus does not contain the Book specified.\n");
-        sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+    mergeStats(total, &retiredStats);
+
+    for (ThreadStats* it = statsRegistry; it != NULL; it = it->nextStats) {
+        mergeStats(total, it);
     }
 
-    //CASE TWO: BOOK CATALOG HAS ONE BOOK
-    else if (temp->next == NULL) {
+    pthread_mutex_unlock(&statsLock);
+}
 
-        //If the Book being searched for is the sole one
-        if (strcmp(temp->author, author) == 0 && strcmp(temp->title, title) == 0 && strcmp(temp->location, location) == 0) {
 
-            //Free the book
-            free(temp);
-            temp = NULL;
 
-            //Set the passed head pointer to the temporary one to save the changes
-            *head = temp;
+//FUNCTION launchMetricsListener
+void* launchMetricsListener(void* arg) {
 
-            //Build the REMOVED Server Response Message
-            strcpy(serverResponse, "203:REMOVED\nTITLE:");
-            strcat(serverResponse, title);
-            strcat(serverResponse, "\nAUTHOR:");
-            strcat(serverResponse, author);
-            strcat(serverResponse, "\nLOCATION:");
-            strcat(serverResponse, location);
-            strcat(serverResponse, "\n");
+    //The admin socket and its address
+    int metricsfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in metricsaddr;
+    int optval = 1;
 
-            //Send the Server Response Message
-            sendServerResponse(childfd, serverResponse, strlen(serverResponse));   
-        } 
+    //How long a scraper has to send its request before it's dropped
+    struct timeval timeout = { METRICS_REQUEST_TIMEOUT, 0 };
 
-        //If the Book being searched for is not the sole one
-        else {
-            
-            //Write to the client that the book was not found
-            strcpy(serverResponse, "402:NOT FOUND\nMESSAGE:The Book specified could not be found in the Catalog.\n");
-            sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+    if (metricsfd < 0) {
+        perror("ERROR: ");
+        return NULL;
+    }
+
+    setsockopt(metricsfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval , sizeof(int));
+
+    memset(&metricsaddr, 0, sizeof(metricsaddr));
+    metricsaddr.sin_family = AF_INET;
+    metricsaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    metricsaddr.sin_port = htons((unsigned short) metricsPort);
+
+    //Bind the admin port, waiting for a server that was taken over to let go of it
+    if (bind(metricsfd, (struct sockaddr *) &metricsaddr, sizeof(metricsaddr)) < 0) {
+
+        fprintf(stderr, "ERROR: The admin port %d is in use. Metrics will be served once it's free.\n", metricsPort);
+
+        while (bind(metricsfd, (struct sockaddr *) &metricsaddr, sizeof(metricsaddr)) < 0) {
+            sleep(1);
         }
     }
 
-    //CASE THREE: BOOK CATALOG HAS MORE THAN ONE BOOK
-    else {
+    if (listen(metricsfd, 16) < 0) {
+        perror("ERROR: ");
+        close(metricsfd);
+        return NULL;
+    }
 
-        //Temporary Book iterator for the Catalog
-        Book* it = temp;
+    printf("Serving metrics at http://localhost:%d/metrics.\n", metricsPort);
+    fflush(stdout);
 
-        //Iterate through the Book Catalog for the desired Book to Remove
-        while(it != NULL) {
+    //Answer every scrape in turn
+    while (1) {
 
-            //If there's a match, stop iterating
-            if (strcmp(it->title, title) == 0 && strcmp(it->author, author) == 0 && strcmp(it->location, location) == 0) {
+        //The scraper's connection, and its HTTP request
+        int scrapefd = accept(metricsfd, NULL, NULL);
+        char request[METRICS_REQUEST_LENGTH];
+        int requestLength = 0;
+
+        if (scrapefd < 0) {
+            continue;
+        }
+
+        setsockopt(scrapefd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        //Read the request up to the blank line ending its headers, or as much of it as fits
+        while (requestLength < METRICS_REQUEST_LENGTH - 1) {
+
+            int readLength = recv(scrapefd, request + requestLength, METRICS_REQUEST_LENGTH - 1 - requestLength, 0);
+
+            if (readLength <= 0) {
                 break;
             }
 
-            //Keep iterating
-            else {
-                it = it->next;
+            requestLength += readLength;
+            request[requestLength] = '\0';
+
+            if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+                break;
             }
         }
 
-        //If the Book wasn't found in the list
-        if (it == NULL) {
+        request[requestLength] = '\0';
 
-            //Write to the client that the book was not found
-            strcpy(serverResponse, "402:NOT FOUND\nMESSAGE:The Book specified could not be found in the Catalog.\n");
-            sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+        //Only the metrics path is served
+        if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET /metrics?", 13) == 0) {
+            serveMetrics(scrapefd);
+        }
+        else if (requestLength > 0) {
+            send(scrapefd, "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\nNot found\n", 98, MSG_NOSIGNAL);
         }
 
-        //Otherwise, remove the Book entry based on its position in the Catalog
-        else {
+        close(scrapefd);
+    }
 
-            //If this is the first Book in the Catalog
-            if (it->previous == NULL && it->next != NULL) {
+    return NULL;
+}
 
-                //Set the second last Book's previous pointer to NULL
-                it->next->previous = NULL;
 
-                //Move the head pointer to the second Book
-                temp = it->next;
 
-                //Free the Book
-                free(it);        
+//FUNCTION serveMetrics
+void serveMetrics(int scrapefd) {
 
-                //Set the passed head pointer to the temporary one to save the changes
-                *head = temp;
+    //Every thread's statistics merged together
+    ThreadStats total;
 
-                //Build the REMOVED Server Response Message
-                strcpy(serverResponse, "203:REMOVED\nTITLE:");
-                strcat(serverResponse, title);
-                strcat(serverResponse, "\nAUTHOR:");
-                strcat(serverResponse, author);
-                strcat(serverResponse, "\nLOCATION:");
-                strcat(serverResponse, location);
-                strcat(serverResponse, "\n");
+    //The metrics, and the HTTP response header sent before them
+    ResponseBuffer metrics = { NULL, 0, 0 };
+    char line[512];
+    int headerLength;
+    int totalSent = 0;
 
-                //Send the Server Response Message
-                sendServerResponse(childfd, serverResponse, strlen(serverResponse));   
-            }
+    //The Books, catalogs and tracked keys, and the connections
+    long long mappedBookCount = snapshotLength / sizeof(Book);
+    long long bookCount;
+    int catalogCount = 0;
+    int trackedKeyCount = 0;
+    int connectionCount;
 
-            //If this is the last Book in the Catalog
-            if (it->previous != NULL && it->next == NULL) {
+    collectStats(&total);
 
-                //Set the second last Book's next pointer to NULL
-                it->previous->next = NULL;
+    pthread_mutex_lock(&connectionRegistry.lock);
+    connectionCount = connectionRegistry.connectionCount;
+    pthread_mutex_unlock(&connectionRegistry.lock);
 
-                //Free the Book node
-                free(it);
+    //The tracking table is the only index the server keeps, guarded by its own lock rather than any catalog's
+    pthread_mutex_lock(&trackingLock);
 
-                //Set the passed head pointer to the temporary one to save the changes
-                *head = temp;
+    for (int bucket = 0; bucket < TRACKING_TABLE_SIZE; bucket++) {
+        for (TrackedKey* it = trackingTable[bucket]; it != NULL; it = it->nextKey) {
+            trackedKeyCount++;
+        }
+    }
 
-                //Build the REMOVED Server Response Message
-                strcpy(serverResponse, "203:REMOVED\nTITLE:");
-                strcat(serverResponse, title);
-                strcat(serverResponse, "\nAUTHOR:");
-                strcat(serverResponse, author);
-                strcat(serverResponse, "\nLOCATION:");
-                strcat(serverResponse, location);
-                strcat(serverResponse, "\n");
+    pthread_mutex_unlock(&trackingLock);
 
-                //Send the Server Response Message
-                sendServerResponse(childfd, serverResponse, strlen(serverResponse));   
-            }
+    for (Catalog* it = __atomic_load_n(&catalogs, __ATOMIC_ACQUIRE); it != NULL; it = __atomic_load_n(&it->nextCatalog, __ATOMIC_ACQUIRE)) {
+        catalogCount++;
+    }
 
-            //This Book lies in the middle of the Catalog
-            else {
+    bookCount = __atomic_load_n(&heapBookCount, __ATOMIC_RELAXED) + mappedBookCount - __atomic_load_n(&freedSnapshotBookCount, __ATOMIC_RELAXED);
+
+    //The size and memory of the Catalog
+    sprintf(line, "# HELP catalog_books The number of Books in every catalog.\n# TYPE catalog_books gauge\ncatalog_books %lld\n", bookCount);
+    appendResponse(&metrics, line);
+
+    sprintf(line, "# HELP catalog_catalogs The number of catalogs, including the default catalog.\n# TYPE catalog_catalogs gauge\ncatalog_catalogs %d\n",
+            catalogCount);
+    appendResponse(&metrics, line);
+
+    sprintf(line, "# HELP catalog_book_storage_bytes The memory holding Books, allocated on the heap or mapped from the snapshot file.\n"
+                  "# TYPE catalog_book_storage_bytes gauge\ncatalog_book_storage_bytes{storage=\"heap\"} %lld\ncatalog_book_storage_bytes{storage=\"snapshot\"} %lld\n",
+            __atomic_load_n(&heapBookCount, __ATOMIC_RELAXED) * (long long) sizeof(Book), (long long) snapshotLength);
+    appendResponse(&metrics, line);
+
+    sprintf(line, "# HELP catalog_tracked_keys The titles and authors connections cache GET results for.\n# TYPE catalog_tracked_keys gauge\n"
+                  "catalog_tracked_keys %d\n# HELP catalog_index_bytes The memory of the server's indexes.\n# TYPE catalog_index_bytes gauge\n"
+                  "catalog_index_bytes{index=\"tracking\"} %lld\n", trackedKeyCount,
+            (long long) sizeof(trackingTable) + trackedKeyCount * (long long) sizeof(TrackedKey));
+    appendResponse(&metrics, line);
+
+    //The connections and the bytes they've moved
+    sprintf(line, "# HELP catalog_connections The open client connections.\n# TYPE catalog_connections gauge\ncatalog_connections %d\n"
+                  "# HELP catalog_received_bytes_total The bytes of requests read.\n# TYPE catalog_received_bytes_total counter\ncatalog_received_bytes_total %lld\n"
+                  "# HELP catalog_sent_bytes_total The bytes of responses and invalidations written.\n# TYPE catalog_sent_bytes_total counter\n"
+                  "catalog_sent_bytes_total %lld\n", connectionCount, total.bytesIn, total.bytesOut);
+    appendResponse(&metrics, line);
+
+    //Every type of request answered, a metric family at a time
+    appendResponse(&metrics, "# HELP catalog_requests_total The requests answered.\n# TYPE catalog_requests_total counter\n");
+
+    for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++) {
+        if (total.operations[operation] != NULL) {
+            sprintf(line, "catalog_requests_total{operation=\"%s\"} %lld\n", statsOperationNames[operation], total.operations[operation]->requests);
+            appendResponse(&metrics, line);
+        }
+    }
 
-                //Set the previous node to point to the one after the one being deleted
-                it->previous->next = it->next;
+    appendResponse(&metrics, "# HELP catalog_request_errors_total The requests answered with an error, not counting searches that found nothing.\n"
+                             "# TYPE catalog_request_errors_total counter\n");
 
-                //Set the next node to point to the one before the one being deleted
-                it->next->previous = it->previous;
+    for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++) {
+        if (total.operations[operation] != NULL) {
+            sprintf(line, "catalog_request_errors_total{operation=\"%s\"} %lld\n", statsOperationNames[operation], total.operations[operation]->errors);
+            appendResponse(&metrics, line);
+        }
+    }
 
-                //Free the node
-                free(it);
+    appendResponse(&metrics, "# HELP catalog_request_duration_seconds The time from reading each request to sending its response.\n"
+                             "# TYPE catalog_request_duration_seconds histogram\n");
 
-                //Set the passed head pointer to the temporary one to save the changes
-                *head = temp;
+    for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++) {
+        if (total.operations[operation] != NULL) {
+            appendHistogramMetric(&metrics, "catalog_request_duration_seconds", statsOperationNames[operation], &total.operations[operation]->serviceTime);
+        }
+    }
 
-                //Build the REMOVED Server Response Message
-                strcpy(serverResponse, "203:REMOVED\nTITLE:");
-                strcat(serverResponse, title);
-                strcat(serverResponse, "\nAUTHOR:");
-                strcat(serverResponse, author);
-                strcat(serverResponse, "\nLOCATION:");
-                strcat(serverResponse, location);
-                strcat(serverResponse, "\n");
+    appendResponse(&metrics, "# HELP catalog_request_lock_wait_seconds The time each request waited for its catalog's semaphore.\n"
+                             "# TYPE catalog_request_lock_wait_seconds histogram\n");
 
-                //Send the Server Response Message
-                sendServerResponse(childfd, serverResponse, strlen(serverResponse));   
-            }
+    for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++) {
+        if (total.operations[operation] != NULL) {
+            appendHistogramMetric(&metrics, "catalog_request_lock_wait_seconds", statsOperationNames[operation], &total.operations[operation]->lockWait);
         }
     }
 
-    //Free the server response message
-    free(serverResponse);
-}
+    appendResponse(&metrics, "# HELP catalog_request_lock_hold_seconds The time each request held its catalog's semaphore.\n"
+                             "# TYPE catalog_request_lock_hold_seconds histogram\n");
 
+    for (int operation = 0; operation < STATS_OPERATION_COUNT; operation++) {
+        if (total.operations[operation] != NULL) {
+            appendHistogramMetric(&metrics, "catalog_request_lock_hold_seconds", statsOperationNames[operation], &total.operations[operation]->lockHold);
+            free(total.operations[operation]);
+        }
+    }
 
+    //Every catalog's semaphore, read without taking it
+    appendResponse(&metrics, "# HELP catalog_semaphore_acquisitions_total The times a catalog's semaphore was taken, and how many of them had to wait.\n"
+                             "# TYPE catalog_semaphore_acquisitions_total counter\n");
 
-//Append a new member to the end of the list -- CHECKED
-void submitBook(Book** head, char title[100], char author[100], char location[100], int childfd) {
+    for (Catalog* it = __atomic_load_n(&catalogs, __ATOMIC_ACQUIRE); it != NULL; it = __atomic_load_n(&it->nextCatalog, __ATOMIC_ACQUIRE)) {
 
-    //Temporary head pointer to modify the Catalog list
-    Book* temp = *head;
+        appendResponse(&metrics, "catalog_semaphore_acquisitions_total{catalog=\"");
+        appendLabelValue(&metrics, it->name);
+        sprintf(line, "\",contended=\"no\"} %lld\n", __atomic_load_n(&it->acquisitions, __ATOMIC_RELAXED) - __atomic_load_n(&it->contendedAcquisitions, __ATOMIC_RELAXED));
+        appendResponse(&metrics, line);
 
-    //The new Book to be added
-    Book* newBook;
+        appendResponse(&metrics, "catalog_semaphore_acquisitions_total{catalog=\"");
+        appendLabelValue(&metrics, it->name);
+        sprintf(line, "\",contended=\"yes\"} %lld\n", __atomic_load_n(&it->contendedAcquisitions, __ATOMIC_RELAXED));
+        appendResponse(&metrics, line);
+    }
 
-    //The response message to send back to the client
-    char* serverResponse;
-    serverResponse = malloc(sizeof(char) * 1000);
+    appendResponse(&metrics, "# HELP catalog_semaphore_wait_seconds_total The time spent waiting for a catalog's semaphore.\n"
+                             "# TYPE catalog_semaphore_wait_seconds_total counter\n");
 
-    //Malloc the new Book Struct
-    newBook = malloc(sizeof(Book));
+    for (Catalog* it = __atomic_load_n(&catalogs, __ATOMIC_ACQUIRE); it != NULL; it = __atomic_load_n(&it->nextCatalog, __ATOMIC_ACQUIRE)) {
+        appendResponse(&metrics, "catalog_semaphore_wait_seconds_total{catalog=\"");
+        appendLabelValue(&metrics, it->name);
+        sprintf(line, "\"} %.9f\n", __atomic_load_n(&it->waitNs, __ATOMIC_RELAXED) / 1e9);
+        appendResponse(&metrics, line);
+    }
 
-    //add the new data to the entry
-    strcpy(newBook->title, title);
-    strcpy(newBook->author, author);
-    strcpy(newBook->location, location);
+    appendResponse(&metrics, "# HELP catalog_semaphore_hold_seconds_total The time a catalog's semaphore was held.\n"
+                             "# TYPE catalog_semaphore_hold_seconds_total counter\n");
 
-    //Since end of list, next will always be NULL
-    newBook->next = NULL;
-    
-    //If list empty, new node is the head
-    if(temp == NULL) {
-        newBook->previous = NULL;
-        newBook->next = NULL;
-        temp = newBook;
+    for (Catalog* it = __atomic_load_n(&catalogs, __ATOMIC_ACQUIRE); it != NULL; it = __atomic_load_n(&it->nextCatalog, __ATOMIC_ACQUIRE)) {
+        appendResponse(&metrics, "catalog_semaphore_hold_seconds_total{catalog=\"");
+        appendLabelValue(&metrics, it->name);
+        sprintf(line, "\"} %.9f\n", __atomic_load_n(&it->holdNs, __ATOMIC_RELAXED) / 1e9);
+        appendResponse(&metrics, line);
+    }
 
-        //Set the passed head pointer to the temporary one to save the changes
-        *head = temp;
+    appendResponse(&metrics, "# HELP catalog_semaphore_blocked_seconds_total The time each type of work waited for a catalog's semaphore behind each type that held it.\n"
+                             "# TYPE catalog_semaphore_blocked_seconds_total counter\n");
 
-        //Form the server response message
-        strcpy(serverResponse, "201: SUBMITTED\n");
-        strcat(serverResponse, "TITLE:");
-        strcat(serverResponse, title);
-        strcat(serverResponse, "\n");
-        strcat(serverResponse, "AUTHOR:");
-        strcat(serverResponse, author);
-        strcat(serverResponse, "\n");
-        strcat(serverResponse, "LOCATION:");
-        strcat(serverResponse, location);
-        strcat(serverResponse, "\n");
+    for (Catalog* it = __atomic_load_n(&catalogs, __ATOMIC_ACQUIRE); it != NULL; it = __atomic_load_n(&it->nextCatalog, __ATOMIC_ACQUIRE)) {
 
-        //Send the server response message
-        sendServerResponse(childfd, serverResponse, strlen(serverResponse));
-    }
+        for (int holder = 0; holder < STATS_OPERATION_COUNT; holder++) {
 
-    else {
+            for (int waiter = 0; waiter < STATS_OPERATION_COUNT; waiter++) {
 
-        //Otherwise traverse to the end of the list
-        Book* it = temp;
-        
-        bool duplicate = false;
+                long long blockedNs = __atomic_load_n(&it->blockedNs[holder][waiter], __ATOMIC_RELAXED);
 
-        //Traverse the list to the end
-        while(it->next != NULL) {
+                if (blockedNs == 0) {
+                    continue;
+                }
 
-            //If the Book submission is a duplicate, it can't be added to the Catalog
-            if (strcmp(title, it->title) == 0 && strcmp(author, it->author) == 0 && strcmp(location, it->location) == 0) {
-                duplicate = true;
-                break;
+                appendResponse(&metrics, "catalog_semaphore_blocked_seconds_total{catalog=\"");
+                appendLabelValue(&metrics, it->name);
+                sprintf(line, "\",holder=\"%s\",waiter=\"%s\"} %.9f\n", statsOperationNames[holder], statsOperationNames[waiter], blockedNs / 1e9);
+                appendResponse(&metrics, line);
             }
-
-            it = it->next;
         }
+    }
 
-        //If this is a duplicate Book submission, inform the user
-        if (duplicate == true) {
-            
-            //Write to the client that the Book is a duplicate
-            strcpy(serverResponse, "401:DUPLICATE\nMESSAGE:The Book specified is a duplicate submission and could not be added to the Catalog.\n");
-            sendServerResponse(childfd, serverResponse, strlen(serverResponse));
-        }
+    //Send the metrics after their header, without letting a scraper that hung up end the server
+    headerLength = sprintf(line, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", metrics.length);
 
-        //Insert the next and previous node info
-        newBook->previous = it;
-        it->next = newBook;
+    while (totalSent < headerLength + metrics.length) {
 
-        //Set the passed head pointer to the temporary one to save the changes
-        *head = temp;
+        int sentBytes;
 
-        //Form the server response message
-        strcpy(serverResponse, "201: SUBMITTED\n");
-        strcat(serverResponse, "TITLE:");
-        strcat(serverResponse, title);
-        strcat(serverResponse, "\n");
-        strcat(serverResponse, "AUTHOR:");
-        strcat(serverResponse, author);
-        strcat(serverResponse, "\n");
-        strcat(serverResponse, "LOCATION:");
-        strcat(serverResponse, location);
-        strcat(serverResponse, "\n");
+        if (totalSent < headerLength) {
+            sentBytes = send(scrapefd, line + totalSent, headerLength - totalSent, MSG_NOSIGNAL);
+        }
+        else {
+            sentBytes = send(scrapefd, metrics.text + totalSent - headerLength, metrics.length - (totalSent - headerLength), MSG_NOSIGNAL);
+        }
 
-        //Send the server response message
-        sendServerResponse(childfd, serverResponse, strlen(serverResponse));
+        if (sentBytes <= 0) {
+            break;
+        }
+
+        totalSent += sentBytes;
     }
 
-    //Free the server response message
-    free(serverResponse);
+    free(metrics.text);
 }
@@ -0,0 +1,186 @@
+/*
+ * WalBench.c - Measures Catalog write throughput under each write-ahead log durability mode.
+ *
+ * The benchmark links against the server's own request handling, so every SUBMIT takes the same path as one from a client:
+ *     gcc -O2 -pthread -DSERVER_NO_MAIN -o WalBench WalBench.c Server.c
+ *     ./WalBench <log directory> [threads] [submits per thread]
+ */
+#define _XOPEN_SOURCE 500
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//The durability modes of the write-ahead log, as defined by Server.c
+#define WAL_SYNC 0
+#define WAL_BATCH 1
+#define WAL_ASYNC 2
+
+//The request handling and write-ahead log functions from Server.c
+void decipherRequest(char request[], int childfd);
+int openWriteAheadLog(char path[], int mode, int batchInterval);
+unsigned long long walFlushCount();
+
+//The settings shared by every submitting thread
+int submitsPerThread = 1000;
+int sinkfd;
+
+
+
+/* Name: launchSubmitter
+ * Description: This function runs a thread that submits its share of distinct Books through the server's request handling.
+ *
+ * Parameter: arg                   The thread's number, used to keep its Book titles distinct
+ * Return: NULL
+*/
+void* launchSubmitter(void* arg);
+
+
+
+/* Name: runMode
+ * Description: This function measures the write throughput of a single durability mode in a child process, so every mode starts
+ *              from an empty Catalog and a new write-ahead log.
+ *
+ * Parameter: logPath               The path of the write-ahead log to create
+ * Parameter: label                 The name of the mode, printed with the results
+ * Parameter: mode                  The durability mode
+ * Parameter: batchInterval         The fsync interval in batch mode, in milliseconds
+ * Parameter: threadCount           The number of concurrent submitting threads
+ * Return: None
+*/
+void runMode(char logPath[], char label[], int mode, int batchInterval, int threadCount);
+
+
+
+//Main loop
+int main(int argc, char **argv) {
+
+    //The number of concurrent submitting threads
+    int threadCount = 8;
+
+    //The path of the write-ahead log used by each mode
+    char logPath[1000];
+
+    //Verify the user specified a directory for the logs
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "usage: %s <log directory> [threads] [submits per thread]\n", argv[0]);
+        exit(1);
+    }
+
+    //Grab the optional thread and submission counts
+    if (argc >= 3) {
+        threadCount = atoi(argv[2]);
+    }
+    if (argc == 4) {
+        submitsPerThread = atoi(argv[3]);
+    }
+
+    if (threadCount <= 0 || submitsPerThread <= 0) {
+        fprintf(stderr, "usage: [threads] and [submits per thread] must be positive.\n");
+        exit(1);
+    }
+
+    snprintf(logPath, sizeof(logPath), "%s/walbench.log", argv[1]);
+
+    printf("%-12s %10s %10s %14s %16s\n", "mode", "threads", "submits", "submits/sec", "records/flush");
+
+    //Measure every mode the same way
+    runMode(logPath, "sync", WAL_SYNC, 0, threadCount);
+    runMode(logPath, "batch:1", WAL_BATCH, 1, threadCount);
+    runMode(logPath, "batch:10", WAL_BATCH, 10, threadCount);
+    runMode(logPath, "async", WAL_ASYNC, 0, threadCount);
+
+    unlink(logPath);
+
+    return 0;
+}
+
+
+
+//FUNCTION launchSubmitter
+void* launchSubmitter(void* arg) {
+
+    //The thread's number
+    int threadNumber = *((int*) arg);
+
+    //The SUBMIT request, rebuilt for every Book since parsing consumes it
+    char request[300];
+
+    for (int i = 0; i < submitsPerThread; i++) {
+        sprintf(request, "METHOD:SUBMIT,TITLE:Bench %d-%d,AUTHOR:Bench,LOCATION:Shelf %d", threadNumber, i, i % 100);
+        decipherRequest(request, sinkfd);
+    }
+
+    return NULL;
+}
+
+
+
+//FUNCTION runMode
+void runMode(char logPath[], char label[], int mode, int batchInterval, int threadCount) {
+
+    //The child process running the mode
+    pid_t child;
+
+    //Run the mode in a child process and wait for it to finish, without the child repeating anything still buffered for stdout
+    fflush(stdout);
+    child = fork();
+
+    if (child < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    if (child > 0) {
+        waitpid(child, NULL, 0);
+        return;
+    }
+
+    //The submitting threads and their numbers
+    pthread_t* threads = malloc(sizeof(pthread_t) * threadCount);
+    int* threadNumbers = malloc(sizeof(int) * threadCount);
+
+    //The start and end of the measurement
+    struct timeval start;
+    struct timeval end;
+    double elapsed;
+
+    //Responses are written to a sink so only the Catalog and log are measured
+    sinkfd = open("/dev/null", O_WRONLY);
+
+    //Start from a new, empty log
+    unlink(logPath);
+
+    if (openWriteAheadLog(logPath, mode, batchInterval) < 0) {
+        perror("ERROR: ");
+        exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+
+    //Submit from every thread at once
+    for (int i = 0; i < threadCount; i++) {
+        threadNumbers[i] = i;
+        pthread_create(&threads[i], NULL, launchSubmitter, &threadNumbers[i]);
+    }
+
+    for (int i = 0; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    gettimeofday(&end, NULL);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+
+    printf("%-12s %10d %10d %14.0f %16.1f\n", label, threadCount, threadCount * submitsPerThread,
+           threadCount * submitsPerThread / elapsed,
+           walFlushCount() > 0 ? (double) threadCount * submitsPerThread / walFlushCount() : 0.0);
+
+    exit(0);
+}